@@ -0,0 +1,65 @@
+/*
+ * Bump allocator
+ * One block is allocated when the owner is created, allocations only move
+ * an offset forward and a reset rewinds it, so owners that reset between
+ * units of work never call malloc on their hot path
+ */
+
+#include "arena.h"
+#include <stdlib.h>
+
+/**
+ * Allocates the block
+ * Args:
+ *   arena: Arena to initialize
+ *   capacity: Bytes available between two resets
+ * Returns:
+ *   Boolean indicating success
+ */
+bool arena_init(Arena *arena, const size_t capacity) {
+    arena->base = malloc(capacity);
+    arena->capacity = arena->base != NULL ? capacity : 0;
+    arena->used = 0;
+    return arena->base != NULL;
+}
+
+/**
+ * Frees the block
+ * Args:
+ *   arena: Arena to destroy, may never have been initialized if zeroed
+ * Returns: void
+ */
+void arena_destroy(Arena *arena) {
+    free(arena->base);
+    arena->base = NULL;
+    arena->capacity = 0;
+    arena->used = 0;
+}
+
+/**
+ * Hands out memory valid until the next reset
+ * Args:
+ *   arena: Source arena
+ *   size: Bytes needed
+ * Returns:
+ *   ARENA_ALIGNMENT aligned, uninitialized memory or NULL if the arena is full
+ */
+void *arena_alloc(Arena *arena, const size_t size) {
+    // malloc already aligns the base, so aligning the offset aligns the pointer
+    const size_t start = (arena->used + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+    if (start > arena->capacity || size > arena->capacity - start) {
+        return NULL;
+    }
+    arena->used = start + size;
+    return arena->base + start;
+}
+
+/**
+ * Releases every allocation at once
+ * Args:
+ *   arena: Arena to reset
+ * Returns: void
+ */
+void arena_reset(Arena *arena) {
+    arena->used = 0;
+}
@@ -0,0 +1,62 @@
+// arena.h
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ARENA_ALIGNMENT _Alignof(max_align_t) //every allocation starts on this boundary
+
+/**
+ * Bump allocator over one block allocated up front
+ * Components:
+ *   base: The block, NULL until arena_init succeeds
+ *   capacity: Size of the block in bytes
+ *   used: Bytes handed out since the last reset
+ * Operation:
+ *   - Allocating moves used forward, nothing is freed on its own
+ *   - arena_reset drops everything at once, the block is reused
+ */
+typedef struct {
+    unsigned char *base;
+    size_t capacity;
+    size_t used;
+} Arena;
+
+/**
+ * Allocates the block
+ * Args:
+ *   arena: Arena to initialize
+ *   capacity: Bytes available between two resets
+ * Returns:
+ *   Boolean indicating success
+ */
+bool arena_init(Arena *arena, size_t capacity);
+
+/**
+ * Frees the block
+ * Args:
+ *   arena: Arena to destroy, may never have been initialized if zeroed
+ * Returns: void
+ */
+void arena_destroy(Arena *arena);
+
+/**
+ * Hands out memory valid until the next reset
+ * Args:
+ *   arena: Source arena
+ *   size: Bytes needed
+ * Returns:
+ *   ARENA_ALIGNMENT aligned, uninitialized memory or NULL if the arena is full
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/**
+ * Releases every allocation at once
+ * Args:
+ *   arena: Arena to reset
+ * Returns: void
+ */
+void arena_reset(Arena *arena);
+
+#endif // ARENA_H
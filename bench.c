@@ -0,0 +1,985 @@
+/*
+ * Load generator for the game server
+ * Runs pairs of headless bots through a whole game: key exchange, HEL answer,
+ * the one round trip PRV setup, echoed CMD traffic and a flag submission,
+ * then reports the connect rate, game setup latency, relay throughput and
+ * message latency percentiles
+ * With -x the bots of a thread share one multiplexed connection, one stream each
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <openssl/crypto.h>
+#include "cryptography_game_util.h"
+#include "key_exchange.h"
+#include "message_frame.h"
+#include "file_decrypt.h"
+
+#define USAGE "Usage: %s [-g games] [-c concurrent_games] [-m messages_per_bot] [-w window] [-s payload_bytes] " \
+              "[-p capability_mask] [-x streams_per_connection] <ip> <port>\n"
+#define CORRECT_ARGC 2 //positional arguments after the options
+#define IP_ARGV 0 //positions after the options
+#define PORT_ARGV 1
+#define SOCKET_ERROR -1
+#define SOCKET_INIT_ERROR 0
+#define BOTS_PER_GAME 2
+#define DEFAULT_GAMES 100
+#define DEFAULT_CONCURRENT_GAMES 16
+#define DEFAULT_MESSAGES 100 //CMD round trips each bot makes before asking for the flag
+#define DEFAULT_WINDOW 1 //CMDs a bot keeps in flight
+#define DEFAULT_PAYLOAD 64 //padding bytes in every CMD
+#define MAX_WINDOW 32
+#define MAX_PAYLOAD 2048 //keeps a CMD well below FRAME_TEXT_MAX_SIZE
+#define BENCH_CAPABILITIES (FRAME_CAPABILITY_BINARY | FRAME_CAPABILITY_AEAD | FRAME_CAPABILITY_PROVISION | \
+                            FRAME_CAPABILITY_SUBMIT | FRAME_CAPABILITY_MULTIPLEX) //capabilities a bot implements
+#define DEFAULT_STREAMS 1 //bots sharing one connection, 1 keeps a connection per bot
+#define BOT_STACK_SIZE (256 * 1024) //bots only keep small buffers on the stack
+#define RECEIVE_TIMEOUT_SEC 30 //a bot whose opponent vanished gives up after this
+#define WAIT_RETRY_US 10000 //pause before refilling the window after WAIT_CLIENT
+#define NS_PER_SEC 1000000000ull
+#define NS_PER_US 1000.0
+#define BYTES_PER_KIB 1024.0
+#define CAPABILITY_ANSWER_SIZE 16
+#define COMMAND_SIZE (MAX_PAYLOAD + 128) //"echo bench <bot> <sequence> <ns> <padding>"
+#define PROVISION_REQUEST_SIZE 64
+#define BENCH_DIRECTORY "/tmp/bench" //never created, the bots keep their files in memory
+#define STATUS_OKAY_TEXT "okay"
+#define FLG_DIR_TEXT "FLG_DIR"
+#define ECHO_PREFIX "echo "
+#define ECHO_PREFIX_LEN 5
+#define BENCH_TAG "bench "
+#define BENCH_TAG_LEN 6
+#define FLAG_COMMAND "cat flag.txt"
+#define WIN_TEXT "\nyou won!\n"
+#define LOSE_TEXT "\nyou lost ):\n"
+#define WAIT_CLIENT_TEXT "Wait for second client to connect\n"
+#define GAME_MAX_TEXT "game limit reached\n"
+#define KEY_FILE_FIELD_SIZE 64
+#define FLAG_SIZE (128 + DECRYPT_PLAINTEXT_SLACK) //decrypted flag.txt, PROVISION_FLAG_FILE_SIZE bounds the file
+#define DEFERRED_MAX (MAX_WINDOW + 2) //opponent window plus the flag request
+#define NEWLINE_LEN 1
+#define PERCENT 100
+
+/**
+ * Run parameters, set once in main
+ * Components:
+ *   games: Games to play in total
+ *   concurrent_games: Games in progress at once, two bot threads each
+ *   messages: CMD round trips per bot
+ *   window: CMDs a bot keeps in flight
+ *   capability_mask: Capabilities the bots may accept from the server's offer
+ *   streams: Bots playing at once over one connection, each on its own stream
+ *   address: Server address
+ *   padding: payload_bytes of filler appended to every CMD
+ */
+typedef struct {
+    unsigned int games;
+    unsigned int concurrent_games;
+    unsigned long messages;
+    unsigned int window;
+    unsigned int capability_mask;
+    unsigned int streams;
+    struct sockaddr_in address;
+    char padding[MAX_PAYLOAD + 1];
+} BenchConfig;
+
+/**
+ * Latency samples of one kind, filled lock free by all bots
+ * Components:
+ *   samples: Nanosecond values
+ *   capacity: Entries in samples
+ *   count: Entries claimed, may pass capacity, the extra samples are dropped
+ */
+typedef struct {
+    uint64_t *samples;
+    size_t capacity;
+    atomic_size_t count;
+} SampleSet;
+
+/**
+ * State of one headless client
+ * Components:
+ *   session: Server connection
+ *   encoding: Framing agreed in the HEL exchange
+ *   capabilities: FRAME_CAPABILITY_* bits agreed with the server
+ *   id: Bot number, part of every CMD so traces stay readable
+ *   start_ns: Start of the connect, setup and game times are measured from it
+ *   stream: Stream id on a multiplexed connection
+ *   answered_hello: The capability answer was sent, the next HEL is the AEAD acknowledgement
+ *   negotiated: The server acknowledged the answer, streams can be opened if it agreed multiplexing
+ *   setup_done: PRV okay was sent, the server now relays this bot's messages
+ *   flag_requested: FLAG_COMMAND is in flight
+ *   flag_submitted: The opponent's flag went out as a guess
+ *   finished: The game ended or the bot gave up
+ *   won: The server answered the guess with WIN_TEXT
+ *   flag: Own decrypted flag.txt, the answer to the opponent's FLAG_COMMAND
+ *   flag_length: Bytes in flag
+ *   next_sequence: Sequence number of the next CMD
+ *   in_flight: CMDs sent and not yet echoed
+ *   completed: CMDs echoed
+ *   deferred: Opponent CMDs received before setup_done, answered once it is set
+ *   deferred_count: Entries in deferred
+ */
+typedef struct {
+    CryptoSession *session;
+    FrameEncoding encoding;
+    unsigned int capabilities;
+    unsigned int id;
+    uint64_t start_ns;
+    uint32_t stream;
+    bool answered_hello;
+    bool negotiated;
+    bool setup_done;
+    bool flag_requested;
+    bool flag_submitted;
+    bool finished;
+    bool won;
+    char flag[FLAG_SIZE];
+    size_t flag_length;
+    unsigned long next_sequence;
+    unsigned int in_flight;
+    unsigned long completed;
+    char *deferred[DEFERRED_MAX];
+    unsigned int deferred_count;
+} Bot;
+
+static BenchConfig config = {
+    .games = DEFAULT_GAMES, .concurrent_games = DEFAULT_CONCURRENT_GAMES, .messages = DEFAULT_MESSAGES,
+    .window = DEFAULT_WINDOW, .capability_mask = BENCH_CAPABILITIES, .streams = DEFAULT_STREAMS
+};
+static atomic_uint next_bot = 0; //bots handed to threads so far
+static atomic_ulong connects = 0; //completed key exchanges
+static atomic_ulong connect_failures = 0; //refused connections and failed key exchanges
+static atomic_ulong streams_opened = 0; //bots that joined over an existing connection
+static atomic_ulong games_rejected = 0; //GAME_MAX answers
+static atomic_ulong games_won = 0;
+static atomic_ulong bots_failed = 0; //timeouts, disconnects and protocol errors
+static atomic_ulong relayed_messages = 0; //bench CMDs and their OUT echoes received
+static atomic_ulong relayed_bytes = 0; //their data bytes
+static atomic_ulong wait_retries = 0; //CMDs refused with WAIT_CLIENT
+static SampleSet connect_latency; //TCP connect and key exchange
+static SampleSet setup_latency; //connect start to PRV okay
+static SampleSet one_way_latency; //CMD send to its arrival at the opponent
+static SampleSet round_trip_latency; //CMD send to its OUT echo
+static SampleSet game_duration; //connect start to WIN_TEXT, one sample per win
+
+/**
+ * Reads the monotonic clock
+ * Returns:
+ *   Nanoseconds, comparable across all bot threads
+ */
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * NS_PER_SEC + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * Allocates a sample set
+ * Args:
+ *   set: Set to initialize
+ *   capacity: Most samples kept
+ * Returns:
+ *   Boolean indicating success
+ */
+static bool sample_set_init(SampleSet *set, const size_t capacity) {
+    set->samples = calloc(capacity > 0 ? capacity : 1, sizeof(uint64_t));
+    set->capacity = capacity;
+    atomic_init(&set->count, 0);
+    return set->samples != NULL;
+}
+
+/**
+ * Stores one sample
+ * Args:
+ *   set: Destination set
+ *   value: Nanoseconds
+ * Returns: void
+ */
+static void record_sample(SampleSet *set, const uint64_t value) {
+    const size_t index = atomic_fetch_add_explicit(&set->count, 1, memory_order_relaxed);
+    if (index < set->capacity) {
+        set->samples[index] = value;
+    }
+}
+
+/**
+ * qsort comparator for uint64_t
+ */
+static int compare_samples(const void *a, const void *b) {
+    const uint64_t left = *(const uint64_t *) a;
+    const uint64_t right = *(const uint64_t *) b;
+    return (left > right) - (left < right);
+}
+
+/**
+ * Prints p50, p90, p99 and the maximum of a set in microseconds
+ * Args:
+ *   name: Row label
+ *   set: Samples, sorted in place
+ * Returns: void
+ */
+static void report_percentiles(const char *name, SampleSet *set) {
+    size_t count = atomic_load(&set->count);
+    count = count < set->capacity ? count : set->capacity;
+    if (count == 0) {
+        printf("%-22s no samples\n", name);
+        return;
+    }
+    qsort(set->samples, count, sizeof(uint64_t), compare_samples);
+    static const unsigned int percentiles[] = {50, 90, 99};
+    printf("%-22s n=%zu", name, count);
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        printf(" p%u=%.1fus", percentiles[i], set->samples[(count - 1) * percentiles[i] / PERCENT] / NS_PER_US);
+    }
+    printf(" max=%.1fus\n", set->samples[count - 1] / NS_PER_US);
+}
+
+/**
+ * Sends one single segment frame in the agreed framing
+ * Args:
+ *   bot: Sending bot
+ *   type: Message type
+ *   data: Payload
+ *   length: Payload size
+ * Returns:
+ *   Boolean indicating success
+ */
+static bool bot_send(Bot *bot, const MessageType type, const char *data, const size_t length) {
+    return send_frame(bot->session, bot->encoding, type, data, length);
+}
+
+/**
+ * Connects and runs the key exchange
+ * Args:
+ *   bot: Bot to connect, receives the session
+ * Operation:
+ *   TCP_NODELAY like the client, SO_RCVTIMEO so a vanished opponent cannot hang the run
+ * Returns:
+ *   Boolean indicating success
+ */
+static bool bot_connect(Bot *bot) {
+    const int socketFD = createTCPIpv4Socket();
+    if (socketFD == SOCKET_ERROR) {
+        return false;
+    }
+    const int no_delay = 1;
+    setsockopt(socketFD, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    const struct timeval timeout = {.tv_sec = RECEIVE_TIMEOUT_SEC, .tv_usec = 0};
+    setsockopt(socketFD, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(socketFD, (const struct sockaddr *) &config.address, sizeof(config.address)) != SOCKET_INIT_ERROR) {
+        close(socketFD);
+        return false;
+    }
+    size_t key_size = 0;
+    const unsigned char *key = send_recv_key(socketFD, &key_size);
+    if (key == NULL) {
+        close(socketFD);
+        return false;
+    }
+    bot->session = crypto_session_create(socketFD, key, key_size, CRYPTO_ROLE_CLIENT);
+    OPENSSL_cleanse((void *) key, key_size);
+    free((void *) key);
+    if (bot->session == NULL) {
+        close(socketFD);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Answers the server's capability offer, or applies its AEAD acknowledgement
+ * Args:
+ *   bot: Receiving bot
+ *   hello: HEL segment
+ * Operation:
+ *   - Same two step exchange as handle_server_hello in the client, limited to config.capability_mask
+ *   - Turns on stream headers when FRAME_CAPABILITY_MULTIPLEX is accepted
+ * Returns:
+ *   Boolean indicating success
+ */
+static bool answer_hello(Bot *bot, const FrameSegment *hello) {
+    if (bot->answered_hello) {
+        if (bot->capabilities & FRAME_CAPABILITY_AEAD) {
+            session_seal_receive(bot->session);
+        }
+        bot->negotiated = true;
+        return true;
+    }
+    bot->answered_hello = true;
+    bot->capabilities = frame_capabilities(hello) & config.capability_mask;
+    // Same rule as the server, and the stream headers must be on before the send direction seals
+    if ((bot->capabilities & FRAME_MULTIPLEX_REQUIRED) != FRAME_MULTIPLEX_REQUIRED ||
+        (bot->capabilities & FRAME_CAPABILITY_MULTIPLEX && !crypto_session_enable_streams(bot->session, false))) {
+        bot->capabilities &= ~FRAME_CAPABILITY_MULTIPLEX;
+    }
+    char answer[CAPABILITY_ANSWER_SIZE] = {0};
+    const int answer_length = snprintf(answer, sizeof(answer), "%u", bot->capabilities);
+    // The answer itself still goes out in text framing
+    const bool sent = bot->capabilities & FRAME_CAPABILITY_AEAD
+                          ? send_frame_and_seal(bot->session, FRAME_ENCODING_TEXT, MESSAGE_TYPE_HEL, answer,
+                                                (size_t) answer_length)
+                          : send_frame(bot->session, FRAME_ENCODING_TEXT, MESSAGE_TYPE_HEL, answer,
+                                       (size_t) answer_length);
+    bot->encoding = bot->capabilities & FRAME_CAPABILITY_BINARY ? FRAME_ENCODING_BINARY : FRAME_ENCODING_TEXT;
+    return sent;
+}
+
+/**
+ * Answers FLG_DIR with a PRV request for both game files
+ * Args:
+ *   bot: Receiving bot
+ *   segment: FLG segment
+ * Returns:
+ *   Boolean indicating the bot can go on, legacy shell setup is not emulated
+ */
+static bool request_provision(Bot *bot, const FrameSegment *segment) {
+    if (!frame_data_equals(segment, FLG_DIR_TEXT) || !(bot->capabilities & FRAME_CAPABILITY_PROVISION)) {
+        return false;
+    }
+    char request[PROVISION_REQUEST_SIZE];
+    const size_t length = write_provision(request, sizeof(request), BENCH_DIRECTORY, strlen(BENCH_DIRECTORY),
+                                          BENCH_DIRECTORY, strlen(BENCH_DIRECTORY));
+    return length > 0 && bot_send(bot, MESSAGE_TYPE_PRV, request, length);
+}
+
+/**
+ * Builds the OUT a shell would print for one of the opponent's commands
+ * Args:
+ *   bot: Bot the command runs on
+ *   command: CMD data
+ *   length: Bytes of command
+ * Operation:
+ *   - echo: Prints the rest of the line, records the one way latency of bench CMDs
+ *   - FLAG_COMMAND: Prints the bot's decrypted flag.txt
+ * Returns:
+ *   Boolean indicating success
+ */
+static bool reply_command(Bot *bot, const char *command, const size_t length) {
+    if (length == strlen(FLAG_COMMAND) && memcmp(command, FLAG_COMMAND, length) == 0) {
+        return bot_send(bot, MESSAGE_TYPE_OUT, bot->flag, bot->flag_length);
+    }
+    char output[COMMAND_SIZE];
+    if (length < ECHO_PREFIX_LEN || memcmp(command, ECHO_PREFIX, ECHO_PREFIX_LEN) != 0 ||
+        length - ECHO_PREFIX_LEN + NEWLINE_LEN >= sizeof(output)) {
+        // Anything else prints nothing, like a command with no output
+        return bot_send(bot, MESSAGE_TYPE_OUT, "\n", NEWLINE_LEN);
+    }
+    const size_t output_length = length - ECHO_PREFIX_LEN;
+    memcpy(output, command + ECHO_PREFIX_LEN, output_length);
+    output[output_length] = '\n';
+    output[output_length + NEWLINE_LEN] = '\0';
+    unsigned int sender = 0;
+    unsigned long sequence = 0;
+    unsigned long long sent_ns = 0;
+    if (sscanf(output, BENCH_TAG "%u %lu %llu", &sender, &sequence, &sent_ns) == 3) {
+        record_sample(&one_way_latency, now_ns() - sent_ns);
+    }
+    return bot_send(bot, MESSAGE_TYPE_OUT, output, output_length + NEWLINE_LEN);
+}
+
+/**
+ * Handles a CMD relayed from the opponent
+ * Args:
+ *   bot: Receiving bot
+ *   segment: CMD segment
+ * Operation:
+ *   Defers it while this bot's own setup is still running, the server would
+ *   take an OUT in that phase for a broken setup reply
+ * Returns:
+ *   Boolean indicating success
+ */
+static bool handle_command(Bot *bot, const FrameSegment *segment) {
+    atomic_fetch_add_explicit(&relayed_messages, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&relayed_bytes, segment->length, memory_order_relaxed);
+    if (bot->setup_done) {
+        return reply_command(bot, segment->data, segment->length);
+    }
+    if (bot->deferred_count >= DEFERRED_MAX) {
+        return false;
+    }
+    char *copy = malloc(segment->length + NEWLINE_LEN);
+    if (copy == NULL) {
+        return false;
+    }
+    memcpy(copy, segment->data, segment->length);
+    copy[segment->length] = '\0';
+    bot->deferred[bot->deferred_count++] = copy;
+    return true;
+}
+
+/**
+ * Sends the CMDs deferred during setup and frees them
+ * Args:
+ *   bot: Bot whose setup just finished
+ * Returns:
+ *   Boolean indicating success
+ */
+static bool flush_deferred(Bot *bot) {
+    bool ok = true;
+    for (unsigned int i = 0; i < bot->deferred_count; i++) {
+        ok = ok && reply_command(bot, bot->deferred[i], strlen(bot->deferred[i]));
+        free(bot->deferred[i]);
+    }
+    bot->deferred_count = 0;
+    return ok;
+}
+
+/**
+ * Decrypts the bot's own flag from a PRV reply and confirms the setup
+ * Args:
+ *   bot: Receiving bot
+ *   segment: PRV segment, key.txt then flag.txt
+ * Operation:
+ *   - Reads key and method from key.txt, decrypts flag.txt in memory with decrypt_buffer
+ *   - Answers okay, which completes the flag and key phases on the server
+ * Returns:
+ *   Boolean indicating success
+ */
+static bool handle_provision(Bot *bot, const FrameSegment *segment) {
+    Provision files;
+    if (!parse_provision(segment, &files) || files.first.length >= KEY_FILE_FIELD_SIZE ||
+        files.second.length + DECRYPT_PLAINTEXT_SLACK > FLAG_SIZE) {
+        return false;
+    }
+    // key.txt is "<key>\n<method>\n"
+    char key_file[KEY_FILE_FIELD_SIZE];
+    memcpy(key_file, files.first.data, files.first.length);
+    key_file[files.first.length] = '\0';
+    char *method = strchr(key_file, '\n');
+    if (method == NULL) {
+        return false;
+    }
+    *method++ = '\0';
+    method[strcspn(method, "\n")] = '\0';
+    const char *methods[] = {method};
+    unsigned char plaintext[FLAG_SIZE];
+    size_t plaintext_length = 0;
+    if (decrypt_buffer((const unsigned char *) files.second.data, files.second.length, key_file, methods, 1,
+                       plaintext, &plaintext_length) < 0) {
+        return false;
+    }
+    memcpy(bot->flag, plaintext, plaintext_length);
+    bot->flag_length = plaintext_length;
+    OPENSSL_cleanse(plaintext, sizeof(plaintext));
+    if (!bot_send(bot, MESSAGE_TYPE_PRV, STATUS_OKAY_TEXT, strlen(STATUS_OKAY_TEXT))) {
+        return false;
+    }
+    bot->setup_done = true;
+    record_sample(&setup_latency, now_ns() - bot->start_ns);
+    return flush_deferred(bot);
+}
+
+/**
+ * Handles OUT, the echo of a bench CMD, the opponent's flag or the game result
+ * Args:
+ *   bot: Receiving bot
+ *   segment: OUT segment
+ * Returns:
+ *   Boolean indicating success
+ */
+static bool handle_output(Bot *bot, const FrameSegment *segment) {
+    if (frame_data_equals(segment, WIN_TEXT) || frame_data_equals(segment, LOSE_TEXT)) {
+        bot->won = frame_data_equals(segment, WIN_TEXT);
+        bot->finished = true;
+        return true;
+    }
+    if (segment->length >= BENCH_TAG_LEN && memcmp(segment->data, BENCH_TAG, BENCH_TAG_LEN) == 0) {
+        atomic_fetch_add_explicit(&relayed_messages, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&relayed_bytes, segment->length, memory_order_relaxed);
+        char header[COMMAND_SIZE];
+        const size_t length = segment->length < sizeof(header) ? segment->length : sizeof(header) - 1;
+        memcpy(header, segment->data, length);
+        header[length] = '\0';
+        unsigned int sender = 0;
+        unsigned long sequence = 0;
+        unsigned long long sent_ns = 0;
+        if (sscanf(header, BENCH_TAG "%u %lu %llu", &sender, &sequence, &sent_ns) == 3 && sender == bot->id &&
+            bot->in_flight > 0) {
+            record_sample(&round_trip_latency, now_ns() - sent_ns);
+            bot->in_flight--;
+            bot->completed++;
+        }
+        return true;
+    }
+    if (bot->flag_requested && !bot->flag_submitted) {
+        // The opponent's cat flag.txt, guessed without the newline the flag file ends in
+        size_t length = segment->length;
+        while (length > 0 && segment->data[length - 1] == '\n') {
+            length--;
+        }
+        bot->flag_submitted = true;
+        const MessageType type = bot->capabilities & FRAME_CAPABILITY_SUBMIT ? MESSAGE_TYPE_SUB : MESSAGE_TYPE_CMD;
+        return bot_send(bot, type, segment->data, length);
+    }
+    return true;
+}
+
+/**
+ * Handles ERR
+ * Args:
+ *   bot: Receiving bot
+ *   segment: ERR segment
+ * Operation:
+ *   - GAME_MAX ends the bot
+ *   - WAIT_CLIENT means the CMD was not relayed, the window refills after a pause
+ *   - Any error after the guess means it was wrong
+ * Returns:
+ *   Boolean indicating the bot can go on
+ */
+static bool handle_error(Bot *bot, const FrameSegment *segment) {
+    if (frame_data_equals(segment, GAME_MAX_TEXT)) {
+        atomic_fetch_add(&games_rejected, 1);
+        bot->finished = true;
+        return true;
+    }
+    if (bot->flag_submitted) {
+        return false;
+    }
+    if (bot->in_flight > 0) {
+        bot->in_flight--;
+    } else {
+        bot->flag_requested = false;
+    }
+    if (frame_data_equals(segment, WAIT_CLIENT_TEXT)) {
+        atomic_fetch_add_explicit(&wait_retries, 1, memory_order_relaxed);
+        usleep(WAIT_RETRY_US);
+    }
+    return true;
+}
+
+/**
+ * Keeps config.window bench CMDs in flight, then asks the opponent for its flag
+ * Args:
+ *   bot: Sending bot
+ * Operation:
+ *   "echo bench <bot> <sequence> <send ns> <padding>", the opponent echoes it back in an OUT
+ * Returns:
+ *   Boolean indicating success
+ */
+static bool fill_window(Bot *bot) {
+    if (!bot->setup_done || bot->flag_requested) {
+        return true;
+    }
+    char command[COMMAND_SIZE];
+    while (bot->in_flight < config.window && bot->completed + bot->in_flight < config.messages) {
+        const int length = snprintf(command, sizeof(command), ECHO_PREFIX BENCH_TAG "%u %lu %llu %s", bot->id,
+                                    bot->next_sequence++, (unsigned long long) now_ns(), config.padding);
+        if (length < 0 || (size_t) length >= sizeof(command) ||
+            !bot_send(bot, MESSAGE_TYPE_CMD, command, (size_t) length)) {
+            return false;
+        }
+        bot->in_flight++;
+    }
+    if (bot->in_flight == 0 && bot->completed >= config.messages) {
+        bot->flag_requested = true;
+        return bot_send(bot, MESSAGE_TYPE_CMD, FLAG_COMMAND, strlen(FLAG_COMMAND));
+    }
+    return true;
+}
+
+/**
+ * Dispatches one segment received from the server
+ * Args:
+ *   bot: Receiving bot
+ *   segment: Segment in wire order
+ * Returns:
+ *   Boolean indicating the bot can go on
+ */
+static bool handle_segment(Bot *bot, const FrameSegment *segment) {
+    switch (segment->type) {
+        case MESSAGE_TYPE_HEL:
+            return answer_hello(bot, segment);
+        case MESSAGE_TYPE_FLG:
+            return request_provision(bot, segment);
+        case MESSAGE_TYPE_PRV:
+            return handle_provision(bot, segment);
+        case MESSAGE_TYPE_CMD:
+            return handle_command(bot, segment);
+        case MESSAGE_TYPE_OUT:
+            return handle_output(bot, segment);
+        case MESSAGE_TYPE_ERR:
+            return handle_error(bot, segment);
+        default:
+            // CWD and anything newer carry nothing a bot acts on
+            return true;
+    }
+}
+
+/**
+ * Handles one message received for a bot
+ * Args:
+ *   bot: Receiving bot
+ *   buffer: Message, one byte of room after it for the terminator
+ *   length: Message length
+ * Operation:
+ *   Dispatches every segment, then refills the bot's window
+ * Returns:
+ *   Boolean indicating the bot can go on
+ */
+static bool bot_receive(Bot *bot, char *buffer, const size_t length) {
+    // Keeps the last segment NUL terminated like the client's receive buffer
+    buffer[length] = '\0';
+    FrameView view;
+    bool ok = parse_frame(buffer, length, &view);
+    for (unsigned int i = 0; ok && !bot->finished && i < view.segment_count; i++) {
+        ok = handle_segment(bot, &view.segments[i]);
+    }
+    return ok && (bot->finished || fill_window(bot));
+}
+
+/**
+ * Records a bot's result and frees what it holds besides its session
+ * Args:
+ *   bot: Bot that stopped playing
+ *   ok: No protocol error happened
+ * Returns: void
+ */
+static void finish_bot(Bot *bot, const bool ok) {
+    if (bot->won) {
+        atomic_fetch_add(&games_won, 1);
+        record_sample(&game_duration, now_ns() - bot->start_ns);
+    }
+    if (!ok || !bot->finished) {
+        atomic_fetch_add(&bots_failed, 1);
+    }
+    for (unsigned int i = 0; i < bot->deferred_count; i++) {
+        free(bot->deferred[i]);
+    }
+    bot->deferred_count = 0;
+    OPENSSL_cleanse(bot->flag, sizeof(bot->flag));
+}
+
+/**
+ * Plays one game as one side
+ * Args:
+ *   id: Bot number
+ *   buffer: FRAME_MAX_SIZE receive buffer owned by the calling thread
+ * Returns: void
+ */
+static void run_bot(const unsigned int id, char *buffer) {
+    Bot bot = {.id = id, .encoding = FRAME_ENCODING_TEXT, .start_ns = now_ns()};
+    if (!bot_connect(&bot)) {
+        atomic_fetch_add(&connect_failures, 1);
+        return;
+    }
+    atomic_fetch_add(&connects, 1);
+    record_sample(&connect_latency, now_ns() - bot.start_ns);
+    bool ok = true;
+    while (ok && !bot.finished) {
+        const ssize_t received = session_recv(bot.session, buffer, FRAME_MAX_SIZE - 1);
+        if (received <= 0) {
+            break;
+        }
+        ok = bot_receive(&bot, buffer, (size_t) received);
+    }
+    finish_bot(&bot, ok);
+    const int socketFD = crypto_session_socket(bot.session);
+    crypto_session_destroy(bot.session);
+    close(socketFD);
+}
+
+/**
+ * Starts a bot on a new stream of a multiplexed connection
+ * Args:
+ *   bot: Slot to fill
+ *   root: Connection's session
+ *   id: Bot number
+ *   stream: Unused stream id, never one that was open before
+ *   capabilities: Capabilities agreed on the primary stream
+ * Operation:
+ *   The HEL on the new stream opens it, the server's HEL reply is taken as the acknowledgement
+ * Returns:
+ *   Boolean indicating the HEL went out
+ */
+static bool open_stream_bot(Bot *bot, CryptoSession *root, const unsigned int id, const uint32_t stream,
+                            const unsigned int capabilities) {
+    memset(bot, 0, sizeof(*bot));
+    bot->id = id;
+    bot->stream = stream;
+    bot->start_ns = now_ns();
+    bot->answered_hello = true;
+    bot->capabilities = capabilities & ~FRAME_CAPABILITY_MULTIPLEX;
+    bot->encoding = FRAME_ENCODING_BINARY;
+    bot->session = crypto_session_open_stream(root, stream);
+    if (bot->session == NULL) {
+        return false;
+    }
+    atomic_fetch_add(&streams_opened, 1);
+    char answer[CAPABILITY_ANSWER_SIZE] = {0};
+    const int answer_length = snprintf(answer, sizeof(answer), "%u", bot->capabilities);
+    return bot_send(bot, MESSAGE_TYPE_HEL, answer, (size_t) answer_length);
+}
+
+/**
+ * Finds the bot playing on a stream
+ * Args:
+ *   bots: config.streams slots, a slot without session is free
+ *   stream: Stream id of a received record
+ * Returns:
+ *   Bot or NULL if no bot plays on the stream anymore
+ */
+static Bot *find_stream_bot(Bot *bots, const uint32_t stream) {
+    for (unsigned int i = 0; i < config.streams; i++) {
+        if (bots[i].session != NULL && bots[i].stream == stream) {
+            return &bots[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Plays bots over one multiplexed connection
+ * Args:
+ *   bots: config.streams zeroed slots
+ *   buffer: FRAME_MAX_SIZE receive buffer owned by the calling thread
+ * Operation:
+ *   - The first bot connects and plays on the primary stream
+ *   - Once the server agreed FRAME_CAPABILITY_MULTIPLEX, up to config.streams bots
+ *     play at once, a finished bot's slot goes to the next one on a fresh stream id
+ *   - Without multiplexing the connection ends with its only bot, like run_bot
+ * Returns:
+ *   Boolean indicating a bot was claimed, false once all of them were handed out
+ */
+static bool run_multiplexed_bots(Bot *bots, char *buffer) {
+    const unsigned int total = config.games * BOTS_PER_GAME;
+    const unsigned int first = atomic_fetch_add(&next_bot, 1);
+    if (first >= total) {
+        return false;
+    }
+    Bot *primary = &bots[0];
+    *primary = (Bot) {.id = first, .encoding = FRAME_ENCODING_TEXT, .start_ns = now_ns()};
+    if (!bot_connect(primary)) {
+        atomic_fetch_add(&connect_failures, 1);
+        primary->session = NULL;
+        return true;
+    }
+    atomic_fetch_add(&connects, 1);
+    record_sample(&connect_latency, now_ns() - primary->start_ns);
+    CryptoSession *root = primary->session;
+    const int socketFD = crypto_session_socket(root);
+    unsigned int active = 1;
+    uint32_t next_stream = CRYPTO_SESSION_PRIMARY_STREAM + 1;
+    unsigned int agreed = 0;
+    bool multiplexed = false;
+    while (active > 0) {
+        uint32_t stream = CRYPTO_SESSION_PRIMARY_STREAM;
+        const ssize_t received = multiplexed ? session_recv_stream(root, buffer, FRAME_MAX_SIZE - 1, &stream)
+                                             : session_recv(root, buffer, FRAME_MAX_SIZE - 1);
+        if (received < 0 || (!multiplexed && received == 0)) {
+            break;
+        }
+        Bot *bot = find_stream_bot(bots, stream);
+        if (bot == NULL) {
+            // The server closing a stream this side already finished
+            continue;
+        }
+        // An empty record is the server closing the stream, the bot is done either way
+        const bool ok = received > 0 && bot_receive(bot, buffer, (size_t) received);
+        const bool agreed_now = !multiplexed && primary->negotiated &&
+                                primary->capabilities & FRAME_CAPABILITY_MULTIPLEX;
+        if (agreed_now) {
+            multiplexed = true;
+            agreed = primary->capabilities;
+        }
+        if (!ok || bot->finished) {
+            finish_bot(bot, ok);
+            if (multiplexed && received > 0) {
+                session_close_stream(root, bot->stream);
+            }
+            if (bot->session != root) {
+                crypto_session_destroy(bot->session);
+            }
+            bot->session = NULL;
+            active--;
+            if (!multiplexed) {
+                break;
+            }
+        } else if (!agreed_now) {
+            continue;
+        }
+        // Fill every free slot, the primary's included once its game is over
+        for (unsigned int i = 0; i < config.streams; i++) {
+            if (bots[i].session != NULL) {
+                continue;
+            }
+            const unsigned int id = atomic_fetch_add(&next_bot, 1);
+            if (id >= total) {
+                break;
+            }
+            if (!open_stream_bot(&bots[i], root, id, next_stream++, agreed)) {
+                atomic_fetch_add(&bots_failed, 1);
+                crypto_session_destroy(bots[i].session);
+                bots[i].session = NULL;
+                continue;
+            }
+            active++;
+        }
+    }
+    for (unsigned int i = 0; i < config.streams; i++) {
+        if (bots[i].session != NULL) {
+            finish_bot(&bots[i], false);
+            if (bots[i].session != root) {
+                crypto_session_destroy(bots[i].session);
+            }
+            bots[i].session = NULL;
+        }
+    }
+    crypto_session_destroy(root);
+    close(socketFD);
+    return true;
+}
+
+/**
+ * Bot thread body
+ * Args:
+ *   arg: Unused
+ * Operation:
+ *   Plays bots until config.games games worth of them have run, config.streams at a time with -x
+ * Returns: NULL
+ */
+static void *bot_thread(void *arg) {
+    (void) arg;
+    char *buffer = malloc(FRAME_MAX_SIZE);
+    if (buffer == NULL) {
+        return NULL;
+    }
+    if (config.streams > DEFAULT_STREAMS) {
+        Bot *bots = calloc(config.streams, sizeof(Bot));
+        while (bots != NULL && run_multiplexed_bots(bots, buffer)) {
+        }
+        free(bots);
+    } else {
+        unsigned int id;
+        while ((id = atomic_fetch_add(&next_bot, 1)) < config.games * BOTS_PER_GAME) {
+            run_bot(id, buffer);
+        }
+    }
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * Prints the run summary
+ * Args:
+ *   elapsed_ns: Wall time of the run
+ * Returns: void
+ */
+static void report(const uint64_t elapsed_ns) {
+    const double seconds = (double) elapsed_ns / NS_PER_SEC;
+    printf("duration               %.3fs\n", seconds);
+    // Two guesses checked at the same moment can both win, so wins may pass the game count
+    printf("games                  %u requested, %lu wins, %lu rejected with game limit\n", config.games,
+           atomic_load(&games_won), atomic_load(&games_rejected));
+    printf("bots                   %lu connected, %lu on shared connections, %lu connect failures, "
+           "%lu failed mid game\n", atomic_load(&connects), atomic_load(&streams_opened),
+           atomic_load(&connect_failures), atomic_load(&bots_failed));
+    printf("connect rate           %.1f/s\n", atomic_load(&connects) / seconds);
+    printf("relay throughput       %lu messages, %.1f msg/s, %.1f KiB/s, %lu WAIT_CLIENT retries\n",
+           atomic_load(&relayed_messages), atomic_load(&relayed_messages) / seconds,
+           atomic_load(&relayed_bytes) / BYTES_PER_KIB / seconds, atomic_load(&wait_retries));
+    report_percentiles("connect latency", &connect_latency);
+    report_percentiles("game setup latency", &setup_latency);
+    report_percentiles("relay latency", &one_way_latency);
+    report_percentiles("round trip latency", &round_trip_latency);
+    report_percentiles("game duration", &game_duration);
+}
+
+/**
+ * Main entry point
+ * Args:
+ *   argc: Argument count
+ *   argv: Options, then server IP and port
+ * Operation:
+ *   - Parses the options
+ *   - Runs 2 * concurrent_games bot threads until all games were played,
+ *     with -x one thread per connection of streams bots
+ *   - Prints the report
+ * Returns:
+ *   EXIT_SUCCESS when every bot played its game to the end, EXIT_FAILURE otherwise
+ */
+int main(const int argc, char *argv[]) {
+    int option;
+    unsigned long payload = DEFAULT_PAYLOAD;
+    while ((option = getopt(argc, argv, "g:c:m:w:s:p:x:")) != -1) {
+        const unsigned long value = strtoul(optarg, NULL, 0);
+        if (option == 'g' && value > 0) {
+            config.games = (unsigned int) value;
+        } else if (option == 'c' && value > 0) {
+            config.concurrent_games = (unsigned int) value;
+        } else if (option == 'm') {
+            config.messages = value;
+        } else if (option == 'w' && value > 0 && value <= MAX_WINDOW) {
+            config.window = (unsigned int) value;
+        } else if (option == 's' && value <= MAX_PAYLOAD) {
+            payload = value;
+        } else if (option == 'p') {
+            config.capability_mask = (unsigned int) value & BENCH_CAPABILITIES;
+        } else if (option == 'x' && value > 0 && value <= FRAME_MAX_STREAMS) {
+            config.streams = (unsigned int) value;
+        } else {
+            printf(USAGE, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != CORRECT_ARGC) {
+        printf("incorrect number of arguments\n");
+        printf(USAGE, argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (createIPv4Address(argv[optind + IP_ARGV], atoi(argv[optind + PORT_ARGV]), &config.address) ==
+        SOCKET_INIT_ERROR) {
+        printf("Incorrect IP or port\n");
+        return EXIT_FAILURE;
+    }
+    // Bots only implement the one round trip setup
+    config.capability_mask |= FRAME_CAPABILITY_PROVISION;
+    if (config.streams == DEFAULT_STREAMS) {
+        config.capability_mask &= ~FRAME_CAPABILITY_MULTIPLEX;
+    }
+    memset(config.padding, 'x', payload);
+    config.padding[payload] = '\0';
+    const size_t bots = (size_t) config.games * BOTS_PER_GAME;
+    if (!sample_set_init(&connect_latency, bots) || !sample_set_init(&setup_latency, bots) ||
+        !sample_set_init(&one_way_latency, bots * config.messages) ||
+        !sample_set_init(&round_trip_latency, bots * config.messages) ||
+        !sample_set_init(&game_duration, bots)) {
+        printf("Cannot allocate %zu latency samples\n", bots * config.messages);
+        return EXIT_FAILURE;
+    }
+    const unsigned int thread_count = (config.concurrent_games * BOTS_PER_GAME + config.streams - 1) / config.streams;
+    pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+    if (threads == NULL) {
+        return EXIT_FAILURE;
+    }
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, BOT_STACK_SIZE);
+    printf("Running %u games, %u at a time, %lu messages per bot, window %u, %lu byte payloads, "
+           "%u bots per connection\n", config.games, config.concurrent_games, config.messages, config.window, payload,
+           config.streams);
+    const uint64_t start = now_ns();
+    unsigned int started = 0;
+    while (started < thread_count && pthread_create(&threads[started], &attributes, bot_thread, NULL) == 0) {
+        started++;
+    }
+    pthread_attr_destroy(&attributes);
+    for (unsigned int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    report(now_ns() - start);
+    free(threads);
+    const bool complete = atomic_load(&bots_failed) == 0 && atomic_load(&connect_failures) == 0 &&
+                          atomic_load(&games_rejected) == 0;
+    return complete ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,301 @@
+/*
+ * Terminal client for the game
+ * Runs a client_core session without any GUI: output and working directory
+ * changes go straight to stdout, stdin lines are sent as commands, and the
+ * same "submit", "cancel" and decrypt actions as the window are typed as
+ * line prefixes
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "cryptography_game_util.h"
+#include "client_core.h"
+
+#define CORRECT_ARGC 3
+#define IP_ARGV 1
+#define PORT_ARGV 2
+#define USAGE "Usage: %s <ip> <port>\n" \
+              "  <command>                          run a command on the other player's client\n" \
+              "  submit <flag>                      guess the other player's flag\n" \
+              "  cancel                             stop your commands still running remotely\n" \
+              "  decrypt <key> <path> [method...]   decrypt a remote file, every method when none is given\n"
+#define START_CWD "/home"
+#define SUBMIT_PREFIX "submit "
+#define CANCEL_COMMAND "cancel"
+#define DECRYPT_PREFIX "decrypt "
+#define TOKEN_DELIMITERS " \t"
+#define MAX_DECRYPT_METHODS 8
+#define INPUT_LINE_SIZE 1024
+#define POLL_STDIN 0
+#define POLL_CLOSED 1
+#define POLL_FD_COUNT 2
+#define POLL_FOREVER -1
+#define EVENTFD_ERROR -1
+#define CLOSED_SIGNAL 1
+#define SIGNAL_CODE 128
+#define NULL_CHAR 0
+
+static ClientCore *client_core = NULL; // The game session, set before signals are handled
+static pthread_mutex_t client_core_mutex = PTHREAD_MUTEX_INITIALIZER; // Held by termination_handler until exit
+static int closed_event = EVENTFD_ERROR; // Readable once the session reported CLIENT_STATUS_CLOSED
+
+static const char *const cipher_methods[] = {
+    "aes-256-cbc",
+    "aes-128-cbc",
+    "des-ede3"
+};
+
+/**
+ * Output hook, writes the text as it arrives
+ * Args:
+ *   context: Unused
+ *   data: OUT, ERR or OFR text
+ *   length: Number of bytes
+ * Operation:
+ *   A slow terminal blocks the listener, which throttles the server instead of buffering
+ * Returns: void
+ */
+static void on_output(void *context, const char *data, const size_t length) {
+    (void) context;
+    fwrite(data, 1, length, stdout);
+    fflush(stdout);
+}
+
+/**
+ * Working directory hook
+ * Args:
+ *   context: Unused
+ *   cwd: The other player's working directory
+ * Returns: void
+ */
+static void on_cwd(void *context, const char *cwd) {
+    (void) context;
+    printf("[cwd %s]\n", cwd);
+    fflush(stdout);
+}
+
+/**
+ * Connection status hook
+ * Args:
+ *   context: Unused
+ *   status: New connection status
+ * Operation:
+ *   Wakes the input loop once the connection closed
+ * Returns: void
+ */
+static void on_status(void *context, const ClientStatus status) {
+    (void) context;
+    if (status == CLIENT_STATUS_READY) {
+        printf("[game files ready]\n");
+        fflush(stdout);
+    } else if (status == CLIENT_STATUS_CLOSED) {
+        printf("[connection closed]\n");
+        fflush(stdout);
+        const uint64_t value = CLOSED_SIGNAL;
+        write(closed_event, &value, sizeof(value));
+    }
+}
+
+/**
+ * Sends a decrypt request typed as "decrypt <key> <path> [method...]"
+ * Args:
+ *   arguments: Text after the prefix, split in place
+ * Returns:
+ *   Boolean indicating the request was sent
+ */
+static bool send_decrypt_line(char *arguments) {
+    char *context = NULL;
+    const char *key = strtok_r(arguments, TOKEN_DELIMITERS, &context);
+    const char *path = strtok_r(NULL, TOKEN_DELIMITERS, &context);
+    if (key == NULL || path == NULL) {
+        return false;
+    }
+    const char *methods[MAX_DECRYPT_METHODS];
+    size_t method_count = 0;
+    const char *method;
+    while (method_count < MAX_DECRYPT_METHODS &&
+           (method = strtok_r(NULL, TOKEN_DELIMITERS, &context)) != NULL) {
+        methods[method_count++] = method;
+    }
+    if (method_count == 0) {
+        return client_core_request_decrypt(client_core, key, path, cipher_methods,
+                                           sizeof(cipher_methods) / sizeof(cipher_methods[0]));
+    }
+    return client_core_request_decrypt(client_core, key, path, methods, method_count);
+}
+
+/**
+ * Handles one typed line
+ * Args:
+ *   line: NUL terminated line without the newline
+ * Operation:
+ *   "submit <flag>" guesses, "cancel" cancels, "decrypt ..." asks for a decrypt, anything else is a command
+ * Returns: void
+ */
+static void handle_line(char *line) {
+    bool sent;
+    if (strlen(line) == 0) {
+        return;
+    }
+    if (strncmp(line, SUBMIT_PREFIX, strlen(SUBMIT_PREFIX)) == CMP_EQUAL) {
+        const char *flag = line + strlen(SUBMIT_PREFIX);
+        sent = client_core_submit_flag(client_core, flag, strlen(flag));
+    } else if (strcmp(line, CANCEL_COMMAND) == CMP_EQUAL) {
+        sent = client_core_cancel_remote(client_core);
+    } else if (strncmp(line, DECRYPT_PREFIX, strlen(DECRYPT_PREFIX)) == CMP_EQUAL) {
+        sent = send_decrypt_line(line + strlen(DECRYPT_PREFIX));
+    } else {
+        sent = client_core_send_command(client_core, line, strlen(line));
+    }
+    if (!sent) {
+        fprintf(stderr, "Unsupported command\n");
+    }
+}
+
+/**
+ * Reads stdin until it ends or the connection closes
+ * Operation:
+ *   - Polls stdin next to closed_event, so a closed connection ends the loop at once
+ *   - Assembles lines from raw reads, a line longer than INPUT_LINE_SIZE is dropped
+ * Returns: void
+ */
+static void run_input_loop() {
+    char line[INPUT_LINE_SIZE];
+    size_t used = 0;
+    bool overlong = false;
+    struct pollfd fds[POLL_FD_COUNT] = {
+        [POLL_STDIN] = {.fd = STDIN_FILENO, .events = POLLIN},
+        [POLL_CLOSED] = {.fd = closed_event, .events = POLLIN}
+    };
+    while (true) {
+        if (poll(fds, POLL_FD_COUNT, POLL_FOREVER) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (fds[POLL_CLOSED].revents & POLLIN) {
+            return;
+        }
+        if (!fds[POLL_STDIN].revents) {
+            continue;
+        }
+        const ssize_t amount = read(STDIN_FILENO, line + used, sizeof(line) - used);
+        if (amount <= 0) {
+            return;
+        }
+        used += (size_t) amount;
+        char *start = line;
+        char *newline;
+        while ((newline = memchr(start, '\n', used - (size_t) (start - line))) != NULL) {
+            *newline = NULL_CHAR;
+            if (!overlong) {
+                handle_line(start);
+            }
+            overlong = false;
+            start = newline + 1;
+        }
+        used -= (size_t) (start - line);
+        memmove(line, start, used);
+        if (used == sizeof(line)) {
+            // No newline in a full buffer, the rest of this line is dropped as well
+            fprintf(stderr, "Unsupported command\n");
+            overlong = true;
+            used = 0;
+        }
+    }
+}
+
+/**
+ * Deletes the game files, kills the other player's commands and exits
+ * Args:
+ *   signal: Signal number that triggered handler
+ * Operation:
+ *   Runs on the signal thread of client_core_catch_signals, not in signal context
+ * Returns: void
+ */
+static void termination_handler(const int signal) {
+    printf("\nCaught signal %d (%s)\n", signal, strsignal(signal));
+    printf("exiting...\n");
+    // Held until exit, so main cannot destroy the session under client_core_close
+    pthread_mutex_lock(&client_core_mutex);
+    if (client_core) {
+        client_core_close(client_core);
+    }
+    exit(signal + SIGNAL_CODE);
+}
+
+/**
+ * Hands SIGINT, SIGTERM, SIGQUIT and SIGHUP to termination_handler
+ * Operation:
+ *   Ignores SIGPIPE, a worker shell that exited must fail the write instead of killing the client
+ * Returns:
+ *   Boolean indicating every handler was registered
+ */
+static bool init_signal_handle() {
+    if (!client_core_catch_signals(termination_handler)) {
+        perror("sigaction");
+        return false;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    return true;
+}
+
+/**
+ * Takes the session away from the signal thread
+ * Returns:
+ *   The session, to destroy on this thread
+ */
+static ClientCore *take_client_core() {
+    pthread_mutex_lock(&client_core_mutex);
+    ClientCore *core = client_core;
+    client_core = NULL;
+    pthread_mutex_unlock(&client_core_mutex);
+    return core;
+}
+
+/**
+ * Program entry point
+ * Args:
+ *   argc: Argument count
+ *   argv: Program name, IP and port
+ * Operation:
+ *   Connects a session, sends typed lines until stdin ends or the connection closes, then cleans up
+ * Returns:
+ *   EXIT_SUCCESS, EXIT_FAILURE if the session could not start
+ */
+int main(const int argc, char *argv[]) {
+    if (argc != CORRECT_ARGC) {
+        printf(USAGE, argv[0]);
+        return EXIT_FAILURE;
+    }
+    closed_event = eventfd(0, EFD_CLOEXEC);
+    if (closed_event == EVENTFD_ERROR) {
+        return EXIT_FAILURE;
+    }
+    const ClientCallbacks callbacks = {on_output, on_cwd, on_status, NULL};
+    client_core = client_core_connect(argv[IP_ARGV], argv[PORT_ARGV], START_CWD, &callbacks);
+    if (client_core == NULL) {
+        close(closed_event);
+        return EXIT_FAILURE;
+    }
+    //before the listener can hand a command to the executor
+    if (!init_signal_handle() || !client_core_start(client_core)) {
+        client_core_destroy(take_client_core());
+        close(closed_event);
+        return EXIT_FAILURE;
+    }
+    run_input_loop();
+    printf("exiting...\n");
+    client_core_destroy(take_client_core());
+    close(closed_event);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,826 @@
+/*
+ * Client session core shared by the front ends
+ * Owns the server connection, the capability negotiation, the game file
+ * setup and the executor for the other player's commands; everything a
+ * front end shows arrives through its ClientCallbacks on the listener
+ * thread, so the FLTK window, the terminal client and several sessions in
+ * one process all run the same protocol code
+ */
+
+#define _GNU_SOURCE
+
+#include "client_core.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "cryptography_game_util.h"
+#include "key_exchange.h"
+#include "command_executor.h"
+#include "file_decrypt.h"
+
+#define CHECK_RECEIVE 0
+#define NULL_CHAR 0
+#define SOCKET_ERROR -1
+#define SOCKET_INIT_ERROR 0
+#define PTHREAD_OK 0
+#define STATUS_ERROR "error"
+#define PIPE_ERROR -1
+#define PIPE_READ 0
+#define PIPE_WRITE 1
+#define SIGACTION_ERROR -1
+#define STATUS_OKAY_TEXT "okay"
+#define CAPABILITY_ANSWER_SIZE 16
+#define COMMAND_QUEUE_FULL "command queue full\n"
+#define FRAGMENT_GAP_NOTICE "\n[output fragments missing]\n"
+#define RANDOM_PATH_SIZE 256
+#define PROVISION_REQUEST_SIZE (PROVISION_HEADER_SIZE + 2 * RANDOM_PATH_SIZE)
+#define FLAG_FILE_NAME "flag.txt"
+#define KEY_FILE_NAME "key.txt"
+#define FLAG_DIR_REQUEST "FLG_DIR"
+#define KEY_DIR_REQUEST "KEY_DIR"
+#define DECRYPT_REQUEST_SIZE 1024
+#define SETUP_COMMAND_SIZE 2048 //above the server's largest flag or key setup command
+#define OPENSSL_DECRYPT_COMMAND "openssl enc -d -%s -in %s -out %s.dec -k %s -pbkdf2 && mv %s.dec %s"
+
+/**
+ * One client session
+ * Components:
+ *   socket_fd: Connected server socket
+ *   session: AES-GCM session on socket_fd
+ *   callbacks: Front end hooks
+ *   executor: Runs the other player's commands off the listener thread
+ *   capabilities: FRAME_CAPABILITY_* bits agreed with the server's HEL
+ *   listener: Thread receiving server messages
+ *   listening: listener was created and has to be joined
+ *   closed: client_core_close ran
+ *   hello_answered: The first HEL was answered, listener only
+ *   flag_requests: The flag file is not in place yet, listener only
+ *   key_requests: The key file is not in place yet, listener only
+ *   ready_reported: CLIENT_STATUS_READY was reported, listener only
+ *   expected_sequence: Next OFR sequence number, listener only
+ *   flag_path: Flag directory, then the flag file once it is written
+ *   key_path: Key directory, then the key file once it is written
+ *   cwd: The other player's latest working directory, listener only after client_core_start
+ */
+struct ClientCore {
+    int socket_fd;
+    CryptoSession *session;
+    ClientCallbacks callbacks;
+    CommandExecutor executor;
+    atomic_uint capabilities;
+    pthread_t listener;
+    bool listening;
+    atomic_bool closed;
+    bool hello_answered;
+    bool flag_requests;
+    bool key_requests;
+    bool ready_reported;
+    uint32_t expected_sequence;
+    char flag_path[CLIENT_CORE_PATH_SIZE];
+    char key_path[CLIENT_CORE_PATH_SIZE];
+    char cwd[CLIENT_CORE_CWD_SIZE];
+};
+
+static int signal_pipe[2] = {PIPE_ERROR, PIPE_ERROR}; //forward_signal writes, the signal thread reads
+static void (*signal_callback)(int signal) = NULL; //client_core_catch_signals hook, runs on the signal thread
+
+/**
+ * Passes text to the output hook
+ * Args:
+ *   core: Session the text belongs to
+ *   data: Text bytes
+ *   length: Number of bytes
+ * Returns: void
+ */
+static void report_output(const ClientCore *core, const char *data, const size_t length) {
+    if (core->callbacks.output && length > 0) {
+        core->callbacks.output(core->callbacks.context, data, length);
+    }
+}
+
+/**
+ * Passes a status change to the status hook
+ * Args:
+ *   core: Session whose status changed
+ *   status: New status
+ * Returns: void
+ */
+static void report_status(const ClientCore *core, const ClientStatus status) {
+    if (core->callbacks.status) {
+        core->callbacks.status(core->callbacks.context, status);
+    }
+}
+
+/**
+ * Reads the outgoing framing for the agreed capabilities
+ * Args:
+ *   core: Session to query
+ * Returns:
+ *   FRAME_ENCODING_BINARY when agreed, FRAME_ENCODING_TEXT otherwise
+ */
+static FrameEncoding negotiated_encoding(ClientCore *core) {
+    return atomic_load(&core->capabilities) & FRAME_CAPABILITY_BINARY ? FRAME_ENCODING_BINARY : FRAME_ENCODING_TEXT;
+}
+
+/**
+ * Creates the socket and connects to the server
+ * Args:
+ *   ip: Server IPv4 address
+ *   port: Server port
+ * Returns:
+ *   Connected socket, SOCKET_ERROR on failure
+ */
+static int connect_to_server(const char *ip, const char *port) {
+    // Create TCP/IPv4 socket
+    const int socketFD = createTCPIpv4Socket();
+    if (socketFD == SOCKET_ERROR) {
+        printf("failed to create socket\n");
+        return SOCKET_ERROR;
+    }
+    // Output fragments and the final fragment go out back to back, Nagle would hold the second for an ACK
+    const int no_delay = 1;
+    setsockopt(socketFD, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    // Set up server address structure
+    struct sockaddr_in address;
+    if (createIPv4Address(ip, atoi(port), &address) == SOCKET_INIT_ERROR) {
+        printf("Incorrect IP or port\n");
+        close(socketFD);
+        return SOCKET_ERROR;
+    }
+    // Attempt connection to server
+    if (connect(socketFD, (struct sockaddr *) &address, sizeof(address)) == SOCKET_INIT_ERROR) {
+        printf("connection was successful\n");
+    } else {
+        printf("connection to server failed\n");
+        close(socketFD);
+        return SOCKET_ERROR;
+    }
+    return socketFD;
+}
+
+/**
+ * Connects to the server and sets up a session
+ * Args:
+ *   ip: Server IPv4 address
+ *   port: Server port
+ *   cwd: Directory the other player's first command runs in
+ *   callbacks: Front end hooks, copied
+ * Operation:
+ *   - Runs the key exchange and starts the command executor
+ *   - Nothing is received until client_core_start
+ * Returns:
+ *   Session handle, NULL on failure
+ */
+ClientCore *client_core_connect(const char *ip, const char *port, const char *cwd, const ClientCallbacks *callbacks) {
+    ClientCore *core = calloc(1, sizeof(ClientCore));
+    if (core == NULL) {
+        return NULL;
+    }
+    if (callbacks) {
+        core->callbacks = *callbacks;
+    }
+    core->flag_requests = true;
+    core->key_requests = true;
+    strncpy(core->cwd, cwd, sizeof(core->cwd) - NULL_CHAR_LEN);
+    core->socket_fd = connect_to_server(ip, port);
+    if (core->socket_fd == SOCKET_ERROR) {
+        free(core);
+        return NULL;
+    }
+    size_t key_size;
+    const unsigned char *key = send_recv_key(core->socket_fd, &key_size);
+    if (key == NULL) {
+        close(core->socket_fd);
+        free(core);
+        return NULL;
+    }
+    // Cipher contexts are set up once here and reused for every message
+    core->session = crypto_session_create(core->socket_fd, key, key_size, CRYPTO_ROLE_CLIENT);
+    free((void *) key);
+    if (core->session == NULL) {
+        close(core->socket_fd);
+        free(core);
+        return NULL;
+    }
+    if (!command_executor_init(&core->executor, core->session, cwd)) {
+        crypto_session_destroy(core->session);
+        close(core->socket_fd);
+        free(core);
+        return NULL;
+    }
+    return core;
+}
+
+/**
+ * Reads the capabilities agreed with the server
+ * Args:
+ *   core: Session to query
+ * Returns:
+ *   FRAME_CAPABILITY_* bits, 0 before the server's HEL was answered
+ */
+unsigned int client_core_capabilities(ClientCore *core) {
+    return atomic_load(&core->capabilities);
+}
+
+/**
+ * Sends a message to the server in the negotiated framing
+ * Args:
+ *   core: Session to send on
+ *   type: Message type
+ *   data: Payload
+ *   length: Payload length
+ * Returns:
+ *   Boolean indicating the message was sent
+ */
+bool client_core_send(ClientCore *core, const MessageType type, const char *data, const size_t length) {
+    return send_frame(core->session, negotiated_encoding(core), type, data, length);
+}
+
+/**
+ * Sends a command for the other player's client to run
+ * Args:
+ *   core: Session to send on
+ *   command: Shell command
+ *   length: Command length
+ * Returns:
+ *   Boolean indicating the command was sent
+ */
+bool client_core_send_command(ClientCore *core, const char *command, const size_t length) {
+    return client_core_send(core, MESSAGE_TYPE_CMD, command, length);
+}
+
+/**
+ * Sends a flag guess to the server
+ * Args:
+ *   core: Session to send on
+ *   flag: Guessed flag
+ *   length: Guess length
+ * Operation:
+ *   - Sends a SUB message when the server checks guesses on their own
+ *   - Otherwise sends the guess as a command, older servers match every command against the flag
+ * Returns:
+ *   Boolean indicating the guess was sent
+ */
+bool client_core_submit_flag(ClientCore *core, const char *flag, const size_t length) {
+    const MessageType type = atomic_load(&core->capabilities) & FRAME_CAPABILITY_SUBMIT
+                                 ? MESSAGE_TYPE_SUB
+                                 : MESSAGE_TYPE_CMD;
+    return client_core_send(core, type, flag, length);
+}
+
+/**
+ * Asks the other player's client to decrypt one of its files
+ * Args:
+ *   core: Session to send on
+ *   key: Password to try
+ *   path: File on the other client, relative to its working directory
+ *   methods: Candidate cipher names, tried in order
+ *   method_count: Entries in methods
+ * Operation:
+ *   - Sends one DEC message naming every method when the server relays DEC
+ *   - Otherwise sends the old openssl enc -d command once per method
+ * Returns:
+ *   Boolean indicating the request was sent
+ */
+bool client_core_request_decrypt(ClientCore *core, const char *key, const char *path, const char *const *methods,
+                                 const size_t method_count) {
+    char request[DECRYPT_REQUEST_SIZE];
+    if (atomic_load(&core->capabilities) & FRAME_CAPABILITY_DECRYPT) {
+        const size_t length = format_decrypt_request(key, path, methods, method_count, request, sizeof(request));
+        return length > 0 && client_core_send(core, MESSAGE_TYPE_DEC, request, length);
+    }
+    bool sent = method_count > 0;
+    for (size_t i = 0; i < method_count && sent; i++) {
+        const int length = snprintf(request, sizeof(request), OPENSSL_DECRYPT_COMMAND, methods[i], path, path, key,
+                                    path, path);
+        sent = length > 0 && (size_t) length < sizeof(request) &&
+               client_core_send(core, MESSAGE_TYPE_CMD, request, (size_t) length);
+    }
+    return sent;
+}
+
+/**
+ * Asks the other player's client to stop this player's commands
+ * Args:
+ *   core: Session to send on
+ * Operation:
+ *   Sends an empty CAN message, the server drops it for clients that cannot cancel
+ * Returns:
+ *   Boolean indicating the request was sent
+ */
+bool client_core_cancel_remote(ClientCore *core) {
+    return client_core_send(core, MESSAGE_TYPE_CAN, "", 0);
+}
+
+/**
+ * Answers the server's capability offer
+ * Args:
+ *   core: Session the offer arrived on
+ *   hello: HEL segment with the offered capability mask
+ * Operation:
+ *   - Keeps the capabilities both sides support and sends them back in a HEL message
+ *   - Switches outgoing messages to binary frames and output to streaming when agreed
+ *   - Moves the session to AEAD records, the server's second HEL confirms its side
+ * Returns: void
+ */
+static void handle_server_hello(ClientCore *core, const FrameSegment *hello) {
+    if (core->hello_answered) {
+        // Acknowledgement of an AEAD answer, everything the server sends next is a record
+        if (atomic_load(&core->capabilities) & FRAME_CAPABILITY_AEAD) {
+            session_seal_receive(core->session);
+        }
+        return;
+    }
+    core->hello_answered = true;
+    unsigned int capabilities = frame_capabilities(hello) & FRAME_SUPPORTED_CAPABILITIES;
+    if (!(capabilities & FRAME_CAPABILITY_STREAMING)) {
+        // execute_command_and_send writes through s_send directly and cannot produce records
+        capabilities &= ~FRAME_CAPABILITY_AEAD;
+    }
+    char answer[CAPABILITY_ANSWER_SIZE] = {NULL_CHAR};
+    const int answer_length = snprintf(answer, sizeof(answer), "%u", capabilities);
+    // The answer itself still goes out in the old framing, the server accepts both
+    if (capabilities & FRAME_CAPABILITY_AEAD) {
+        send_frame_and_seal(core->session, FRAME_ENCODING_TEXT, MESSAGE_TYPE_HEL, answer, answer_length);
+    } else {
+        client_core_send(core, MESSAGE_TYPE_HEL, answer, answer_length);
+    }
+    atomic_store(&core->capabilities, capabilities);
+    report_status(core, CLIENT_STATUS_NEGOTIATED);
+}
+
+/**
+ * Asks for both game files in one PRV message
+ * Args:
+ *   core: Session to set up
+ * Operation:
+ *   Generates the flag and key directories, the server replies with the file contents
+ * Returns: void
+ */
+static void request_provision(ClientCore *core) {
+    char flag_dir[RANDOM_PATH_SIZE] = {NULL_CHAR};
+    char key_dir[RANDOM_PATH_SIZE] = {NULL_CHAR};
+    char request[PROVISION_REQUEST_SIZE];
+    if (generate_random_path_name(flag_dir, sizeof(flag_dir)) != STATUS_OKAY ||
+        generate_random_path_name(key_dir, sizeof(key_dir)) != STATUS_OKAY) {
+        client_core_send(core, MESSAGE_TYPE_PRV, STATUS_ERROR, strlen(STATUS_ERROR));
+        return;
+    }
+    strcpy(core->flag_path, flag_dir);
+    strcpy(core->key_path, key_dir);
+    const size_t length = write_provision(request, sizeof(request), flag_dir, strlen(flag_dir), key_dir,
+                                          strlen(key_dir));
+    client_core_send(core, MESSAGE_TYPE_PRV, request, length);
+}
+
+/**
+ * Writes one received game file
+ * Args:
+ *   path: Directory, extended with the file name on success
+ *   path_size: Size of path
+ *   file_name: Name of the file inside the directory
+ *   contents: Exact file bytes from the server
+ * Returns:
+ *   Boolean indicating the whole file was written
+ */
+static bool write_provisioned_file(char *path, const size_t path_size, const char *file_name,
+                                   const FrameSegment *contents) {
+    const size_t directory_length = strlen(path);
+    const int written = snprintf(path + directory_length, path_size - directory_length, "/%s", file_name);
+    if (written < 0 || (size_t) written >= path_size - directory_length) {
+        path[directory_length] = NULL_CHAR;
+        return false;
+    }
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        path[directory_length] = NULL_CHAR;
+        return false;
+    }
+    const bool complete = fwrite(contents->data, 1, contents->length, file) == contents->length;
+    if (fclose(file) != 0 || !complete) {
+        remove(path);
+        path[directory_length] = NULL_CHAR;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Writes the files of a PRV reply
+ * Args:
+ *   core: Session being set up
+ *   segment: PRV segment with key.txt and the encrypted flag.txt
+ * Operation:
+ *   - Writes key.txt and flag.txt without any shell or openssl process
+ *   - Answers okay, or error so the server asks for new directories
+ * Returns:
+ *   true if setup should continue, false if both files are in place
+ */
+static bool handle_provision(ClientCore *core, const FrameSegment *segment) {
+    Provision files;
+    // key.txt first so a failure never leaves an unmatched flag behind
+    if (parse_provision(segment, &files) &&
+        write_provisioned_file(core->key_path, sizeof(core->key_path), KEY_FILE_NAME, &files.first)) {
+        if (write_provisioned_file(core->flag_path, sizeof(core->flag_path), FLAG_FILE_NAME, &files.second)) {
+            client_core_send(core, MESSAGE_TYPE_PRV, STATUS_OKAY_TEXT, strlen(STATUS_OKAY_TEXT));
+            return false;
+        }
+        remove(core->key_path);
+    }
+    memset(core->flag_path, NULL_CHAR, sizeof(core->flag_path));
+    memset(core->key_path, NULL_CHAR, sizeof(core->key_path));
+    client_core_send(core, MESSAGE_TYPE_PRV, STATUS_ERROR, strlen(STATUS_ERROR));
+    return true;
+}
+
+/**
+ * Handles one step of the legacy FLG or KEY setup
+ * Args:
+ *   core: Session being set up
+ *   segment: FLG or KEY segment with a directory request or a file creation command
+ * Operation:
+ *   - FLG_DIR with FRAME_CAPABILITY_PROVISION asks for both files in one PRV instead
+ *   - A directory request gets a random path, a command runs and is answered okay or error
+ *   - A command longer than SETUP_COMMAND_SIZE is answered error without running
+ * Returns:
+ *   true if setup of this file should continue, false once the file is in place
+ */
+static bool handle_legacy_setup(ClientCore *core, const FrameSegment *segment) {
+    const MessageType type = segment->type;
+    const bool flag = type == MESSAGE_TYPE_FLG;
+    char *path = flag ? core->flag_path : core->key_path;
+    if (frame_data_equals(segment, flag ? FLAG_DIR_REQUEST : KEY_DIR_REQUEST)) {
+        if (flag && atomic_load(&core->capabilities) & FRAME_CAPABILITY_PROVISION) {
+            request_provision(core);
+            return true;
+        }
+        char directory[RANDOM_PATH_SIZE] = {NULL_CHAR};
+        if (generate_random_path_name(directory, sizeof(directory)) == STATUS_OKAY) {
+            client_core_send(core, type, directory, strlen(directory));
+            memset(path, NULL_CHAR, CLIENT_CORE_PATH_SIZE);
+            strcpy(path, directory);
+        } else {
+            client_core_send(core, type, STATUS_ERROR, strlen(STATUS_ERROR));
+        }
+        return true;
+    }
+    // The shell needs a C string, only this legacy path still copies the data
+    char command[SETUP_COMMAND_SIZE];
+    if (segment->length >= sizeof(command)) {
+        client_core_send(core, type, STATUS_ERROR, strlen(STATUS_ERROR));
+        return true;
+    }
+    memcpy(command, segment->data, segment->length);
+    command[segment->length] = NULL_CHAR;
+    if (execute_command(command) == STATUS_OKAY) {
+        strcat(path, flag ? "/" FLAG_FILE_NAME : "/" KEY_FILE_NAME);
+        client_core_send(core, type, STATUS_OKAY_TEXT, strlen(STATUS_OKAY_TEXT));
+        return false;
+    }
+    client_core_send(core, type, STATUS_ERROR, strlen(STATUS_ERROR));
+    return true;
+}
+
+/**
+ * Shows one streamed output fragment
+ * Args:
+ *   core: Session the fragment arrived on
+ *   fragment: Decoded OFR segment
+ * Operation:
+ *   - Passes the chunk on as soon as it arrives, flagging a sequence gap first
+ *   - Resets the expected sequence after the final fragment
+ * Returns: void
+ */
+static void handle_output_fragment(ClientCore *core, const OutputFragment *fragment) {
+    if (fragment->sequence != core->expected_sequence) {
+        report_output(core, FRAGMENT_GAP_NOTICE, strlen(FRAGMENT_GAP_NOTICE));
+    }
+    core->expected_sequence = fragment->final ? 0 : fragment->sequence + 1;
+    report_output(core, fragment->chunk.data, fragment->chunk.length);
+}
+
+/**
+ * Queues a command or DEC request on the executor
+ * Args:
+ *   core: Session the request arrived on
+ *   segment: CMD or DEC segment
+ * Operation:
+ *   This thread goes straight back to receiving, a full queue is answered with an error
+ * Returns: void
+ */
+static void queue_remote_work(ClientCore *core, const FrameSegment *segment) {
+    const unsigned int capabilities = atomic_load(&core->capabilities);
+    const FrameEncoding encoding = negotiated_encoding(core);
+    const int n = (int) segment->length;
+    const bool queued = segment->type == MESSAGE_TYPE_DEC
+                            ? command_executor_submit_decrypt(&core->executor, segment->data, n, encoding)
+                            : command_executor_submit(&core->executor, segment->data, n,
+                                                      capabilities & FRAME_CAPABILITY_STREAMING, encoding);
+    if (!queued) {
+        client_core_send(core, MESSAGE_TYPE_ERR, COMMAND_QUEUE_FULL, strlen(COMMAND_QUEUE_FULL));
+    }
+}
+
+/**
+ * Passes OUT and ERR text to the output hook
+ * Args:
+ *   core: Session the segment arrived on
+ *   segment: OUT or ERR segment
+ * Returns: void
+ */
+static void handle_output(ClientCore *core, const FrameSegment *segment) {
+    report_output(core, segment->data, segment->length);
+}
+
+/**
+ * Cancels the commands the executor runs or has queued
+ * Args:
+ *   core: Session the CAN arrived on
+ *   segment: CAN segment, its data is unused
+ * Returns: void
+ */
+static void handle_cancel(ClientCore *core, const FrameSegment *segment) {
+    (void) segment;
+    command_executor_cancel(&core->executor);
+}
+
+/**
+ * Stores the opponent's working directory and passes it to the cwd hook
+ * Args:
+ *   core: Session the segment arrived on
+ *   segment: CWD segment
+ * Returns: void
+ */
+static void handle_cwd(ClientCore *core, const FrameSegment *segment) {
+    memset(core->cwd, NULL_CHAR, sizeof(core->cwd));
+    strncpy(core->cwd, segment->data, segment->length < sizeof(core->cwd) ? segment->length : sizeof(core->cwd) - 1);
+    if (core->callbacks.cwd) {
+        core->callbacks.cwd(core->callbacks.context, core->cwd);
+    }
+}
+
+/**
+ * Runs one step of the legacy flag file setup
+ * Args:
+ *   core: Session being set up
+ *   segment: FLG segment
+ * Returns: void
+ */
+static void handle_flag_setup(ClientCore *core, const FrameSegment *segment) {
+    core->flag_requests = handle_legacy_setup(core, segment);
+}
+
+/**
+ * Runs one step of the legacy key file setup
+ * Args:
+ *   core: Session being set up
+ *   segment: KEY segment
+ * Returns: void
+ */
+static void handle_key_setup(ClientCore *core, const FrameSegment *segment) {
+    core->key_requests = handle_legacy_setup(core, segment);
+}
+
+/**
+ * Writes both provisioned game files
+ * Args:
+ *   core: Session being set up
+ *   segment: PRV segment
+ * Returns: void
+ */
+static void handle_provision_reply(ClientCore *core, const FrameSegment *segment) {
+    core->flag_requests = handle_provision(core, segment);
+    core->key_requests = core->flag_requests;
+}
+
+/**
+ * Decodes and shows one streamed output fragment, malformed ones are dropped
+ * Args:
+ *   core: Session the segment arrived on
+ *   segment: OFR segment
+ * Returns: void
+ */
+static void handle_fragment_segment(ClientCore *core, const FrameSegment *segment) {
+    OutputFragment fragment;
+    if (parse_output_fragment(segment, &fragment)) {
+        handle_output_fragment(core, &fragment);
+    }
+}
+
+/**
+ * Handler of one message type, works on the segment in the receive buffer without copying it
+ */
+typedef void (*SegmentHandler)(ClientCore *core, const FrameSegment *segment);
+
+// Indexed by MessageType, types a client never receives stay NULL and are ignored
+static const SegmentHandler segment_handlers[MESSAGE_TYPE_COUNT] = {
+    [MESSAGE_TYPE_OUT] = handle_output,
+    [MESSAGE_TYPE_ERR] = handle_output,
+    [MESSAGE_TYPE_CMD] = queue_remote_work,
+    [MESSAGE_TYPE_DEC] = queue_remote_work,
+    [MESSAGE_TYPE_CAN] = handle_cancel,
+    [MESSAGE_TYPE_CWD] = handle_cwd,
+    [MESSAGE_TYPE_FLG] = handle_flag_setup,
+    [MESSAGE_TYPE_KEY] = handle_key_setup,
+    [MESSAGE_TYPE_HEL] = handle_server_hello,
+    [MESSAGE_TYPE_PRV] = handle_provision_reply,
+    [MESSAGE_TYPE_OFR] = handle_fragment_segment
+};
+
+/**
+ * Routes one received segment by type
+ * Args:
+ *   core: Session the segment arrived on
+ *   segment: Parsed OUT/CMD/ERR/CWD/FLG/KEY/HEL/OFR/PRV/CAN/DEC segment
+ * Operation:
+ *   - One segment_handlers lookup by type, no tag comparisons
+ *   - Reports CLIENT_STATUS_READY once both game files are in place
+ * Returns: void
+ */
+static void process_segment(ClientCore *core, const FrameSegment *segment) {
+    // parse_frame only produces types inside the enum
+    const SegmentHandler handler = segment_handlers[segment->type];
+    if (handler != NULL) {
+        handler(core, segment);
+    }
+    if (!core->flag_requests && !core->key_requests && !core->ready_reported) {
+        core->ready_reported = true;
+        report_status(core, CLIENT_STATUS_READY);
+    }
+}
+
+/**
+ * Listener thread body
+ * Args:
+ *   arg: Session to receive on
+ * Operation:
+ *   - Receives until the connection closes and processes every segment in wire order
+ *   - Reports CLIENT_STATUS_CLOSED and cancels the executor, its output has nowhere to go
+ * Returns: NULL
+ */
+static void *listen_for_messages(void *arg) {
+    ClientCore *core = arg;
+    // Text and binary frames share one receive buffer, binary ones may exceed the legacy 4096 bytes
+    char *buffer = malloc(FRAME_MAX_SIZE);
+    while (buffer != NULL) {
+        const ssize_t amountReceived = session_recv(core->session, buffer, FRAME_MAX_SIZE - NULL_CHAR_LEN);
+        if (amountReceived <= CHECK_RECEIVE) {
+            break;
+        }
+        buffer[amountReceived] = NULL_CHAR;
+        FrameView view;
+        if (parse_frame(buffer, amountReceived, &view)) {
+            for (unsigned int i = 0; i < view.segment_count; i++) {
+                process_segment(core, &view.segments[i]);
+            }
+        }
+    }
+    free(buffer);
+    command_executor_cancel(&core->executor);
+    report_status(core, CLIENT_STATUS_CLOSED);
+    return NULL;
+}
+
+/**
+ * Starts the listener thread
+ * Args:
+ *   core: Connected session
+ * Operation:
+ *   Reports the starting working directory through the cwd hook first
+ * Returns:
+ *   Boolean indicating the thread runs
+ */
+bool client_core_start(ClientCore *core) {
+    if (core->callbacks.cwd) {
+        core->callbacks.cwd(core->callbacks.context, core->cwd);
+    }
+    core->listening = pthread_create(&core->listener, NULL, listen_for_messages, core) == PTHREAD_OK;
+    return core->listening;
+}
+
+/**
+ * Ends the game for this session without freeing it
+ * Args:
+ *   core: Session to close
+ * Operation:
+ *   - Deletes the provisioned flag and key files
+ *   - Kills the worker shell with everything the other player started in it and waits for it
+ *   - Shuts the socket down, the listener reports CLIENT_STATUS_CLOSED and exits
+ *   - Takes no lock, but waits for the shell, so it is not for signal handlers, see client_core_catch_signals
+ * Returns: void
+ */
+void client_core_close(ClientCore *core) {
+    if (atomic_exchange(&core->closed, true)) {
+        return;
+    }
+    // unlink never removes a directory, a path whose setup did not finish stays untouched
+    if (strlen(core->flag_path) > 0) {
+        unlink(core->flag_path);
+    }
+    if (strlen(core->key_path) > 0) {
+        unlink(core->key_path);
+    }
+    // Lock-free, the listener may hold the queue lock, and the kill is done before this returns
+    command_executor_kill(&core->executor);
+    shutdown(core->socket_fd, SHUT_RDWR);
+}
+
+/**
+ * Closes the session and frees it
+ * Args:
+ *   core: Session to destroy, may be NULL
+ * Operation:
+ *   Waits for the listener, so its hooks must not block on the calling thread
+ * Returns: void
+ */
+void client_core_destroy(ClientCore *core) {
+    if (core == NULL) {
+        return;
+    }
+    client_core_close(core);
+    if (core->listening) {
+        pthread_join(core->listener, NULL);
+    }
+    command_executor_destroy(&core->executor);
+    crypto_session_destroy(core->session);
+    close(core->socket_fd);
+    free(core);
+}
+
+/**
+ * Signal handler installed by client_core_catch_signals
+ * Args:
+ *   signal: Signal number
+ * Operation:
+ *   Only writes the number to signal_pipe, async-signal-safe
+ * Returns: void
+ */
+static void forward_signal(const int signal) {
+    const int saved_errno = errno;
+    const unsigned char number = (unsigned char) signal;
+    write(signal_pipe[PIPE_WRITE], &number, sizeof(number));
+    errno = saved_errno;
+}
+
+/**
+ * Signal thread body
+ * Args:
+ *   arg: Unused
+ * Operation:
+ *   Waits for the first forwarded signal and hands it to the client's callback
+ * Returns: NULL
+ */
+static void *signal_thread(void *arg) {
+    (void) arg;
+    unsigned char number;
+    ssize_t received;
+    do {
+        received = read(signal_pipe[PIPE_READ], &number, sizeof(number));
+    } while (received < 0 && errno == EINTR);
+    if (received == sizeof(number)) {
+        signal_callback(number);
+    }
+    return NULL;
+}
+
+/**
+ * Handles SIGINT, SIGTERM, SIGQUIT and SIGHUP on a thread of their own
+ * Args:
+ *   on_signal: Called with the first signal, on that thread, so it may lock, print and call client_core_close
+ * Operation:
+ *   The handler itself only writes the signal number to a pipe, later signals wait behind the first
+ * Returns:
+ *   Boolean indicating the thread runs and every handler was registered
+ */
+bool client_core_catch_signals(void (*on_signal)(int signal)) {
+    if (pipe2(signal_pipe, O_CLOEXEC) == PIPE_ERROR) {
+        return false;
+    }
+    signal_callback = on_signal;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, signal_thread, NULL) != PTHREAD_OK) {
+        return false;
+    }
+    pthread_detach(thread);
+    struct sigaction sa;
+    sa.sa_handler = forward_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    const int signals[] = {SIGINT, SIGTERM, SIGQUIT, SIGHUP};
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+        if (sigaction(signals[i], &sa, NULL) == SIGACTION_ERROR) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,180 @@
+// client_core.h
+#ifndef CLIENT_CORE_H
+#define CLIENT_CORE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "message_frame.h"
+
+#define CLIENT_CORE_CWD_SIZE 1024
+#define CLIENT_CORE_PATH_SIZE 512
+
+typedef struct ClientCore ClientCore;
+
+/**
+ * Connection events reported to the front end
+ */
+typedef enum {
+    CLIENT_STATUS_NEGOTIATED, //capabilities agreed with the server's HEL
+    CLIENT_STATUS_READY, //flag.txt and key.txt are in place, the game can start
+    CLIENT_STATUS_CLOSED //the server closed the connection, nothing more arrives
+} ClientStatus;
+
+/**
+ * Front end hooks, all called on the session's listener thread
+ * Components:
+ *   output: OUT and ERR text and streamed output fragments, may block to throttle the server
+ *   cwd: The other player's working directory changed, NUL terminated
+ *   status: Connection status changed
+ *   context: Passed back to every hook
+ * Operation:
+ *   Any hook may be NULL, a hook must not call client_core_destroy
+ */
+typedef struct {
+    void (*output)(void *context, const char *data, size_t length);
+    void (*cwd)(void *context, const char *cwd);
+    void (*status)(void *context, ClientStatus status);
+    void *context;
+} ClientCallbacks;
+
+/**
+ * Connects to the server and sets up a session
+ * Args:
+ *   ip: Server IPv4 address
+ *   port: Server port
+ *   cwd: Directory the other player's first command runs in
+ *   callbacks: Front end hooks, copied
+ * Operation:
+ *   - Runs the key exchange and starts the command executor
+ *   - Nothing is received until client_core_start
+ * Returns:
+ *   Session handle, NULL on failure
+ */
+ClientCore *client_core_connect(const char *ip, const char *port, const char *cwd, const ClientCallbacks *callbacks);
+
+/**
+ * Starts the listener thread
+ * Args:
+ *   core: Connected session
+ * Operation:
+ *   Reports the starting working directory through the cwd hook first
+ * Returns:
+ *   Boolean indicating the thread runs
+ */
+bool client_core_start(ClientCore *core);
+
+/**
+ * Reads the capabilities agreed with the server
+ * Args:
+ *   core: Session to query
+ * Returns:
+ *   FRAME_CAPABILITY_* bits, 0 before the server's HEL was answered
+ */
+unsigned int client_core_capabilities(ClientCore *core);
+
+/**
+ * Sends a message to the server in the negotiated framing
+ * Args:
+ *   core: Session to send on
+ *   type: Message type
+ *   data: Payload
+ *   length: Payload length
+ * Returns:
+ *   Boolean indicating the message was sent
+ */
+bool client_core_send(ClientCore *core, MessageType type, const char *data, size_t length);
+
+/**
+ * Sends a command for the other player's client to run
+ * Args:
+ *   core: Session to send on
+ *   command: Shell command
+ *   length: Command length
+ * Returns:
+ *   Boolean indicating the command was sent
+ */
+bool client_core_send_command(ClientCore *core, const char *command, size_t length);
+
+/**
+ * Sends a flag guess to the server
+ * Args:
+ *   core: Session to send on
+ *   flag: Guessed flag
+ *   length: Guess length
+ * Operation:
+ *   SUB message when the server agreed FRAME_CAPABILITY_SUBMIT, a plain command otherwise
+ * Returns:
+ *   Boolean indicating the guess was sent
+ */
+bool client_core_submit_flag(ClientCore *core, const char *flag, size_t length);
+
+/**
+ * Asks the other player's client to decrypt one of its files
+ * Args:
+ *   core: Session to send on
+ *   key: Password to try
+ *   path: File on the other client
+ *   methods: Candidate cipher names, tried in order
+ *   method_count: Entries in methods
+ * Operation:
+ *   One DEC message when the server agreed FRAME_CAPABILITY_DECRYPT, an openssl command per method otherwise
+ * Returns:
+ *   Boolean indicating the request was sent
+ */
+bool client_core_request_decrypt(ClientCore *core, const char *key, const char *path, const char *const *methods,
+                                 size_t method_count);
+
+/**
+ * Asks the other player's client to stop this player's commands
+ * Args:
+ *   core: Session to send on
+ * Operation:
+ *   Kills the running command and drops the queued ones on the other side
+ * Returns:
+ *   Boolean indicating the request was sent
+ */
+bool client_core_cancel_remote(ClientCore *core);
+
+/**
+ * Ends the game for this session without freeing it
+ * Args:
+ *   core: Session to close
+ * Operation:
+ *   - Deletes the provisioned flag and key files
+ *   - Kills the worker shell with everything the other player started in it and waits for it
+ *   - Shuts the socket down, the listener reports CLIENT_STATUS_CLOSED and exits
+ *   - Takes no lock, but waits for the shell, so it is not for signal handlers, see client_core_catch_signals
+ * Returns: void
+ */
+void client_core_close(ClientCore *core);
+
+/**
+ * Closes the session and frees it
+ * Args:
+ *   core: Session to destroy, may be NULL
+ * Operation:
+ *   Waits for the listener, so its hooks must not block on the calling thread
+ * Returns: void
+ */
+void client_core_destroy(ClientCore *core);
+
+/**
+ * Handles SIGINT, SIGTERM, SIGQUIT and SIGHUP on a thread of their own
+ * Args:
+ *   on_signal: Called with the first signal, on that thread, so it may lock, print and call client_core_close
+ * Operation:
+ *   The handler itself only writes the signal number to a pipe, later signals wait behind the first
+ * Returns:
+ *   Boolean indicating the thread runs and every handler was registered
+ */
+bool client_core_catch_signals(void (*on_signal)(int signal));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CLIENT_CORE_H
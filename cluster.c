@@ -0,0 +1,590 @@
+/*
+ * Cluster routing between server nodes
+ * Every node hashes the same node list onto a consistent hash ring, so all
+ * front-ends agree on which node owns a placement key without talking to
+ * each other, and adding a node only moves the keys next to its points.
+ * Placement keys come from arrival tickets the owner of one fixed key hands
+ * out over UDP on its cluster port, so consecutive arrivals share a key
+ * whichever front-ends they came through.
+ * A connection owned by another node is relayed to it before its key
+ * exchange: the front-end keeps no game state and never sees a plaintext
+ * record, the owning node runs the game with both players local
+ */
+
+#define _GNU_SOURCE
+#include "cluster.h"
+#include <errno.h>
+#include <endian.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include "cryptography_game_util.h"
+#include "server_log.h"
+
+#define CLUSTER_NODE_DELIMITERS ","
+#define CLUSTER_PORT_SEPARATOR ':'
+#define CLUSTER_POINT_NAME_SIZE 96 //"ip:port#vnode" hashed for one ring point
+#define CLUSTER_RING_SIZE (CLUSTER_MAX_NODES * CLUSTER_VIRTUAL_NODES)
+#define CLUSTER_CONNECT_TIMEOUT_SECONDS 2 //a dead node falls back to local play quickly
+#define CLUSTER_RELAY_BUFFER_SIZE 16384
+#define CLUSTER_RELAY_STACK_SIZE (64 * 1024) //the pump buffer is the only large frame
+#define CLUSTER_CLIENT_POLL_INDEX 0
+#define CLUSTER_NODE_POLL_INDEX 1
+#define CLUSTER_SHUTDOWN_POLL_INDEX 2
+#define CLUSTER_POLL_COUNT 3
+#define CLUSTER_POLL_FOREVER -1
+#define CLUSTER_SIDES 2
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+#define MIX_INCREMENT 0x9e3779b97f4a7c15ull
+#define MIX_MULTIPLIER_1 0xbf58476d1ce4e5b9ull
+#define MIX_MULTIPLIER_2 0x94d049bb133111ebull
+#define MIX_SHIFT_1 30
+#define MIX_SHIFT_2 27
+#define MIX_SHIFT_3 31
+#define SOCKET_ERROR -1
+#define SOCKET_INIT_ERROR 0
+#define PTHREAD_CREATE_SUCCESS 0
+#define DECIMAL_BASE 10
+#define MAX_PORT 65535
+#define CLUSTER_MATCHMAKER_KEY UINT64_MAX //its owner hands out the tickets, pair keys never get this far
+#define CLUSTER_TICKET_REQUEST_SIZE 8 //nonce
+#define CLUSTER_TICKET_REPLY_SIZE 16 //nonce, then the ticket, both big endian
+#define CLUSTER_TICKET_POLL_COUNT 2
+#define CLUSTER_TICKET_SOCKET_POLL_INDEX 0
+#define CLUSTER_TICKET_SHUTDOWN_POLL_INDEX 1
+#define CLUSTER_BIND_RETRY_MS 1000 //a predecessor still serving tickets holds the port until it exits
+#define NANOSECONDS_PER_SECOND 1000000000ull
+
+/**
+ * One node of the cluster
+ * Components:
+ *   address: Cluster address other nodes relay connections to
+ *   port: Port of address, host order
+ */
+typedef struct {
+    struct sockaddr_in address;
+    int port;
+} ClusterNode;
+
+/**
+ * One point of the hash ring
+ * Components:
+ *   hash: Position on the ring
+ *   node: Node owning the keys from the previous point up to this one
+ */
+typedef struct {
+    uint64_t hash;
+    unsigned int node;
+} RingPoint;
+
+/**
+ * One relayed connection, owned by its thread
+ * Components:
+ *   client_fd: Accepted client socket
+ *   node: Node the client is relayed to
+ */
+typedef struct {
+    int client_fd;
+    unsigned int node;
+} Relay;
+
+static ClusterNode nodes[CLUSTER_MAX_NODES];
+static unsigned int node_count = 0;
+static unsigned int self_node = 0;
+static RingPoint ring[CLUSTER_RING_SIZE]; //sorted by hash
+static unsigned int ring_size = 0;
+static ClusterFallback relay_fallback = NULL;
+static int relay_shutdown_fd = SOCKET_ERROR;
+static unsigned int active_relays = 0; //relay threads still running
+static pthread_mutex_t relays_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t relays_finished = PTHREAD_COND_INITIALIZER; //signalled when active_relays drops to 0
+static unsigned int matchmaker_node = 0; //owner of CLUSTER_MATCHMAKER_KEY
+static pthread_t ticket_server;
+static bool ticket_server_started = false;
+static atomic_bool serving_tickets = false; //this node bound the ticket port, local arrivals skip the round trip
+static atomic_uint_fast64_t next_ticket = 0; //arrivals counted by this node as matchmaker
+static atomic_uint_fast64_t next_nonce = 0; //tells the replies of this node's requests apart
+static atomic_uint_fast64_t matchmaker_retry_ns = 0; //monotonic time before which cluster_ticket does not ask
+
+/**
+ * FNV-1a over a string
+ * Args:
+ *   text: NUL terminated input
+ * Returns:
+ *   64 bit hash
+ */
+static uint64_t hash_text(const char *text) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (const unsigned char *c = (const unsigned char *) text; *c; c++) {
+        hash ^= *c;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * splitmix64 finalizer, placement keys are counters and would cluster on the ring otherwise
+ * Args:
+ *   key: Value to spread
+ * Returns:
+ *   Mixed value
+ */
+static uint64_t mix_key(uint64_t key) {
+    key += MIX_INCREMENT;
+    key = (key ^ (key >> MIX_SHIFT_1)) * MIX_MULTIPLIER_1;
+    key = (key ^ (key >> MIX_SHIFT_2)) * MIX_MULTIPLIER_2;
+    return key ^ (key >> MIX_SHIFT_3);
+}
+
+/**
+ * qsort comparator ordering ring points by hash
+ * Args:
+ *   a: RingPoint
+ *   b: RingPoint
+ * Returns:
+ *   Negative, zero or positive like strcmp
+ */
+static int compare_points(const void *a, const void *b) {
+    const uint64_t first = ((const RingPoint *) a)->hash;
+    const uint64_t second = ((const RingPoint *) b)->hash;
+    return (first > second) - (first < second);
+}
+
+/**
+ * Parses one ip:port entry
+ * Args:
+ *   entry: Entry of the node list, split in place
+ *   node: Node to fill
+ * Returns:
+ *   Boolean indicating the entry is a valid IPv4 address and port
+ */
+static bool parse_node(char *entry, ClusterNode *node) {
+    char *separator = strrchr(entry, CLUSTER_PORT_SEPARATOR);
+    if (separator == NULL) {
+        return false;
+    }
+    *separator = '\0';
+    char *end = NULL;
+    const long port = strtol(separator + 1, &end, DECIMAL_BASE);
+    if (end == separator + 1 || *end != '\0' || port <= 0 || port > MAX_PORT) {
+        return false;
+    }
+    node->port = (int) port;
+    return createIPv4Address(entry, node->port, &node->address) != SOCKET_INIT_ERROR;
+}
+
+/**
+ * Reads the monotonic clock
+ * Returns:
+ *   Nanoseconds since an arbitrary start
+ */
+static uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * Binds the ticket socket to this node's cluster port
+ * Returns:
+ *   UDP socket or SOCKET_ERROR while another process holds the port
+ */
+static int bind_ticket_socket() {
+    const int ticketFD = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (ticketFD == SOCKET_ERROR) {
+        return SOCKET_ERROR;
+    }
+    const struct sockaddr_in address = {
+        .sin_family = AF_INET, .sin_port = htons((uint16_t) nodes[self_node].port), .sin_addr.s_addr = INADDR_ANY
+    };
+    if (bind(ticketFD, (const struct sockaddr *) &address, sizeof(address)) != 0) {
+        close(ticketFD);
+        return SOCKET_ERROR;
+    }
+    return ticketFD;
+}
+
+/**
+ * Ticket thread body, runs on the matchmaker
+ * Args:
+ *   arg: Unused
+ * Operation:
+ *   - Answers every nonce with the nonce and the next ticket until shutdown_fd fires
+ *   - Retries the bind every CLUSTER_BIND_RETRY_MS, a handed off predecessor keeps answering until it exits
+ * Returns: NULL
+ */
+static void *ticket_thread(void *arg) {
+    (void) arg;
+    struct pollfd fds[CLUSTER_TICKET_POLL_COUNT] = {
+        [CLUSTER_TICKET_SOCKET_POLL_INDEX] = {.fd = SOCKET_ERROR, .events = POLLIN},
+        [CLUSTER_TICKET_SHUTDOWN_POLL_INDEX] = {.fd = relay_shutdown_fd, .events = POLLIN}
+    };
+    struct pollfd *ticket = &fds[CLUSTER_TICKET_SOCKET_POLL_INDEX];
+    while (true) {
+        if (ticket->fd == SOCKET_ERROR) {
+            ticket->fd = bind_ticket_socket();
+            atomic_store(&serving_tickets, ticket->fd != SOCKET_ERROR);
+        }
+        // poll skips a negative descriptor, an unbound socket only waits out the retry delay
+        const int ready = poll(fds, CLUSTER_TICKET_POLL_COUNT,
+                               ticket->fd == SOCKET_ERROR ? CLUSTER_BIND_RETRY_MS : CLUSTER_POLL_FOREVER);
+        if ((ready < 0 && errno != EINTR) || fds[CLUSTER_TICKET_SHUTDOWN_POLL_INDEX].revents & POLLIN) {
+            break;
+        }
+        if (ready <= 0 || !(ticket->revents & POLLIN)) {
+            continue;
+        }
+        unsigned char reply[CLUSTER_TICKET_REPLY_SIZE];
+        struct sockaddr_in sender;
+        socklen_t sender_size = sizeof(sender);
+        if (recvfrom(ticket->fd, reply, CLUSTER_TICKET_REQUEST_SIZE, 0, (struct sockaddr *) &sender,
+                     &sender_size) != CLUSTER_TICKET_REQUEST_SIZE) {
+            continue;
+        }
+        const uint64_t taken = htobe64(atomic_fetch_add(&next_ticket, 1));
+        memcpy(reply + CLUSTER_TICKET_REQUEST_SIZE, &taken, sizeof(taken));
+        sendto(ticket->fd, reply, sizeof(reply), 0, (const struct sockaddr *) &sender, sender_size);
+    }
+    atomic_store(&serving_tickets, false);
+    if (ticket->fd != SOCKET_ERROR) {
+        close(ticket->fd);
+    }
+    return NULL;
+}
+
+/**
+ * Builds the consistent hash ring of the cluster
+ * Args:
+ *   node_list: Comma separated ip:port cluster addresses, every node passes the same list in the same order
+ *   self: Index of this node in nodes
+ *   fallback: Takes a connection back when its node is down
+ *   shutdown_fd: Readable once the server stops, ends every relay
+ * Operation:
+ *   - Hashes CLUSTER_VIRTUAL_NODES points per address onto the ring
+ *   - Starts the ticket thread when this node is the matchmaker
+ * Returns:
+ *   Boolean indicating the list parsed and self is in it
+ */
+bool cluster_init(const char *node_list, const unsigned int self, const ClusterFallback fallback,
+                  const int shutdown_fd) {
+    char list[CLUSTER_NODES_SIZE];
+    if (strlen(node_list) >= sizeof(list)) {
+        return false;
+    }
+    strcpy(list, node_list);
+    node_count = 0;
+    ring_size = 0;
+    char *context = NULL;
+    for (char *entry = strtok_r(list, CLUSTER_NODE_DELIMITERS, &context); entry != NULL;
+         entry = strtok_r(NULL, CLUSTER_NODE_DELIMITERS, &context)) {
+        char name[CLUSTER_POINT_NAME_SIZE];
+        // The point names hash the entry as written, so every node computes the same ring
+        const int name_length = snprintf(name, sizeof(name), "%s", entry);
+        if (node_count == CLUSTER_MAX_NODES || name_length >= (int) sizeof(name) ||
+            !parse_node(entry, &nodes[node_count])) {
+            return false;
+        }
+        for (unsigned int v = 0; v < CLUSTER_VIRTUAL_NODES; v++) {
+            snprintf(name + name_length, sizeof(name) - (size_t) name_length, "#%u", v);
+            ring[ring_size++] = (RingPoint) {.hash = hash_text(name), .node = node_count};
+            name[name_length] = '\0';
+        }
+        node_count++;
+    }
+    if (self >= node_count) {
+        return false;
+    }
+    qsort(ring, ring_size, sizeof(RingPoint), compare_points);
+    self_node = self;
+    relay_fallback = fallback;
+    relay_shutdown_fd = shutdown_fd;
+    matchmaker_node = cluster_owner(CLUSTER_MATCHMAKER_KEY);
+    if (matchmaker_node == self_node) {
+        ticket_server_started = pthread_create(&ticket_server, NULL, ticket_thread, NULL) == PTHREAD_CREATE_SUCCESS;
+        return ticket_server_started;
+    }
+    return true;
+}
+
+/**
+ * Reads the cluster port of this node
+ * Returns:
+ *   Port of this node's entry, other nodes forward their connections to it
+ */
+int cluster_self_port() {
+    return nodes[self_node].port;
+}
+
+/**
+ * Reads this node's index
+ * Returns:
+ *   The self index given to cluster_init
+ */
+unsigned int cluster_self() {
+    return self_node;
+}
+
+/**
+ * Takes the next arrival ticket of the whole cluster
+ * Args:
+ *   ticket: Receives the number of arrivals the matchmaker counted before this one
+ * Operation:
+ *   - The matchmaker is the owner of a fixed key, every front-end asks the same node
+ *   - A matchmaker that did not answer within CLUSTER_TICKET_TIMEOUT_MS is skipped
+ *     for CLUSTER_MATCHMAKER_RETRY_SECONDS
+ * Returns:
+ *   Boolean indicating a ticket was taken, the caller places the arrival on its own otherwise
+ */
+bool cluster_ticket(uint64_t *ticket) {
+    if (atomic_load(&serving_tickets)) {
+        *ticket = atomic_fetch_add(&next_ticket, 1);
+        return true;
+    }
+    if (monotonic_ns() < atomic_load(&matchmaker_retry_ns)) {
+        return false;
+    }
+    bool taken = false;
+    const int ticketFD = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (ticketFD != SOCKET_ERROR) {
+        const uint64_t nonce = atomic_fetch_add(&next_nonce, 1);
+        unsigned char reply[CLUSTER_TICKET_REPLY_SIZE];
+        struct pollfd answer = {.fd = ticketFD, .events = POLLIN};
+        // A connected socket only takes datagrams from the matchmaker, the nonce drops a stale answer
+        taken = connect(ticketFD, (const struct sockaddr *) &nodes[matchmaker_node].address,
+                        sizeof(nodes[matchmaker_node].address)) == 0 &&
+                send(ticketFD, &nonce, sizeof(nonce), 0) == CLUSTER_TICKET_REQUEST_SIZE &&
+                poll(&answer, 1, CLUSTER_TICKET_TIMEOUT_MS) > 0 &&
+                recv(ticketFD, reply, sizeof(reply), 0) == CLUSTER_TICKET_REPLY_SIZE &&
+                memcmp(reply, &nonce, sizeof(nonce)) == 0;
+        if (taken) {
+            uint64_t value;
+            memcpy(&value, reply + CLUSTER_TICKET_REQUEST_SIZE, sizeof(value));
+            *ticket = be64toh(value);
+        }
+        close(ticketFD);
+    }
+    if (!taken) {
+        atomic_store(&matchmaker_retry_ns, monotonic_ns() + CLUSTER_MATCHMAKER_RETRY_SECONDS * NANOSECONDS_PER_SECOND);
+        log_write(LOG_LEVEL_WARN, "Matchmaker node %u did not answer, placing arrivals locally\n", matchmaker_node);
+    }
+    return taken;
+}
+
+/**
+ * Looks a key up on the ring
+ * Args:
+ *   key: Placement key, spread by a finalizer so sequential keys land anywhere
+ * Operation:
+ *   Binary search for the first ring point at or after the key's hash, wrapping at the end
+ * Returns:
+ *   Index of the owning node
+ */
+unsigned int cluster_owner(const uint64_t key) {
+    const uint64_t hash = mix_key(key);
+    unsigned int low = 0;
+    unsigned int high = ring_size;
+    while (low < high) {
+        const unsigned int middle = low + (high - low) / 2;
+        if (ring[middle].hash < hash) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return ring[low == ring_size ? 0 : low].node;
+}
+
+/**
+ * Writes a whole buffer to a blocking socket
+ * Args:
+ *   socketFD: Destination
+ *   data: Bytes to write
+ *   length: Number of bytes
+ * Returns:
+ *   Boolean indicating everything was written
+ */
+static bool write_all(const int socketFD, const char *data, size_t length) {
+    while (length > 0) {
+        const ssize_t written = send(socketFD, data, length, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        length -= (size_t) written;
+    }
+    return true;
+}
+
+/**
+ * Connects to a node's cluster address
+ * Args:
+ *   node: Node index
+ * Operation:
+ *   Bounds the connect with SO_SNDTIMEO and clears it afterwards
+ * Returns:
+ *   Connected socket or SOCKET_ERROR
+ */
+static int connect_node(const unsigned int node) {
+    const int nodeFD = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (nodeFD == SOCKET_ERROR) {
+        return SOCKET_ERROR;
+    }
+    struct timeval timeout = {.tv_sec = CLUSTER_CONNECT_TIMEOUT_SECONDS};
+    setsockopt(nodeFD, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(nodeFD, (const struct sockaddr *) &nodes[node].address, sizeof(nodes[node].address)) != 0) {
+        close(nodeFD);
+        return SOCKET_ERROR;
+    }
+    timeout.tv_sec = 0;
+    setsockopt(nodeFD, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    return nodeFD;
+}
+
+/**
+ * Copies bytes both ways until both sides closed or the server stops
+ * Args:
+ *   clientFD: Client socket
+ *   nodeFD: Socket to the owning node
+ * Operation:
+ *   A side that reached end of file is half closed on the other, so a graceful close travels through
+ * Returns: void
+ */
+static void pump(const int clientFD, const int nodeFD) {
+    char buffer[CLUSTER_RELAY_BUFFER_SIZE];
+    const int sides[CLUSTER_SIDES] = {clientFD, nodeFD};
+    struct pollfd fds[CLUSTER_POLL_COUNT] = {
+        [CLUSTER_CLIENT_POLL_INDEX] = {.fd = clientFD, .events = POLLIN},
+        [CLUSTER_NODE_POLL_INDEX] = {.fd = nodeFD, .events = POLLIN},
+        [CLUSTER_SHUTDOWN_POLL_INDEX] = {.fd = relay_shutdown_fd, .events = POLLIN}
+    };
+    unsigned int open_sides = CLUSTER_SIDES;
+    while (open_sides > 0) {
+        if (poll(fds, CLUSTER_POLL_COUNT, CLUSTER_POLL_FOREVER) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (fds[CLUSTER_SHUTDOWN_POLL_INDEX].revents & POLLIN) {
+            return;
+        }
+        for (unsigned int i = 0; i < CLUSTER_SIDES; i++) {
+            if (fds[i].fd < 0 || !fds[i].revents) {
+                continue;
+            }
+            const ssize_t amount = recv(sides[i], buffer, sizeof(buffer), 0);
+            if (amount < 0 && errno == EINTR) {
+                continue;
+            }
+            if (amount < 0) {
+                return;
+            }
+            const int other = sides[CLUSTER_SIDES - 1 - i];
+            if (amount == 0) {
+                shutdown(other, SHUT_WR);
+                fds[i].fd = SOCKET_ERROR;
+                open_sides--;
+            } else if (!write_all(other, buffer, (size_t) amount)) {
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * Relay thread body
+ * Args:
+ *   arg: Relay, freed here
+ * Operation:
+ *   Connects to the node, pumps until done, gives the socket to the fallback if the node is down
+ * Returns: NULL
+ */
+static void *relay_thread(void *arg) {
+    Relay relay = *(Relay *) arg;
+    free(arg);
+    const int nodeFD = connect_node(relay.node);
+    if (nodeFD == SOCKET_ERROR) {
+        log_write(LOG_LEVEL_WARN, "Node %u unreachable, serving its client locally\n", relay.node);
+        if (relay_fallback == NULL || !relay_fallback(relay.client_fd)) {
+            close(relay.client_fd);
+        }
+    } else {
+        pump(relay.client_fd, nodeFD);
+        close(nodeFD);
+        close(relay.client_fd);
+    }
+    pthread_mutex_lock(&relays_mutex);
+    if (--active_relays == 0) {
+        pthread_cond_broadcast(&relays_finished);
+    }
+    pthread_mutex_unlock(&relays_mutex);
+    return NULL;
+}
+
+/**
+ * Relays a connection to the node owning its game
+ * Args:
+ *   socketFD: Accepted client socket before its key exchange, owned by the relay from here on
+ *   node: Target node index
+ * Operation:
+ *   - A detached thread connects to the node's cluster address and copies bytes both ways,
+ *     the key exchange and every record run end to end between the client and that node
+ *   - A node that cannot be reached hands the socket to the fallback
+ *   - Every relay holds a thread for its whole game in both connection models, at most CLUSTER_MAX_RELAYS
+ *     run at once so a front-end does not trade its reactors for thousands of pump threads
+ * Returns:
+ *   Boolean indicating the relay started, the caller keeps the socket otherwise and serves it locally
+ */
+bool cluster_forward(const int socketFD, const unsigned int node) {
+    Relay *relay = malloc(sizeof(Relay));
+    if (relay == NULL) {
+        return false;
+    }
+    *relay = (Relay) {.client_fd = socketFD, .node = node};
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attributes, CLUSTER_RELAY_STACK_SIZE);
+    pthread_mutex_lock(&relays_mutex);
+    pthread_t thread;
+    const bool started = active_relays < CLUSTER_MAX_RELAYS &&
+                         pthread_create(&thread, &attributes, relay_thread, relay) == PTHREAD_CREATE_SUCCESS;
+    if (started) {
+        active_relays++;
+    }
+    pthread_mutex_unlock(&relays_mutex);
+    pthread_attr_destroy(&attributes);
+    if (!started) {
+        log_write(LOG_LEVEL_INFO, "Relay to node %u not started, serving its client locally\n", node);
+        free(relay);
+    }
+    return started;
+}
+
+/**
+ * Waits for every relay and the ticket thread to exit after shutdown_fd fired
+ * Returns: void
+ */
+void cluster_stop() {
+    pthread_mutex_lock(&relays_mutex);
+    while (active_relays > 0) {
+        pthread_cond_wait(&relays_finished, &relays_mutex);
+    }
+    pthread_mutex_unlock(&relays_mutex);
+    if (ticket_server_started) {
+        pthread_join(ticket_server, NULL);
+        ticket_server_started = false;
+    }
+}
@@ -0,0 +1,99 @@
+// cluster.h
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CLUSTER_MAX_NODES 64
+#define CLUSTER_VIRTUAL_NODES 64 //ring points per node, evens out the share of keys each node owns
+#define CLUSTER_NODES_SIZE 4096 //longest -n node list
+#define CLUSTER_TICKET_TIMEOUT_MS 50 //a matchmaker slower than this is skipped
+#define CLUSTER_MATCHMAKER_RETRY_SECONDS 5 //front-ends place arrivals on their own this long after a miss
+#define CLUSTER_MAX_RELAYS 1024 //relay threads running at once, later owned arrivals are served locally
+
+/**
+ * Takes back a connection whose node could not be reached
+ * Args:
+ *   socketFD: Client socket, its key exchange has not started
+ * Returns:
+ *   Boolean indicating the caller took the socket, the relay closes it otherwise
+ */
+typedef bool (*ClusterFallback)(int socketFD);
+
+/**
+ * Builds the consistent hash ring of the cluster
+ * Args:
+ *   node_list: Comma separated ip:port cluster addresses, every node passes the same list in the same order
+ *   self: Index of this node in nodes
+ *   fallback: Takes a connection back when its node is down
+ *   shutdown_fd: Readable once the server stops, ends every relay
+ * Operation:
+ *   - Hashes CLUSTER_VIRTUAL_NODES points per address onto the ring
+ *   - Starts the ticket thread when this node is the matchmaker
+ * Returns:
+ *   Boolean indicating the list parsed and self is in it
+ */
+bool cluster_init(const char *node_list, unsigned int self, ClusterFallback fallback, int shutdown_fd);
+
+/**
+ * Reads the cluster port of this node
+ * Returns:
+ *   Port of this node's entry, other nodes forward their connections to it
+ */
+int cluster_self_port();
+
+/**
+ * Looks a key up on the ring
+ * Args:
+ *   key: Placement key, spread by a finalizer so sequential keys land anywhere
+ * Operation:
+ *   Binary search for the first ring point at or after the key's hash, wrapping at the end
+ * Returns:
+ *   Index of the owning node
+ */
+unsigned int cluster_owner(uint64_t key);
+
+/**
+ * Reads this node's index
+ * Returns:
+ *   The self index given to cluster_init
+ */
+unsigned int cluster_self();
+
+/**
+ * Takes the next arrival ticket of the whole cluster
+ * Args:
+ *   ticket: Receives the number of arrivals the matchmaker counted before this one
+ * Operation:
+ *   - The matchmaker is the owner of a fixed key, every front-end asks the same node
+ *   - A matchmaker that did not answer within CLUSTER_TICKET_TIMEOUT_MS is skipped
+ *     for CLUSTER_MATCHMAKER_RETRY_SECONDS
+ * Returns:
+ *   Boolean indicating a ticket was taken, the caller places the arrival on its own otherwise
+ */
+bool cluster_ticket(uint64_t *ticket);
+
+/**
+ * Relays a connection to the node owning its game
+ * Args:
+ *   socketFD: Accepted client socket before its key exchange, owned by the relay from here on
+ *   node: Target node index
+ * Operation:
+ *   - A detached thread connects to the node's cluster address and copies bytes both ways,
+ *     the key exchange and every record run end to end between the client and that node
+ *   - A node that cannot be reached hands the socket to the fallback
+ *   - Every relay holds a thread for its whole game in both connection models, at most CLUSTER_MAX_RELAYS
+ *     run at once so a front-end does not trade its reactors for thousands of pump threads
+ * Returns:
+ *   Boolean indicating the relay started, the caller keeps the socket otherwise and serves it locally
+ */
+bool cluster_forward(int socketFD, unsigned int node);
+
+/**
+ * Waits for every relay and the ticket thread to exit after shutdown_fd fired
+ * Returns: void
+ */
+void cluster_stop();
+
+#endif // CLUSTER_H
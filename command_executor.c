@@ -0,0 +1,314 @@
+/*
+ * Executes the other player's commands on a worker thread
+ * The receive thread only queues, the worker spawns and streams, and a
+ * CAN message from the other player reaches the running command through an
+ * eventfd that stream_command polls next to the output pipe
+ */
+
+#include "command_executor.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "cryptography_game_util.h"
+#include "file_decrypt.h"
+
+#define EVENTFD_ERROR -1
+#define CANCEL_SIGNAL 1
+#define PTHREAD_OK 0
+#define COMMAND_START_ERROR "failed to run command\n"
+#define DECRYPT_REQUEST_ERROR "bad decrypt request\n"
+#define DECRYPT_RESULT_SIZE 1536
+#define DECRYPT_PATH_SIZE (COMMAND_CWD_SIZE + 256)
+
+/**
+ * Frees every queued command, queue lock held
+ * Args:
+ *   executor: Executor whose queue is emptied
+ * Returns: void
+ */
+static void drop_queued_commands(CommandExecutor *executor) {
+    while (executor->count > 0) {
+        free(executor->jobs[executor->head].command);
+        executor->head = (executor->head + 1) % COMMAND_QUEUE_CAPACITY;
+        executor->count--;
+    }
+}
+
+/**
+ * Signals the running command to stop, queue lock held
+ * Args:
+ *   executor: Target executor
+ * Operation:
+ *   Only while a command runs, the worker resets the event after each one
+ * Returns: void
+ */
+static void signal_cancel(CommandExecutor *executor) {
+    if (executor->running) {
+        const uint64_t value = CANCEL_SIGNAL;
+        write(executor->cancel_event, &value, sizeof(value));
+    }
+}
+
+/**
+ * Runs one DEC request
+ * Args:
+ *   executor: Executor the request belongs to
+ *   job: Request to run, its data is split in place
+ * Operation:
+ *   - Resolves a relative path against the command working directory
+ *   - Reports the cipher that opened the file in OUT, failures and ambiguous matches in ERR
+ * Returns: void
+ */
+static void run_decrypt_job(CommandExecutor *executor, const CommandJob *job) {
+    DecryptRequest request;
+    if (!parse_decrypt_request(job->command, &request)) {
+        send_frame(executor->session, job->encoding, MESSAGE_TYPE_ERR, DECRYPT_REQUEST_ERROR,
+                   strlen(DECRYPT_REQUEST_ERROR));
+        return;
+    }
+    char path[DECRYPT_PATH_SIZE];
+    const int path_length = request.path[0] == '/'
+                                ? snprintf(path, sizeof(path), "%s", request.path)
+                                : snprintf(path, sizeof(path), "%s/%s", executor->cwd, request.path);
+    const int matched = path_length > 0 && (size_t) path_length < sizeof(path)
+                            ? decrypt_file(path, request.key, request.methods, request.method_count)
+                            : DECRYPT_FILE_ERROR;
+    char result[DECRYPT_RESULT_SIZE];
+    int result_length;
+    MessageType type = MESSAGE_TYPE_ERR;
+    if (matched >= 0) {
+        type = MESSAGE_TYPE_OUT;
+        result_length = snprintf(result, sizeof(result), "decrypted %s with %s\n", request.path,
+                                 request.methods[matched]);
+    } else if (matched == DECRYPT_NO_MATCH) {
+        result_length = snprintf(result, sizeof(result), "%s: wrong key or method\n", request.path);
+    } else if (matched == DECRYPT_AMBIGUOUS) {
+        result_length = snprintf(result, sizeof(result), "%s: several methods fit, left untouched, pick one\n",
+                                 request.path);
+    } else {
+        result_length = snprintf(result, sizeof(result), "%s: cannot decrypt this file\n", request.path);
+    }
+    if (result_length > 0) {
+        send_frame(executor->session, job->encoding, type, result,
+                   (size_t) result_length < sizeof(result) ? (size_t) result_length : sizeof(result) - 1);
+    }
+}
+
+/**
+ * Runs one command
+ * Args:
+ *   executor: Executor the command belongs to
+ *   job: Command to run
+ * Returns: void
+ */
+static void run_job(CommandExecutor *executor, const CommandJob *job) {
+    if (job->decrypt) {
+        run_decrypt_job(executor, job);
+        return;
+    }
+    if (job->streaming) {
+        if (!stream_command(&executor->shell, job->command, executor->session, job->encoding, executor->cwd,
+                            sizeof(executor->cwd), executor->cancel_event, COMMAND_TIMEOUT_MS)) {
+            send_frame(executor->session, job->encoding, MESSAGE_TYPE_ERR, COMMAND_START_ERROR,
+                       strlen(COMMAND_START_ERROR));
+        }
+        return;
+    }
+    // Only reachable before AEAD records, handle_server_hello never accepts them without streaming
+    execute_command_and_send(job->command, job->length + NULL_CHAR_LEN, crypto_session_socket(executor->session),
+                             crypto_session_key(executor->session), executor->cwd, sizeof(executor->cwd));
+}
+
+/**
+ * Worker thread body
+ * Args:
+ *   arg: The CommandExecutor
+ * Operation:
+ *   Takes commands in arrival order until the executor stops
+ * Returns: NULL
+ */
+static void *executor_worker(void *arg) {
+    CommandExecutor *executor = arg;
+    pthread_mutex_lock(&executor->queue_mutex);
+    while (true) {
+        while (executor->count == 0 && !executor->stopping) {
+            pthread_cond_wait(&executor->queue_not_empty, &executor->queue_mutex);
+        }
+        if (executor->stopping) {
+            break;
+        }
+        const CommandJob job = executor->jobs[executor->head];
+        executor->head = (executor->head + 1) % COMMAND_QUEUE_CAPACITY;
+        executor->count--;
+        executor->running = true;
+        pthread_mutex_unlock(&executor->queue_mutex);
+        run_job(executor, &job);
+        free(job.command);
+        pthread_mutex_lock(&executor->queue_mutex);
+        executor->running = false;
+        // A cancel aimed at this command must not stop the next one
+        uint64_t value;
+        read(executor->cancel_event, &value, sizeof(value));
+    }
+    pthread_mutex_unlock(&executor->queue_mutex);
+    return NULL;
+}
+
+/**
+ * Starts the worker
+ * Args:
+ *   executor: Executor to initialize
+ *   session: Server connection for command output
+ *   cwd: Directory the first command runs in
+ * Returns:
+ *   Boolean indicating success
+ */
+bool command_executor_init(CommandExecutor *executor, CryptoSession *session, const char *cwd) {
+    memset(executor, 0, sizeof(CommandExecutor));
+    executor->session = session;
+    strncpy(executor->cwd, cwd, sizeof(executor->cwd) - NULL_CHAR_LEN);
+    shell_session_init(&executor->shell);
+    // Non-blocking so the worker can reset it whether or not a cancel came in
+    executor->cancel_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (executor->cancel_event == EVENTFD_ERROR) {
+        return false;
+    }
+    pthread_mutex_init(&executor->queue_mutex, NULL);
+    pthread_cond_init(&executor->queue_not_empty, NULL);
+    if (pthread_create(&executor->worker, NULL, executor_worker, executor) != PTHREAD_OK) {
+        pthread_mutex_destroy(&executor->queue_mutex);
+        pthread_cond_destroy(&executor->queue_not_empty);
+        close(executor->cancel_event);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Copies a job into the ring
+ * Args:
+ *   executor: Target executor
+ *   command: Job data, copied
+ *   length: Data length
+ *   streaming: Send the output as OFR fragments
+ *   decrypt: Data is a DEC request
+ *   encoding: Framing negotiated with the server
+ * Returns:
+ *   false if the queue is full or the copy failed
+ */
+static bool queue_job(CommandExecutor *executor, const char *command, const size_t length, const bool streaming,
+                      const bool decrypt, const FrameEncoding encoding) {
+    char *copy = malloc(length + NULL_CHAR_LEN);
+    if (copy == NULL) {
+        return false;
+    }
+    memcpy(copy, command, length);
+    copy[length] = '\0';
+    pthread_mutex_lock(&executor->queue_mutex);
+    const bool queued = executor->count < COMMAND_QUEUE_CAPACITY && !executor->stopping;
+    if (queued) {
+        CommandJob *job = &executor->jobs[(executor->head + executor->count) % COMMAND_QUEUE_CAPACITY];
+        job->command = copy;
+        job->length = length;
+        job->streaming = streaming;
+        job->decrypt = decrypt;
+        job->encoding = encoding;
+        executor->count++;
+        pthread_cond_signal(&executor->queue_not_empty);
+    }
+    pthread_mutex_unlock(&executor->queue_mutex);
+    if (!queued) {
+        free(copy);
+    }
+    return queued;
+}
+
+/**
+ * Queues a command
+ * Args:
+ *   executor: Target executor
+ *   command: Command bytes, copied
+ *   length: Command length
+ *   streaming: Send the output as OFR fragments
+ *   encoding: Framing negotiated with the server
+ * Operation:
+ *   Never waits for a running command
+ * Returns:
+ *   false if the queue is full or the copy failed
+ */
+bool command_executor_submit(CommandExecutor *executor, const char *command, const size_t length,
+                             const bool streaming, const FrameEncoding encoding) {
+    return queue_job(executor, command, length, streaming, false, encoding);
+}
+
+/**
+ * Queues a DEC request
+ * Args:
+ *   executor: Target executor
+ *   request: DEC message data, copied
+ *   length: Data length
+ *   encoding: Framing negotiated with the server
+ * Operation:
+ *   - Runs in order with the commands, so relative paths follow an earlier cd
+ *   - The result goes back as one OUT or ERR message
+ * Returns:
+ *   false if the queue is full or the copy failed
+ */
+bool command_executor_submit_decrypt(CommandExecutor *executor, const char *request, const size_t length,
+                                     const FrameEncoding encoding) {
+    return queue_job(executor, request, length, false, true, encoding);
+}
+
+/**
+ * Cancels the running command and drops the queued ones
+ * Args:
+ *   executor: Target executor
+ * Operation:
+ *   - Takes the queue lock and leaves the kill to the worker, for CAN handling, teardown uses command_executor_kill
+ *   - Commands run through execute_command_and_send cannot be interrupted
+ * Returns: void
+ */
+void command_executor_cancel(CommandExecutor *executor) {
+    pthread_mutex_lock(&executor->queue_mutex);
+    drop_queued_commands(executor);
+    signal_cancel(executor);
+    pthread_mutex_unlock(&executor->queue_mutex);
+}
+
+/**
+ * Kills the worker shell and everything it started from any thread
+ * Args:
+ *   executor: Executor being torn down
+ * Operation:
+ *   - Takes no lock, the worker may hold the queue lock or be gone already
+ *   - Sends SIGKILL to the shell's process group and waits for the shell, later streamed commands fail to start
+ *   - Commands run through execute_command_and_send are not in that group and keep running
+ * Returns: void
+ */
+void command_executor_kill(CommandExecutor *executor) {
+    shell_session_kill(&executor->shell);
+}
+
+/**
+ * Stops the worker and frees the queue
+ * Args:
+ *   executor: Executor to destroy
+ * Operation:
+ *   Cancels the running command first, so this does not wait for it to finish, then kills the worker shell
+ * Returns: void
+ */
+void command_executor_destroy(CommandExecutor *executor) {
+    pthread_mutex_lock(&executor->queue_mutex);
+    executor->stopping = true;
+    drop_queued_commands(executor);
+    signal_cancel(executor);
+    pthread_cond_broadcast(&executor->queue_not_empty);
+    pthread_mutex_unlock(&executor->queue_mutex);
+    pthread_join(executor->worker, NULL);
+    shell_session_close(&executor->shell);
+    pthread_mutex_destroy(&executor->queue_mutex);
+    pthread_cond_destroy(&executor->queue_not_empty);
+    close(executor->cancel_event);
+}
@@ -0,0 +1,144 @@
+// command_executor.h
+#ifndef COMMAND_EXECUTOR_H
+#define COMMAND_EXECUTOR_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "message_frame.h"
+#include "command_stream.h"
+
+#define COMMAND_QUEUE_CAPACITY 16 //commands waiting behind the running one
+#define COMMAND_TIMEOUT_MS 60000 //a streamed command is killed after running this long
+#define COMMAND_CWD_SIZE 1024
+
+/**
+ * One received command waiting to run
+ * Components:
+ *   command: NUL terminated copy of the CMD data, owned by the queue
+ *   length: Command length without the terminator
+ *   streaming: Output goes out as OFR fragments, otherwise through execute_command_and_send
+ *   decrypt: command holds DEC data and runs through decrypt_file instead of a shell
+ *   encoding: Framing negotiated with the server when the command arrived
+ */
+typedef struct {
+    char *command;
+    size_t length;
+    bool streaming;
+    bool decrypt;
+    FrameEncoding encoding;
+} CommandJob;
+
+/**
+ * Runs the other player's commands off the receive thread
+ * Components:
+ *   session: Server connection the output is sent on
+ *   cwd: Directory the worker shell is in, only the worker touches it
+ *   shell: Long-lived shell the streamed commands run in, other threads only reach it through command_executor_kill
+ *   jobs: Ring of queued commands
+ *   head: Oldest queued command
+ *   count: Queued commands
+ *   running: The worker is executing a command
+ *   stopping: The worker exits once set
+ *   cancel_event: eventfd that is readable while the running command should stop
+ *   queue_mutex: Guards the ring, running, stopping and writes to cancel_event
+ *   queue_not_empty: Signaled when a command is queued or the executor stops
+ *   worker: Thread executing the commands
+ * Operation:
+ *   - One worker runs the commands in arrival order, a cd still carries on
+ *     to the next command and OFR streams never interleave
+ *   - The receive thread only copies the command into the ring, so WIN/LOSE
+ *     and disconnects are handled however long a command runs
+ */
+typedef struct {
+    CryptoSession *session;
+    char cwd[COMMAND_CWD_SIZE];
+    ShellSession shell;
+    CommandJob jobs[COMMAND_QUEUE_CAPACITY];
+    unsigned int head;
+    unsigned int count;
+    bool running;
+    bool stopping;
+    int cancel_event;
+    pthread_mutex_t queue_mutex;
+    pthread_cond_t queue_not_empty;
+    pthread_t worker;
+} CommandExecutor;
+
+/**
+ * Starts the worker
+ * Args:
+ *   executor: Executor to initialize
+ *   session: Server connection for command output
+ *   cwd: Directory the first command runs in
+ * Returns:
+ *   Boolean indicating success
+ */
+bool command_executor_init(CommandExecutor *executor, CryptoSession *session, const char *cwd);
+
+/**
+ * Queues a command
+ * Args:
+ *   executor: Target executor
+ *   command: Command bytes, copied
+ *   length: Command length
+ *   streaming: Send the output as OFR fragments
+ *   encoding: Framing negotiated with the server
+ * Operation:
+ *   Never waits for a running command
+ * Returns:
+ *   false if the queue is full or the copy failed
+ */
+bool command_executor_submit(CommandExecutor *executor, const char *command, size_t length, bool streaming,
+                             FrameEncoding encoding);
+
+/**
+ * Queues a DEC request
+ * Args:
+ *   executor: Target executor
+ *   request: DEC message data, copied
+ *   length: Data length
+ *   encoding: Framing negotiated with the server
+ * Operation:
+ *   - Runs in order with the commands, so relative paths follow an earlier cd
+ *   - The result goes back as one OUT or ERR message
+ * Returns:
+ *   false if the queue is full or the copy failed
+ */
+bool command_executor_submit_decrypt(CommandExecutor *executor, const char *request, size_t length,
+                                     FrameEncoding encoding);
+
+/**
+ * Cancels the running command and drops the queued ones
+ * Args:
+ *   executor: Target executor
+ * Operation:
+ *   - Takes the queue lock and leaves the kill to the worker, for CAN handling, teardown uses command_executor_kill
+ *   - Commands run through execute_command_and_send cannot be interrupted
+ * Returns: void
+ */
+void command_executor_cancel(CommandExecutor *executor);
+
+/**
+ * Kills the worker shell and everything it started from any thread
+ * Args:
+ *   executor: Executor being torn down
+ * Operation:
+ *   - Takes no lock, the worker may hold the queue lock or be gone already
+ *   - Sends SIGKILL to the shell's process group and waits for the shell, later streamed commands fail to start
+ *   - Commands run through execute_command_and_send are not in that group and keep running
+ * Returns: void
+ */
+void command_executor_kill(CommandExecutor *executor);
+
+/**
+ * Stops the worker and frees the queue
+ * Args:
+ *   executor: Executor to destroy
+ * Operation:
+ *   Cancels the running command first, so this does not wait for it to finish, then kills the worker shell
+ * Returns: void
+ */
+void command_executor_destroy(CommandExecutor *executor);
+
+#endif // COMMAND_EXECUTOR_H
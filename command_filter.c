@@ -0,0 +1,439 @@
+/*
+ * Allow/ban filter for relayed commands and setup directories
+ * The rules of the -c file compile into one Aho-Corasick DFA over byte classes, every state knows the longest
+ * ban and the longest allow text ending in it, so a check keeps a single pending ban start and decides in one pass
+ * Verdicts, the util library checks included, are cached in a lock-free table keyed by a seeded hash
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/rand.h>
+#include "cryptography_game_util.h"
+#include "command_filter.h"
+
+#define BYTE_VALUES 256
+#define OTHER_BYTES_CLASS 0 //bytes no rule uses, they all lead to the same states
+#define ROOT_STATE 0u
+#define NO_STATE UINT32_MAX //edge not in the trie yet, memset 0xff fills it
+#define NO_PENDING SIZE_MAX
+#define BAN_KEYWORD "ban "
+#define ALLOW_KEYWORD "allow "
+#define COMMENT_CHAR '#'
+#define LINE_END "\r\n"
+#define OPENSSL_OK 1
+#define CACHE_VERDICT 0x1u //cached answer bit
+#define CACHE_FILLED 0x2u //set in every written entry, an all zero entry matches no hash
+#define CACHE_FLAG_BITS 0x3u
+#define CACHE_SLOT_SHIFT 32 //slot from the high half, the tag keeps the rest
+#define HASH_WORD_SIZE 8
+#define HASH_LENGTH_MULTIPLIER 0x9e3779b97f4a7c15ull
+
+/**
+ * Kinds of cached verdicts, each hashes with its own seed
+ */
+typedef enum {
+    VERDICT_COMMAND, //command_filter_allows
+    VERDICT_BANNED, //command_filter_banned
+    VERDICT_KINDS
+} VerdictKind;
+
+/**
+ * One line of the rule file
+ * Components:
+ *   text: Bytes to match, not NUL terminated
+ *   length: Number of bytes
+ *   allow: Allow rule, a ban rule otherwise
+ */
+typedef struct {
+    char text[COMMAND_FILTER_RULE_SIZE];
+    size_t length;
+    bool allow;
+} Rule;
+
+/**
+ * Compiled rules, immutable once built
+ * Components:
+ *   next: Complete transition table, state * class_count + class
+ *   ban_length: Longest ban text ending in a state, 0 for none
+ *   allow_length: Longest allow text ending in a state, 0 for none
+ *   classes: Byte to class map
+ *   class_count: Distinct rule bytes plus OTHER_BYTES_CLASS
+ *   state_count: Trie nodes
+ *   longest_allow: Longest allow text, a ban no allow can reach back to is final
+ */
+typedef struct {
+    uint32_t *next;
+    uint16_t *ban_length;
+    uint16_t *allow_length;
+    uint16_t classes[BYTE_VALUES];
+    unsigned int class_count;
+    unsigned int state_count;
+    size_t longest_allow;
+} Automaton;
+
+/**
+ * Decides one text without the cache
+ */
+typedef bool (*Verdict)(const char *data, size_t length);
+
+static Automaton *automaton = NULL; //NULL without rules, set once before the first check
+static uint64_t seeds[VERDICT_KINDS]; //random per run, cache keys cannot be aimed at from outside
+static atomic_uint_fast64_t verdict_cache[COMMAND_FILTER_CACHE_SLOTS]; //tag bits | CACHE_FILLED | CACHE_VERDICT
+
+/**
+ * Frees an automaton and its tables
+ * Args:
+ *   compiled: Automaton to free, may be NULL
+ * Returns: void
+ */
+static void free_automaton(Automaton *compiled) {
+    if (compiled == NULL) {
+        return;
+    }
+    free(compiled->next);
+    free(compiled->ban_length);
+    free(compiled->allow_length);
+    free(compiled);
+}
+
+/**
+ * Parses one rule line
+ * Args:
+ *   line: NUL terminated line without its line end
+ *   rule: Receives the rule
+ * Returns:
+ *   Boolean indicating a ban or allow keyword followed by some text
+ */
+static bool parse_rule(const char *line, Rule *rule) {
+    const char *text;
+    if (strncmp(line, BAN_KEYWORD, strlen(BAN_KEYWORD)) == 0) {
+        text = line + strlen(BAN_KEYWORD);
+        rule->allow = false;
+    } else if (strncmp(line, ALLOW_KEYWORD, strlen(ALLOW_KEYWORD)) == 0) {
+        text = line + strlen(ALLOW_KEYWORD);
+        rule->allow = true;
+    } else {
+        return false;
+    }
+    rule->length = strlen(text);
+    memcpy(rule->text, text, rule->length);
+    return rule->length > 0;
+}
+
+/**
+ * Adds failure transitions, turning the trie into a complete DFA
+ * Args:
+ *   compiled: Automaton whose trie edges are set and whose other edges are NO_STATE
+ * Operation:
+ *   - Breadth first, a state's failure target is shallower and already complete
+ *   - Missing edges take the failure target's edge, ban and allow lengths take the longer of both
+ * Returns:
+ *   Boolean indicating the work queue could be allocated
+ */
+static bool link_failures(Automaton *compiled) {
+    uint32_t *queue = malloc(compiled->state_count * sizeof(uint32_t));
+    uint32_t *failure = malloc(compiled->state_count * sizeof(uint32_t));
+    if (queue == NULL || failure == NULL) {
+        free(queue);
+        free(failure);
+        return false;
+    }
+    const unsigned int classes = compiled->class_count;
+    size_t head = 0;
+    size_t tail = 0;
+    for (unsigned int c = 0; c < classes; c++) {
+        uint32_t *edge = &compiled->next[ROOT_STATE * classes + c];
+        if (*edge == NO_STATE) {
+            *edge = ROOT_STATE;
+        } else {
+            failure[*edge] = ROOT_STATE;
+            queue[tail++] = *edge;
+        }
+    }
+    while (head < tail) {
+        const uint32_t state = queue[head++];
+        for (unsigned int c = 0; c < classes; c++) {
+            uint32_t *edge = &compiled->next[state * classes + c];
+            const uint32_t fallback = compiled->next[failure[state] * classes + c];
+            if (*edge == NO_STATE) {
+                *edge = fallback;
+                continue;
+            }
+            const uint32_t child = *edge;
+            failure[child] = fallback;
+            if (compiled->ban_length[fallback] > compiled->ban_length[child]) {
+                compiled->ban_length[child] = compiled->ban_length[fallback];
+            }
+            if (compiled->allow_length[fallback] > compiled->allow_length[child]) {
+                compiled->allow_length[child] = compiled->allow_length[fallback];
+            }
+            queue[tail++] = child;
+        }
+    }
+    free(queue);
+    free(failure);
+    return true;
+}
+
+/**
+ * Builds the automaton of a rule set
+ * Args:
+ *   rules: Parsed rules
+ *   count: Number of rules
+ * Operation:
+ *   - Bytes no rule uses share one class, the table is state_count * class_count wide
+ *   - Inserts every rule into a trie, then completes it with failure transitions
+ * Returns:
+ *   The automaton, NULL when the rules need more than COMMAND_FILTER_MAX_STATES states or memory ran out
+ */
+static Automaton *build_automaton(const Rule *rules, const size_t count) {
+    Automaton *compiled = calloc(1, sizeof(Automaton));
+    if (compiled == NULL) {
+        return NULL;
+    }
+    compiled->class_count = OTHER_BYTES_CLASS + 1;
+    size_t max_states = ROOT_STATE + 1;
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < rules[i].length; j++) {
+            uint16_t *class = &compiled->classes[(unsigned char) rules[i].text[j]];
+            if (*class == OTHER_BYTES_CLASS) {
+                *class = (uint16_t) compiled->class_count++;
+            }
+        }
+        max_states += rules[i].length;
+    }
+    if (max_states > COMMAND_FILTER_MAX_STATES) {
+        free_automaton(compiled);
+        return NULL;
+    }
+    compiled->next = malloc(max_states * compiled->class_count * sizeof(uint32_t));
+    compiled->ban_length = calloc(max_states, sizeof(uint16_t));
+    compiled->allow_length = calloc(max_states, sizeof(uint16_t));
+    if (compiled->next == NULL || compiled->ban_length == NULL || compiled->allow_length == NULL) {
+        free_automaton(compiled);
+        return NULL;
+    }
+    memset(compiled->next, 0xff, max_states * compiled->class_count * sizeof(uint32_t));
+    compiled->state_count = ROOT_STATE + 1;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t state = ROOT_STATE;
+        for (size_t j = 0; j < rules[i].length; j++) {
+            uint32_t *edge = &compiled->next[state * compiled->class_count +
+                                             compiled->classes[(unsigned char) rules[i].text[j]]];
+            if (*edge == NO_STATE) {
+                *edge = compiled->state_count++;
+            }
+            state = *edge;
+        }
+        uint16_t *length = rules[i].allow ? &compiled->allow_length[state] : &compiled->ban_length[state];
+        if (rules[i].length > *length) {
+            *length = (uint16_t) rules[i].length;
+        }
+        if (rules[i].allow && rules[i].length > compiled->longest_allow) {
+            compiled->longest_allow = rules[i].length;
+        }
+    }
+    if (!link_failures(compiled)) {
+        free_automaton(compiled);
+        return NULL;
+    }
+    return compiled;
+}
+
+/**
+ * Runs the loaded rules over a text
+ * Args:
+ *   data: Text to check
+ *   length: Text bytes
+ * Operation:
+ *   - Tracks the earliest start of a ban match no allow match covers yet
+ *   - An allow match starting at or before it covers every pending ban, they all end by now
+ *   - The pending ban is final once no allow text could reach back to it from a later byte
+ * Returns:
+ *   Boolean indicating an uncovered ban match
+ */
+static bool rules_refuse(const char *data, const size_t length) {
+    const Automaton *compiled = automaton;
+    if (compiled == NULL) {
+        return false;
+    }
+    uint32_t state = ROOT_STATE;
+    size_t pending = NO_PENDING;
+    for (size_t i = 0; i < length; i++) {
+        state = compiled->next[state * compiled->class_count + compiled->classes[(unsigned char) data[i]]];
+        const size_t ban = compiled->ban_length[state];
+        if (ban > 0 && (pending == NO_PENDING || i + 1 - ban < pending)) {
+            pending = i + 1 - ban;
+        }
+        const size_t allow = compiled->allow_length[state];
+        if (pending != NO_PENDING && allow > 0 && i + 1 - allow <= pending) {
+            pending = NO_PENDING;
+        }
+        if (pending != NO_PENDING && i + 2 - pending > compiled->longest_allow) {
+            return true;
+        }
+    }
+    return pending != NO_PENDING;
+}
+
+/**
+ * splitmix64 finalizer
+ */
+static uint64_t mix_hash(uint64_t hash) {
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ull;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebull;
+    return hash ^ (hash >> 31);
+}
+
+/**
+ * Hashes a text eight bytes at a time
+ * Args:
+ *   seed: Per kind seed
+ *   data: Text to hash
+ *   length: Text bytes
+ * Returns:
+ *   64 bit hash
+ */
+static uint64_t hash_text(const uint64_t seed, const char *data, const size_t length) {
+    uint64_t hash = seed ^ (length * HASH_LENGTH_MULTIPLIER);
+    size_t i = 0;
+    for (; i + HASH_WORD_SIZE <= length; i += HASH_WORD_SIZE) {
+        uint64_t word;
+        memcpy(&word, data + i, HASH_WORD_SIZE);
+        hash = mix_hash(hash ^ word);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, length - i);
+    return mix_hash(hash ^ tail);
+}
+
+/**
+ * Looks a verdict up in the cache, deciding and storing it on a miss
+ * Args:
+ *   kind: Verdict kind, picks the seed
+ *   data: Text to decide
+ *   length: Text bytes
+ *   verdict: Decides the text on a miss
+ * Operation:
+ *   One relaxed 64 bit slot per entry, a racing writer only replaces a verdict with another correct one
+ * Returns:
+ *   The verdict
+ */
+static bool cached_verdict(const VerdictKind kind, const char *data, const size_t length, const Verdict verdict) {
+    const uint64_t hash = hash_text(seeds[kind], data, length);
+    atomic_uint_fast64_t *slot = &verdict_cache[(hash >> CACHE_SLOT_SHIFT) & (COMMAND_FILTER_CACHE_SLOTS - 1)];
+    const uint64_t tag = (hash & ~(uint64_t) CACHE_FLAG_BITS) | CACHE_FILLED;
+    const uint64_t entry = atomic_load_explicit(slot, memory_order_relaxed);
+    if ((entry & ~(uint64_t) CACHE_VERDICT) == tag) {
+        return entry & CACHE_VERDICT;
+    }
+    const bool result = verdict(data, length);
+    atomic_store_explicit(slot, tag | (result ? CACHE_VERDICT : 0), memory_order_relaxed);
+    return result;
+}
+
+/**
+ * Decides a command without the cache
+ */
+static bool command_accepted(const char *data, const size_t length) {
+    return check_command_data(data) && !rules_refuse(data, length);
+}
+
+/**
+ * Decides a setup directory without the cache
+ */
+static bool text_banned(const char *data, const size_t length) {
+    return contains_banned_word(data) || rules_refuse(data, length);
+}
+
+/**
+ * Compiles a rule file into the filter automaton
+ * Args:
+ *   path: Rule file, one "ban <text>" or "allow <text>" per line, # comments and blank lines skipped,
+ *         NULL to only cache the util library checks
+ * Operation:
+ *   - Seeds the verdict cache, call once at startup before any check runs, with or without rules
+ *   - A command is refused when it contains a ban text that no allow text around it covers
+ *   - Builds one Aho-Corasick DFA over every rule, so a check is one pass whatever the rule count
+ * Returns:
+ *   Boolean indicating the cache is seeded and, with a path, the file was read and every line is a rule
+ */
+bool command_filter_load(const char *path) {
+    if (RAND_bytes((unsigned char *) seeds, sizeof(seeds)) != OPENSSL_OK) {
+        return false;
+    }
+    if (path == NULL) {
+        return true;
+    }
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    Rule *rules = malloc(COMMAND_FILTER_MAX_RULES * sizeof(Rule));
+    size_t count = 0;
+    bool ok = rules != NULL;
+    // Room for a full rule, its line end and the NUL
+    char line[COMMAND_FILTER_RULE_SIZE + sizeof(LINE_END)];
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        const size_t length = strcspn(line, LINE_END);
+        if (line[length] == '\0' && !feof(file)) {
+            ok = false;
+            break;
+        }
+        line[length] = '\0';
+        if (length == 0 || line[0] == COMMENT_CHAR) {
+            continue;
+        }
+        ok = count < COMMAND_FILTER_MAX_RULES && parse_rule(line, &rules[count++]);
+    }
+    fclose(file);
+    if (ok) {
+        automaton = build_automaton(rules, count);
+        ok = automaton != NULL;
+    }
+    free(rules);
+    return ok;
+}
+
+/**
+ * Checks CMD data before it is relayed
+ * Args:
+ *   data: Command text, NUL terminated at length like the receive buffer
+ *   length: Command bytes
+ * Operation:
+ *   - check_command_data from the util library and the loaded rules must both accept it
+ *   - Verdicts are cached by a seeded hash of the data, a repeated command skips both scans
+ * Returns:
+ *   Boolean indicating the command may be relayed
+ */
+bool command_filter_allows(const char *data, const size_t length) {
+    return cached_verdict(VERDICT_COMMAND, data, length, command_accepted);
+}
+
+/**
+ * Checks a setup directory a client answered with
+ * Args:
+ *   data: Directory text, NUL terminated at length
+ *   length: Text bytes
+ * Operation:
+ *   contains_banned_word from the util library or the loaded rules refusing it, cached like commands
+ * Returns:
+ *   Boolean indicating the text is banned
+ */
+bool command_filter_banned(const char *data, const size_t length) {
+    return cached_verdict(VERDICT_BANNED, data, length, text_banned);
+}
+
+/**
+ * Frees the automaton loaded at startup
+ * Returns: void
+ */
+void command_filter_free() {
+    free_automaton(automaton);
+    automaton = NULL;
+}
@@ -0,0 +1,58 @@
+// command_filter.h
+#ifndef COMMAND_FILTER_H
+#define COMMAND_FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define COMMAND_FILTER_MAX_RULES 4096
+#define COMMAND_FILTER_RULE_SIZE 256 //longest rule line, keyword included
+#define COMMAND_FILTER_MAX_STATES 16384 //automaton states, roughly the rule bytes
+#define COMMAND_FILTER_CACHE_SLOTS 4096 //cached verdicts, power of two
+
+/**
+ * Compiles a rule file into the filter automaton
+ * Args:
+ *   path: Rule file, one "ban <text>" or "allow <text>" per line, # comments and blank lines skipped,
+ *         NULL to only cache the util library checks
+ * Operation:
+ *   - Seeds the verdict cache, call once at startup before any check runs, with or without rules
+ *   - A command is refused when it contains a ban text that no allow text around it covers
+ *   - Builds one Aho-Corasick DFA over every rule, so a check is one pass whatever the rule count
+ * Returns:
+ *   Boolean indicating the cache is seeded and, with a path, the file was read and every line is a rule
+ */
+bool command_filter_load(const char *path);
+
+/**
+ * Checks CMD data before it is relayed
+ * Args:
+ *   data: Command text, NUL terminated at length like the receive buffer
+ *   length: Command bytes
+ * Operation:
+ *   - check_command_data from the util library and the loaded rules must both accept it
+ *   - Verdicts are cached by a seeded hash of the data, a repeated command skips both scans
+ * Returns:
+ *   Boolean indicating the command may be relayed
+ */
+bool command_filter_allows(const char *data, size_t length);
+
+/**
+ * Checks a setup directory a client answered with
+ * Args:
+ *   data: Directory text, NUL terminated at length
+ *   length: Text bytes
+ * Operation:
+ *   contains_banned_word from the util library or the loaded rules refusing it, cached like commands
+ * Returns:
+ *   Boolean indicating the text is banned
+ */
+bool command_filter_banned(const char *data, size_t length);
+
+/**
+ * Frees the automaton loaded at startup
+ * Returns: void
+ */
+void command_filter_free();
+
+#endif // COMMAND_FILTER_H
@@ -0,0 +1,543 @@
+/*
+ * Streams the output of a remote player's command back through the server
+ * Commands run in one long-lived shell per executor, so a short command costs
+ * a pipe write instead of a shell start. Its output is forwarded chunk by
+ * chunk as OFR fragments, and the shell reports its directory on a control
+ * pipe once the command is done. Every wait also watches a cancel descriptor
+ * and a deadline, so a hung command is killed instead of holding the executor
+ */
+
+#define _GNU_SOURCE
+
+#include "command_stream.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "cryptography_game_util.h"
+
+#define PIPE_READ 0
+#define PIPE_WRITE 1
+#define PIPE_ERROR -1
+#define POLL_ERROR -1
+#define NO_CANCEL_FD -1
+#define NO_TIMEOUT 0
+#define POLL_WAIT_FOREVER -1
+#define SPAWN_OK 0
+#define OWN_PROCESS_GROUP 0
+#define CWD_FD 3
+#define SHELL_PATH "/bin/sh"
+#define PATH_MAX_LENGTH 1024
+#define MS_PER_SECOND 1000
+#define NS_PER_MS 1000000
+#define WAIT_POLL_COUNT 3
+#define OUTPUT_POLL_INDEX 0
+#define CONTROL_POLL_INDEX 1
+#define CANCEL_POLL_INDEX 2
+#define WRITE_ERROR -1
+#define CLOSED_FD -1
+#define SHELL_START_ATTEMPTS 2 //a shell that exited since the last command is replaced once
+#define TRAILING_OUTPUT_LIMIT 65536 //one pipe's worth, everything the command wrote before its directory
+#define CANCEL_NOTICE "\n[command cancelled]\n"
+#define TIMEOUT_NOTICE "\n[command timed out]\n"
+#define SHELL_QUOTE '\''
+#define QUOTED_QUOTE "'\\''"
+#define QUOTED_QUOTE_LENGTH 4
+#define QUOTE_OVERHEAD 2
+// Runs $1 with stdin on /dev/null and the control pipe closed, then reports the directory on it
+// command eval keeps a syntax error from ending the shell
+#define SHELL_PRELUDE "__cg_run() { command eval \"$1\" </dev/null 3>&-; printf '%s\\n' \"$PWD\" >&3; }\n"
+#define SHELL_CD "cd -- %s\n"
+#define SHELL_RUN "__cg_run %s\n"
+
+/**
+ * Outcome of a command in the worker shell
+ */
+typedef enum {
+    STREAM_DONE, //the shell reported its directory
+    STREAM_EXITED, //the shell exited, the command ran exit or exec
+    STREAM_CANCELLED, //the cancel descriptor fired
+    STREAM_TIMED_OUT, //the deadline passed
+    STREAM_FAILED //poll failed
+} StreamWait;
+
+/**
+ * Reads from a descriptor, retrying interrupted reads
+ * Args:
+ *   fd: Descriptor to read
+ *   buffer: Destination
+ *   size: Maximum bytes
+ * Returns:
+ *   Bytes read, 0 at end of file, -1 on error
+ */
+static ssize_t read_retry(const int fd, char *buffer, const size_t size) {
+    ssize_t amount;
+    do {
+        amount = read(fd, buffer, size);
+    } while (amount < 0 && errno == EINTR);
+    return amount;
+}
+
+/**
+ * Milliseconds left until a deadline
+ * Args:
+ *   deadline: CLOCK_MONOTONIC deadline, NULL for none
+ * Returns:
+ *   Remaining milliseconds for poll, 0 once passed, POLL_WAIT_FOREVER without a deadline
+ */
+static int remaining_ms(const struct timespec *deadline) {
+    if (deadline == NULL) {
+        return POLL_WAIT_FOREVER;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const long long left = (long long) (deadline->tv_sec - now.tv_sec) * MS_PER_SECOND +
+                           (deadline->tv_nsec - now.tv_nsec) / NS_PER_MS;
+    return left > 0 ? (int) left : 0;
+}
+
+/**
+ * Writes a whole buffer, retrying interrupted and short writes
+ * Args:
+ *   fd: Descriptor to write
+ *   data: Bytes to write
+ *   length: Number of bytes
+ * Returns:
+ *   Boolean indicating everything was written
+ */
+static bool write_all(const int fd, const char *data, size_t length) {
+    while (length > 0) {
+        const ssize_t amount = write(fd, data, length);
+        if (amount == WRITE_ERROR) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += amount;
+        length -= (size_t) amount;
+    }
+    return true;
+}
+
+/**
+ * Quotes text for the shell
+ * Args:
+ *   text: Text to quote
+ * Operation:
+ *   Single quotes, with every ' written as '\\'', so the shell reads the text back verbatim
+ * Returns:
+ *   Allocated quoted copy, NULL on allocation failure
+ */
+static char *quote_shell(const char *text) {
+    size_t quotes = 0;
+    for (const char *c = text; *c != '\0'; c++) {
+        quotes += *c == SHELL_QUOTE;
+    }
+    char *quoted = malloc(strlen(text) + quotes * (QUOTED_QUOTE_LENGTH - 1) + QUOTE_OVERHEAD + NULL_CHAR_LEN);
+    if (quoted == NULL) {
+        return NULL;
+    }
+    char *out = quoted;
+    *out++ = SHELL_QUOTE;
+    for (const char *c = text; *c != '\0'; c++) {
+        if (*c == SHELL_QUOTE) {
+            memcpy(out, QUOTED_QUOTE, QUOTED_QUOTE_LENGTH);
+            out += QUOTED_QUOTE_LENGTH;
+        } else {
+            *out++ = *c;
+        }
+    }
+    *out++ = SHELL_QUOTE;
+    *out = '\0';
+    return quoted;
+}
+
+/**
+ * Writes one line of shell input with a quoted argument
+ * Args:
+ *   shell: Running shell
+ *   format: Line format with a single %s for the argument
+ *   argument: Text passed quoted
+ * Returns:
+ *   Boolean indicating the shell took the line
+ */
+static bool write_shell_line(const ShellSession *shell, const char *format, const char *argument) {
+    char *quoted = quote_shell(argument);
+    if (quoted == NULL) {
+        return false;
+    }
+    const size_t size = strlen(format) + strlen(quoted) + NULL_CHAR_LEN;
+    char *line = malloc(size);
+    bool written = false;
+    if (line != NULL) {
+        const int length = snprintf(line, size, format, quoted);
+        written = length > 0 && write_all(shell->input_fd, line, (size_t) length);
+        free(line);
+    }
+    free(quoted);
+    return written;
+}
+
+/**
+ * Spawns the worker shell
+ * Args:
+ *   input_fd: Read end for the shell's stdin
+ *   output_fd: Write end for stdout and stderr
+ *   control_fd: Write end the shell reports its directory on
+ *   child: Receives the shell's pid, also its process group
+ * Operation:
+ *   posix_spawn, so the client's address space is never copied, with
+ *   default signal dispositions, the shell reads its commands from stdin
+ * Returns:
+ *   Boolean indicating the shell started
+ */
+static bool spawn_shell(const int input_fd, const int output_fd, const int control_fd, pid_t *child) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attributes;
+    if (posix_spawn_file_actions_init(&actions) != SPAWN_OK) {
+        return false;
+    }
+    if (posix_spawnattr_init(&attributes) != SPAWN_OK) {
+        posix_spawn_file_actions_destroy(&actions);
+        return false;
+    }
+    sigset_t no_signals;
+    sigset_t default_signals;
+    sigemptyset(&no_signals);
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGPIPE);
+    // The pipes are O_CLOEXEC, only the duplicated descriptors reach the shell
+    posix_spawn_file_actions_adddup2(&actions, input_fd, STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, output_fd, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, output_fd, STDERR_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, control_fd, CWD_FD);
+    // Own process group, so cancelling also reaches whatever the command started
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setpgroup(&attributes, OWN_PROCESS_GROUP);
+    posix_spawnattr_setsigmask(&attributes, &no_signals);
+    posix_spawnattr_setsigdefault(&attributes, &default_signals);
+    char *const arguments[] = {SHELL_PATH, "-s", NULL};
+    const int result = posix_spawn(child, SHELL_PATH, &actions, &attributes, arguments, environ);
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&actions);
+    return result == SPAWN_OK;
+}
+
+/**
+ * Marks a shell session as not started
+ * Args:
+ *   shell: Session to initialize
+ * Returns: void
+ */
+void shell_session_init(ShellSession *shell) {
+    shell->pid = SHELL_NOT_RUNNING;
+    shell->input_fd = CLOSED_FD;
+    shell->output_fd = CLOSED_FD;
+    shell->control_fd = CLOSED_FD;
+}
+
+/**
+ * Kills the shell and everything it started
+ * Args:
+ *   shell: Session to close, may already be closed
+ * Returns: void
+ */
+void shell_session_close(ShellSession *shell) {
+    pid_t pid = atomic_load(&shell->pid);
+    if (pid == SHELL_NOT_RUNNING) {
+        return;
+    }
+    // After shell_session_kill the pid is gone but the pipes are still open
+    if (pid != SHELL_KILLED && atomic_compare_exchange_strong(&shell->pid, &pid, SHELL_NOT_RUNNING)) {
+        kill(-pid, SIGKILL);
+    }
+    if (shell->input_fd != CLOSED_FD) {
+        close(shell->input_fd);
+        close(shell->output_fd);
+        close(shell->control_fd);
+        shell->input_fd = CLOSED_FD;
+        shell->output_fd = CLOSED_FD;
+        shell->control_fd = CLOSED_FD;
+    }
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+}
+
+/**
+ * Kills the shell and everything it started from any thread
+ * Args:
+ *   shell: Session another thread runs commands in
+ * Operation:
+ *   - Takes no lock and leaves the pipes to the owning thread, whose next read or write sees the shell gone
+ *   - Waits until the shell is reaped, no shell is started in this session afterwards
+ * Returns: void
+ */
+void shell_session_kill(ShellSession *shell) {
+    const pid_t pid = atomic_exchange(&shell->pid, SHELL_KILLED);
+    if (pid > 0) {
+        kill(-pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+}
+
+/**
+ * Starts the worker shell in a directory
+ * Args:
+ *   shell: Session that is not running
+ *   cwd: Directory to start in
+ * Operation:
+ *   Defines the command wrapper and changes into cwd before the first command arrives
+ * Returns:
+ *   Boolean indicating the shell is ready
+ */
+static bool shell_session_start(ShellSession *shell, const char *cwd) {
+    int input_pipe[2];
+    int output_pipe[2];
+    int control_pipe[2];
+    if (pipe2(input_pipe, O_CLOEXEC) == PIPE_ERROR) {
+        return false;
+    }
+    if (pipe2(output_pipe, O_CLOEXEC) == PIPE_ERROR) {
+        close(input_pipe[PIPE_READ]);
+        close(input_pipe[PIPE_WRITE]);
+        return false;
+    }
+    if (pipe2(control_pipe, O_CLOEXEC) == PIPE_ERROR) {
+        close(input_pipe[PIPE_READ]);
+        close(input_pipe[PIPE_WRITE]);
+        close(output_pipe[PIPE_READ]);
+        close(output_pipe[PIPE_WRITE]);
+        return false;
+    }
+    pid_t child;
+    const bool spawned = spawn_shell(input_pipe[PIPE_READ], output_pipe[PIPE_WRITE], control_pipe[PIPE_WRITE], &child);
+    close(input_pipe[PIPE_READ]);
+    close(output_pipe[PIPE_WRITE]);
+    close(control_pipe[PIPE_WRITE]);
+    if (!spawned) {
+        close(input_pipe[PIPE_WRITE]);
+        close(output_pipe[PIPE_READ]);
+        close(control_pipe[PIPE_READ]);
+        return false;
+    }
+    // Output left behind by background jobs is drained without waiting for them
+    fcntl(output_pipe[PIPE_READ], F_SETFL, fcntl(output_pipe[PIPE_READ], F_GETFL) | O_NONBLOCK);
+    shell->input_fd = input_pipe[PIPE_WRITE];
+    shell->output_fd = output_pipe[PIPE_READ];
+    shell->control_fd = control_pipe[PIPE_READ];
+    // A kill that came in while spawning wins, the new shell goes straight away
+    pid_t expected = SHELL_NOT_RUNNING;
+    if (!atomic_compare_exchange_strong(&shell->pid, &expected, child)) {
+        kill(-child, SIGKILL);
+        waitpid(child, NULL, 0);
+        shell_session_close(shell);
+        return false;
+    }
+    if (!write_all(shell->input_fd, SHELL_PRELUDE, strlen(SHELL_PRELUDE)) ||
+        !write_shell_line(shell, SHELL_CD, cwd)) {
+        shell_session_close(shell);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Hands a command to the worker shell
+ * Args:
+ *   shell: Worker shell, started when not running
+ *   command: Shell command
+ *   cwd: Directory a new shell starts in
+ * Operation:
+ *   A shell that exited after the previous command is replaced, the write then fails with EPIPE,
+ *   a killed session takes no command anymore
+ * Returns:
+ *   Boolean indicating the shell took the command
+ */
+static bool submit_to_shell(ShellSession *shell, const char *command, const char *cwd) {
+    for (int attempt = 0; attempt < SHELL_START_ATTEMPTS; attempt++) {
+        if (atomic_load(&shell->pid) == SHELL_KILLED) {
+            return false;
+        }
+        if (shell->pid == SHELL_NOT_RUNNING && !shell_session_start(shell, cwd)) {
+            return false;
+        }
+        if (write_shell_line(shell, SHELL_RUN, command)) {
+            return true;
+        }
+        shell_session_close(shell);
+    }
+    return false;
+}
+
+/**
+ * Sends one OFR fragment whose chunk already sits after the header space
+ * Args:
+ *   fragment: OUTPUT_FRAGMENT_HEADER_SIZE header bytes followed by the chunk
+ *   chunk_length: Bytes of output in the fragment
+ *   sequence: Position in the stream
+ *   final: Last fragment of the stream
+ * Returns: void
+ */
+static void send_output_fragment(CryptoSession *session, const FrameEncoding encoding, char *fragment,
+                                 const size_t chunk_length, const uint32_t sequence, const bool final) {
+    write_output_fragment_header(fragment, sequence, final);
+    send_frame(session, encoding, MESSAGE_TYPE_OFR, fragment, OUTPUT_FRAGMENT_HEADER_SIZE + chunk_length);
+}
+
+/**
+ * Forwards what the output pipe holds right now
+ * Args:
+ *   shell: Worker shell
+ *   fragment: Fragment buffer with header space
+ *   sequence: Next fragment position, advanced per fragment
+ *   limit: Most bytes to forward
+ * Returns:
+ *   Boolean indicating the pipe is still open
+ */
+static bool forward_output(const ShellSession *shell, CryptoSession *session, const FrameEncoding encoding,
+                           char *fragment, uint32_t *sequence, const size_t limit) {
+    size_t forwarded = 0;
+    while (forwarded < limit) {
+        const ssize_t amount = read_retry(shell->output_fd, fragment + OUTPUT_FRAGMENT_HEADER_SIZE,
+                                          OUTPUT_CHUNK_SIZE);
+        if (amount <= 0) {
+            // EAGAIN means drained, 0 that no process holds the write end anymore
+            return amount < 0;
+        }
+        send_output_fragment(session, encoding, fragment, (size_t) amount, (*sequence)++, false);
+        forwarded += (size_t) amount;
+    }
+    return true;
+}
+
+/**
+ * Forwards output until the shell reports the command's directory
+ * Args:
+ *   shell: Worker shell running the command
+ *   fragment: Fragment buffer with header space
+ *   sequence: Next fragment position, advanced per fragment
+ *   new_cwd: Receives the reported directory line
+ *   cwd_size: Size of new_cwd
+ *   cancel_fd: Cancel descriptor, NO_CANCEL_FD for none
+ *   deadline: CLOCK_MONOTONIC deadline, NULL for none
+ * Returns:
+ *   Why the command ended, cancellation wins over pending output
+ */
+static StreamWait wait_for_command(const ShellSession *shell, CryptoSession *session, const FrameEncoding encoding,
+                                   char *fragment, uint32_t *sequence, char *new_cwd, const size_t cwd_size,
+                                   const int cancel_fd, const struct timespec *deadline) {
+    struct pollfd waits[WAIT_POLL_COUNT] = {
+        [OUTPUT_POLL_INDEX] = {.fd = shell->output_fd, .events = POLLIN},
+        [CONTROL_POLL_INDEX] = {.fd = shell->control_fd, .events = POLLIN},
+        [CANCEL_POLL_INDEX] = {.fd = cancel_fd, .events = POLLIN}
+    };
+    const nfds_t count = cancel_fd == NO_CANCEL_FD ? WAIT_POLL_COUNT - 1 : WAIT_POLL_COUNT;
+    size_t cwd_length = 0;
+    while (true) {
+        const int timeout = remaining_ms(deadline);
+        if (timeout == 0) {
+            return STREAM_TIMED_OUT;
+        }
+        const int ready = poll(waits, count, timeout);
+        if (ready == POLL_ERROR) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return STREAM_FAILED;
+        }
+        if (count == WAIT_POLL_COUNT && waits[CANCEL_POLL_INDEX].revents) {
+            return STREAM_CANCELLED;
+        }
+        if (waits[OUTPUT_POLL_INDEX].revents &&
+            !forward_output(shell, session, encoding, fragment, sequence, OUTPUT_CHUNK_SIZE)) {
+            waits[OUTPUT_POLL_INDEX].fd = CLOSED_FD; // poll skips negative descriptors
+        }
+        if (waits[CONTROL_POLL_INDEX].revents) {
+            const ssize_t amount = read_retry(shell->control_fd, new_cwd + cwd_length,
+                                              cwd_size - NULL_CHAR_LEN - cwd_length);
+            if (amount <= 0) {
+                return STREAM_EXITED;
+            }
+            cwd_length += (size_t) amount;
+            new_cwd[cwd_length] = '\0';
+            if (memchr(new_cwd, '\n', cwd_length) != NULL || cwd_length == cwd_size - NULL_CHAR_LEN) {
+                return STREAM_DONE;
+            }
+        }
+    }
+}
+
+/**
+ * Runs a command and streams its output to the server
+ * Args:
+ *   shell: Worker shell, started on first use
+ *   command: Shell command received from the other player
+ *   session: Server connection
+ *   encoding: Framing negotiated with the server
+ *   cwd: Directory the shell starts in, updated to the directory the command ended in
+ *   cwd_size: Size of cwd
+ *   cancel_fd: Descriptor that becomes readable to cancel the command, -1 for none
+ *   timeout_ms: Milliseconds the command may run, 0 for no limit
+ * Operation:
+ *   - Writes the command to the worker shell, its stdin stays /dev/null
+ *   - Sends every read of at most OUTPUT_CHUNK_SIZE bytes as a sequenced OFR
+ *     fragment, so memory stays constant and output shows up while it runs
+ *   - The command has ended when the shell reports its directory on the control pipe
+ *   - Kills the shell's process group when cancelled or out of time and says so in the output
+ *   - Terminates the stream with an empty final fragment
+ *   - Sends a CWD message when the working directory changed
+ * Returns:
+ *   Boolean indicating the command could be started
+ */
+bool stream_command(ShellSession *shell, const char *command, CryptoSession *session, const FrameEncoding encoding,
+                    char *cwd, const size_t cwd_size, const int cancel_fd, const int timeout_ms) {
+    if (!submit_to_shell(shell, command, cwd)) {
+        return false;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / MS_PER_SECOND;
+    deadline.tv_nsec += (long) (timeout_ms % MS_PER_SECOND) * NS_PER_MS;
+    if (deadline.tv_nsec >= (long) MS_PER_SECOND * NS_PER_MS) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= (long) MS_PER_SECOND * NS_PER_MS;
+    }
+    const struct timespec *limit = timeout_ms > NO_TIMEOUT ? &deadline : NULL;
+    // Header space in front of the chunk so fragments go out without copying
+    char fragment[OUTPUT_FRAGMENT_HEADER_SIZE + OUTPUT_CHUNK_SIZE];
+    uint32_t sequence = 0;
+    char new_cwd[PATH_MAX_LENGTH] = {0};
+    const StreamWait state = wait_for_command(shell, session, encoding, fragment, &sequence, new_cwd,
+                                              sizeof(new_cwd), cancel_fd, limit);
+    if (state == STREAM_DONE || state == STREAM_EXITED) {
+        // The shell wrote the directory after the command's output, so that output is already in the pipe
+        forward_output(shell, session, encoding, fragment, &sequence, TRAILING_OUTPUT_LIMIT);
+    }
+    if (state != STREAM_DONE) {
+        // Whatever the command left running goes with the shell, the next command starts a new one in cwd
+        shell_session_close(shell);
+    }
+    if (state == STREAM_CANCELLED || state == STREAM_TIMED_OUT) {
+        const char *notice = state == STREAM_TIMED_OUT ? TIMEOUT_NOTICE : CANCEL_NOTICE;
+        memcpy(fragment + OUTPUT_FRAGMENT_HEADER_SIZE, notice, strlen(notice));
+        send_output_fragment(session, encoding, fragment, strlen(notice), sequence++, false);
+    }
+    send_output_fragment(session, encoding, fragment, 0, sequence, true);
+    size_t cwd_length = state == STREAM_DONE ? strcspn(new_cwd, "\n") : 0;
+    new_cwd[cwd_length] = '\0';
+    // The other player's directory label only needs a message when it changes
+    if (cwd_length > 0 && cwd_length < cwd_size && strcmp(new_cwd, cwd) != 0) {
+        memcpy(cwd, new_cwd, cwd_length + NULL_CHAR_LEN);
+        send_frame(session, encoding, MESSAGE_TYPE_CWD, cwd, strlen(cwd));
+    }
+    return true;
+}
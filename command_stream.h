@@ -0,0 +1,87 @@
+// command_stream.h
+#ifndef COMMAND_STREAM_H
+#define COMMAND_STREAM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "message_frame.h"
+
+#define OUTPUT_CHUNK_SIZE 1024 //output bytes per OFR fragment
+#define SHELL_NOT_RUNNING -1
+#define SHELL_KILLED -2 //shell_session_kill ran, no shell starts anymore
+
+/**
+ * Long-lived shell the streamed commands run in
+ * Components:
+ *   pid: Shell process and process group, SHELL_NOT_RUNNING until the first command, whoever swaps it out
+ *        kills and reaps the shell, so shell_session_kill can take it from another thread
+ *   input_fd: Write end of the shell's stdin, commands are written here
+ *   output_fd: Non-blocking read end of the merged stdout and stderr
+ *   control_fd: Read end the shell prints its directory on after each command
+ * Operation:
+ *   - cd, variables and functions carry on to the next command like in a terminal,
+ *     and cd or pwd never start a process
+ *   - Started again in the last known directory after exit, a cancel or a timeout
+ */
+typedef struct {
+    _Atomic pid_t pid;
+    int input_fd;
+    int output_fd;
+    int control_fd;
+} ShellSession;
+
+/**
+ * Marks a shell session as not started
+ * Args:
+ *   shell: Session to initialize
+ * Returns: void
+ */
+void shell_session_init(ShellSession *shell);
+
+/**
+ * Kills the shell and everything it started
+ * Args:
+ *   shell: Session to close, may already be closed
+ * Returns: void
+ */
+void shell_session_close(ShellSession *shell);
+
+/**
+ * Kills the shell and everything it started from any thread
+ * Args:
+ *   shell: Session another thread runs commands in
+ * Operation:
+ *   - Takes no lock and leaves the pipes to the owning thread, whose next read or write sees the shell gone
+ *   - Waits until the shell is reaped, no shell is started in this session afterwards
+ * Returns: void
+ */
+void shell_session_kill(ShellSession *shell);
+
+/**
+ * Runs a command and streams its output to the server
+ * Args:
+ *   shell: Worker shell, started on first use
+ *   command: Shell command received from the other player
+ *   session: Server connection
+ *   encoding: Framing negotiated with the server
+ *   cwd: Directory the shell starts in, updated to the directory the command ended in
+ *   cwd_size: Size of cwd
+ *   cancel_fd: Descriptor that becomes readable to cancel the command, -1 for none
+ *   timeout_ms: Milliseconds the command may run, 0 for no limit
+ * Operation:
+ *   - Writes the command to the worker shell, its stdin stays /dev/null
+ *   - Sends every read of at most OUTPUT_CHUNK_SIZE bytes as a sequenced OFR
+ *     fragment, so memory stays constant and output shows up while it runs
+ *   - The command has ended when the shell reports its directory on the control pipe
+ *   - Kills the shell's process group when cancelled or out of time and says so in the output
+ *   - Terminates the stream with an empty final fragment
+ *   - Sends a CWD message when the working directory changed
+ * Returns:
+ *   Boolean indicating the command could be started
+ */
+bool stream_command(ShellSession *shell, const char *command, CryptoSession *session, FrameEncoding encoding,
+                    char *cwd, size_t cwd_size, int cancel_fd, int timeout_ms);
+
+#endif // COMMAND_STREAM_H
@@ -0,0 +1,1193 @@
+/*
+ * Persistent per-connection encryption
+ * The exchange key is turned into two AES-256-GCM keys once, their contexts
+ * are kept for the lifetime of the connection and only the nonce changes per
+ * message, so no allocation or key schedule happens on the send/recv path
+ * Record layout: 4 byte big endian ciphertext length, ciphertext, 16 byte tag
+ * The length header is authenticated as additional data
+ * Messages can also be queued without touching the socket, whoever flushes
+ * next seals every queued message into one buffer and writes it at once
+ * Once streams are on, every record starts with a 4 byte big endian stream
+ * id inside the ciphertext, so several logical sessions share one socket,
+ * one key exchange and one pair of cipher contexts
+ * A non-blocking session never waits on the socket for sealed records: bytes
+ * the peer did not take yet stay in the wire buffer, partial records collect
+ * in an inbox, and the caller's event loop decides when to try again
+ */
+
+#include "crypto_session.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include "cryptography_game_util.h"
+
+#define AEAD_KEY_SIZE 32
+#define DERIVED_KEYS_SIZE (2 * AEAD_KEY_SIZE)
+#define CLIENT_TO_SERVER_KEY 0
+#define SERVER_TO_CLIENT_KEY AEAD_KEY_SIZE
+#define HKDF_INFO "cryptography_game aead v1"
+#define RECORD_HEADER_SIZE 4
+#define NONCE_COUNTER_OFFSET 4
+#define SEND_CHUNK_SIZE 4096
+#define BYTE_BITS 8
+#define BYTE_MASK 0xFFu
+#define SOCKET_ERROR -1
+#define OPENSSL_OK 1
+#define QUEUE_ENTRY_HEADER_SIZE (2 * sizeof(uint32_t)) //native length, then the stream id
+#define QUEUE_ENTRY_STREAM_OFFSET sizeof(uint32_t)
+#define RECORD_OVERHEAD (RECORD_HEADER_SIZE + CRYPTO_SESSION_TAG_SIZE)
+#define INITIAL_QUEUE_CAPACITY 4096
+#define GROWTH_FACTOR 2
+#define NS_PER_SEC 1000000000ull
+#define TIMING_OFF 0 //timing_now result without a hook
+#define NO_STREAM_HEADER 0 //stream_header result while streams are off
+#define LAST_REFERENCE 1
+#define RECORD_PEER_CLOSED -2 //recv_record result when the peer closed before a record started
+#define INBOX_READ_SIZE 16384 //bytes one session_recv_fill asks the socket for
+
+struct CryptoSession {
+    int socketFD;
+    unsigned char key[CRYPTO_SESSION_MAX_KEY_SIZE]; //exchange key for s_send/s_recv
+    EVP_CIPHER_CTX *send_ctx; //keyed once, IV reset per record
+    EVP_CIPHER_CTX *recv_ctx; //keyed once, IV reset per record
+    uint64_t send_counter; //records sent since sealing
+    uint64_t recv_counter; //records received since sealing
+    bool send_sealed; //send direction uses AEAD records
+    bool recv_sealed; //receive direction uses AEAD records
+    pthread_mutex_t send_mutex; //one writer on the socket at a time
+    pthread_mutex_t queue_mutex; //guards pending, never held across a syscall
+    char *pending; //queued messages, each behind a native uint32_t length
+    size_t pending_length; //bytes used in pending
+    size_t pending_capacity; //bytes allocated for pending
+    char *draining; //previous pending buffer, swapped back in by the flusher
+    size_t draining_capacity; //bytes allocated for draining
+    unsigned char *wire; //sealed records of one flush, written with a single send
+    size_t wire_capacity; //bytes allocated for wire
+    size_t wire_length; //bytes used in wire, non-zero between flushes only on a non-blocking session
+    size_t wire_sent; //bytes of wire already written
+    bool nonblocking; //sealed traffic uses MSG_DONTWAIT, the caller polls for the socket instead
+    bool failed; //a send failed, the peer is gone or stopped reading
+    unsigned char *inbox; //received bytes of records not opened yet, non-blocking sessions only
+    size_t inbox_start; //first byte of inbox not opened yet
+    size_t inbox_length; //bytes used in inbox
+    size_t inbox_capacity; //bytes allocated for inbox
+    CryptoSession *root; //owner of the socket, ciphers and queue, itself unless opened as a stream
+    uint32_t stream; //id written in front of this session's records once streams are on
+    bool streams; //root only, sealed records carry a stream header
+    bool owns_socket; //root only, socketFD is a duplicate closed with the last reference
+    atomic_uint references; //root only, its own plus one per open stream
+};
+
+static CryptoTimingHook timing_hook = NULL; //set once before the first session, read on every record
+
+/**
+ * Installs the process wide timing hook
+ * Args:
+ *   hook: Called after every sealed or opened record, NULL turns timing off
+ * Operation:
+ *   Without a hook the record path reads no clock, call before any session exists
+ * Returns: void
+ */
+void crypto_session_set_timing_hook(const CryptoTimingHook hook) {
+    timing_hook = hook;
+}
+
+/**
+ * Reads the clock for record timing
+ * Returns:
+ *   CLOCK_MONOTONIC nanoseconds, TIMING_OFF without a hook
+ */
+static uint64_t timing_now() {
+    if (timing_hook == NULL) {
+        return TIMING_OFF;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * NS_PER_SEC + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * Reports one record operation to the hook
+ * Args:
+ *   timing: Operation
+ *   started: timing_now value from its start
+ *   excluded: Nanoseconds spent in socket I/O meanwhile
+ * Returns: void
+ */
+static void report_timing(const CryptoTiming timing, const uint64_t started, const uint64_t excluded) {
+    if (timing_hook != NULL && started != TIMING_OFF) {
+        timing_hook(timing, timing_now() - started - excluded);
+    }
+}
+
+/**
+ * Derives the two direction keys
+ * Args:
+ *   key: Exchange key
+ *   key_length: Exchange key size
+ *   derived: Receives DERIVED_KEYS_SIZE bytes
+ * Returns:
+ *   Boolean indicating success
+ */
+static bool derive_keys(const unsigned char *key, const size_t key_length, unsigned char *derived) {
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    size_t derived_length = DERIVED_KEYS_SIZE;
+    const bool ok = ctx != NULL &&
+                    EVP_PKEY_derive_init(ctx) == OPENSSL_OK &&
+                    EVP_PKEY_CTX_set_hkdf_md(ctx, EVP_sha256()) == OPENSSL_OK &&
+                    EVP_PKEY_CTX_set1_hkdf_key(ctx, key, (int) key_length) == OPENSSL_OK &&
+                    EVP_PKEY_CTX_add1_hkdf_info(ctx, (const unsigned char *) HKDF_INFO,
+                                                (int) (sizeof(HKDF_INFO) - 1)) == OPENSSL_OK &&
+                    EVP_PKEY_derive(ctx, derived, &derived_length) == OPENSSL_OK &&
+                    derived_length == DERIVED_KEYS_SIZE;
+    EVP_PKEY_CTX_free(ctx);
+    return ok;
+}
+
+/**
+ * Creates the session right after the key exchange
+ * Args:
+ *   socketFD: Connected socket
+ *   key: Key returned by recv_send_key/send_recv_key, copied
+ *   key_length: Key size in bytes
+ *   role: Which end of the connection this is
+ * Operation:
+ *   - Derives one key per direction with HKDF-SHA256
+ *   - Runs the AES-256-GCM key schedule once for each direction
+ * Returns:
+ *   New session or NULL on failure
+ */
+CryptoSession *crypto_session_create(const int socketFD, const unsigned char *key, const size_t key_length,
+                                     const CryptoRole role) {
+    if (key == NULL || key_length == 0 || key_length > CRYPTO_SESSION_MAX_KEY_SIZE) {
+        return NULL;
+    }
+    CryptoSession *session = calloc(1, sizeof(CryptoSession));
+    if (session == NULL) {
+        return NULL;
+    }
+    session->socketFD = socketFD;
+    session->root = session;
+    atomic_init(&session->references, LAST_REFERENCE);
+    memcpy(session->key, key, key_length);
+    pthread_mutex_init(&session->send_mutex, NULL);
+    pthread_mutex_init(&session->queue_mutex, NULL);
+    unsigned char derived[DERIVED_KEYS_SIZE];
+    const size_t send_offset = role == CRYPTO_ROLE_CLIENT ? CLIENT_TO_SERVER_KEY : SERVER_TO_CLIENT_KEY;
+    const size_t recv_offset = role == CRYPTO_ROLE_CLIENT ? SERVER_TO_CLIENT_KEY : CLIENT_TO_SERVER_KEY;
+    session->send_ctx = EVP_CIPHER_CTX_new();
+    session->recv_ctx = EVP_CIPHER_CTX_new();
+    const bool ok = session->send_ctx != NULL && session->recv_ctx != NULL &&
+                    derive_keys(key, key_length, derived) &&
+                    EVP_EncryptInit_ex(session->send_ctx, EVP_aes_256_gcm(), NULL, derived + send_offset, NULL) ==
+                    OPENSSL_OK &&
+                    EVP_DecryptInit_ex(session->recv_ctx, EVP_aes_256_gcm(), NULL, derived + recv_offset, NULL) ==
+                    OPENSSL_OK;
+    OPENSSL_cleanse(derived, sizeof(derived));
+    if (!ok) {
+        crypto_session_destroy(session);
+        return NULL;
+    }
+    return session;
+}
+
+/**
+ * Frees the session and wipes its keys
+ * Args:
+ *   session: Session to destroy, may be NULL
+ * Operation:
+ *   - A stream only drops its reference on the root
+ *   - The root is freed with its last reference, closing its socket if it owns it
+ * Returns: void
+ */
+void crypto_session_destroy(CryptoSession *session) {
+    if (session == NULL) {
+        return;
+    }
+    CryptoSession *root = session->root;
+    if (session != root) {
+        free(session);
+    }
+    if (atomic_fetch_sub(&root->references, 1) != LAST_REFERENCE) {
+        return;
+    }
+    if (root->owns_socket) {
+        close(root->socketFD);
+    }
+    EVP_CIPHER_CTX_free(root->send_ctx);
+    EVP_CIPHER_CTX_free(root->recv_ctx);
+    pthread_mutex_destroy(&root->send_mutex);
+    pthread_mutex_destroy(&root->queue_mutex);
+    free(root->pending);
+    free(root->draining);
+    free(root->wire);
+    if (root->inbox != NULL) {
+        OPENSSL_cleanse(root->inbox, root->inbox_capacity);
+        free(root->inbox);
+    }
+    OPENSSL_cleanse(root->key, sizeof(root->key));
+    free(root);
+}
+
+/**
+ * Turns on stream headers for every sealed record
+ * Args:
+ *   session: Session before its send direction is sealed
+ *   own_socket: Move to a duplicate of the socket that is closed with the last reference
+ * Operation:
+ *   - Changes state under the send lock, senders see it together with the seal
+ *   - Records sent on the session itself carry CRYPTO_SESSION_PRIMARY_STREAM
+ *   - With own_socket the original descriptor may be closed while streams still send
+ * Returns:
+ *   Boolean indicating streams are on
+ */
+bool crypto_session_enable_streams(CryptoSession *session, const bool own_socket) {
+    CryptoSession *root = session->root;
+    pthread_mutex_lock(&root->send_mutex);
+    if (own_socket && !root->owns_socket) {
+        const int duplicate = dup(root->socketFD);
+        if (duplicate == SOCKET_ERROR) {
+            pthread_mutex_unlock(&root->send_mutex);
+            return false;
+        }
+        root->socketFD = duplicate;
+        root->owns_socket = true;
+    }
+    root->streams = true;
+    pthread_mutex_unlock(&root->send_mutex);
+    return true;
+}
+
+/**
+ * Opens one more logical session on a connection with streams on
+ * Args:
+ *   session: Any session of the connection
+ *   stream: Stream id its records carry
+ * Operation:
+ *   Shares socket, ciphers, send lock and queue with the root and holds a reference on it
+ * Returns:
+ *   Stream session or NULL on failure
+ */
+CryptoSession *crypto_session_open_stream(CryptoSession *session, const uint32_t stream) {
+    CryptoSession *root = session->root;
+    if (!root->streams) {
+        return NULL;
+    }
+    CryptoSession *opened = calloc(1, sizeof(CryptoSession));
+    if (opened == NULL) {
+        return NULL;
+    }
+    opened->root = root;
+    opened->stream = stream;
+    opened->socketFD = root->socketFD;
+    memcpy(opened->key, root->key, sizeof(opened->key));
+    atomic_fetch_add(&root->references, 1);
+    return opened;
+}
+
+/**
+ * Takes another reference on a session's connection
+ * Args:
+ *   session: Any session of the connection
+ * Operation:
+ *   Released with crypto_session_destroy on the returned root
+ * Returns:
+ *   Root session
+ */
+CryptoSession *crypto_session_retain(CryptoSession *session) {
+    CryptoSession *root = session->root;
+    atomic_fetch_add(&root->references, 1);
+    return root;
+}
+
+/**
+ * Moves the sealed traffic of a connection off blocking socket calls
+ * Args:
+ *   session: Any session of the connection
+ * Operation:
+ *   - Sealed sends write what the socket takes and keep the rest for session_write_backlog
+ *   - Sealed records are read with session_recv_fill and session_recv_buffered
+ *   - The descriptor itself stays blocking, s_send and s_recv before the seal keep their socket timeouts
+ * Returns: void
+ */
+void crypto_session_set_nonblocking(CryptoSession *session) {
+    CryptoSession *root = session->root;
+    pthread_mutex_lock(&root->send_mutex);
+    root->nonblocking = true;
+    pthread_mutex_unlock(&root->send_mutex);
+}
+
+/**
+ * Returns the socket a session sends on
+ * Args:
+ *   session: Session
+ * Returns:
+ *   Socket file descriptor
+ */
+int crypto_session_socket(const CryptoSession *session) {
+    return session->root->socketFD;
+}
+
+/**
+ * Returns the exchanged key for util calls that take it directly
+ * Args:
+ *   session: Session
+ * Operation:
+ *   Only valid for plaintext s_send traffic, sealed directions ignore it
+ * Returns:
+ *   Key passed to crypto_session_create
+ */
+const unsigned char *crypto_session_key(const CryptoSession *session) {
+    return session->key;
+}
+
+/**
+ * Builds the nonce of a record
+ * Args:
+ *   nonce: Receives CRYPTO_SESSION_NONCE_SIZE bytes
+ *   counter: Record number in its direction
+ * Returns: void
+ */
+static void build_nonce(unsigned char *nonce, uint64_t counter) {
+    memset(nonce, 0, CRYPTO_SESSION_NONCE_SIZE);
+    for (unsigned int i = CRYPTO_SESSION_NONCE_SIZE; i > NONCE_COUNTER_OFFSET; i--) {
+        nonce[i - 1] = (unsigned char) (counter & BYTE_MASK);
+        counter >>= BYTE_BITS;
+    }
+}
+
+/**
+ * Writes a whole buffer
+ * Args:
+ *   socketFD: Destination socket
+ *   buffer: Bytes to write
+ *   length: Number of bytes
+ * Returns:
+ *   Boolean indicating everything was written
+ */
+static bool send_all(const int socketFD, const unsigned char *buffer, size_t length) {
+    while (length > 0) {
+        const ssize_t sent = send(socketFD, buffer, length, MSG_NOSIGNAL);
+        if (sent == SOCKET_ERROR && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        buffer += sent;
+        length -= (size_t) sent;
+    }
+    return true;
+}
+
+/**
+ * Reads a whole buffer
+ * Args:
+ *   socketFD: Source socket
+ *   buffer: Destination
+ *   length: Number of bytes
+ * Returns:
+ *   length on success, 0 if the peer closed first, -1 on error
+ */
+static ssize_t recv_all(const int socketFD, unsigned char *buffer, const size_t length) {
+    size_t received = 0;
+    while (received < length) {
+        const ssize_t amount = recv(socketFD, buffer + received, length - received, 0);
+        if (amount == SOCKET_ERROR && errno == EINTR) {
+            continue;
+        }
+        if (amount <= 0) {
+            return amount;
+        }
+        received += (size_t) amount;
+    }
+    return (ssize_t) received;
+}
+
+/**
+ * Writes the unsent part of the wire buffer, send lock held
+ * Args:
+ *   session: Root session
+ * Operation:
+ *   - Blocking sessions write everything
+ *   - Non-blocking sessions stop when the socket is full and keep the rest,
+ *     more than CRYPTO_SESSION_BACKLOG_LIMIT unsent bytes count as a failed peer
+ *   - A failure marks the session failed
+ * Returns:
+ *   Boolean indicating nothing failed
+ */
+static bool write_wire(CryptoSession *session) {
+    bool ok = true;
+    if (!session->nonblocking) {
+        ok = send_all(session->socketFD, session->wire + session->wire_sent,
+                      session->wire_length - session->wire_sent);
+        session->wire_sent = session->wire_length;
+    }
+    while (ok && session->wire_sent < session->wire_length) {
+        const ssize_t sent = send(session->socketFD, session->wire + session->wire_sent,
+                                  session->wire_length - session->wire_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent == SOCKET_ERROR && errno == EINTR) {
+            continue;
+        }
+        if (sent == SOCKET_ERROR && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            ok = session->wire_length - session->wire_sent <= CRYPTO_SESSION_BACKLOG_LIMIT;
+            break;
+        }
+        if (sent <= 0) {
+            ok = false;
+            break;
+        }
+        session->wire_sent += (size_t) sent;
+    }
+    if (session->wire_sent == session->wire_length) {
+        session->wire_sent = 0;
+        session->wire_length = 0;
+    }
+    if (!ok) {
+        session->failed = true;
+    }
+    return ok;
+}
+
+/**
+ * Builds the stream header of a record, send lock held
+ * Args:
+ *   root: Root session
+ *   stream: Stream the record belongs to
+ *   header: Receives up to CRYPTO_SESSION_STREAM_HEADER_SIZE bytes
+ * Returns:
+ *   Header length, NO_STREAM_HEADER while streams are off
+ */
+static size_t stream_header(const CryptoSession *root, const uint32_t stream, unsigned char *header) {
+    if (!root->streams) {
+        return NO_STREAM_HEADER;
+    }
+    for (unsigned int i = 0; i < CRYPTO_SESSION_STREAM_HEADER_SIZE; i++) {
+        header[i] = (unsigned char) (stream >> (BYTE_BITS * (CRYPTO_SESSION_STREAM_HEADER_SIZE - 1 - i)) & BYTE_MASK);
+    }
+    return CRYPTO_SESSION_STREAM_HEADER_SIZE;
+}
+
+/**
+ * Encrypts and sends one record, send lock held
+ * Args:
+ *   session: Sealed root session
+ *   prefix: Stream header encrypted in front of the plaintext
+ *   prefix_length: Bytes of prefix, NO_STREAM_HEADER for none
+ *   buffer: Plaintext
+ *   length: Plaintext length
+ * Operation:
+ *   Encrypts through a fixed stack chunk, small messages leave in one send
+ * Returns:
+ *   Boolean indicating the record was sent
+ */
+static bool send_record(CryptoSession *session, const unsigned char *prefix, const size_t prefix_length,
+                        const char *buffer, const size_t length) {
+    unsigned char nonce[CRYPTO_SESSION_NONCE_SIZE];
+    unsigned char chunk[RECORD_HEADER_SIZE + CRYPTO_SESSION_STREAM_HEADER_SIZE + SEND_CHUNK_SIZE +
+                        CRYPTO_SESSION_TAG_SIZE];
+    const size_t record_length = prefix_length + length;
+    if (length > UINT32_MAX - prefix_length) {
+        return false;
+    }
+    for (unsigned int i = 0; i < RECORD_HEADER_SIZE; i++) {
+        chunk[i] = (unsigned char) (record_length >> (BYTE_BITS * (RECORD_HEADER_SIZE - 1 - i)) & BYTE_MASK);
+    }
+    const uint64_t started = timing_now();
+    uint64_t excluded = 0;
+    build_nonce(nonce, session->send_counter++);
+    int out_length = 0;
+    if (EVP_EncryptInit_ex(session->send_ctx, NULL, NULL, NULL, nonce) != OPENSSL_OK ||
+        EVP_EncryptUpdate(session->send_ctx, NULL, &out_length, chunk, RECORD_HEADER_SIZE) != OPENSSL_OK) {
+        return false;
+    }
+    size_t used = RECORD_HEADER_SIZE;
+    if (prefix_length > 0) {
+        if (EVP_EncryptUpdate(session->send_ctx, chunk + used, &out_length, prefix, (int) prefix_length) !=
+            OPENSSL_OK) {
+            return false;
+        }
+        used += (size_t) out_length;
+    }
+    size_t offset = 0;
+    while (offset < length) {
+        const size_t piece = length - offset < SEND_CHUNK_SIZE ? length - offset : SEND_CHUNK_SIZE;
+        if (used + piece > RECORD_HEADER_SIZE + CRYPTO_SESSION_STREAM_HEADER_SIZE + SEND_CHUNK_SIZE) {
+            const uint64_t send_started = timing_now();
+            if (!send_all(session->socketFD, chunk, used)) {
+                return false;
+            }
+            excluded += timing_now() - send_started;
+            used = 0;
+        }
+        if (EVP_EncryptUpdate(session->send_ctx, chunk + used, &out_length,
+                              (const unsigned char *) buffer + offset, (int) piece) != OPENSSL_OK) {
+            return false;
+        }
+        used += (size_t) out_length;
+        offset += piece;
+    }
+    if (EVP_EncryptFinal_ex(session->send_ctx, chunk + used, &out_length) != OPENSSL_OK ||
+        EVP_CIPHER_CTX_ctrl(session->send_ctx, EVP_CTRL_GCM_GET_TAG, CRYPTO_SESSION_TAG_SIZE,
+                            chunk + used + out_length) != OPENSSL_OK) {
+        return false;
+    }
+    used += (size_t) out_length + CRYPTO_SESSION_TAG_SIZE;
+    report_timing(CRYPTO_TIMING_SEAL, started, excluded);
+    return send_all(session->socketFD, chunk, used);
+}
+
+/**
+ * Encrypts one record into memory, send lock held
+ * Args:
+ *   session: Sealed root session
+ *   out: Receives RECORD_OVERHEAD + prefix_length + length bytes
+ *   prefix: Stream header encrypted in front of the plaintext
+ *   prefix_length: Bytes of prefix, NO_STREAM_HEADER for none
+ *   buffer: Plaintext
+ *   length: Plaintext length
+ * Returns:
+ *   Boolean indicating success
+ */
+static bool seal_record_into(CryptoSession *session, unsigned char *out, const unsigned char *prefix,
+                             const size_t prefix_length, const char *buffer, const size_t length) {
+    const uint64_t started = timing_now();
+    unsigned char nonce[CRYPTO_SESSION_NONCE_SIZE];
+    const size_t record_length = prefix_length + length;
+    for (unsigned int i = 0; i < RECORD_HEADER_SIZE; i++) {
+        out[i] = (unsigned char) (record_length >> (BYTE_BITS * (RECORD_HEADER_SIZE - 1 - i)) & BYTE_MASK);
+    }
+    build_nonce(nonce, session->send_counter++);
+    int out_length = 0;
+    int prefix_out = 0;
+    int final_length = 0;
+    unsigned char *ciphertext = out + RECORD_HEADER_SIZE;
+    const bool sealed = EVP_EncryptInit_ex(session->send_ctx, NULL, NULL, NULL, nonce) == OPENSSL_OK &&
+                        EVP_EncryptUpdate(session->send_ctx, NULL, &out_length, out, RECORD_HEADER_SIZE) ==
+                        OPENSSL_OK &&
+                        (prefix_length == 0 ||
+                         EVP_EncryptUpdate(session->send_ctx, ciphertext, &prefix_out, prefix,
+                                           (int) prefix_length) == OPENSSL_OK) &&
+                        EVP_EncryptUpdate(session->send_ctx, ciphertext + prefix_out, &out_length,
+                                          (const unsigned char *) buffer, (int) length) == OPENSSL_OK &&
+                        EVP_EncryptFinal_ex(session->send_ctx, ciphertext + prefix_out + out_length,
+                                            &final_length) == OPENSSL_OK &&
+                        EVP_CIPHER_CTX_ctrl(session->send_ctx, EVP_CTRL_GCM_GET_TAG, CRYPTO_SESSION_TAG_SIZE,
+                                            ciphertext + record_length) == OPENSSL_OK;
+    report_timing(CRYPTO_TIMING_SEAL, started, 0);
+    return sealed;
+}
+
+/**
+ * Grows a buffer to at least the needed size
+ * Args:
+ *   buffer: Buffer to grow, may be NULL
+ *   capacity: Current size, updated
+ *   needed: Required size
+ * Returns:
+ *   Boolean indicating the buffer is large enough
+ */
+static bool reserve_buffer(void **buffer, size_t *capacity, const size_t needed) {
+    if (needed <= *capacity) {
+        return true;
+    }
+    size_t grown = *capacity > 0 ? *capacity : INITIAL_QUEUE_CAPACITY;
+    while (grown < needed) {
+        grown *= GROWTH_FACTOR;
+    }
+    void *resized = realloc(*buffer, grown);
+    if (resized == NULL) {
+        return false;
+    }
+    *buffer = resized;
+    *capacity = grown;
+    return true;
+}
+
+/**
+ * Moves the unsent bytes of the wire buffer to its start, send lock held
+ * Args:
+ *   session: Root session
+ * Returns: void
+ */
+static void compact_wire(CryptoSession *session) {
+    if (session->wire_sent > 0) {
+        memmove(session->wire, session->wire + session->wire_sent, session->wire_length - session->wire_sent);
+        session->wire_length -= session->wire_sent;
+        session->wire_sent = 0;
+    }
+}
+
+/**
+ * Seals one record at the end of the wire buffer, send lock held
+ * Args:
+ *   session: Sealed root session
+ *   prefix: Stream header encrypted in front of the plaintext
+ *   prefix_length: Bytes of prefix, NO_STREAM_HEADER for none
+ *   buffer: Plaintext
+ *   length: Plaintext length
+ * Returns:
+ *   Boolean indicating the record is on the wire buffer
+ */
+static bool append_record(CryptoSession *session, const unsigned char *prefix, const size_t prefix_length,
+                          const char *buffer, const size_t length) {
+    if (length > UINT32_MAX - prefix_length ||
+        !reserve_buffer((void **) &session->wire, &session->wire_capacity,
+                        session->wire_length + RECORD_OVERHEAD + prefix_length + length) ||
+        !seal_record_into(session, session->wire + session->wire_length, prefix, prefix_length, buffer, length)) {
+        return false;
+    }
+    session->wire_length += RECORD_OVERHEAD + prefix_length + length;
+    return true;
+}
+
+/**
+ * Sends one record, send lock held
+ * Args:
+ *   session: Sealed root session
+ *   prefix: Stream header encrypted in front of the plaintext
+ *   prefix_length: Bytes of prefix, NO_STREAM_HEADER for none
+ *   buffer: Plaintext
+ *   length: Plaintext length
+ * Operation:
+ *   Blocking sessions encrypt through send_record, non-blocking ones go through the wire buffer
+ * Returns:
+ *   Boolean indicating the record was sent or, non-blocking, kept for later
+ */
+static bool send_sealed(CryptoSession *session, const unsigned char *prefix, const size_t prefix_length,
+                        const char *buffer, const size_t length) {
+    if (!session->nonblocking) {
+        const bool sent = send_record(session, prefix, prefix_length, buffer, length);
+        session->failed = session->failed || !sent;
+        return sent;
+    }
+    compact_wire(session);
+    if (!append_record(session, prefix, prefix_length, buffer, length)) {
+        session->failed = true;
+        return false;
+    }
+    return write_wire(session);
+}
+
+/**
+ * Sends every queued message, send lock held
+ * Args:
+ *   session: Session to drain
+ * Operation:
+ *   - Writes what a non-blocking session still has on the wire first
+ *   - Swaps the queue out so enqueuers only wait for the swap
+ *   - Sealed sessions encrypt all messages into the wire buffer and write it in one send
+ *   - Unsealed sessions hand each message to s_send
+ *   - Repeats until the queue stays empty, a failed peer drops what is left
+ * Returns:
+ *   Boolean indicating everything was sent or, non-blocking, kept for later
+ */
+static bool drain_pending(CryptoSession *session) {
+    if (session->wire_length > 0 && !write_wire(session)) {
+        return false;
+    }
+    while (true) {
+        pthread_mutex_lock(&session->queue_mutex);
+        char *batch = session->pending;
+        const size_t batch_length = session->pending_length;
+        const size_t batch_capacity = session->pending_capacity;
+        session->pending = session->draining;
+        session->pending_capacity = session->draining_capacity;
+        session->pending_length = 0;
+        session->draining = batch;
+        session->draining_capacity = batch_capacity;
+        pthread_mutex_unlock(&session->queue_mutex);
+        if (batch_length == 0) {
+            return true;
+        }
+        compact_wire(session);
+        bool ok = true;
+        for (size_t offset = 0; ok && offset < batch_length;) {
+            uint32_t length;
+            uint32_t stream;
+            memcpy(&length, batch + offset, sizeof(length));
+            memcpy(&stream, batch + offset + QUEUE_ENTRY_STREAM_OFFSET, sizeof(stream));
+            const char *message = batch + offset + QUEUE_ENTRY_HEADER_SIZE;
+            offset += QUEUE_ENTRY_HEADER_SIZE + length;
+            if (!session->send_sealed) {
+                ok = s_send(session->socketFD, session->key, message, length) >= 0;
+                continue;
+            }
+            // The header is decided here, under the send lock, so it always matches the seal state
+            unsigned char prefix[CRYPTO_SESSION_STREAM_HEADER_SIZE];
+            const size_t prefix_length = stream_header(session, stream, prefix);
+            ok = append_record(session, prefix, prefix_length, message, length);
+        }
+        if (!ok) {
+            session->failed = true;
+            return false;
+        }
+        // Everything sealed in this round leaves in a single syscall
+        if (session->wire_length > 0 && !write_wire(session)) {
+            return false;
+        }
+    }
+}
+
+/**
+ * Releases the send lock without stranding queued messages
+ * Args:
+ *   session: Session whose send lock is held
+ * Operation:
+ *   An enqueuer that found the lock taken relies on the holder, so the
+ *   holder checks the queue again after unlocking and drains it if it can
+ *   take the lock back
+ * Returns:
+ *   Boolean indicating every drain succeeded
+ */
+static bool release_send_lock(CryptoSession *session) {
+    bool ok = true;
+    while (true) {
+        pthread_mutex_unlock(&session->send_mutex);
+        pthread_mutex_lock(&session->queue_mutex);
+        const bool queued = session->pending_length > 0;
+        pthread_mutex_unlock(&session->queue_mutex);
+        if (!queued || pthread_mutex_trylock(&session->send_mutex) != 0) {
+            return ok;
+        }
+        ok = drain_pending(session) && ok;
+    }
+}
+
+/**
+ * Sends one message
+ * Args:
+ *   session: Session to send on
+ *   buffer: Message bytes
+ *   length: Message length
+ * Operation:
+ *   - Serialized with every other sender of the session
+ *   - Uses s_send until the send direction is sealed, AES-GCM records afterwards
+ * Returns:
+ *   Bytes sent or -1 on failure
+ */
+ssize_t session_send(CryptoSession *session, const char *buffer, const size_t length) {
+    CryptoSession *root = session->root;
+    ssize_t result = (ssize_t) length;
+    pthread_mutex_lock(&root->send_mutex);
+    // Queued messages were first
+    if (!drain_pending(root)) {
+        result = SOCKET_ERROR;
+    } else if (root->send_sealed) {
+        unsigned char prefix[CRYPTO_SESSION_STREAM_HEADER_SIZE];
+        const size_t prefix_length = stream_header(root, session->stream, prefix);
+        if (!send_sealed(root, prefix, prefix_length, buffer, length)) {
+            result = SOCKET_ERROR;
+        }
+    } else {
+        result = s_send(root->socketFD, root->key, buffer, length);
+        root->failed = root->failed || result < 0;
+    }
+    release_send_lock(root);
+    return result;
+}
+
+/**
+ * Sends the last s_send message and seals the send direction
+ * Args:
+ *   session: Session to send on
+ *   buffer: Message bytes
+ *   length: Message length
+ * Operation:
+ *   Sending and switching happen under the send lock, so no other sender
+ *   can slip an s_send message in after it
+ * Returns:
+ *   Bytes sent or -1 on failure
+ */
+ssize_t session_send_and_seal(CryptoSession *session, const char *buffer, const size_t length) {
+    CryptoSession *root = session->root;
+    pthread_mutex_lock(&root->send_mutex);
+    const ssize_t result = drain_pending(root) ? s_send(root->socketFD, root->key, buffer, length)
+                                               : SOCKET_ERROR;
+    root->failed = root->failed || result < 0;
+    root->send_sealed = true;
+    release_send_lock(root);
+    return result;
+}
+
+/**
+ * Tells the peer a stream is finished
+ * Args:
+ *   session: Any session of the connection
+ *   stream: Stream to close
+ * Operation:
+ *   Sends a record with the stream header and nothing after it
+ * Returns:
+ *   Boolean indicating the record was sent
+ */
+bool session_close_stream(CryptoSession *session, const uint32_t stream) {
+    CryptoSession *root = session->root;
+    pthread_mutex_lock(&root->send_mutex);
+    unsigned char prefix[CRYPTO_SESSION_STREAM_HEADER_SIZE];
+    const size_t prefix_length = stream_header(root, stream, prefix);
+    const bool sent = root->send_sealed && prefix_length > 0 && drain_pending(root) &&
+                      send_sealed(root, prefix, prefix_length, NULL, 0);
+    return release_send_lock(root) && sent;
+}
+
+/**
+ * Queues one message without touching the socket
+ * Args:
+ *   session: Session to send on
+ *   buffer: Message bytes, copied
+ *   length: Message length
+ * Operation:
+ *   Only takes the queue lock, safe to call while holding other locks
+ * Returns:
+ *   Boolean indicating the message was queued
+ */
+bool session_enqueue(CryptoSession *session, const char *buffer, const size_t length) {
+    char *slot = session_enqueue_reserve(session, length);
+    if (slot == NULL) {
+        return false;
+    }
+    memcpy(slot, buffer, length);
+    session_enqueue_commit(session, length);
+    return true;
+}
+
+/**
+ * Reserves room for one message at the end of the queue
+ * Args:
+ *   session: Session to send on
+ *   length: Exact message length
+ * Operation:
+ *   - Returns with the queue lock held, the caller writes the message in
+ *     place and must call session_enqueue_commit right away
+ *   - Never touches the socket
+ * Returns:
+ *   Where to write the message, NULL (lock released) if it cannot be queued
+ */
+char *session_enqueue_reserve(CryptoSession *session, const size_t length) {
+    CryptoSession *root = session->root;
+    if (length > UINT32_MAX) {
+        return NULL;
+    }
+    const uint32_t entry_length = (uint32_t) length;
+    pthread_mutex_lock(&root->queue_mutex);
+    // Both queue buffers keep their capacity across swaps, steady traffic stops reallocating
+    if (!reserve_buffer((void **) &root->pending, &root->pending_capacity,
+                        root->pending_length + QUEUE_ENTRY_HEADER_SIZE + length)) {
+        pthread_mutex_unlock(&root->queue_mutex);
+        return NULL;
+    }
+    char *entry = root->pending + root->pending_length;
+    memcpy(entry, &entry_length, sizeof(entry_length));
+    memcpy(entry + QUEUE_ENTRY_STREAM_OFFSET, &session->stream, sizeof(session->stream));
+    return entry + QUEUE_ENTRY_HEADER_SIZE;
+}
+
+/**
+ * Appends the message written after session_enqueue_reserve
+ * Args:
+ *   session: Session whose queue lock session_enqueue_reserve took
+ *   length: Same length that was reserved
+ * Returns: void
+ */
+void session_enqueue_commit(CryptoSession *session, const size_t length) {
+    CryptoSession *root = session->root;
+    root->pending_length += QUEUE_ENTRY_HEADER_SIZE + length;
+    pthread_mutex_unlock(&root->queue_mutex);
+}
+
+/**
+ * Writes out queued messages
+ * Args:
+ *   session: Session to flush
+ * Operation:
+ *   - Below CRYPTO_SESSION_QUEUE_LIMIT a busy sender takes the queue along
+ *     and this returns right away
+ *   - Above it the caller waits for the send lock, so a slow peer slows
+ *     down whoever feeds it instead of growing the queue without bound
+ * Returns:
+ *   Boolean indicating no send failed on this thread
+ */
+bool session_flush(CryptoSession *session) {
+    CryptoSession *root = session->root;
+    pthread_mutex_lock(&root->queue_mutex);
+    const size_t queued = root->pending_length;
+    pthread_mutex_unlock(&root->queue_mutex);
+    if (queued == 0) {
+        return true;
+    }
+    if (queued > CRYPTO_SESSION_QUEUE_LIMIT) {
+        pthread_mutex_lock(&root->send_mutex);
+    } else if (pthread_mutex_trylock(&root->send_mutex) != 0) {
+        return true;
+    }
+    const bool ok = drain_pending(root);
+    return release_send_lock(root) && ok;
+}
+
+/**
+ * Decrypts and authenticates one received record in place
+ * Args:
+ *   session: Root session with a sealed receive direction
+ *   header: Record length header, authenticated as additional data
+ *   prefix: Encrypted stream header, decrypted in place
+ *   prefix_length: Bytes of prefix, NO_STREAM_HEADER while streams are off
+ *   buffer: Ciphertext after the stream header, replaced by the plaintext
+ *   length: Bytes of buffer
+ *   tag: Record tag
+ *   stream: Receives the stream id, CRYPTO_SESSION_PRIMARY_STREAM while streams are off
+ * Returns:
+ *   Boolean indicating the record is authentic
+ */
+static bool open_record(CryptoSession *session, const unsigned char *header, unsigned char *prefix,
+                        const size_t prefix_length, char *buffer, const size_t length, unsigned char *tag,
+                        uint32_t *stream) {
+    const uint64_t started = timing_now();
+    unsigned char nonce[CRYPTO_SESSION_NONCE_SIZE];
+    build_nonce(nonce, session->recv_counter++);
+    int out_length = 0;
+    int final_length = 0;
+    if (EVP_DecryptInit_ex(session->recv_ctx, NULL, NULL, NULL, nonce) != OPENSSL_OK ||
+        EVP_DecryptUpdate(session->recv_ctx, NULL, &out_length, header, RECORD_HEADER_SIZE) != OPENSSL_OK ||
+        (prefix_length > 0 &&
+         EVP_DecryptUpdate(session->recv_ctx, prefix, &out_length, prefix, (int) prefix_length) != OPENSSL_OK) ||
+        EVP_DecryptUpdate(session->recv_ctx, (unsigned char *) buffer, &out_length, (unsigned char *) buffer,
+                          (int) length) != OPENSSL_OK ||
+        EVP_CIPHER_CTX_ctrl(session->recv_ctx, EVP_CTRL_GCM_SET_TAG, CRYPTO_SESSION_TAG_SIZE, tag) != OPENSSL_OK ||
+        EVP_DecryptFinal_ex(session->recv_ctx, (unsigned char *) buffer + length, &final_length) !=
+        OPENSSL_OK) {
+        return false;
+    }
+    report_timing(CRYPTO_TIMING_OPEN, started, 0);
+    *stream = CRYPTO_SESSION_PRIMARY_STREAM;
+    for (size_t i = 0; i < prefix_length; i++) {
+        *stream = *stream << BYTE_BITS | prefix[i];
+    }
+    return true;
+}
+
+/**
+ * Decodes a record length header
+ * Args:
+ *   header: RECORD_HEADER_SIZE big endian bytes
+ * Returns:
+ *   Bytes of ciphertext, stream header included
+ */
+static size_t record_length_of(const unsigned char *header) {
+    size_t length = 0;
+    for (unsigned int i = 0; i < RECORD_HEADER_SIZE; i++) {
+        length = length << BYTE_BITS | header[i];
+    }
+    return length;
+}
+
+/**
+ * Reads and opens one AES-GCM record
+ * Args:
+ *   session: Root session with a sealed receive direction
+ *   buffer: Destination for the plaintext after the stream header
+ *   size: Size of buffer
+ *   stream: Receives the stream id, CRYPTO_SESSION_PRIMARY_STREAM while streams are off
+ * Operation:
+ *   The stream header is decrypted on its own, the rest in place, so nothing is moved afterwards
+ * Returns:
+ *   Bytes of plaintext in buffer, RECORD_PEER_CLOSED if the peer closed, -1 on failure or a forged record
+ */
+static ssize_t recv_record(CryptoSession *session, char *buffer, const size_t size, uint32_t *stream) {
+    unsigned char header[RECORD_HEADER_SIZE];
+    const ssize_t header_result = recv_all(session->socketFD, header, sizeof(header));
+    if (header_result <= 0) {
+        return header_result == 0 ? RECORD_PEER_CLOSED : SOCKET_ERROR;
+    }
+    size_t length = record_length_of(header);
+    unsigned char prefix[CRYPTO_SESSION_STREAM_HEADER_SIZE];
+    const size_t prefix_length = session->streams ? CRYPTO_SESSION_STREAM_HEADER_SIZE : NO_STREAM_HEADER;
+    unsigned char tag[CRYPTO_SESSION_TAG_SIZE];
+    if (length < prefix_length || length - prefix_length > size ||
+        recv_all(session->socketFD, prefix, prefix_length) != (ssize_t) prefix_length ||
+        recv_all(session->socketFD, (unsigned char *) buffer, length - prefix_length) !=
+        (ssize_t) (length - prefix_length) ||
+        recv_all(session->socketFD, tag, sizeof(tag)) != (ssize_t) sizeof(tag)) {
+        return SOCKET_ERROR;
+    }
+    length -= prefix_length;
+    if (!open_record(session, header, prefix, prefix_length, buffer, length, tag, stream)) {
+        return SOCKET_ERROR;
+    }
+    return (ssize_t) length;
+}
+
+/**
+ * Receives one message
+ * Args:
+ *   session: Session to receive on, only one reader at a time
+ *   buffer: Destination
+ *   size: Size of buffer
+ * Operation:
+ *   Uses s_recv until the receive direction is sealed, then reads and
+ *   authenticates AES-GCM records in place, dropping any stream header
+ * Returns:
+ *   Bytes received, 0 if the peer closed, -1 on failure or a forged record
+ */
+ssize_t session_recv(CryptoSession *session, char *buffer, const size_t size) {
+    CryptoSession *root = session->root;
+    if (!root->recv_sealed) {
+        return s_recv(root->socketFD, buffer, size, root->key);
+    }
+    uint32_t stream;
+    const ssize_t received = recv_record(root, buffer, size, &stream);
+    return received == RECORD_PEER_CLOSED ? 0 : received;
+}
+
+/**
+ * Receives one record of a connection with streams on
+ * Args:
+ *   session: Any session of the connection, one reader for all of its streams
+ *   buffer: Destination for the message after the stream header
+ *   size: Size of buffer
+ *   stream: Receives the stream id the record carried
+ * Operation:
+ *   The receive direction must be sealed
+ * Returns:
+ *   Message length, 0 for a record that closes its stream, -1 once the peer closed, failed or forged a record
+ */
+ssize_t session_recv_stream(CryptoSession *session, char *buffer, const size_t size, uint32_t *stream) {
+    CryptoSession *root = session->root;
+    if (!root->recv_sealed || !root->streams) {
+        return SOCKET_ERROR;
+    }
+    const ssize_t received = recv_record(root, buffer, size, stream);
+    // 0 is taken by records that close a stream, the connection ending is reported like a failure
+    return received == RECORD_PEER_CLOSED ? SOCKET_ERROR : received;
+}
+
+/**
+ * Switches the receive direction to AES-GCM records
+ * Args:
+ *   session: Session; the next message the peer sends must be a record
+ * Returns: void
+ */
+void session_seal_receive(CryptoSession *session) {
+    session->root->recv_sealed = true;
+}
+
+/**
+ * Reads what the socket has for a non-blocking session
+ * Args:
+ *   session: Session with a sealed receive direction
+ * Operation:
+ *   - One bounded recv into the inbox, never waits
+ *   - Call session_recv_buffered until it would block afterwards, the socket may not report those bytes again
+ * Returns:
+ *   Bytes read, 0 if the peer closed, CRYPTO_SESSION_WOULD_BLOCK if nothing was there, -1 on failure
+ */
+ssize_t session_recv_fill(CryptoSession *session) {
+    CryptoSession *root = session->root;
+    if (!root->recv_sealed) {
+        return SOCKET_ERROR;
+    }
+    // Opened records are dropped from the front so the inbox only ever holds one partial record
+    if (root->inbox_start > 0) {
+        memmove(root->inbox, root->inbox + root->inbox_start, root->inbox_length - root->inbox_start);
+        root->inbox_length -= root->inbox_start;
+        root->inbox_start = 0;
+    }
+    if (!reserve_buffer((void **) &root->inbox, &root->inbox_capacity, root->inbox_length + INBOX_READ_SIZE)) {
+        return SOCKET_ERROR;
+    }
+    while (true) {
+        const ssize_t amount = recv(root->socketFD, root->inbox + root->inbox_length, INBOX_READ_SIZE,
+                                    MSG_DONTWAIT);
+        if (amount == SOCKET_ERROR && errno == EINTR) {
+            continue;
+        }
+        if (amount == SOCKET_ERROR && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return CRYPTO_SESSION_WOULD_BLOCK;
+        }
+        if (amount > 0) {
+            root->inbox_length += (size_t) amount;
+        }
+        return amount;
+    }
+}
+
+/**
+ * Opens the next whole record session_recv_fill collected
+ * Args:
+ *   session: Session with a sealed receive direction
+ *   buffer: Destination for the message after the stream header
+ *   size: Size of buffer
+ * Operation:
+ *   - Refuses a record longer than size as soon as its header arrived, the inbox never
+ *     grows past one record and one read
+ *   - The stream header is dropped like session_recv does
+ * Returns:
+ *   Message length, CRYPTO_SESSION_WOULD_BLOCK until a whole record is buffered, -1 on a forged or oversized record
+ */
+ssize_t session_recv_buffered(CryptoSession *session, char *buffer, const size_t size) {
+    CryptoSession *root = session->root;
+    const size_t available = root->inbox_length - root->inbox_start;
+    unsigned char *record = root->inbox + root->inbox_start;
+    if (available < RECORD_HEADER_SIZE) {
+        return CRYPTO_SESSION_WOULD_BLOCK;
+    }
+    const size_t length = record_length_of(record);
+    const size_t prefix_length = root->streams ? CRYPTO_SESSION_STREAM_HEADER_SIZE : NO_STREAM_HEADER;
+    if (length < prefix_length || length - prefix_length > size) {
+        return SOCKET_ERROR;
+    }
+    if (available < RECORD_OVERHEAD + length) {
+        return CRYPTO_SESSION_WOULD_BLOCK;
+    }
+    const size_t message_length = length - prefix_length;
+    unsigned char prefix[CRYPTO_SESSION_STREAM_HEADER_SIZE];
+    unsigned char tag[CRYPTO_SESSION_TAG_SIZE];
+    memcpy(prefix, record + RECORD_HEADER_SIZE, prefix_length);
+    memcpy(buffer, record + RECORD_HEADER_SIZE + prefix_length, message_length);
+    memcpy(tag, record + RECORD_HEADER_SIZE + length, sizeof(tag));
+    root->inbox_start += RECORD_OVERHEAD + length;
+    uint32_t stream;
+    if (!open_record(root, record, prefix, prefix_length, buffer, message_length, tag, &stream)) {
+        return SOCKET_ERROR;
+    }
+    return (ssize_t) message_length;
+}
+
+/**
+ * Writes what a non-blocking session could not send earlier
+ * Args:
+ *   session: Any session of the connection
+ * Operation:
+ *   Call once the socket is writable again, queued messages follow the older bytes
+ * Returns:
+ *   Boolean indicating no send failed
+ */
+bool session_write_backlog(CryptoSession *session) {
+    CryptoSession *root = session->root;
+    pthread_mutex_lock(&root->send_mutex);
+    const bool ok = drain_pending(root);
+    return release_send_lock(root) && ok;
+}
+
+/**
+ * Tells how much a non-blocking session still has to write
+ * Args:
+ *   session: Any session of the connection
+ * Returns:
+ *   Unsent sealed bytes, -1 once a send failed
+ */
+ssize_t session_output_backlog(CryptoSession *session) {
+    CryptoSession *root = session->root;
+    pthread_mutex_lock(&root->send_mutex);
+    const ssize_t backlog = root->failed ? SOCKET_ERROR : (ssize_t) (root->wire_length - root->wire_sent);
+    pthread_mutex_unlock(&root->send_mutex);
+    return backlog;
+}
@@ -0,0 +1,337 @@
+// crypto_session.h
+#ifndef CRYPTO_SESSION_H
+#define CRYPTO_SESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define CRYPTO_SESSION_MAX_KEY_SIZE 64 //largest exchange key kept for s_send/s_recv
+#define CRYPTO_SESSION_TAG_SIZE 16 //AES-GCM authentication tag
+#define CRYPTO_SESSION_NONCE_SIZE 12 //AES-GCM nonce, 4 zero bytes and a 64-bit record counter
+#define CRYPTO_SESSION_QUEUE_LIMIT (256 * 1024) //queued bytes after which flushing waits for the peer
+#define CRYPTO_SESSION_STREAM_HEADER_SIZE 4 //big endian stream id opening every record once streams are on
+#define CRYPTO_SESSION_PRIMARY_STREAM 0 //stream of the session crypto_session_create returned
+#define CRYPTO_SESSION_BACKLOG_LIMIT (1024 * 1024) //unsent bytes a non-blocking session keeps before giving up
+#define CRYPTO_SESSION_WOULD_BLOCK -2 //non-blocking receive result until a whole record arrived
+
+/**
+ * Per-connection transport state
+ * Components (private to crypto_session.c):
+ *   - Socket and the key returned by the key exchange
+ *   - One AES-256-GCM context per direction, keyed once with HKDF output
+ *   - Record counters used as implicit nonces
+ *   - Send lock, so replies and relayed messages never interleave
+ *   - Reference count shared with the stream sessions opened on it
+ * Operation:
+ *   Starts out on s_send/s_recv, each direction moves to the AEAD record
+ *   layer once both peers agreed on FRAME_CAPABILITY_AEAD
+ *   A stream session only carries its stream id, everything else is done on
+ *   the session it was opened from
+ */
+typedef struct CryptoSession CryptoSession;
+
+/**
+ * Side of the connection, picks which derived key encrypts and which decrypts
+ */
+typedef enum {
+    CRYPTO_ROLE_SERVER,
+    CRYPTO_ROLE_CLIENT
+} CryptoRole;
+
+/**
+ * AES-GCM work a timing hook is told about
+ */
+typedef enum {
+    CRYPTO_TIMING_SEAL, //one record encrypted, socket writes excluded
+    CRYPTO_TIMING_OPEN //one record decrypted and authenticated, socket reads excluded
+} CryptoTiming;
+
+/**
+ * Receives the duration of every record operation
+ * Args:
+ *   timing: Which operation ran
+ *   ns: CLOCK_MONOTONIC nanoseconds it took
+ */
+typedef void (*CryptoTimingHook)(CryptoTiming timing, uint64_t ns);
+
+/**
+ * Installs the process wide timing hook
+ * Args:
+ *   hook: Called after every sealed or opened record, NULL turns timing off
+ * Operation:
+ *   Without a hook the record path reads no clock, call before any session exists
+ * Returns: void
+ */
+void crypto_session_set_timing_hook(CryptoTimingHook hook);
+
+/**
+ * Creates the session right after the key exchange
+ * Args:
+ *   socketFD: Connected socket
+ *   key: Key returned by recv_send_key/send_recv_key, copied
+ *   key_length: Key size in bytes
+ *   role: Which end of the connection this is
+ * Operation:
+ *   - Derives one key per direction with HKDF-SHA256
+ *   - Runs the AES-256-GCM key schedule once for each direction
+ * Returns:
+ *   New session or NULL on failure
+ */
+CryptoSession *crypto_session_create(int socketFD, const unsigned char *key, size_t key_length, CryptoRole role);
+
+/**
+ * Frees the session and wipes its keys
+ * Args:
+ *   session: Session to destroy, may be NULL
+ * Operation:
+ *   - A stream only drops its reference on the root
+ *   - The root is freed with its last reference, closing its socket if it owns it
+ * Returns: void
+ */
+void crypto_session_destroy(CryptoSession *session);
+
+/**
+ * Turns on stream headers for every sealed record
+ * Args:
+ *   session: Session before its send direction is sealed
+ *   own_socket: Move to a duplicate of the socket that is closed with the last reference
+ * Operation:
+ *   - Changes state under the send lock, senders see it together with the seal
+ *   - Records sent on the session itself carry CRYPTO_SESSION_PRIMARY_STREAM
+ *   - With own_socket the original descriptor may be closed while streams still send
+ * Returns:
+ *   Boolean indicating streams are on
+ */
+bool crypto_session_enable_streams(CryptoSession *session, bool own_socket);
+
+/**
+ * Opens one more logical session on a connection with streams on
+ * Args:
+ *   session: Any session of the connection
+ *   stream: Stream id its records carry
+ * Operation:
+ *   Shares socket, ciphers, send lock and queue with the root and holds a reference on it
+ * Returns:
+ *   Stream session or NULL on failure
+ */
+CryptoSession *crypto_session_open_stream(CryptoSession *session, uint32_t stream);
+
+/**
+ * Takes another reference on a session's connection
+ * Args:
+ *   session: Any session of the connection
+ * Operation:
+ *   Released with crypto_session_destroy on the returned root
+ * Returns:
+ *   Root session
+ */
+CryptoSession *crypto_session_retain(CryptoSession *session);
+
+/**
+ * Moves the sealed traffic of a connection off blocking socket calls
+ * Args:
+ *   session: Any session of the connection
+ * Operation:
+ *   - Sealed sends write what the socket takes and keep the rest for session_write_backlog
+ *   - Sealed records are read with session_recv_fill and session_recv_buffered
+ *   - The descriptor itself stays blocking, s_send and s_recv before the seal keep their socket timeouts
+ * Returns: void
+ */
+void crypto_session_set_nonblocking(CryptoSession *session);
+
+/**
+ * Returns the socket a session sends on
+ * Args:
+ *   session: Session
+ * Returns:
+ *   Socket file descriptor
+ */
+int crypto_session_socket(const CryptoSession *session);
+
+/**
+ * Returns the exchanged key for util calls that take it directly
+ * Args:
+ *   session: Session
+ * Operation:
+ *   Only valid for plaintext s_send traffic, sealed directions ignore it
+ * Returns:
+ *   Key passed to crypto_session_create
+ */
+const unsigned char *crypto_session_key(const CryptoSession *session);
+
+/**
+ * Sends one message
+ * Args:
+ *   session: Session to send on
+ *   buffer: Message bytes
+ *   length: Message length
+ * Operation:
+ *   - Serialized with every other sender of the session
+ *   - Uses s_send until the send direction is sealed, AES-GCM records afterwards
+ * Returns:
+ *   Bytes sent or -1 on failure
+ */
+ssize_t session_send(CryptoSession *session, const char *buffer, size_t length);
+
+/**
+ * Sends the last s_send message and seals the send direction
+ * Args:
+ *   session: Session to send on
+ *   buffer: Message bytes
+ *   length: Message length
+ * Operation:
+ *   Sending and switching happen under the send lock, so no other sender
+ *   can slip an s_send message in after it
+ * Returns:
+ *   Bytes sent or -1 on failure
+ */
+ssize_t session_send_and_seal(CryptoSession *session, const char *buffer, size_t length);
+
+/**
+ * Tells the peer a stream is finished
+ * Args:
+ *   session: Any session of the connection
+ *   stream: Stream to close
+ * Operation:
+ *   Sends a record with the stream header and nothing after it
+ * Returns:
+ *   Boolean indicating the record was sent
+ */
+bool session_close_stream(CryptoSession *session, uint32_t stream);
+
+/**
+ * Queues one message without touching the socket
+ * Args:
+ *   session: Session to send on
+ *   buffer: Message bytes, copied
+ *   length: Message length
+ * Operation:
+ *   Only takes the queue lock, safe to call while holding other locks
+ * Returns:
+ *   Boolean indicating the message was queued
+ */
+bool session_enqueue(CryptoSession *session, const char *buffer, size_t length);
+
+/**
+ * Reserves room for one message at the end of the queue
+ * Args:
+ *   session: Session to send on
+ *   length: Exact message length
+ * Operation:
+ *   - Returns with the queue lock held, the caller writes the message in
+ *     place and must call session_enqueue_commit right away
+ *   - Never touches the socket
+ * Returns:
+ *   Where to write the message, NULL (lock released) if it cannot be queued
+ */
+char *session_enqueue_reserve(CryptoSession *session, size_t length);
+
+/**
+ * Appends the message written after session_enqueue_reserve
+ * Args:
+ *   session: Session whose queue lock session_enqueue_reserve took
+ *   length: Same length that was reserved
+ * Returns: void
+ */
+void session_enqueue_commit(CryptoSession *session, size_t length);
+
+/**
+ * Writes out queued messages
+ * Args:
+ *   session: Session to flush
+ * Operation:
+ *   - Below CRYPTO_SESSION_QUEUE_LIMIT a busy sender takes the queue along
+ *     and this returns right away
+ *   - Above it the caller waits for the send lock, so a slow peer slows
+ *     down whoever feeds it instead of growing the queue without bound
+ * Returns:
+ *   Boolean indicating no send failed on this thread
+ */
+bool session_flush(CryptoSession *session);
+
+/**
+ * Receives one message
+ * Args:
+ *   session: Session to receive on, only one reader at a time
+ *   buffer: Destination
+ *   size: Size of buffer
+ * Operation:
+ *   Uses s_recv until the receive direction is sealed, then reads and
+ *   authenticates AES-GCM records in place, dropping any stream header
+ * Returns:
+ *   Bytes received, 0 if the peer closed, -1 on failure or a forged record
+ */
+ssize_t session_recv(CryptoSession *session, char *buffer, size_t size);
+
+/**
+ * Receives one record of a connection with streams on
+ * Args:
+ *   session: Any session of the connection, one reader for all of its streams
+ *   buffer: Destination for the message after the stream header
+ *   size: Size of buffer
+ *   stream: Receives the stream id the record carried
+ * Operation:
+ *   The receive direction must be sealed
+ * Returns:
+ *   Message length, 0 for a record that closes its stream, -1 once the peer closed, failed or forged a record
+ */
+ssize_t session_recv_stream(CryptoSession *session, char *buffer, size_t size, uint32_t *stream);
+
+/**
+ * Switches the receive direction to AES-GCM records
+ * Args:
+ *   session: Session; the next message the peer sends must be a record
+ * Returns: void
+ */
+void session_seal_receive(CryptoSession *session);
+
+/**
+ * Reads what the socket has for a non-blocking session
+ * Args:
+ *   session: Session with a sealed receive direction
+ * Operation:
+ *   - One bounded recv into the inbox, never waits
+ *   - Call session_recv_buffered until it would block afterwards, the socket may not report those bytes again
+ * Returns:
+ *   Bytes read, 0 if the peer closed, CRYPTO_SESSION_WOULD_BLOCK if nothing was there, -1 on failure
+ */
+ssize_t session_recv_fill(CryptoSession *session);
+
+/**
+ * Opens the next whole record session_recv_fill collected
+ * Args:
+ *   session: Session with a sealed receive direction
+ *   buffer: Destination for the message after the stream header
+ *   size: Size of buffer
+ * Operation:
+ *   - Refuses a record longer than size as soon as its header arrived, the inbox never
+ *     grows past one record and one read
+ *   - The stream header is dropped like session_recv does
+ * Returns:
+ *   Message length, CRYPTO_SESSION_WOULD_BLOCK until a whole record is buffered, -1 on a forged or oversized record
+ */
+ssize_t session_recv_buffered(CryptoSession *session, char *buffer, size_t size);
+
+/**
+ * Writes what a non-blocking session could not send earlier
+ * Args:
+ *   session: Any session of the connection
+ * Operation:
+ *   Call once the socket is writable again, queued messages follow the older bytes
+ * Returns:
+ *   Boolean indicating no send failed
+ */
+bool session_write_backlog(CryptoSession *session);
+
+/**
+ * Tells how much a non-blocking session still has to write
+ * Args:
+ *   session: Any session of the connection
+ * Returns:
+ *   Unsent sealed bytes, -1 once a send failed
+ */
+ssize_t session_output_backlog(CryptoSession *session);
+
+#endif // CRYPTO_SESSION_H
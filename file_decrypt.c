@@ -0,0 +1,306 @@
+/*
+ * In-process decryption of openssl enc -pbkdf2 files
+ * Replaces the openssl enc -d ... && mv shell command the GUI used to send,
+ * one DEC message tries every candidate cipher against a single mapping of
+ * the file and a single PBKDF2 run. Valid padding alone is a 1 in 256 false
+ * match, so a candidate only counts when its plaintext reads as a flag line
+ */
+
+#include "file_decrypt.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+
+#define SALT_MAGIC "Salted__"
+#define SALT_MAGIC_SIZE 8
+#define SALT_SIZE 8
+#define SALT_HEADER_SIZE (SALT_MAGIC_SIZE + SALT_SIZE)
+#define PBKDF2_ITERATIONS 10000 //openssl enc -pbkdf2 default
+#define OPENSSL_OK 1
+#define OPEN_ERROR -1
+#define FIELD_SEPARATOR '\n'
+#define FIELD_SEPARATOR_LEN 1
+#define DECRYPT_FIELDS_BEFORE_METHODS 2 //key and path
+#define FLAG_LINE_MAX 64 //FLAG_LINE_SIZE in flag_provision.c, the flag and its newline
+#define FLAG_LINE_END '\n'
+#define TEMP_SUFFIX ".dec" //same name the old openssl enc -d -out used
+#define TEMP_PATH_SIZE 4096
+#define FILE_MODE_BITS 0777
+
+/**
+ * Builds DEC message data
+ * Args:
+ *   key: Password to try
+ *   path: File to decrypt
+ *   methods: Candidate cipher names
+ *   method_count: Entries in methods, at most DECRYPT_MAX_METHODS
+ *   out: Destination buffer
+ *   size: Size of out
+ * Operation:
+ *   "<key>\n<path>\n<method>[\n<method>...]"
+ * Returns:
+ *   Length of the data, 0 if it does not fit or a field contains a newline
+ */
+size_t format_decrypt_request(const char *key, const char *path, const char *const *methods,
+                              const size_t method_count, char *out, const size_t size) {
+    if (method_count == 0 || method_count > DECRYPT_MAX_METHODS || strchr(key, FIELD_SEPARATOR) != NULL ||
+        strchr(path, FIELD_SEPARATOR) != NULL) {
+        return 0;
+    }
+    int length = snprintf(out, size, "%s\n%s", key, path);
+    for (size_t i = 0; i < method_count && length >= 0 && (size_t) length < size; i++) {
+        if (strchr(methods[i], FIELD_SEPARATOR) != NULL) {
+            return 0;
+        }
+        length += snprintf(out + length, size - (size_t) length, "\n%s", methods[i]);
+    }
+    if (length < 0 || (size_t) length >= size) {
+        return 0;
+    }
+    return (size_t) length;
+}
+
+/**
+ * Splits DEC message data in place
+ * Args:
+ *   data: NUL terminated message data, its newlines are replaced
+ *   request: Receives pointers into data
+ * Returns:
+ *   Boolean indicating a key, a path and 1 to DECRYPT_MAX_METHODS methods were found
+ */
+bool parse_decrypt_request(char *data, DecryptRequest *request) {
+    const char *fields[DECRYPT_FIELDS_BEFORE_METHODS + DECRYPT_MAX_METHODS];
+    size_t count = 0;
+    char *cursor = data;
+    bool complete = false;
+    while (!complete && count < sizeof(fields) / sizeof(fields[0])) {
+        fields[count++] = cursor;
+        char *separator = strchr(cursor, FIELD_SEPARATOR);
+        if (separator == NULL) {
+            complete = true;
+        } else {
+            *separator = '\0';
+            cursor = separator + FIELD_SEPARATOR_LEN;
+        }
+    }
+    // Still incomplete after the last slot means too many methods
+    if (!complete || count < DECRYPT_FIELDS_BEFORE_METHODS + 1) {
+        return false;
+    }
+    request->key = fields[0];
+    request->path = fields[1];
+    request->method_count = count - DECRYPT_FIELDS_BEFORE_METHODS;
+    for (size_t i = 0; i < request->method_count; i++) {
+        request->methods[i] = fields[i + DECRYPT_FIELDS_BEFORE_METHODS];
+    }
+    return *request->key != '\0' && *request->path != '\0';
+}
+
+/**
+ * Tries one cipher on the mapped ciphertext
+ * Args:
+ *   ctx: Reusable cipher context
+ *   cipher: Candidate cipher
+ *   derived: PBKDF2 output, key then IV
+ *   ciphertext: Data after the salt header
+ *   length: Bytes of ciphertext
+ *   plaintext: Receives the decrypted data, length plus DECRYPT_PLAINTEXT_SLACK bytes
+ *   plaintext_length: Receives its length
+ * Returns:
+ *   Boolean indicating the final block padding was valid
+ */
+static bool try_cipher(EVP_CIPHER_CTX *ctx, const EVP_CIPHER *cipher, const unsigned char *derived,
+                       const unsigned char *ciphertext, const size_t length, unsigned char *plaintext,
+                       size_t *plaintext_length) {
+    const int key_length = EVP_CIPHER_get_key_length(cipher);
+    const int iv_length = EVP_CIPHER_get_iv_length(cipher);
+    int update_length = 0;
+    int final_length = 0;
+    const bool ok = EVP_CIPHER_CTX_reset(ctx) == OPENSSL_OK &&
+                    EVP_DecryptInit_ex(ctx, cipher, NULL, derived, iv_length > 0 ? derived + key_length : NULL) ==
+                    OPENSSL_OK &&
+                    EVP_DecryptUpdate(ctx, plaintext, &update_length, ciphertext, (int) length) == OPENSSL_OK &&
+                    EVP_DecryptFinal_ex(ctx, plaintext + update_length, &final_length) == OPENSSL_OK;
+    *plaintext_length = (size_t) update_length + (size_t) final_length;
+    return ok;
+}
+
+/**
+ * Checks that a candidate plaintext reads as a flag line
+ * Args:
+ *   plaintext: Decrypted data
+ *   length: Bytes of plaintext
+ * Operation:
+ *   One line of printable characters, shorter than FLAG_LINE_MAX, optionally ending in a newline
+ * Returns:
+ *   Boolean indicating the plaintext looks like a flag
+ */
+static bool looks_like_flag(const unsigned char *plaintext, size_t length) {
+    if (length > 0 && plaintext[length - 1] == FLAG_LINE_END) {
+        length--;
+    }
+    if (length == 0 || length >= FLAG_LINE_MAX) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (!isprint(plaintext[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Writes the plaintext next to the file, then renames it over the file
+ * Args:
+ *   path: File being decrypted
+ *   mode: Permission bits of the file
+ *   plaintext: New contents
+ *   length: Bytes of plaintext
+ * Operation:
+ *   The original stays intact until the rename, a failed write removes <path>.dec
+ * Returns:
+ *   Boolean indicating success
+ */
+static bool replace_file(const char *path, const mode_t mode, const unsigned char *plaintext, const size_t length) {
+    char temp_path[TEMP_PATH_SIZE];
+    const int path_length = snprintf(temp_path, sizeof(temp_path), "%s%s", path, TEMP_SUFFIX);
+    if (path_length < 0 || (size_t) path_length >= sizeof(temp_path)) {
+        return false;
+    }
+    const int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (fd == OPEN_ERROR) {
+        return false;
+    }
+    size_t written = 0;
+    while (written < length) {
+        const ssize_t amount = write(fd, plaintext + written, length - written);
+        if (amount <= 0) {
+            break;
+        }
+        written += (size_t) amount;
+    }
+    const bool ok = written == length && fsync(fd) == 0;
+    if (close(fd) != 0 || !ok || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Decrypts the contents of an openssl enc -pbkdf2 file in memory
+ * Args:
+ *   data: File contents, "Salted__", the salt, then the ciphertext
+ *   size: Bytes of data
+ *   key: Password
+ *   methods: Candidate cipher names, tried in order
+ *   method_count: Entries in methods
+ *   plaintext: Receives the plaintext, size + DECRYPT_PLAINTEXT_SLACK bytes
+ *   plaintext_length: Receives its length
+ * Operation:
+ *   - Runs PBKDF2 once for all candidates, a shorter derived key is a prefix of a longer one
+ *   - Tries every candidate, one counts when its padding is valid and the plaintext is a flag line
+ * Returns:
+ *   Index of the only method that matched, DECRYPT_NO_MATCH, DECRYPT_AMBIGUOUS or DECRYPT_FILE_ERROR
+ */
+int decrypt_buffer(const unsigned char *data, const size_t size, const char *key, const char *const *methods,
+                   const size_t method_count, unsigned char *plaintext, size_t *plaintext_length) {
+    if (size <= SALT_HEADER_SIZE || memcmp(data, SALT_MAGIC, SALT_MAGIC_SIZE) != 0) {
+        return DECRYPT_FILE_ERROR;
+    }
+    const EVP_CIPHER *ciphers[DECRYPT_MAX_METHODS] = {NULL};
+    int derived_length = 0;
+    for (size_t i = 0; i < method_count && i < DECRYPT_MAX_METHODS; i++) {
+        ciphers[i] = EVP_get_cipherbyname(methods[i]);
+        if (ciphers[i] != NULL) {
+            const int needed = EVP_CIPHER_get_key_length(ciphers[i]) + EVP_CIPHER_get_iv_length(ciphers[i]);
+            derived_length = needed > derived_length ? needed : derived_length;
+        }
+    }
+    unsigned char derived[EVP_MAX_KEY_LENGTH + EVP_MAX_IV_LENGTH];
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    // Later candidates reuse the plaintext buffer, the accepted flag line waits here
+    unsigned char accepted[FLAG_LINE_MAX];
+    size_t accepted_length = 0;
+    int matched = DECRYPT_NO_MATCH;
+    if (ctx != NULL && derived_length > 0 &&
+        PKCS5_PBKDF2_HMAC(key, (int) strlen(key), data + SALT_MAGIC_SIZE, SALT_SIZE, PBKDF2_ITERATIONS,
+                          EVP_sha256(), derived_length, derived) == OPENSSL_OK) {
+        for (size_t i = 0; i < method_count && i < DECRYPT_MAX_METHODS && matched != DECRYPT_AMBIGUOUS; i++) {
+            size_t length = 0;
+            if (ciphers[i] != NULL && try_cipher(ctx, ciphers[i], derived, data + SALT_HEADER_SIZE,
+                                                 size - SALT_HEADER_SIZE, plaintext, &length) &&
+                looks_like_flag(plaintext, length)) {
+                matched = matched == DECRYPT_NO_MATCH ? (int) i : DECRYPT_AMBIGUOUS;
+                memcpy(accepted, plaintext, length);
+                accepted_length = length;
+            }
+        }
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    OPENSSL_cleanse(derived, sizeof(derived));
+    *plaintext_length = 0;
+    if (matched >= 0) {
+        memcpy(plaintext, accepted, accepted_length);
+        *plaintext_length = accepted_length;
+    }
+    OPENSSL_cleanse(accepted, sizeof(accepted));
+    return matched;
+}
+
+/**
+ * Decrypts an openssl enc -pbkdf2 file
+ * Args:
+ *   path: File to decrypt
+ *   key: Password
+ *   methods: Candidate cipher names, tried in order
+ *   method_count: Entries in methods
+ * Operation:
+ *   - Maps the file read only and decrypts the mapping, no openssl process
+ *   - Only a single matching method replaces the file, through <path>.dec and a rename
+ *     like the old openssl enc -d ... && mv command, an ambiguous match leaves it untouched
+ * Returns:
+ *   Index of the method that matched, DECRYPT_NO_MATCH, DECRYPT_AMBIGUOUS or DECRYPT_FILE_ERROR
+ */
+int decrypt_file(const char *path, const char *key, const char *const *methods, const size_t method_count) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == OPEN_ERROR) {
+        return DECRYPT_FILE_ERROR;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode) || file_stat.st_size <= SALT_HEADER_SIZE ||
+        file_stat.st_size > DECRYPT_MAX_FILE_SIZE) {
+        close(fd);
+        return DECRYPT_FILE_ERROR;
+    }
+    const size_t size = (size_t) file_stat.st_size;
+    unsigned char *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        close(fd);
+        return DECRYPT_FILE_ERROR;
+    }
+    const size_t plaintext_size = size + DECRYPT_PLAINTEXT_SLACK;
+    unsigned char *plaintext = malloc(plaintext_size);
+    size_t plaintext_length = 0;
+    int matched = plaintext != NULL
+                      ? decrypt_buffer(mapped, size, key, methods, method_count, plaintext, &plaintext_length)
+                      : DECRYPT_FILE_ERROR;
+    munmap(mapped, size);
+    close(fd);
+    if (matched >= 0 && !replace_file(path, file_stat.st_mode & FILE_MODE_BITS, plaintext, plaintext_length)) {
+        matched = DECRYPT_FILE_ERROR;
+    }
+    if (plaintext != NULL) {
+        OPENSSL_cleanse(plaintext, plaintext_size);
+        free(plaintext);
+    }
+    return matched;
+}
@@ -0,0 +1,92 @@
+// file_decrypt.h
+#ifndef FILE_DECRYPT_H
+#define FILE_DECRYPT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DECRYPT_MAX_METHODS 8 //candidate ciphers one DEC message may name
+#define DECRYPT_MAX_FILE_SIZE (16 * 1024 * 1024) //larger files are refused instead of mapped
+#define DECRYPT_NO_MATCH -1 //no candidate method opened the file into a flag line
+#define DECRYPT_FILE_ERROR -2 //missing, unreadable, too large or not an openssl enc -pbkdf2 file
+#define DECRYPT_AMBIGUOUS -3 //more than one candidate method gave a flag line
+#define DECRYPT_PLAINTEXT_SLACK 32 //EVP_MAX_BLOCK_LENGTH, the decrypt may write one block past the input
+
+/**
+ * Parsed DEC message
+ * Components:
+ *   key: Password to try
+ *   path: File to decrypt, relative to the command working directory
+ *   methods: openssl enc cipher names, tried in order
+ *   method_count: Entries in methods
+ */
+typedef struct {
+    const char *key;
+    const char *path;
+    const char *methods[DECRYPT_MAX_METHODS];
+    size_t method_count;
+} DecryptRequest;
+
+/**
+ * Builds DEC message data
+ * Args:
+ *   key: Password to try
+ *   path: File to decrypt
+ *   methods: Candidate cipher names
+ *   method_count: Entries in methods, at most DECRYPT_MAX_METHODS
+ *   out: Destination buffer
+ *   size: Size of out
+ * Operation:
+ *   "<key>\n<path>\n<method>[\n<method>...]"
+ * Returns:
+ *   Length of the data, 0 if it does not fit or a field contains a newline
+ */
+size_t format_decrypt_request(const char *key, const char *path, const char *const *methods, size_t method_count,
+                              char *out, size_t size);
+
+/**
+ * Splits DEC message data in place
+ * Args:
+ *   data: NUL terminated message data, its newlines are replaced
+ *   request: Receives pointers into data
+ * Returns:
+ *   Boolean indicating a key, a path and 1 to DECRYPT_MAX_METHODS methods were found
+ */
+bool parse_decrypt_request(char *data, DecryptRequest *request);
+
+/**
+ * Decrypts the contents of an openssl enc -pbkdf2 file in memory
+ * Args:
+ *   data: File contents, "Salted__", the salt, then the ciphertext
+ *   size: Bytes of data
+ *   key: Password
+ *   methods: Candidate cipher names, tried in order
+ *   method_count: Entries in methods
+ *   plaintext: Receives the plaintext, size + DECRYPT_PLAINTEXT_SLACK bytes
+ *   plaintext_length: Receives its length
+ * Operation:
+ *   - Runs PBKDF2 once for all candidates, a shorter derived key is a prefix of a longer one
+ *   - Tries every candidate, one counts when its padding is valid and the plaintext is a flag line
+ * Returns:
+ *   Index of the only method that matched, DECRYPT_NO_MATCH, DECRYPT_AMBIGUOUS or DECRYPT_FILE_ERROR
+ */
+int decrypt_buffer(const unsigned char *data, size_t size, const char *key, const char *const *methods,
+                   size_t method_count, unsigned char *plaintext, size_t *plaintext_length);
+
+/**
+ * Decrypts an openssl enc -pbkdf2 file
+ * Args:
+ *   path: File to decrypt
+ *   key: Password
+ *   methods: Candidate cipher names, tried in order
+ *   method_count: Entries in methods
+ * Operation:
+ *   - Maps the file read only and decrypts the mapping, no openssl process
+ *   - Only a single matching method replaces the file, through <path>.dec and a rename
+ *     like the old openssl enc -d ... && mv command, an ambiguous match leaves it untouched
+ * Returns:
+ *   Index of the method that matched, DECRYPT_NO_MATCH, DECRYPT_AMBIGUOUS or DECRYPT_FILE_ERROR
+ */
+int decrypt_file(const char *path, const char *key, const char *const *methods, size_t method_count);
+
+#endif // FILE_DECRYPT_H
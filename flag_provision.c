@@ -0,0 +1,397 @@
+/*
+ * Native flag and key file generation
+ * Produces the files the client used to create through echo and openssl enc
+ * shell pipelines, so a game can be provisioned with a single PRV message
+ * A producer thread keeps a pool of finished tuples so the PBKDF2 and RNG
+ * work never runs on a client handler while the player waits
+ */
+
+#include "flag_provision.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include "cryptography_game_util.h"
+#include "mpmc_ring.h"
+
+#define SALT_MAGIC "Salted__"
+#define SALT_MAGIC_SIZE 8
+#define SALT_SIZE 8
+#define SALT_HEADER_SIZE (SALT_MAGIC_SIZE + SALT_SIZE)
+#define PBKDF2_ITERATIONS 10000 //openssl enc -pbkdf2 default
+#define FLAG_LINE_SIZE 64
+#define OPENSSL_OK 1
+#define NULL_CHAR_LEN 1
+#define FIRST_METHOD_INDEX 0
+#define METHOD_NAME_SIZE 16
+#define METHOD_SEPARATORS ", " //names may be padded after the commas
+#define METHOD_LIST_SIZE 256 //longest cipher list
+#define DEFAULT_METHOD_COUNT 3 //names of PROVISION_DEFAULT_METHODS, in that order
+#define DEFAULT_METHOD_MASK ((1u << DEFAULT_METHOD_COUNT) - 1)
+#define SEMAPHORE_THREAD_SHARED 0
+
+/**
+ * Pool of pregenerated tuples
+ * Components:
+ *   slots: PROVISION_POOL_CAPACITY tuples, owned by whoever holds their index
+ *   free_slots: Indexes the producer may fill
+ *   ready_slots: Indexes of finished tuples
+ *   free_count: Counts free_slots entries, the producer sleeps on it
+ *   producer: Background generation thread
+ *   running: Producer should keep going
+ *   started: Pool is usable
+ *   hits: Takes served from ready_slots
+ *   misses: Takes generated on the caller's thread
+ */
+typedef struct {
+    ProvisionMaterial *slots;
+    MpmcRing free_slots;
+    MpmcRing ready_slots;
+    sem_t free_count;
+    pthread_t producer;
+    atomic_bool running;
+    atomic_bool started;
+    atomic_ulong hits;
+    atomic_ulong misses;
+} ProvisionPool;
+
+static ProvisionPool provision_pool;
+// Append only, a name keeps its index and storage once added
+static char method_names[PROVISION_MAX_METHODS][METHOD_NAME_SIZE] = {"aes-256-cbc", "aes-128-cbc", "des-ede3"};
+static unsigned int method_name_count = DEFAULT_METHOD_COUNT; //guarded by methods_mutex
+static atomic_uint active_methods = DEFAULT_METHOD_MASK; //bit per method_names entry in the current set
+static pthread_mutex_t methods_mutex = PTHREAD_MUTEX_INITIALIZER; //serializes provision_set_methods
+
+/**
+ * Builds the contents of key.txt
+ * Args:
+ *   key: Password the flag file is encrypted with
+ *   method: openssl enc cipher name
+ *   out: Destination buffer
+ *   size: Size of out
+ * Operation:
+ *   Same bytes the echo "<key>\n<method>" shell command used to write
+ * Returns:
+ *   Length of the contents, 0 if they do not fit
+ */
+size_t provision_key_file(const char *key, const char *method, char *out, const size_t size) {
+    const int length = snprintf(out, size, "%s\n%s\n", key, method);
+    if (length < 0 || (size_t) length >= size) {
+        return 0;
+    }
+    return (size_t) length;
+}
+
+/**
+ * Builds the contents of the encrypted flag.txt
+ * Args:
+ *   flag_data: Flag string
+ *   key: Password
+ *   method: openssl enc cipher name
+ *   out: Destination buffer
+ *   size: Size of out
+ * Operation:
+ *   - Encrypts the flag line exactly like openssl enc -<method> -e -pbkdf2 -k <key>
+ *   - "Salted__", 8 byte salt, then the ciphertext, key and IV from PBKDF2-SHA256
+ *   - The file still opens with the client's openssl enc -d decrypt command
+ * Returns:
+ *   Length of the contents, 0 on failure
+ */
+size_t provision_flag_file(const char *flag_data, const char *key, const char *method, unsigned char *out,
+                           const size_t size) {
+    const EVP_CIPHER *cipher = EVP_get_cipherbyname(method);
+    char line[FLAG_LINE_SIZE];
+    const int line_length = snprintf(line, sizeof(line), "%s\n", flag_data);
+    if (cipher == NULL || line_length < 0 || (size_t) line_length >= sizeof(line) ||
+        size < SALT_HEADER_SIZE + (size_t) line_length + (size_t) EVP_CIPHER_get_block_size(cipher)) {
+        return 0;
+    }
+    memcpy(out, SALT_MAGIC, SALT_MAGIC_SIZE);
+    unsigned char *salt = out + SALT_MAGIC_SIZE;
+    const int key_length = EVP_CIPHER_get_key_length(cipher);
+    const int iv_length = EVP_CIPHER_get_iv_length(cipher);
+    unsigned char derived[EVP_MAX_KEY_LENGTH + EVP_MAX_IV_LENGTH];
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    int update_length = 0;
+    int final_length = 0;
+    const bool ok = ctx != NULL && RAND_bytes(salt, SALT_SIZE) == OPENSSL_OK &&
+                    PKCS5_PBKDF2_HMAC(key, (int) strlen(key), salt, SALT_SIZE, PBKDF2_ITERATIONS, EVP_sha256(),
+                                      key_length + iv_length, derived) == OPENSSL_OK &&
+                    EVP_EncryptInit_ex(ctx, cipher, NULL, derived, iv_length > 0 ? derived + key_length : NULL) ==
+                    OPENSSL_OK &&
+                    EVP_EncryptUpdate(ctx, out + SALT_HEADER_SIZE, &update_length, (const unsigned char *) line,
+                                      line_length) == OPENSSL_OK &&
+                    EVP_EncryptFinal_ex(ctx, out + SALT_HEADER_SIZE + update_length, &final_length) == OPENSSL_OK;
+    EVP_CIPHER_CTX_free(ctx);
+    OPENSSL_cleanse(derived, sizeof(derived));
+    return ok ? SALT_HEADER_SIZE + (size_t) update_length + (size_t) final_length : 0;
+}
+
+/**
+ * Picks the cipher a key file names
+ * Operation:
+ *   Uniform over the current cipher set
+ * Returns:
+ *   openssl enc cipher name, valid for the rest of the run
+ */
+const char *provision_select_method() {
+    unsigned int methods = atomic_load_explicit(&active_methods, memory_order_acquire);
+    // Drop the lowest set bit until the chosen one is lowest
+    for (unsigned int skip = arc4random_uniform((uint32_t) __builtin_popcount(methods)); skip > 0; skip--) {
+        methods &= methods - 1;
+    }
+    return method_names[__builtin_ctz(methods)];
+}
+
+/**
+ * Tells whether a pooled tuple's cipher is still in the current set
+ * Args:
+ *   method: Name provision_select_method returned
+ * Returns:
+ *   Boolean indicating the set still has it
+ */
+static bool method_active(const char *method) {
+    const unsigned int methods = atomic_load_explicit(&active_methods, memory_order_acquire);
+    for (unsigned int i = 0; i < PROVISION_MAX_METHODS; i++) {
+        if (method == method_names[i]) {
+            return methods & 1u << i;
+        }
+    }
+    return false;
+}
+
+/**
+ * Checks that the client's openssl enc command can decrypt a cipher
+ * Args:
+ *   cipher: Cipher looked up by name
+ * Returns:
+ *   Boolean indicating a block, counter or stream mode without AEAD
+ */
+static bool method_usable(const EVP_CIPHER *cipher) {
+    if (cipher == NULL || EVP_CIPHER_get_flags(cipher) & EVP_CIPH_FLAG_AEAD_CIPHER) {
+        return false;
+    }
+    switch (EVP_CIPHER_get_mode(cipher)) {
+        case EVP_CIPH_ECB_MODE:
+        case EVP_CIPH_CBC_MODE:
+        case EVP_CIPH_CFB_MODE:
+        case EVP_CIPH_OFB_MODE:
+        case EVP_CIPH_CTR_MODE:
+        case EVP_CIPH_STREAM_CIPHER:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Finds a cipher name, adding it to method_names on first use
+ * Args:
+ *   name: Cipher name, shorter than METHOD_NAME_SIZE
+ * Operation:
+ *   Caller holds methods_mutex
+ * Returns:
+ *   Index in method_names, PROVISION_MAX_METHODS when the table is full
+ */
+static unsigned int intern_method(const char *name) {
+    for (unsigned int i = 0; i < method_name_count; i++) {
+        if (strcmp(method_names[i], name) == 0) {
+            return i;
+        }
+    }
+    if (method_name_count == PROVISION_MAX_METHODS) {
+        return PROVISION_MAX_METHODS;
+    }
+    strcpy(method_names[method_name_count], name);
+    return method_name_count++;
+}
+
+/**
+ * Replaces the cipher set key files are written with
+ * Args:
+ *   list: Comma separated openssl enc cipher names
+ * Operation:
+ *   - Takes only ciphers openssl enc can decrypt, block, counter and stream modes without AEAD
+ *   - Names are kept for the whole run, pooled tuples with a dropped cipher are not handed out
+ *   - Keeps the old set if any name is refused
+ * Returns:
+ *   Boolean indicating the new set is in use
+ */
+bool provision_set_methods(const char *list) {
+    char names[METHOD_LIST_SIZE];
+    if (strlen(list) >= sizeof(names)) {
+        return false;
+    }
+    strcpy(names, list);
+    pthread_mutex_lock(&methods_mutex);
+    unsigned int methods = 0;
+    char *saved = NULL;
+    for (const char *name = strtok_r(names, METHOD_SEPARATORS, &saved); name != NULL;
+         name = strtok_r(NULL, METHOD_SEPARATORS, &saved)) {
+        const unsigned int index = strlen(name) < METHOD_NAME_SIZE && method_usable(EVP_get_cipherbyname(name))
+                                       ? intern_method(name)
+                                       : PROVISION_MAX_METHODS;
+        if (index == PROVISION_MAX_METHODS) {
+            pthread_mutex_unlock(&methods_mutex);
+            return false;
+        }
+        methods |= 1u << index;
+    }
+    if (methods != 0) {
+        // Release pairs with the acquire in provision_select_method, a new name is written before its bit
+        atomic_store_explicit(&active_methods, methods, memory_order_release);
+    }
+    pthread_mutex_unlock(&methods_mutex);
+    return methods != 0;
+}
+
+/**
+ * Generates one tuple synchronously
+ * Args:
+ *   material: Receives random flag, key, method and both file contents
+ * Returns:
+ *   Boolean indicating success
+ */
+bool provision_generate_material(ProvisionMaterial *material) {
+    generate_random_string(material->flag_data, PROVISION_FLAG_DATA_SIZE - NULL_CHAR_LEN);
+    generate_random_string(material->key, PROVISION_KEY_SIZE - NULL_CHAR_LEN);
+    material->method = provision_select_method();
+    material->key_file_length = provision_key_file(material->key, material->method, material->key_file,
+                                                   sizeof(material->key_file));
+    material->flag_file_length = provision_flag_file(material->flag_data, material->key, material->method,
+                                                     material->flag_file, sizeof(material->flag_file));
+    return material->key_file_length > 0 && material->flag_file_length > 0;
+}
+
+/**
+ * Producer thread body
+ * Args:
+ *   arg: Unused
+ * Operation:
+ *   Sleeps until a slot is free, fills it and publishes it on the ready ring
+ * Returns: NULL
+ */
+static void *provision_producer(void *arg) {
+    (void) arg;
+    while (atomic_load(&provision_pool.running)) {
+        if (sem_wait(&provision_pool.free_count) != 0) {
+            continue; // interrupted, re-check running
+        }
+        uint64_t index;
+        if (!atomic_load(&provision_pool.running) || !mpmc_ring_pop(&provision_pool.free_slots, &index)) {
+            continue;
+        }
+        if (provision_generate_material(&provision_pool.slots[index])) {
+            mpmc_ring_push(&provision_pool.ready_slots, index);
+        } else {
+            // Retry the slot on the next round
+            mpmc_ring_push(&provision_pool.free_slots, index);
+            sem_post(&provision_pool.free_count);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Starts the background producer that keeps the material pool full
+ * Operation:
+ *   - Allocates PROVISION_POOL_CAPACITY slots and their free/ready rings
+ *   - The producer refills a slot as soon as a consumer returns it
+ * Returns:
+ *   Boolean indicating success
+ */
+bool provision_pool_start() {
+    provision_pool.slots = calloc(PROVISION_POOL_CAPACITY, sizeof(ProvisionMaterial));
+    if (provision_pool.slots == NULL) {
+        return false;
+    }
+    if (!mpmc_ring_init(&provision_pool.free_slots, PROVISION_POOL_CAPACITY)) {
+        free(provision_pool.slots);
+        return false;
+    }
+    if (!mpmc_ring_init(&provision_pool.ready_slots, PROVISION_POOL_CAPACITY)) {
+        mpmc_ring_destroy(&provision_pool.free_slots);
+        free(provision_pool.slots);
+        return false;
+    }
+    for (uint64_t i = 0; i < PROVISION_POOL_CAPACITY; i++) {
+        mpmc_ring_push(&provision_pool.free_slots, i);
+    }
+    sem_init(&provision_pool.free_count, SEMAPHORE_THREAD_SHARED, PROVISION_POOL_CAPACITY);
+    atomic_store(&provision_pool.running, true);
+    if (pthread_create(&provision_pool.producer, NULL, provision_producer, NULL) != 0) {
+        sem_destroy(&provision_pool.free_count);
+        mpmc_ring_destroy(&provision_pool.ready_slots);
+        mpmc_ring_destroy(&provision_pool.free_slots);
+        free(provision_pool.slots);
+        return false;
+    }
+    atomic_store(&provision_pool.started, true);
+    return true;
+}
+
+/**
+ * Stops the producer and frees the pool
+ * Returns: void
+ */
+void provision_pool_stop() {
+    if (!atomic_exchange(&provision_pool.started, false)) {
+        return;
+    }
+    atomic_store(&provision_pool.running, false);
+    sem_post(&provision_pool.free_count);
+    pthread_join(provision_pool.producer, NULL);
+    sem_destroy(&provision_pool.free_count);
+    mpmc_ring_destroy(&provision_pool.ready_slots);
+    mpmc_ring_destroy(&provision_pool.free_slots);
+    OPENSSL_cleanse(provision_pool.slots, PROVISION_POOL_CAPACITY * sizeof(ProvisionMaterial));
+    free(provision_pool.slots);
+}
+
+/**
+ * Takes a ready tuple for a game start
+ * Args:
+ *   material: Receives the tuple
+ * Operation:
+ *   - Pops from the lock-free ready ring and hands the slot back to the producer
+ *   - Skips tuples whose cipher provision_set_methods dropped, the producer refills them with the new set
+ *   - Generates synchronously when the pool is empty or not running
+ *   - Counts pool hits and misses
+ * Returns:
+ *   Boolean indicating material was produced
+ */
+bool provision_pool_take(ProvisionMaterial *material) {
+    uint64_t index;
+    while (atomic_load(&provision_pool.started) && mpmc_ring_pop(&provision_pool.ready_slots, &index)) {
+        const bool current = method_active(provision_pool.slots[index].method);
+        if (current) {
+            *material = provision_pool.slots[index];
+        }
+        OPENSSL_cleanse(&provision_pool.slots[index], sizeof(ProvisionMaterial));
+        mpmc_ring_push(&provision_pool.free_slots, index);
+        sem_post(&provision_pool.free_count);
+        if (current) {
+            atomic_fetch_add(&provision_pool.hits, 1);
+            return true;
+        }
+    }
+    atomic_fetch_add(&provision_pool.misses, 1);
+    return provision_generate_material(material);
+}
+
+/**
+ * Reads the pool counters
+ * Args:
+ *   hits: Receives tuples served from the pool
+ *   misses: Receives tuples generated on the caller's thread
+ * Returns: void
+ */
+void provision_pool_stats(unsigned long *hits, unsigned long *misses) {
+    *hits = atomic_load(&provision_pool.hits);
+    *misses = atomic_load(&provision_pool.misses);
+}
@@ -0,0 +1,139 @@
+// flag_provision.h
+#ifndef FLAG_PROVISION_H
+#define FLAG_PROVISION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PROVISION_KEY_FILE_SIZE 64 //"<key>\n<method>\n"
+#define PROVISION_FLAG_FILE_SIZE 128 //salt header and the padded flag line
+#define PROVISION_FLAG_DATA_SIZE 32 //flag string and terminator
+#define PROVISION_KEY_SIZE 8 //flag file password and terminator
+#define PROVISION_POOL_CAPACITY 256 //ready tuples kept ahead of game starts, two per match
+#define PROVISION_DEFAULT_METHODS "aes-256-cbc,aes-128-cbc,des-ede3" //cipher set until provision_set_methods
+#define PROVISION_MAX_METHODS 16 //distinct cipher names over the whole run
+
+/**
+ * Everything one client needs for a game, generated ahead of time
+ * Components:
+ *   flag_data: Flag string the opponent has to find
+ *   key: Password of the flag file
+ *   method: openssl enc cipher name
+ *   key_file: Contents of key.txt
+ *   key_file_length: Bytes in key_file
+ *   flag_file: Contents of the encrypted flag.txt
+ *   flag_file_length: Bytes in flag_file
+ */
+typedef struct {
+    char flag_data[PROVISION_FLAG_DATA_SIZE];
+    char key[PROVISION_KEY_SIZE];
+    const char *method;
+    char key_file[PROVISION_KEY_FILE_SIZE];
+    size_t key_file_length;
+    unsigned char flag_file[PROVISION_FLAG_FILE_SIZE];
+    size_t flag_file_length;
+} ProvisionMaterial;
+
+/**
+ * Builds the contents of key.txt
+ * Args:
+ *   key: Password the flag file is encrypted with
+ *   method: openssl enc cipher name
+ *   out: Destination buffer
+ *   size: Size of out
+ * Operation:
+ *   Same bytes the echo "<key>\n<method>" shell command used to write
+ * Returns:
+ *   Length of the contents, 0 if they do not fit
+ */
+size_t provision_key_file(const char *key, const char *method, char *out, size_t size);
+
+/**
+ * Builds the contents of the encrypted flag.txt
+ * Args:
+ *   flag_data: Flag string
+ *   key: Password
+ *   method: openssl enc cipher name
+ *   out: Destination buffer
+ *   size: Size of out
+ * Operation:
+ *   - Encrypts the flag line exactly like openssl enc -<method> -e -pbkdf2 -k <key>
+ *   - "Salted__", 8 byte salt, then the ciphertext, key and IV from PBKDF2-SHA256
+ *   - The file still opens with the client's openssl enc -d decrypt command
+ * Returns:
+ *   Length of the contents, 0 on failure
+ */
+size_t provision_flag_file(const char *flag_data, const char *key, const char *method, unsigned char *out,
+                           size_t size);
+
+/**
+ * Picks the cipher a key file names
+ * Operation:
+ *   Uniform over the current cipher set
+ * Returns:
+ *   openssl enc cipher name, valid for the rest of the run
+ */
+const char *provision_select_method();
+
+/**
+ * Replaces the cipher set key files are written with
+ * Args:
+ *   list: Comma separated openssl enc cipher names
+ * Operation:
+ *   - Takes only ciphers openssl enc can decrypt, block, counter and stream modes without AEAD
+ *   - Names are kept for the whole run, pooled tuples with a dropped cipher are not handed out
+ *   - Keeps the old set if any name is refused
+ * Returns:
+ *   Boolean indicating the new set is in use
+ */
+bool provision_set_methods(const char *list);
+
+/**
+ * Generates one tuple synchronously
+ * Args:
+ *   material: Receives random flag, key, method and both file contents
+ * Returns:
+ *   Boolean indicating success
+ */
+bool provision_generate_material(ProvisionMaterial *material);
+
+/**
+ * Starts the background producer that keeps the material pool full
+ * Operation:
+ *   - Allocates PROVISION_POOL_CAPACITY slots and their free/ready rings
+ *   - The producer refills a slot as soon as a consumer returns it
+ * Returns:
+ *   Boolean indicating success
+ */
+bool provision_pool_start();
+
+/**
+ * Stops the producer and frees the pool
+ * Returns: void
+ */
+void provision_pool_stop();
+
+/**
+ * Takes a ready tuple for a game start
+ * Args:
+ *   material: Receives the tuple
+ * Operation:
+ *   - Pops from the lock-free ready ring and hands the slot back to the producer
+ *   - Skips tuples whose cipher provision_set_methods dropped, the producer refills them with the new set
+ *   - Generates synchronously when the pool is empty or not running
+ *   - Counts pool hits and misses
+ * Returns:
+ *   Boolean indicating material was produced
+ */
+bool provision_pool_take(ProvisionMaterial *material);
+
+/**
+ * Reads the pool counters
+ * Args:
+ *   hits: Receives tuples served from the pool
+ *   misses: Receives tuples generated on the caller's thread
+ * Returns: void
+ */
+void provision_pool_stats(unsigned long *hits, unsigned long *misses);
+
+#endif // FLAG_PROVISION_H
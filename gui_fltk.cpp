@@ -8,6 +8,7 @@
 #include <FL/Fl_Text_Display.H>
 #include <FL/Fl_Text_Buffer.H>
 #include <FL/fl_ask.H>
+#include <atomic>
 
 extern "C" {
 #include "cryptography_game_util.h"
@@ -16,10 +17,15 @@ extern "C" {
 #define SLEEP 3000
 #define SECONDS 0
 #define MAX_COMMAND_LENGTH 250
-#define COMMAND_BUFFER_SIZE 512
 #define COMMAND_MESSAGE_SIZE 1024
 #define MAX_OPENSSL_LENGTH 400
+#define SUBMIT_PREFIX "submit " //command input prefix that sends the rest as a flag guess
+#define CANCEL_COMMAND "cancel" //command input that stops the commands still running remotely
 #define FIRST_ENC_LIST_INDEX 0
+#define FIRST_CIPHER_INDEX 1 //encryption_methods entries after "None" are cipher names
+#define CIPHER_COUNT 3
+#define ANY_METHOD "Any" //tries every cipher in one request
+#define SINGLE_METHOD 1
 #define MESSAGE_WINDOW_ARGS 300, 100, "Message"
 #define MESSAGE_WINDOW_BOX_ARGS 10, 10, 280, 40
 #define MESSAGE_WINDOW_BUTTON_ARGS 110, 60, 80, 30, "OK"
@@ -54,7 +60,12 @@ extern "C" {
 #define Y_POS_INCREMENT_A 20
 #define Y_POS_INCREMENT_B 10
 #define ELEMENT_HEIGHT 30
-#define UI_REFRESH_INTERVAL 0.1
+#define OUTPUT_DRAIN_BUDGET 65536 //bytes appended per wakeup before input events get a turn
+#define SCROLLBACK_TRIM_PCT 75 //share of the limit kept after a trim, so trims run once per quarter limit of output
+#define SCROLLBACK_PCT_DIVISOR 100
+#define LINE_BREAK_LEN 1
+#define AWAKE_OK 0
+#define CWD_TEXT_SIZE 1024
 
 
 /**
@@ -127,7 +138,7 @@ void display_message(const char *message) {
  *   encryption_choice: Encryption method selector
  *   cwd_label: Current working directory display
  *   submit_button: Decrypt action button
- *   socket_fd: Server communication socket
+ *   core: Game session
  *   cmd_label: Command input label
  *   enc_label: Encryption selector label
  *   key_label: Key input label
@@ -149,8 +160,7 @@ typedef struct {
     Fl_Choice *encryption_choice;
     Fl_Box *cwd_label;
     Fl_Button *submit_button;
-    int socket_fd;
-    const unsigned char *encryption_key;
+    ClientCore *core;
     Fl_Box *cmd_label;
     Fl_Box *enc_label;
     Fl_Box *key_label;
@@ -159,43 +169,144 @@ typedef struct {
 } GuiComponents;
 
 static GuiComponents *gui = nullptr;
+static std::atomic<bool> gui_running(false); // Fl::lock was called, Fl::awake is safe from other threads
+static std::atomic<bool> update_pending(false); // an update_gui_cb is queued and has not started yet
+static std::atomic<bool> closed_pending(false); // the listener saw the connection close
+static size_t scrollback_limit = DEFAULT_SCROLLBACK_LIMIT; // bytes the text display keeps
+static char output_batch[OUTPUT_DRAIN_BUDGET + NULL_CHAR_LEN]; // FLTK thread only, one append per wakeup
+static pthread_mutex_t cwd_mutex = PTHREAD_MUTEX_INITIALIZER; // guards cwd_text and cwd_updated
+static char cwd_text[CWD_TEXT_SIZE] = {NULL_CHAR}; // latest working directory from the session
+static bool cwd_updated = false; // cwd_text changed since the label last showed it
 
 static const char *encryption_methods[] = {
     "None",
     "aes-256-cbc",
     "aes-128-cbc",
     "des-ede3",
+    ANY_METHOD,
     nullptr
 };
 
 /**
- * @brief Periodic callback function for updating the GUI.
- *
- * This function checks shared buffers for changes and updates the GUI accordingly.
- * Buffers are properly cleared after being processed.
+ * Sets how much output the text display keeps
+ * Args:
+ *   limit: Scrollback size in bytes
+ * Operation:
+ *   Raised to MIN_SCROLLBACK_LIMIT, call before start_gui
+ * Returns: void
+ */
+void set_scrollback_limit(const size_t limit) {
+    scrollback_limit = limit < MIN_SCROLLBACK_LIMIT ? MIN_SCROLLBACK_LIMIT : limit;
+}
+
+/**
+ * Appends text to the display and drops the oldest lines past the scrollback limit
+ * Args:
+ *   text: Null terminated text
+ * Operation:
+ *   - Trims down to SCROLLBACK_TRIM_PCT of the limit at a line start, so the
+ *     buffer is shifted rarely instead of on every append
+ *   - Fl_Text_Display redraws only the lines the change touched
+ * Returns: void
+ */
+static void append_scrollback(const char *text) {
+    gui->text_buffer->append(text);
+    const int length = gui->text_buffer->length();
+    if ((size_t) length <= scrollback_limit) {
+        return;
+    }
+    const int cut = gui->text_buffer->utf8_align(
+        length - (int) (scrollback_limit / SCROLLBACK_PCT_DIVISOR * SCROLLBACK_TRIM_PCT));
+    const int line_cut = gui->text_buffer->line_end(cut) + LINE_BREAK_LEN;
+    // A single line longer than what is kept is cut mid line
+    gui->text_buffer->remove(0, line_cut < length ? line_cut : cut);
+}
+
+/**
+ * Applies pending output and working directory updates
+ * Args:
+ *   data: User data (unused)
+ * Operation:
+ *   - Runs on the FLTK thread through Fl::awake, only when notify_gui was called
+ *   - Collects up to OUTPUT_DRAIN_BUDGET from the output ring and appends it at once
+ *   - Queues itself again when the budget ran out, so a flood cannot starve input
+ * Returns: void
  */
-static void periodic_update_cb(void *) {
+static void update_gui_cb(void *) {
+    // Cleared first, output queued after this point asks for another wakeup
+    update_pending = false;
     if (gui && gui->window) {
-        // Check for output updates
-        pthread_mutex_lock(&output_mutex);
-        if (output_updated && gui->text_buffer) {
-            gui->text_buffer->append(output_buffer);
-            memset(output_buffer, NULL_CHAR, sizeof(output_buffer));
-            output_updated = false;
-            gui->text_display->redraw();
+        if (gui->text_buffer) {
+            size_t drained = 0;
+            size_t amount;
+            while (drained < OUTPUT_DRAIN_BUDGET &&
+                   (amount = take_output(output_batch + drained, OUTPUT_DRAIN_BUDGET - drained)) > 0) {
+                drained += amount;
+            }
+            if (drained > 0) {
+                output_batch[drained] = NULL_CHAR;
+                append_scrollback(output_batch);
+            }
+            if (drained >= OUTPUT_DRAIN_BUDGET) {
+                notify_gui();
+            }
         }
-        pthread_mutex_unlock(&output_mutex);
         // Check for CWD updates
-        pthread_mutex_lock(&cwd_buffer_mutex);
+        pthread_mutex_lock(&cwd_mutex);
         if (cwd_updated && gui->cwd_label) {
-            gui->cwd_label->copy_label(cwd_buffer);
-            memset(cwd_buffer, NULL_CHAR, sizeof(cwd_buffer));
+            gui->cwd_label->copy_label(cwd_text);
+            memset(cwd_text, NULL_CHAR, sizeof(cwd_text));
             cwd_updated = false;
             gui->cwd_label->redraw();
         }
-        pthread_mutex_unlock(&cwd_buffer_mutex);
+        pthread_mutex_unlock(&cwd_mutex);
+    }
+}
+
+/**
+ * Tells the GUI thread that output or the working directory changed
+ * Operation:
+ *   - Safe from any thread, queues at most one Fl::awake callback at a time
+ *   - Does nothing before the GUI runs, start_gui picks up what came earlier
+ * Returns: void
+ */
+void notify_gui(void) {
+    if (gui_running && !update_pending.exchange(true)) {
+        if (Fl::awake(update_gui_cb) != AWAKE_OK) {
+            update_pending = false; // FLTK's awake queue is full, the next update tries again
+        }
+    }
+}
+
+/**
+ * Shows the other player's working directory
+ * Args:
+ *   cwd: Directory path
+ * Operation:
+ *   - Safe from any thread, the label changes on the FLTK thread
+ *   - May be called before start_gui, the window starts with the latest path
+ * Returns: void
+ */
+void set_gui_cwd(const char *cwd) {
+    pthread_mutex_lock(&cwd_mutex);
+    strncpy(cwd_text, cwd, sizeof(cwd_text) - NULL_CHAR_LEN);
+    cwd_text[sizeof(cwd_text) - NULL_CHAR_LEN] = NULL_CHAR;
+    cwd_updated = true;
+    pthread_mutex_unlock(&cwd_mutex);
+    notify_gui();
+}
+
+/**
+ * Shows the connection closed notice on the FLTK thread
+ * Args:
+ *   data: User data (unused)
+ * Returns: void
+ */
+static void connection_closed_cb(void *) {
+    if (gui && closed_pending) {
+        gui->connection_closed = true;
+        display_message("Connection closed, close window");
     }
-    Fl::repeat_timeout(UI_REFRESH_INTERVAL, periodic_update_cb);
 }
 
 /**
@@ -203,17 +314,15 @@ static void periodic_update_cb(void *) {
  * Args:
  *   is_closed: Boolean indicating if connection is closed
  * Operation:
- *   - Sets global connection status
+ *   - Called from the listener thread, the widgets are only touched on the FLTK thread
  *   - Displays notification if connection closed
  *   - Updates UI state
  * Returns: void
  */
 void set_connection_status(const bool is_closed) {
-    if (gui) {
-        gui->connection_closed = is_closed;
-        if (is_closed) {
-            display_message("Connection closed, close window");
-        }
+    closed_pending = is_closed;
+    if (is_closed && gui_running) {
+        Fl::awake(connection_closed_cb);
     }
 }
 
@@ -223,13 +332,12 @@ void set_connection_status(const bool is_closed) {
  *   message: Text string to append
  * Operation:
  *   - Appends to text buffer if GUI exists
- *   - Triggers text display redraw
+ *   - Keeps the buffer within the scrollback limit
  * Returns: void
  */
 void append_to_text_view(const char *message) {
     if (gui && gui->text_buffer) {
-        gui->text_buffer->append(message);
-        gui->text_display->redraw();
+        append_scrollback(message);
     }
 }
 
@@ -268,7 +376,7 @@ void close_cb(Fl_Widget *, void *data) {
  *   command: Command string to execute
  * Operation:
  *   - Validates command and connection
- *   - Prepares and sends to server
+ *   - Sends "submit <flag>" as a flag guess, "cancel" as a cancel request, anything else as a command
  *   - Updates display
  * Returns: void
  */
@@ -282,9 +390,14 @@ static void handle_regular_command(const char *command) {
         display_message("Unsupported command");
         return;
     }
-    char buffer[COMMAND_BUFFER_SIZE];
-    prepare_buffer(buffer, sizeof(buffer), command, "CMD");
-    s_send(gui->socket_fd, gui->encryption_key, buffer, strlen(buffer));
+    if (strncmp(command, SUBMIT_PREFIX, strlen(SUBMIT_PREFIX)) == CMP_EQUAL) {
+        const char *flag = command + strlen(SUBMIT_PREFIX);
+        client_core_submit_flag(gui->core, flag, strlen(flag));
+    } else if (strcmp(command, CANCEL_COMMAND) == CMP_EQUAL) {
+        client_core_cancel_remote(gui->core);
+    } else {
+        client_core_send_command(gui->core, command, strlen(command));
+    }
     char message[COMMAND_MESSAGE_SIZE];
     snprintf(message, sizeof(message), ":$> %s\n", command);
     append_to_text_view(message);
@@ -294,8 +407,8 @@ static void handle_regular_command(const char *command) {
  * Processes file decryption operations
  * Operation:
  *   - Validates encryption parameters
- *   - Constructs OpenSSL command
- *   - Sends to server
+ *   - Asks the other client to decrypt with the chosen method, or every method for "Any"
+ *   - The other client only replaces the file when exactly one method gives a flag line
  *   - Resets input fields
  * Returns: void
  */
@@ -313,12 +426,11 @@ static void handle_encryption_command() {
         display_message("Unsupported command");
         return;
     }
-    char command[COMMAND_BUFFER_SIZE];
-    snprintf(command, sizeof(command), "openssl enc -d -%s -in %s -out %s.dec -k %s -pbkdf2 && mv %s.dec %s",
-             encryption_method, path, path, key, path, path);
-    char buffer[COMMAND_MESSAGE_SIZE];
-    prepare_buffer(buffer, sizeof(buffer), command, "CMD");
-    s_send(gui->socket_fd, gui->encryption_key, buffer, strlen(buffer));
+    if (strcmp(encryption_method, ANY_METHOD) == CMP_EQUAL) {
+        client_core_request_decrypt(gui->core, key, path, encryption_methods + FIRST_CIPHER_INDEX, CIPHER_COUNT);
+    } else {
+        client_core_request_decrypt(gui->core, key, path, &encryption_method, SINGLE_METHOD);
+    }
 }
 
 /**
@@ -365,6 +477,7 @@ static void submit_callback(Fl_Widget *, void *) {
  * Returns: void
  */
 void cleanup_gui() {
+    gui_running = false;
     if (!gui) return;
     // Delete all widgets in reverse order of creation
     delete gui->submit_button;
@@ -486,18 +599,19 @@ void initialize_encryption_section(GuiComponents *gui, const int margin, const i
 /**
  * Initializes and displays main GUI
  * Args:
- *   socket_fd: Socket for server communication
+ *   core: Game session the GUI sends commands on
  */
-void start_gui(const int socket_fd, const unsigned char *encryption_key) {
+void start_gui(ClientCore *core) {
     cleanup_gui();
+    // Enables Fl::awake, must happen on this thread before any other thread uses it
+    Fl::lock();
     const int screen_w = Fl::w();
     const int screen_h = Fl::h();
     const int win_w = screen_w * WINDOW_SIZE_PCT / ENCRYPTION_PCT_DIVISOR;
     const int win_h = screen_h * WINDOW_SIZE_PCT / ENCRYPTION_PCT_DIVISOR;
     gui = new GuiComponents;
     memset(gui, 0, sizeof(GuiComponents));
-    gui->socket_fd = socket_fd;
-    gui->encryption_key = encryption_key;
+    gui->core = core;
     gui->window = new Fl_Window(win_w, win_h, "Cryptography Game Client");
     constexpr int margin = MARGIN_SIZE;
     const int text_display_h = win_h - (TEXT_DISPLAY_HEIGHT_MULTIPLIER * ELEMENT_HEIGHT +
@@ -514,6 +628,11 @@ void start_gui(const int socket_fd, const unsigned char *encryption_key) {
     gui->window->resizable(gui->text_display);
     gui->window->end();
     gui->window->show();
-    Fl::add_timeout(UI_REFRESH_INTERVAL, periodic_update_cb);
+    // From here on the listener wakes this thread instead of a timer polling it
+    gui_running = true;
+    update_gui_cb(nullptr);
+    if (closed_pending) {
+        connection_closed_cb(nullptr);
+    }
     Fl::run();
 }
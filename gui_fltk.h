@@ -7,20 +7,59 @@ extern "C" {
 #endif
 
 #include <pthread.h>
+#include "client_core.h"
 
-extern pthread_mutex_t output_mutex;
-extern pthread_mutex_t cwd_buffer_mutex;
-extern char output_buffer[4096];
-extern char cwd_buffer[1024];
-extern bool output_updated;
-extern bool cwd_updated;
+#define DEFAULT_SCROLLBACK_LIMIT (4 * 1024 * 1024) //bytes of output the text display keeps
+#define MIN_SCROLLBACK_LIMIT 4096
+
+/**
+ * Moves queued remote output to the GUI, GUI thread only, provided by the front end
+ * Args:
+ *   buffer: Destination
+ *   size: Size of buffer
+ * Operation:
+ *   Lets a listener blocked on a full output ring continue
+ * Returns:
+ *   Bytes taken, 0 when nothing is queued
+ */
+size_t take_output(char *buffer, size_t size);
+
+/**
+ * Tells the GUI thread that output or the working directory changed
+ * Operation:
+ *   - Safe from any thread, queues at most one Fl::awake callback at a time
+ *   - Does nothing before the GUI runs, start_gui picks up what came earlier
+ * Returns: void
+ */
+void notify_gui(void);
+
+/**
+ * Shows the other player's working directory
+ * Args:
+ *   cwd: Directory path
+ * Operation:
+ *   - Safe from any thread, the label changes on the FLTK thread
+ *   - May be called before start_gui, the window starts with the latest path
+ * Returns: void
+ */
+void set_gui_cwd(const char *cwd);
+
+/**
+ * Sets how much output the text display keeps
+ * Args:
+ *   limit: Scrollback size in bytes
+ * Operation:
+ *   Raised to MIN_SCROLLBACK_LIMIT, call before start_gui
+ * Returns: void
+ */
+void set_scrollback_limit(size_t limit);
 
 /**
  * Initializes and displays main GUI
  * Args:
- *   socket_fd: Socket for server communication
+ *   core: Game session the GUI sends commands on
  */
-void start_gui(int socket_fd, const unsigned char *encryption_key);
+void start_gui(ClientCore *core);
 
 /**
  * Shows a modal message window
@@ -0,0 +1,332 @@
+/*
+ * Listening socket handoff between server processes
+ * A running server offers its listening sockets on a unix socket, a new
+ * process started with the same path takes them over with SCM_RIGHTS.
+ * Both processes then hold the same kernel listen queues, so a connection
+ * arriving during the restart waits in the queue instead of being refused,
+ * and the old process only stops accepting and lets its games end
+ */
+
+#define _GNU_SOURCE
+#include "handoff.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define HANDOFF_REQUEST 'H' //successor asks for the sockets
+#define HANDOFF_CONFIRM 'C' //successor accepts on them now
+#define HANDOFF_TIMEOUT_SECONDS 30 //longest wait for the other side, covers the successor's startup
+#define HANDOFF_MILLISECONDS_PER_SECOND 1000
+#define HANDOFF_BACKLOG 1
+#define HANDOFF_MESSAGE_SIZE 1
+#define HANDOFF_ACCEPT_POLL_INDEX 0
+#define HANDOFF_PEER_POLL_INDEX 0
+#define HANDOFF_SHUTDOWN_POLL_INDEX 1
+#define HANDOFF_POLL_COUNT 2
+#define HANDOFF_POLL_FOREVER -1
+#define HANDOFF_CONTROL_SIZE CMSG_SPACE(sizeof(int) * HANDOFF_MAX_SOCKETS)
+#define SOCKET_ERROR -1
+#define PTHREAD_CREATE_SUCCESS 0
+
+/**
+ * Sockets offered to a successor
+ * Components:
+ *   thread: Answers successors
+ *   socketFD: Listening unix socket, SOCKET_ERROR when not offering
+ *   shutdown_fd: Readable once the server stops
+ *   sockets: Listening descriptors handed over
+ *   roles: HANDOFF_ROLE_* of each socket, sent as the payload
+ *   count: Number of sockets
+ *   drain: Called once a successor confirmed
+ *   path: Bound path, removed on stop unless it was handed off
+ *   running: Thread started
+ *   done: A successor confirmed
+ */
+typedef struct {
+    pthread_t thread;
+    int socketFD;
+    int shutdown_fd;
+    int sockets[HANDOFF_MAX_SOCKETS];
+    unsigned char roles[HANDOFF_MAX_SOCKETS];
+    unsigned int count;
+    HandoffDrain drain;
+    char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    bool running;
+    atomic_bool done;
+} HandoffOffer;
+
+/**
+ * Control buffer aligned for cmsghdr
+ */
+typedef union {
+    char buffer[HANDOFF_CONTROL_SIZE];
+    struct cmsghdr alignment;
+} HandoffControl;
+
+static HandoffOffer offer = {.socketFD = SOCKET_ERROR};
+
+/**
+ * Fills a unix socket address
+ * Args:
+ *   path: Socket path
+ *   address: Address to fill
+ * Returns:
+ *   Boolean indicating path fits sun_path
+ */
+static bool fill_address(const char *path, struct sockaddr_un *address) {
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        return false;
+    }
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+    return true;
+}
+
+/**
+ * Waits for one message byte from the other side
+ * Args:
+ *   connection: Handoff connection
+ *   stop_fd: Ends the wait early when readable, SOCKET_ERROR for none
+ *   expected: Byte the other side must send
+ * Returns:
+ *   Boolean indicating expected arrived within HANDOFF_TIMEOUT_SECONDS
+ */
+static bool wait_for_message(const int connection, const int stop_fd, const char expected) {
+    struct pollfd fds[HANDOFF_POLL_COUNT] = {
+        [HANDOFF_PEER_POLL_INDEX] = {.fd = connection, .events = POLLIN},
+        [HANDOFF_SHUTDOWN_POLL_INDEX] = {.fd = stop_fd, .events = POLLIN}
+    };
+    int ready;
+    do {
+        ready = poll(fds, HANDOFF_POLL_COUNT, HANDOFF_TIMEOUT_SECONDS * HANDOFF_MILLISECONDS_PER_SECOND);
+    } while (ready < 0 && errno == EINTR);
+    if (ready <= 0 || fds[HANDOFF_SHUTDOWN_POLL_INDEX].revents) {
+        return false;
+    }
+    char message;
+    return recv(connection, &message, HANDOFF_MESSAGE_SIZE, 0) == HANDOFF_MESSAGE_SIZE && message == expected;
+}
+
+/**
+ * Takes the listening sockets of the server running on a handoff socket
+ * Args:
+ *   path: Handoff socket of the running server
+ *   sockets: Receives up to HANDOFF_MAX_SOCKETS listening descriptors
+ *   roles: Receives the HANDOFF_ROLE_* of each socket
+ *   count: Receives the number of sockets
+ * Operation:
+ *   - Sends a request, the sockets arrive in one SCM_RIGHTS message with their roles as the payload
+ *   - The old server keeps accepting until handoff_confirm, closing the connection instead cancels
+ * Returns:
+ *   Connection to confirm on, HANDOFF_NONE when nothing listens on path or the transfer failed
+ */
+int handoff_take(const char *path, int *sockets, unsigned char *roles, unsigned int *count) {
+    struct sockaddr_un address;
+    if (!fill_address(path, &address)) {
+        return HANDOFF_NONE;
+    }
+    const int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connection == SOCKET_ERROR) {
+        return HANDOFF_NONE;
+    }
+    const struct timeval timeout = {.tv_sec = HANDOFF_TIMEOUT_SECONDS};
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    const char request = HANDOFF_REQUEST;
+    if (connect(connection, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+        send(connection, &request, HANDOFF_MESSAGE_SIZE, MSG_NOSIGNAL) != HANDOFF_MESSAGE_SIZE) {
+        close(connection);
+        return HANDOFF_NONE;
+    }
+    HandoffControl control;
+    struct iovec payload = {.iov_base = roles, .iov_len = HANDOFF_MAX_SOCKETS};
+    struct msghdr message = {
+        .msg_iov = &payload, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof(control)
+    };
+    ssize_t received;
+    do {
+        received = recvmsg(connection, &message, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    const struct cmsghdr *header = received > 0 ? CMSG_FIRSTHDR(&message) : NULL;
+    if (header == NULL || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+        close(connection);
+        return HANDOFF_NONE;
+    }
+    const unsigned int passed = (unsigned int) ((header->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    memcpy(sockets, CMSG_DATA(header), passed * sizeof(int));
+    // Every socket needs its role byte, anything else is a truncated or foreign message
+    if (passed != (size_t) received || (message.msg_flags & MSG_CTRUNC)) {
+        for (unsigned int i = 0; i < passed; i++) {
+            close(sockets[i]);
+        }
+        close(connection);
+        return HANDOFF_NONE;
+    }
+    *count = passed;
+    return connection;
+}
+
+/**
+ * Tells the old server this one accepts now, it stops accepting and drains its games
+ * Args:
+ *   connection: Connection handoff_take returned
+ * Returns:
+ *   Boolean indicating the confirmation was sent
+ */
+bool handoff_confirm(const int connection) {
+    const char confirmation = HANDOFF_CONFIRM;
+    const bool sent = send(connection, &confirmation, HANDOFF_MESSAGE_SIZE, MSG_NOSIGNAL) == HANDOFF_MESSAGE_SIZE;
+    close(connection);
+    return sent;
+}
+
+/**
+ * Hands the offered sockets to one successor
+ * Args:
+ *   connection: Accepted successor connection
+ * Operation:
+ *   Request, SCM_RIGHTS reply, confirmation, each waited for at most HANDOFF_TIMEOUT_SECONDS
+ * Returns:
+ *   Boolean indicating the successor confirmed, without it this server keeps its sockets to itself
+ */
+static bool answer_successor(const int connection) {
+    if (!wait_for_message(connection, offer.shutdown_fd, HANDOFF_REQUEST)) {
+        return false;
+    }
+    HandoffControl control;
+    memset(&control, 0, sizeof(control));
+    struct iovec payload = {.iov_base = offer.roles, .iov_len = offer.count};
+    struct msghdr message = {
+        .msg_iov = &payload, .msg_iovlen = 1,
+        .msg_control = control.buffer, .msg_controllen = CMSG_SPACE(sizeof(int) * offer.count)
+    };
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int) * offer.count);
+    memcpy(CMSG_DATA(header), offer.sockets, sizeof(int) * offer.count);
+    if (sendmsg(connection, &message, MSG_NOSIGNAL) != (ssize_t) offer.count) {
+        return false;
+    }
+    return wait_for_message(connection, offer.shutdown_fd, HANDOFF_CONFIRM);
+}
+
+/**
+ * Handoff thread
+ * Args:
+ *   arg: Unused
+ * Operation:
+ *   Answers successors until one confirms or shutdown_fd fires, then calls drain once
+ * Returns:
+ *   NULL
+ */
+static void *offer_thread(void *arg) {
+    (void) arg;
+    struct pollfd fds[HANDOFF_POLL_COUNT] = {
+        [HANDOFF_ACCEPT_POLL_INDEX] = {.fd = offer.socketFD, .events = POLLIN},
+        [HANDOFF_SHUTDOWN_POLL_INDEX] = {.fd = offer.shutdown_fd, .events = POLLIN}
+    };
+    while (!atomic_load(&offer.done)) {
+        if (poll(fds, HANDOFF_POLL_COUNT, HANDOFF_POLL_FOREVER) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[HANDOFF_SHUTDOWN_POLL_INDEX].revents) {
+            break;
+        }
+        const int connection = accept4(offer.socketFD, NULL, NULL, SOCK_CLOEXEC);
+        if (connection == SOCKET_ERROR) {
+            continue;
+        }
+        if (answer_successor(connection)) {
+            atomic_store(&offer.done, true);
+            offer.drain();
+        }
+        close(connection);
+    }
+    return NULL;
+}
+
+/**
+ * Offers this server's listening sockets to its successor
+ * Args:
+ *   path: Handoff socket to bind, a stale file or the one the predecessor bound is replaced
+ *   sockets: Listening descriptors, kept open by the caller
+ *   roles: HANDOFF_ROLE_* of each socket
+ *   count: Number of sockets
+ *   drain: Called once a successor confirmed
+ *   shutdown_fd: Readable once the server stops, ends the offer
+ * Operation:
+ *   A thread answers one successor at a time and stops offering after the first confirmation
+ * Returns:
+ *   Boolean indicating the socket is bound and the thread runs
+ */
+bool handoff_serve(const char *path, const int *sockets, const unsigned char *roles, const unsigned int count,
+                   const HandoffDrain drain, const int shutdown_fd) {
+    struct sockaddr_un address;
+    if (count == 0 || count > HANDOFF_MAX_SOCKETS || !fill_address(path, &address)) {
+        return false;
+    }
+    offer.socketFD = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (offer.socketFD == SOCKET_ERROR) {
+        return false;
+    }
+    // Left behind by a crash or by the predecessor, which stopped offering once it handed off
+    unlink(path);
+    if (bind(offer.socketFD, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+        listen(offer.socketFD, HANDOFF_BACKLOG) != 0) {
+        close(offer.socketFD);
+        offer.socketFD = SOCKET_ERROR;
+        return false;
+    }
+    memcpy(offer.sockets, sockets, sizeof(int) * count);
+    memcpy(offer.roles, roles, count);
+    offer.count = count;
+    offer.drain = drain;
+    offer.shutdown_fd = shutdown_fd;
+    strcpy(offer.path, path);
+    offer.running = pthread_create(&offer.thread, NULL, offer_thread, NULL) == PTHREAD_CREATE_SUCCESS;
+    if (!offer.running) {
+        close(offer.socketFD);
+        offer.socketFD = SOCKET_ERROR;
+        unlink(path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Tells whether a successor took the sockets over
+ * Returns:
+ *   Boolean indicating the listening sockets are shared with a successor
+ */
+bool handoff_done() {
+    return atomic_load(&offer.done);
+}
+
+/**
+ * Stops offering and joins the thread after shutdown_fd fired or a handoff
+ * Operation:
+ *   Removes the socket file unless a successor owns it now
+ * Returns: void
+ */
+void handoff_stop() {
+    if (!offer.running) {
+        return;
+    }
+    pthread_join(offer.thread, NULL);
+    offer.running = false;
+    close(offer.socketFD);
+    offer.socketFD = SOCKET_ERROR;
+    if (!atomic_load(&offer.done)) {
+        unlink(offer.path);
+    }
+}
@@ -0,0 +1,76 @@
+// handoff.h
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdbool.h>
+
+#define HANDOFF_MAX_SOCKETS 128 //listening sockets passed in one message
+#define HANDOFF_NONE -1 //no predecessor handed anything over
+#define HANDOFF_ROLE_CLIENT 0 //role byte of a client listener
+#define HANDOFF_ROLE_CLUSTER 1 //role byte of the listener other nodes relay to
+
+/**
+ * Starts draining once a successor accepts on the handed over sockets
+ * Operation:
+ *   Called on the handoff thread, must only flag the accept loops
+ * Returns: void
+ */
+typedef void (*HandoffDrain)(void);
+
+/**
+ * Takes the listening sockets of the server running on a handoff socket
+ * Args:
+ *   path: Handoff socket of the running server
+ *   sockets: Receives up to HANDOFF_MAX_SOCKETS listening descriptors
+ *   roles: Receives the HANDOFF_ROLE_* of each socket
+ *   count: Receives the number of sockets
+ * Operation:
+ *   - Sends a request, the sockets arrive in one SCM_RIGHTS message with their roles as the payload
+ *   - The old server keeps accepting until handoff_confirm, closing the connection instead cancels
+ * Returns:
+ *   Connection to confirm on, HANDOFF_NONE when nothing listens on path or the transfer failed
+ */
+int handoff_take(const char *path, int *sockets, unsigned char *roles, unsigned int *count);
+
+/**
+ * Tells the old server this one accepts now, it stops accepting and drains its games
+ * Args:
+ *   connection: Connection handoff_take returned
+ * Returns:
+ *   Boolean indicating the confirmation was sent
+ */
+bool handoff_confirm(int connection);
+
+/**
+ * Offers this server's listening sockets to its successor
+ * Args:
+ *   path: Handoff socket to bind, a stale file or the one the predecessor bound is replaced
+ *   sockets: Listening descriptors, kept open by the caller
+ *   roles: HANDOFF_ROLE_* of each socket
+ *   count: Number of sockets
+ *   drain: Called once a successor confirmed
+ *   shutdown_fd: Readable once the server stops, ends the offer
+ * Operation:
+ *   A thread answers one successor at a time and stops offering after the first confirmation
+ * Returns:
+ *   Boolean indicating the socket is bound and the thread runs
+ */
+bool handoff_serve(const char *path, const int *sockets, const unsigned char *roles, unsigned int count,
+                   HandoffDrain drain, int shutdown_fd);
+
+/**
+ * Tells whether a successor took the sockets over
+ * Returns:
+ *   Boolean indicating the listening sockets are shared with a successor
+ */
+bool handoff_done();
+
+/**
+ * Stops offering and joins the thread after shutdown_fd fired or a handoff
+ * Operation:
+ *   Removes the socket file unless a successor owns it now
+ * Returns: void
+ */
+void handoff_stop();
+
+#endif // HANDOFF_H
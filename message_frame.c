@@ -0,0 +1,713 @@
+/*
+ * Single-pass parser and encoder for the game's wire frames
+ * Two formats share one FrameView:
+ * - text: "tlength:..;type:..;length:..;data:.." understood by every client
+ * - binary: magic, version, then a type byte and LEB128 length per segment,
+ *   used once both peers advertised FRAME_CAPABILITY_BINARY in a HEL message
+ * The parser never copies or terminates anything, every field of the
+ * resulting FrameView points back into the receive buffer
+ */
+
+#include "message_frame.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TLENGTH_FIELD "tlength:"
+#define TYPE_FIELD "type:"
+#define LENGTH_FIELD "length:"
+#define DATA_FIELD "data:"
+#define FIELD_SEPARATOR ';'
+#define DECIMAL_BASE 10
+#define MAX_LENGTH_DIGITS 9
+#define FIELD_SEPARATOR_LENGTH 1
+#define VARINT_PAYLOAD_BITS 7
+#define VARINT_PAYLOAD_MASK 0x7Fu
+#define VARINT_CONTINUE 0x80u
+#define MAX_VARINT_BYTES 4 //28 bits, far above FRAME_MAX_SIZE
+#define FRAME_SEND_STACK_SIZE 4096
+#define TEXT_NUL_LENGTH 1
+#define LITERAL_LENGTH(literal) (sizeof(literal) - 1)
+#define FRAGMENT_FLAGS_OFFSET 4
+#define BYTE_BITS 8
+#define BYTE_MASK 0xFFu
+
+typedef enum {
+    FRAME_DELIVERY_SEND, //written before returning
+    FRAME_DELIVERY_SEAL, //written, then the send direction is sealed
+    FRAME_DELIVERY_QUEUE //left for session_flush
+} FrameDelivery;
+
+static const MessageTypeInfo message_types[MESSAGE_TYPE_COUNT] = {
+    [MESSAGE_TYPE_UNKNOWN] = {0, 0, 0},
+    [MESSAGE_TYPE_OUT] = {MESSAGE_TAG('O', 'U', 'T'), 0, 0},
+    [MESSAGE_TYPE_CMD] = {MESSAGE_TAG('C', 'M', 'D'), MESSAGE_RULE_NO_NUL, 0},
+    [MESSAGE_TYPE_ERR] = {MESSAGE_TAG('E', 'R', 'R'), 0, 0},
+    [MESSAGE_TYPE_CWD] = {MESSAGE_TAG('C', 'W', 'D'), 0, 0},
+    [MESSAGE_TYPE_FLG] = {MESSAGE_TAG('F', 'L', 'G'), MESSAGE_RULE_SETUP_ONLY, 0},
+    [MESSAGE_TYPE_KEY] = {MESSAGE_TAG('K', 'E', 'Y'), 0, 0},
+    [MESSAGE_TYPE_HEL] = {MESSAGE_TAG('H', 'E', 'L'), MESSAGE_RULE_SETUP_ONLY, 0},
+    [MESSAGE_TYPE_OFR] = {MESSAGE_TAG('O', 'F', 'R'), 0, 0},
+    [MESSAGE_TYPE_PRV] = {MESSAGE_TAG('P', 'R', 'V'), MESSAGE_RULE_SETUP_ONLY, 0},
+    [MESSAGE_TYPE_SUB] = {MESSAGE_TAG('S', 'U', 'B'), MESSAGE_RULE_SETUP_ONLY, 0},
+    [MESSAGE_TYPE_CAN] = {MESSAGE_TAG('C', 'A', 'N'), MESSAGE_RULE_STANDALONE, FRAME_CAPABILITY_CANCEL},
+    [MESSAGE_TYPE_DEC] = {MESSAGE_TAG('D', 'E', 'C'), MESSAGE_RULE_STANDALONE | MESSAGE_RULE_NO_NUL,
+                          FRAME_CAPABILITY_DECRYPT}
+};
+
+/**
+ * Consumes a literal field name
+ * Args:
+ *   cursor: Current position, advanced past the literal on success
+ *   end: End of the buffer
+ *   literal: Expected text
+ *   literal_length: Length of literal
+ * Returns:
+ *   Boolean indicating the literal was present
+ */
+static bool consume_literal(const char **cursor, const char *end, const char *literal, const size_t literal_length) {
+    if ((size_t) (end - *cursor) < literal_length || memcmp(*cursor, literal, literal_length) != 0) {
+        return false;
+    }
+    *cursor += literal_length;
+    return true;
+}
+
+/**
+ * Consumes a decimal number followed by ';'
+ * Args:
+ *   cursor: Current position, advanced past the separator on success
+ *   end: End of the buffer
+ *   value: Receives the number
+ * Returns:
+ *   Boolean indicating a valid number
+ */
+static bool consume_number(const char **cursor, const char *end, size_t *value) {
+    size_t result = 0;
+    unsigned int digits = 0;
+    while (*cursor < end && **cursor >= '0' && **cursor <= '9') {
+        if (++digits > MAX_LENGTH_DIGITS) {
+            return false;
+        }
+        result = result * DECIMAL_BASE + (size_t) (**cursor - '0');
+        (*cursor)++;
+    }
+    if (digits == 0 || *cursor == end || **cursor != FIELD_SEPARATOR) {
+        return false;
+    }
+    (*cursor)++;
+    *value = result;
+    return true;
+}
+
+/**
+ * Maps a packed three character tag to its message type
+ * Args:
+ *   tag: Value built with MESSAGE_TAG
+ * Returns:
+ *   Message type or MESSAGE_TYPE_UNKNOWN
+ */
+MessageType message_type_from_tag(const uint32_t tag) {
+    // MESSAGE_TYPE_UNKNOWN has tag 0, so an all zero tag maps to it like any other unlisted one
+    for (unsigned int type = 0; type < MESSAGE_TYPE_COUNT; type++) {
+        if (message_types[type].tag == tag) {
+            return (MessageType) type;
+        }
+    }
+    return MESSAGE_TYPE_UNKNOWN;
+}
+
+/**
+ * Looks a message type up in the registry
+ * Args:
+ *   type: Message type
+ * Returns:
+ *   Registry entry, the MESSAGE_TYPE_UNKNOWN one for values outside the enum
+ */
+const MessageTypeInfo *message_type_info(const MessageType type) {
+    return &message_types[(unsigned int) type < MESSAGE_TYPE_COUNT ? type : MESSAGE_TYPE_UNKNOWN];
+}
+
+/**
+ * Returns the packed tag of a known message type
+ * Args:
+ *   type: Message type
+ * Returns:
+ *   Tag built with MESSAGE_TAG, 0 for MESSAGE_TYPE_UNKNOWN
+ */
+uint32_t message_type_tag(const MessageType type) {
+    return message_type_info(type)->tag;
+}
+
+/**
+ * Consumes a LEB128 length
+ * Args:
+ *   cursor: Current position, advanced past the varint on success
+ *   end: End of the buffer
+ *   value: Receives the length
+ * Returns:
+ *   Boolean indicating a valid varint
+ */
+static bool consume_varint(const char **cursor, const char *end, size_t *value) {
+    size_t result = 0;
+    for (unsigned int i = 0; i < MAX_VARINT_BYTES && *cursor < end; i++) {
+        const unsigned char byte = (unsigned char) **cursor;
+        (*cursor)++;
+        result |= (size_t) (byte & VARINT_PAYLOAD_MASK) << (i * VARINT_PAYLOAD_BITS);
+        if ((byte & VARINT_CONTINUE) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Tokenizes a binary frame
+ * Args:
+ *   buffer: Received bytes starting with FRAME_MAGIC
+ *   size: Number of received bytes
+ *   view: Receives the parsed frame
+ * Returns:
+ *   Boolean indicating a well formed frame
+ */
+static bool parse_binary_frame(const char *buffer, const size_t size, FrameView *view) {
+    const char *cursor = buffer + FRAME_BINARY_HEADER_SIZE;
+    const char *end = buffer + size;
+    view->segment_count = 0;
+    view->total_length = size;
+    if (size < FRAME_BINARY_HEADER_SIZE || (unsigned char) buffer[1] != FRAME_BINARY_VERSION) {
+        return false;
+    }
+    while (cursor < end) {
+        if (view->segment_count == FRAME_MAX_SEGMENTS) {
+            return false;
+        }
+        FrameSegment *segment = &view->segments[view->segment_count++];
+        const unsigned char type = (unsigned char) *cursor++;
+        segment->type = type < MESSAGE_TYPE_COUNT ? (MessageType) type : MESSAGE_TYPE_UNKNOWN;
+        segment->tag = message_type_tag(segment->type);
+        if (!consume_varint(&cursor, end, &segment->length) || (size_t) (end - cursor) < segment->length) {
+            return false;
+        }
+        segment->data = cursor;
+        cursor += segment->length;
+    }
+    return view->segment_count > 0;
+}
+
+/**
+ * Tokenizes a text or binary frame
+ * Args:
+ *   buffer: Received bytes
+ *   size: Number of received bytes
+ *   view: Receives the parsed frame
+ * Operation:
+ *   - Binary frames are recognized by FRAME_MAGIC, anything else is parsed
+ *     as "tlength:..;type:..;length:..;data:.."
+ *   - Walks the buffer once, no copies and no NUL terminator required
+ *   - Segment lengths must add up to exactly the bytes after the header,
+ *     so the last segment ends where the buffer ends
+ * Returns:
+ *   Boolean indicating a well formed frame
+ */
+bool parse_frame(const char *buffer, size_t size, FrameView *view) {
+    if (size > 0 && (unsigned char) buffer[0] == FRAME_MAGIC) {
+        return parse_binary_frame(buffer, size, view);
+    }
+    // Tolerate a transport that counts the terminating NUL
+    if (size > 0 && buffer[size - 1] == '\0') {
+        size--;
+    }
+    const char *cursor = buffer;
+    const char *end = buffer + size;
+    view->segment_count = 0;
+    if (!consume_literal(&cursor, end, TLENGTH_FIELD, sizeof(TLENGTH_FIELD) - 1) ||
+        !consume_number(&cursor, end, &view->total_length) ||
+        !consume_literal(&cursor, end, TYPE_FIELD, sizeof(TYPE_FIELD) - 1)) {
+        return false;
+    }
+    // type:AAA;BBB;...; until the length field starts
+    while (!consume_literal(&cursor, end, LENGTH_FIELD, sizeof(LENGTH_FIELD) - 1)) {
+        if (view->segment_count == FRAME_MAX_SEGMENTS || end - cursor <= MESSAGE_TAG_LENGTH ||
+            cursor[MESSAGE_TAG_LENGTH] != FIELD_SEPARATOR) {
+            return false;
+        }
+        FrameSegment *segment = &view->segments[view->segment_count++];
+        segment->tag = MESSAGE_TAG(cursor[0], cursor[1], cursor[2]);
+        segment->type = message_type_from_tag(segment->tag);
+        cursor += MESSAGE_TAG_LENGTH + 1;
+    }
+    if (view->segment_count == 0) {
+        return false;
+    }
+    // length:N;M;... one entry per type
+    size_t data_total = 0;
+    for (unsigned int i = 0; i < view->segment_count; i++) {
+        if (!consume_number(&cursor, end, &view->segments[i].length)) {
+            return false;
+        }
+        data_total += view->segments[i].length;
+    }
+    if (!consume_literal(&cursor, end, DATA_FIELD, sizeof(DATA_FIELD) - 1) ||
+        (size_t) (end - cursor) != data_total) {
+        return false;
+    }
+    for (unsigned int i = 0; i < view->segment_count; i++) {
+        view->segments[i].data = cursor;
+        cursor += view->segments[i].length;
+    }
+    return true;
+}
+
+/**
+ * Compares a segment's data with a C string
+ * Args:
+ *   segment: Parsed segment
+ *   text: NUL terminated string to compare with
+ * Returns:
+ *   Boolean indicating an exact match
+ */
+bool frame_data_equals(const FrameSegment *segment, const char *text) {
+    const size_t text_length = strlen(text);
+    return segment->length == text_length && memcmp(segment->data, text, text_length) == 0;
+}
+
+/**
+ * Counts the decimal digits of a length
+ * Args:
+ *   value: Number to measure
+ * Returns:
+ *   Digit count, at least 1
+ */
+static size_t decimal_digits(size_t value) {
+    size_t digits = 1;
+    while (value >= DECIMAL_BASE) {
+        value /= DECIMAL_BASE;
+        digits++;
+    }
+    return digits;
+}
+
+/**
+ * Counts the LEB128 bytes of a length
+ * Args:
+ *   value: Number to measure
+ * Returns:
+ *   Byte count, at least 1
+ */
+static size_t varint_length(size_t value) {
+    size_t bytes = 1;
+    while (value > VARINT_PAYLOAD_MASK) {
+        value >>= VARINT_PAYLOAD_BITS;
+        bytes++;
+    }
+    return bytes;
+}
+
+/**
+ * Writes a decimal number
+ * Args:
+ *   cursor: Output position
+ *   value: Number to write
+ * Returns:
+ *   Position after the last digit
+ */
+static char *write_decimal(char *cursor, size_t value) {
+    const size_t digits = decimal_digits(value);
+    for (size_t i = digits; i > 0; i--) {
+        cursor[i - 1] = (char) ('0' + value % DECIMAL_BASE);
+        value /= DECIMAL_BASE;
+    }
+    return cursor + digits;
+}
+
+/**
+ * Computes the encoded size of a frame
+ * Args:
+ *   encoding: Target wire format
+ *   segments: Segments to encode, tag must be set for text frames
+ *   count: Number of segments
+ * Returns:
+ *   Bytes encode_frame will write, 0 if the segments cannot be encoded
+ */
+size_t frame_encoded_length(const FrameEncoding encoding, const FrameSegment *segments, const unsigned int count) {
+    if (count == 0 || count > FRAME_MAX_SEGMENTS) {
+        return 0;
+    }
+    size_t length = 0;
+    if (encoding == FRAME_ENCODING_BINARY) {
+        length = FRAME_BINARY_HEADER_SIZE;
+        for (unsigned int i = 0; i < count; i++) {
+            if (segments[i].type == MESSAGE_TYPE_UNKNOWN) {
+                return 0;
+            }
+            length += 1 + varint_length(segments[i].length) + segments[i].length;
+        }
+        return length;
+    }
+    // Everything after the tlength digits: ";type:AAA;...length:N;...data:..."
+    length = FIELD_SEPARATOR_LENGTH + LITERAL_LENGTH(TYPE_FIELD) + LITERAL_LENGTH(LENGTH_FIELD) +
+             LITERAL_LENGTH(DATA_FIELD);
+    for (unsigned int i = 0; i < count; i++) {
+        if (segments[i].tag == 0) {
+            return 0;
+        }
+        length += MESSAGE_TAG_LENGTH + FIELD_SEPARATOR_LENGTH + decimal_digits(segments[i].length) +
+                FIELD_SEPARATOR_LENGTH + segments[i].length;
+    }
+    // tlength counts its own digits
+    size_t total = LITERAL_LENGTH(TLENGTH_FIELD) + length + 1;
+    while (LITERAL_LENGTH(TLENGTH_FIELD) + length + decimal_digits(total) != total) {
+        total = LITERAL_LENGTH(TLENGTH_FIELD) + length + decimal_digits(total);
+    }
+    return total;
+}
+
+/**
+ * Serializes segments into a frame
+ * Args:
+ *   encoding: Target wire format
+ *   segments: Segments to encode
+ *   count: Number of segments
+ *   buffer: Output buffer
+ *   size: Size of buffer
+ * Operation:
+ *   Text frames are NUL terminated when there is room, the terminator is not counted
+ * Returns:
+ *   Number of bytes written, 0 if the frame does not fit
+ */
+size_t encode_frame(const FrameEncoding encoding, const FrameSegment *segments, const unsigned int count,
+                    char *buffer, const size_t size) {
+    const size_t total = frame_encoded_length(encoding, segments, count);
+    if (total == 0 || total > size) {
+        return 0;
+    }
+    char *cursor = buffer;
+    if (encoding == FRAME_ENCODING_BINARY) {
+        *cursor++ = (char) FRAME_MAGIC;
+        *cursor++ = (char) FRAME_BINARY_VERSION;
+        for (unsigned int i = 0; i < count; i++) {
+            *cursor++ = (char) segments[i].type;
+            size_t length = segments[i].length;
+            while (length > VARINT_PAYLOAD_MASK) {
+                *cursor++ = (char) ((length & VARINT_PAYLOAD_MASK) | VARINT_CONTINUE);
+                length >>= VARINT_PAYLOAD_BITS;
+            }
+            *cursor++ = (char) length;
+            memcpy(cursor, segments[i].data, segments[i].length);
+            cursor += segments[i].length;
+        }
+        return total;
+    }
+    memcpy(cursor, TLENGTH_FIELD, LITERAL_LENGTH(TLENGTH_FIELD));
+    cursor = write_decimal(cursor + LITERAL_LENGTH(TLENGTH_FIELD), total);
+    *cursor++ = FIELD_SEPARATOR;
+    memcpy(cursor, TYPE_FIELD, LITERAL_LENGTH(TYPE_FIELD));
+    cursor += LITERAL_LENGTH(TYPE_FIELD);
+    for (unsigned int i = 0; i < count; i++) {
+        *cursor++ = (char) (segments[i].tag >> 16);
+        *cursor++ = (char) (segments[i].tag >> 8);
+        *cursor++ = (char) segments[i].tag;
+        *cursor++ = FIELD_SEPARATOR;
+    }
+    memcpy(cursor, LENGTH_FIELD, LITERAL_LENGTH(LENGTH_FIELD));
+    cursor += LITERAL_LENGTH(LENGTH_FIELD);
+    for (unsigned int i = 0; i < count; i++) {
+        cursor = write_decimal(cursor, segments[i].length);
+        *cursor++ = FIELD_SEPARATOR;
+    }
+    memcpy(cursor, DATA_FIELD, LITERAL_LENGTH(DATA_FIELD));
+    cursor += LITERAL_LENGTH(DATA_FIELD);
+    for (unsigned int i = 0; i < count; i++) {
+        memcpy(cursor, segments[i].data, segments[i].length);
+        cursor += segments[i].length;
+    }
+    if (total < size) {
+        *cursor = '\0';
+    }
+    return total;
+}
+
+/**
+ * Encodes a frame and hands it to the session
+ * Args:
+ *   session: Destination connection
+ *   encoding: Wire format of the peer
+ *   segments: Segments to send
+ *   count: Number of segments
+ *   delivery: Send now, send and seal, or queue
+ * Returns:
+ *   Boolean indicating the frame was sent or queued
+ */
+static bool send_encoded_frame(CryptoSession *session, const FrameEncoding encoding, const FrameSegment *segments,
+                               const unsigned int count, const FrameDelivery delivery) {
+    const size_t total = frame_encoded_length(encoding, segments, count);
+    // The receiver terminates what it got, leave it room for that
+    const size_t limit = encoding == FRAME_ENCODING_TEXT ? FRAME_TEXT_MAX_SIZE : FRAME_MAX_SIZE;
+    if (total == 0 || total + TEXT_NUL_LENGTH > limit) {
+        return false;
+    }
+    if (delivery == FRAME_DELIVERY_QUEUE) {
+        // Encoded straight into the queue, no scratch buffer and no copy whatever the size
+        char *slot = session_enqueue_reserve(session, total);
+        if (slot == NULL) {
+            return false;
+        }
+        encode_frame(encoding, segments, count, slot, total);
+        session_enqueue_commit(session, total);
+        return true;
+    }
+    char stack_buffer[FRAME_SEND_STACK_SIZE];
+    char *buffer = total + TEXT_NUL_LENGTH <= sizeof(stack_buffer) ? stack_buffer : malloc(total + TEXT_NUL_LENGTH);
+    if (buffer == NULL) {
+        return false;
+    }
+    encode_frame(encoding, segments, count, buffer, total + TEXT_NUL_LENGTH);
+    bool sent;
+    switch (delivery) {
+        case FRAME_DELIVERY_SEAL:
+            sent = session_send_and_seal(session, buffer, total) >= 0;
+            break;
+        default:
+            sent = session_send(session, buffer, total) >= 0;
+            break;
+    }
+    if (buffer != stack_buffer) {
+        free(buffer);
+    }
+    return sent;
+}
+
+/**
+ * Encodes and sends a multi segment frame
+ * Args:
+ *   session: Destination connection
+ *   encoding: Wire format of the peer
+ *   segments: Segments to send
+ *   count: Number of segments
+ * Returns:
+ *   Boolean indicating the frame was sent
+ */
+bool send_frame_segments(CryptoSession *session, const FrameEncoding encoding, const FrameSegment *segments,
+                         const unsigned int count) {
+    return send_encoded_frame(session, encoding, segments, count, FRAME_DELIVERY_SEND);
+}
+
+/**
+ * Encodes a multi segment frame into the session queue
+ * Args:
+ *   session: Destination connection
+ *   encoding: Wire format of the peer
+ *   segments: Segments to send
+ *   count: Number of segments
+ * Operation:
+ *   - Encoded in place in the session queue, no intermediate buffer
+ *   - Never touches the socket, the frame leaves on the next session_flush
+ *     or with whatever the session sends next
+ * Returns:
+ *   Boolean indicating the frame was queued
+ */
+bool queue_frame_segments(CryptoSession *session, const FrameEncoding encoding, const FrameSegment *segments,
+                          const unsigned int count) {
+    return send_encoded_frame(session, encoding, segments, count, FRAME_DELIVERY_QUEUE);
+}
+
+/**
+ * Encodes and sends a single segment frame
+ * Args:
+ *   session: Destination connection
+ *   encoding: Wire format of the peer
+ *   type: Message type
+ *   data: Payload, not necessarily NUL terminated
+ *   length: Payload length
+ * Operation:
+ *   - Encodes on the stack, falls back to the heap for large frames
+ *   - Text frames are capped at FRAME_TEXT_MAX_SIZE
+ * Returns:
+ *   Boolean indicating the frame was sent
+ */
+bool send_frame(CryptoSession *session, const FrameEncoding encoding, const MessageType type, const char *data,
+                const size_t length) {
+    FrameSegment segment;
+    frame_segment_init(&segment, type, data, length);
+    return send_encoded_frame(session, encoding, &segment, 1, FRAME_DELIVERY_SEND);
+}
+
+/**
+ * Sends the last frame before the send direction moves to AEAD records
+ * Args:
+ *   session: Destination connection
+ *   encoding: Wire format of the peer
+ *   type: Message type
+ *   data: Payload
+ *   length: Payload length
+ * Operation:
+ *   The frame still goes through s_send, everything sent afterwards is sealed
+ * Returns:
+ *   Boolean indicating the frame was sent
+ */
+bool send_frame_and_seal(CryptoSession *session, const FrameEncoding encoding, const MessageType type,
+                         const char *data, const size_t length) {
+    FrameSegment segment;
+    frame_segment_init(&segment, type, data, length);
+    return send_encoded_frame(session, encoding, &segment, 1, FRAME_DELIVERY_SEAL);
+}
+
+/**
+ * Fills a segment from a message type and payload
+ * Args:
+ *   segment: Segment to fill
+ *   type: Known message type
+ *   data: Payload
+ *   length: Payload length
+ * Returns: void
+ */
+void frame_segment_init(FrameSegment *segment, const MessageType type, const char *data, const size_t length) {
+    segment->type = type;
+    segment->tag = message_type_tag(type);
+    segment->data = data;
+    segment->length = length;
+}
+
+/**
+ * Parses the capability mask carried by a HEL segment
+ * Args:
+ *   segment: HEL segment
+ * Returns:
+ *   Capability bits, 0 if the data is not a decimal number
+ */
+unsigned int frame_capabilities(const FrameSegment *segment) {
+    unsigned int capabilities = 0;
+    if (segment->length == 0 || segment->length > MAX_LENGTH_DIGITS) {
+        return 0;
+    }
+    for (size_t i = 0; i < segment->length; i++) {
+        if (segment->data[i] < '0' || segment->data[i] > '9') {
+            return 0;
+        }
+        capabilities = capabilities * DECIMAL_BASE + (unsigned int) (segment->data[i] - '0');
+    }
+    return capabilities;
+}
+
+/**
+ * Decodes an OFR segment
+ * Args:
+ *   segment: Segment typed MESSAGE_TYPE_OFR
+ *   fragment: Receives the header fields and the chunk view
+ * Returns:
+ *   Boolean indicating a well formed fragment
+ */
+bool parse_output_fragment(const FrameSegment *segment, OutputFragment *fragment) {
+    if (segment->type != MESSAGE_TYPE_OFR || segment->length < OUTPUT_FRAGMENT_HEADER_SIZE) {
+        return false;
+    }
+    const unsigned char *header = (const unsigned char *) segment->data;
+    fragment->sequence = 0;
+    for (unsigned int i = 0; i < FRAGMENT_FLAGS_OFFSET; i++) {
+        fragment->sequence = fragment->sequence << BYTE_BITS | header[i];
+    }
+    fragment->final = (header[FRAGMENT_FLAGS_OFFSET] & OUTPUT_FRAGMENT_FINAL) != 0;
+    frame_segment_init(&fragment->chunk, MESSAGE_TYPE_OUT, segment->data + OUTPUT_FRAGMENT_HEADER_SIZE,
+                       segment->length - OUTPUT_FRAGMENT_HEADER_SIZE);
+    return true;
+}
+
+/**
+ * Writes the header that precedes an OFR chunk
+ * Args:
+ *   header: OUTPUT_FRAGMENT_HEADER_SIZE bytes right before the chunk
+ *   sequence: Position of the fragment in its stream
+ *   final: Last fragment of the stream
+ * Returns: void
+ */
+void write_output_fragment_header(char *header, uint32_t sequence, const bool final) {
+    for (unsigned int i = FRAGMENT_FLAGS_OFFSET; i > 0; i--) {
+        header[i - 1] = (char) (sequence & BYTE_MASK);
+        sequence >>= BYTE_BITS;
+    }
+    header[FRAGMENT_FLAGS_OFFSET] = (char) (final ? OUTPUT_FRAGMENT_FINAL : 0);
+}
+
+/**
+ * Decodes a PRV segment
+ * Args:
+ *   segment: Segment typed MESSAGE_TYPE_PRV
+ *   provision: Receives views of both fields
+ * Returns:
+ *   Boolean indicating a well formed segment
+ */
+bool parse_provision(const FrameSegment *segment, Provision *provision) {
+    if (segment->type != MESSAGE_TYPE_PRV || segment->length < PROVISION_HEADER_SIZE) {
+        return false;
+    }
+    const unsigned char *header = (const unsigned char *) segment->data;
+    size_t first_length = 0;
+    for (unsigned int i = 0; i < PROVISION_HEADER_SIZE; i++) {
+        first_length = first_length << BYTE_BITS | header[i];
+    }
+    if (first_length > segment->length - PROVISION_HEADER_SIZE) {
+        return false;
+    }
+    const char *first = segment->data + PROVISION_HEADER_SIZE;
+    frame_segment_init(&provision->first, MESSAGE_TYPE_PRV, first, first_length);
+    frame_segment_init(&provision->second, MESSAGE_TYPE_PRV, first + first_length,
+                       segment->length - PROVISION_HEADER_SIZE - first_length);
+    return true;
+}
+
+/**
+ * Writes the data of a PRV segment
+ * Args:
+ *   out: Destination buffer
+ *   size: Size of out
+ *   first: First field
+ *   first_length: Length of first, at most PROVISION_FIELD_MAX
+ *   second: Second field
+ *   second_length: Length of second
+ * Returns:
+ *   Number of bytes written, 0 if the fields do not fit
+ */
+size_t write_provision(char *out, const size_t size, const char *first, const size_t first_length,
+                       const char *second, const size_t second_length) {
+    if (first_length > PROVISION_FIELD_MAX || size < PROVISION_HEADER_SIZE ||
+        first_length > size - PROVISION_HEADER_SIZE ||
+        second_length > size - PROVISION_HEADER_SIZE - first_length) {
+        return 0;
+    }
+    size_t header = first_length;
+    for (unsigned int i = PROVISION_HEADER_SIZE; i > 0; i--) {
+        out[i - 1] = (char) (header & BYTE_MASK);
+        header >>= BYTE_BITS;
+    }
+    memcpy(out + PROVISION_HEADER_SIZE, first, first_length);
+    memcpy(out + PROVISION_HEADER_SIZE + first_length, second, second_length);
+    return PROVISION_HEADER_SIZE + first_length + second_length;
+}
+
+/**
+ * Rewrites OFR segments as plain OUT segments for peers without streaming
+ * Args:
+ *   segments: Received segments
+ *   count: Number of segments
+ *   flattened: Receives up to count segments
+ * Operation:
+ *   Drops empty and malformed fragments, other segments are copied as they are
+ * Returns:
+ *   Number of segments written to flattened
+ */
+unsigned int flatten_output_fragments(const FrameSegment *segments, const unsigned int count,
+                                      FrameSegment *flattened) {
+    unsigned int written = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        if (segments[i].type != MESSAGE_TYPE_OFR) {
+            flattened[written++] = segments[i];
+            continue;
+        }
+        OutputFragment fragment;
+        if (parse_output_fragment(&segments[i], &fragment) && fragment.chunk.length > 0) {
+            flattened[written++] = fragment.chunk;
+        }
+    }
+    return written;
+}
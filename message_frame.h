@@ -0,0 +1,360 @@
+// message_frame.h
+#ifndef MESSAGE_FRAME_H
+#define MESSAGE_FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "crypto_session.h"
+
+#define FRAME_MAX_SEGMENTS 8
+#define FRAME_MAX_SIZE 65536 //largest frame either side will receive
+#define FRAME_TEXT_MAX_SIZE 4096 //receive buffer of peers that only speak text frames
+#define FRAME_MAGIC 0xCB //first byte of a binary frame, never the 't' of "tlength:"
+#define FRAME_BINARY_VERSION 1
+#define FRAME_BINARY_HEADER_SIZE 2 //magic and version
+#define FRAME_CAPABILITY_BINARY 0x1u //peer accepts and sends binary frames
+#define FRAME_CAPABILITY_STREAMING 0x2u //peer accepts and sends OFR output fragments
+#define FRAME_CAPABILITY_AEAD 0x4u //peer moves the connection to crypto_session AES-GCM records
+#define FRAME_CAPABILITY_PROVISION 0x8u //peer receives flag.txt and key.txt contents in one PRV message
+#define FRAME_CAPABILITY_SUBMIT 0x10u //peer guesses the flag in SUB messages, its CMD traffic is never matched
+#define FRAME_CAPABILITY_CANCEL 0x20u //peer runs commands asynchronously and stops them on CAN
+#define FRAME_CAPABILITY_DECRYPT 0x40u //peer decrypts files in process on DEC instead of running openssl enc -d
+#define FRAME_SUPPORTED_CAPABILITIES (FRAME_CAPABILITY_BINARY | FRAME_CAPABILITY_STREAMING | FRAME_CAPABILITY_AEAD | \
+                                      FRAME_CAPABILITY_PROVISION | FRAME_CAPABILITY_SUBMIT | FRAME_CAPABILITY_CANCEL | \
+                                      FRAME_CAPABILITY_DECRYPT)
+#define FRAME_CAPABILITY_MULTIPLEX 0x80u //peer carries several games on one connection, opt in, never in SUPPORTED
+#define FRAME_MULTIPLEX_REQUIRED (FRAME_CAPABILITY_AEAD | FRAME_CAPABILITY_BINARY) //stream records are sealed binary
+#define FRAME_MAX_STREAMS 64 //streams open at once on one multiplexed connection
+#define OUTPUT_FRAGMENT_HEADER_SIZE 5 //big endian sequence number and a flags byte
+#define OUTPUT_FRAGMENT_FINAL 0x1u //last fragment of a command's output
+#define PROVISION_HEADER_SIZE 2 //big endian length of the first PRV field
+#define PROVISION_FIELD_MAX 0xFFFFu //largest first PRV field
+#define MESSAGE_TAG_LENGTH 3
+#define MESSAGE_TAG(a, b, c) (((uint32_t) (unsigned char) (a) << 16) | \
+                              ((uint32_t) (unsigned char) (b) << 8) | \
+                              (uint32_t) (unsigned char) (c))
+#define MESSAGE_RULE_SETUP_ONLY 0x1u //consumed by the server, never relayed between clients
+#define MESSAGE_RULE_STANDALONE 0x2u //relayed only as the single segment of its frame
+#define MESSAGE_RULE_NO_NUL 0x4u //the receiver uses the data as a C string, it must not contain NUL
+
+/**
+ * Known message types of the tlength/type/length/data protocol
+ * The values double as the type byte of binary frames and must not change
+ */
+typedef enum {
+    MESSAGE_TYPE_UNKNOWN = 0,
+    MESSAGE_TYPE_OUT = 1, //command output
+    MESSAGE_TYPE_CMD = 2, //command to run on the other client
+    MESSAGE_TYPE_ERR = 3, //error text
+    MESSAGE_TYPE_CWD = 4, //working directory update
+    MESSAGE_TYPE_FLG = 5, //flag file setup
+    MESSAGE_TYPE_KEY = 6, //key file setup
+    MESSAGE_TYPE_HEL = 7, //capability offer and answer, data is the decimal capability mask
+    MESSAGE_TYPE_OFR = 8, //sequenced fragment of streamed command output
+    MESSAGE_TYPE_PRV = 9, //flag and key file provisioning, request, contents and status
+    MESSAGE_TYPE_SUB = 10, //flag guess, checked by the server and never relayed
+    MESSAGE_TYPE_CAN = 11, //cancels the commands the other client is running or has queued
+    MESSAGE_TYPE_DEC = 12, //decrypt request for the other client, "<key>\n<path>\n<method>[\n<method>...]"
+    MESSAGE_TYPE_COUNT
+} MessageType;
+
+/**
+ * Registry entry of a message type, one table in message_frame.c shared by the server and the clients
+ * Components:
+ *   tag: The three type characters packed with MESSAGE_TAG, 0 for MESSAGE_TYPE_UNKNOWN
+ *   rules: MESSAGE_RULE_* bits the server checks before relaying
+ *   capability: FRAME_CAPABILITY_* bit a receiver needs to be relayed the type, 0 when every client takes it
+ */
+typedef struct {
+    uint32_t tag;
+    unsigned int rules;
+    unsigned int capability;
+} MessageTypeInfo;
+
+/**
+ * Wire format used when sending to a peer
+ * Receiving always accepts both
+ */
+typedef enum {
+    FRAME_ENCODING_TEXT, //"tlength:..;type:..;length:..;data:.."
+    FRAME_ENCODING_BINARY //magic, version, then type byte + varint length per segment
+} FrameEncoding;
+
+/**
+ * One type/length/data triple of a frame
+ * Components:
+ *   type: Decoded message type
+ *   tag: The three type characters packed into an integer
+ *   data: Points into the receive buffer, not NUL terminated
+ *   length: Number of data bytes
+ */
+typedef struct {
+    MessageType type;
+    uint32_t tag;
+    const char *data;
+    size_t length;
+} FrameSegment;
+
+/**
+ * Decoded OFR segment
+ * Components:
+ *   sequence: Position of the fragment in its stream, restarts at 0 per command
+ *   final: Set on the last fragment of a stream
+ *   chunk: The output bytes, typed MESSAGE_TYPE_OUT
+ */
+typedef struct {
+    uint32_t sequence;
+    bool final;
+    FrameSegment chunk;
+} OutputFragment;
+
+/**
+ * Decoded PRV segment, two byte strings behind a length header
+ * Components:
+ *   first: Flag directory in client requests, key.txt contents in server replies
+ *   second: Key directory in client requests, encrypted flag.txt contents in server replies
+ */
+typedef struct {
+    FrameSegment first;
+    FrameSegment second;
+} Provision;
+
+/**
+ * Zero-copy view of a received frame
+ * Components:
+ *   total_length: Value of the tlength field
+ *   segment_count: Number of valid entries in segments
+ *   segments: Type/data views in wire order
+ * Operation:
+ *   - Filled by parse_frame in a single pass over the buffer
+ *   - Only valid while the parsed buffer is alive and unchanged
+ */
+typedef struct {
+    size_t total_length;
+    unsigned int segment_count;
+    FrameSegment segments[FRAME_MAX_SEGMENTS];
+} FrameView;
+
+/**
+ * Tokenizes a text or binary frame
+ * Args:
+ *   buffer: Received bytes
+ *   size: Number of received bytes
+ *   view: Receives the parsed frame
+ * Operation:
+ *   - Binary frames are recognized by FRAME_MAGIC, anything else is parsed
+ *     as "tlength:..;type:..;length:..;data:.."
+ *   - Walks the buffer once, no copies and no NUL terminator required
+ *   - Segment lengths must add up to exactly the bytes after the header,
+ *     so the last segment ends where the buffer ends
+ * Returns:
+ *   Boolean indicating a well formed frame
+ */
+bool parse_frame(const char *buffer, size_t size, FrameView *view);
+
+/**
+ * Computes the encoded size of a frame
+ * Args:
+ *   encoding: Target wire format
+ *   segments: Segments to encode, tag must be set for text frames
+ *   count: Number of segments
+ * Returns:
+ *   Bytes encode_frame will write, 0 if the segments cannot be encoded
+ */
+size_t frame_encoded_length(FrameEncoding encoding, const FrameSegment *segments, unsigned int count);
+
+/**
+ * Serializes segments into a frame
+ * Args:
+ *   encoding: Target wire format
+ *   segments: Segments to encode
+ *   count: Number of segments
+ *   buffer: Output buffer
+ *   size: Size of buffer
+ * Operation:
+ *   Text frames are NUL terminated when there is room, the terminator is not counted
+ * Returns:
+ *   Number of bytes written, 0 if the frame does not fit
+ */
+size_t encode_frame(FrameEncoding encoding, const FrameSegment *segments, unsigned int count, char *buffer,
+                    size_t size);
+
+/**
+ * Encodes and sends a single segment frame
+ * Args:
+ *   session: Destination connection
+ *   encoding: Wire format of the peer
+ *   type: Message type
+ *   data: Payload, not necessarily NUL terminated
+ *   length: Payload length
+ * Operation:
+ *   - Encodes on the stack, falls back to the heap for large frames
+ *   - Text frames are capped at FRAME_TEXT_MAX_SIZE
+ * Returns:
+ *   Boolean indicating the frame was sent
+ */
+bool send_frame(CryptoSession *session, FrameEncoding encoding, MessageType type, const char *data, size_t length);
+
+/**
+ * Sends the last frame before the send direction moves to AEAD records
+ * Args:
+ *   session: Destination connection
+ *   encoding: Wire format of the peer
+ *   type: Message type
+ *   data: Payload
+ *   length: Payload length
+ * Operation:
+ *   The frame still goes through s_send, everything sent afterwards is sealed
+ * Returns:
+ *   Boolean indicating the frame was sent
+ */
+bool send_frame_and_seal(CryptoSession *session, FrameEncoding encoding, MessageType type, const char *data,
+                         size_t length);
+
+/**
+ * Encodes and sends a multi segment frame
+ * Args:
+ *   session: Destination connection
+ *   encoding: Wire format of the peer
+ *   segments: Segments to send
+ *   count: Number of segments
+ * Returns:
+ *   Boolean indicating the frame was sent
+ */
+bool send_frame_segments(CryptoSession *session, FrameEncoding encoding, const FrameSegment *segments,
+                         unsigned int count);
+
+/**
+ * Encodes a multi segment frame into the session queue
+ * Args:
+ *   session: Destination connection
+ *   encoding: Wire format of the peer
+ *   segments: Segments to send
+ *   count: Number of segments
+ * Operation:
+ *   - Encoded in place in the session queue, no intermediate buffer
+ *   - Never touches the socket, the frame leaves on the next session_flush
+ *     or with whatever the session sends next
+ * Returns:
+ *   Boolean indicating the frame was queued
+ */
+bool queue_frame_segments(CryptoSession *session, FrameEncoding encoding, const FrameSegment *segments,
+                          unsigned int count);
+
+/**
+ * Fills a segment from a message type and payload
+ * Args:
+ *   segment: Segment to fill
+ *   type: Known message type
+ *   data: Payload
+ *   length: Payload length
+ * Returns: void
+ */
+void frame_segment_init(FrameSegment *segment, MessageType type, const char *data, size_t length);
+
+/**
+ * Parses the capability mask carried by a HEL segment
+ * Args:
+ *   segment: HEL segment
+ * Returns:
+ *   Capability bits, 0 if the data is not a decimal number
+ */
+unsigned int frame_capabilities(const FrameSegment *segment);
+
+/**
+ * Decodes an OFR segment
+ * Args:
+ *   segment: Segment typed MESSAGE_TYPE_OFR
+ *   fragment: Receives the header fields and the chunk view
+ * Returns:
+ *   Boolean indicating a well formed fragment
+ */
+bool parse_output_fragment(const FrameSegment *segment, OutputFragment *fragment);
+
+/**
+ * Writes the header that precedes an OFR chunk
+ * Args:
+ *   header: OUTPUT_FRAGMENT_HEADER_SIZE bytes right before the chunk
+ *   sequence: Position of the fragment in its stream
+ *   final: Last fragment of the stream
+ * Returns: void
+ */
+void write_output_fragment_header(char *header, uint32_t sequence, bool final);
+
+/**
+ * Decodes a PRV segment
+ * Args:
+ *   segment: Segment typed MESSAGE_TYPE_PRV
+ *   provision: Receives views of both fields
+ * Returns:
+ *   Boolean indicating a well formed segment
+ */
+bool parse_provision(const FrameSegment *segment, Provision *provision);
+
+/**
+ * Writes the data of a PRV segment
+ * Args:
+ *   out: Destination buffer
+ *   size: Size of out
+ *   first: First field
+ *   first_length: Length of first, at most PROVISION_FIELD_MAX
+ *   second: Second field
+ *   second_length: Length of second
+ * Returns:
+ *   Number of bytes written, 0 if the fields do not fit
+ */
+size_t write_provision(char *out, size_t size, const char *first, size_t first_length, const char *second,
+                       size_t second_length);
+
+/**
+ * Rewrites OFR segments as plain OUT segments for peers without streaming
+ * Args:
+ *   segments: Received segments
+ *   count: Number of segments
+ *   flattened: Receives up to count segments
+ * Operation:
+ *   Drops empty and malformed fragments, other segments are copied as they are
+ * Returns:
+ *   Number of segments written to flattened
+ */
+unsigned int flatten_output_fragments(const FrameSegment *segments, unsigned int count, FrameSegment *flattened);
+
+/**
+ * Looks a message type up in the registry
+ * Args:
+ *   type: Message type
+ * Returns:
+ *   Registry entry, the MESSAGE_TYPE_UNKNOWN one for values outside the enum
+ */
+const MessageTypeInfo *message_type_info(MessageType type);
+
+/**
+ * Returns the packed tag of a known message type
+ * Args:
+ *   type: Message type
+ * Returns:
+ *   Tag built with MESSAGE_TAG, 0 for MESSAGE_TYPE_UNKNOWN
+ */
+uint32_t message_type_tag(MessageType type);
+
+/**
+ * Maps a packed three character tag to its message type
+ * Args:
+ *   tag: Value built with MESSAGE_TAG
+ * Returns:
+ *   Message type or MESSAGE_TYPE_UNKNOWN
+ */
+MessageType message_type_from_tag(uint32_t tag);
+
+/**
+ * Compares a segment's data with a C string
+ * Args:
+ *   segment: Parsed segment
+ *   text: NUL terminated string to compare with
+ * Returns:
+ *   Boolean indicating an exact match
+ */
+bool frame_data_equals(const FrameSegment *segment, const char *text);
+
+#endif // MESSAGE_FRAME_H
@@ -0,0 +1,111 @@
+/*
+ * Bounded lock-free multi-producer/multi-consumer ring
+ * Every slot carries a sequence number, producers and consumers claim
+ * positions with a single CAS and hand the slot over by advancing its
+ * sequence, so neither side ever takes a lock or spins on the other
+ */
+
+#include "mpmc_ring.h"
+#include <stdlib.h>
+
+#define MIN_RING_CAPACITY 2
+#define CLAIM_NEXT 1
+
+/**
+ * Allocates the ring
+ * Args:
+ *   ring: Ring to initialize
+ *   capacity: Number of slots, rounded up to a power of two
+ * Returns:
+ *   Boolean indicating success
+ */
+bool mpmc_ring_init(MpmcRing *ring, const size_t capacity) {
+    size_t size = MIN_RING_CAPACITY;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    ring->cells = malloc(size * sizeof(MpmcRingCell));
+    if (ring->cells == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&ring->cells[i].sequence, i);
+        ring->cells[i].value = 0;
+    }
+    ring->mask = size - 1;
+    atomic_init(&ring->enqueue_pos, 0);
+    atomic_init(&ring->dequeue_pos, 0);
+    return true;
+}
+
+/**
+ * Frees the ring slots
+ * Args:
+ *   ring: Ring to destroy, must not be in use
+ * Returns: void
+ */
+void mpmc_ring_destroy(MpmcRing *ring) {
+    free(ring->cells);
+    ring->cells = NULL;
+}
+
+/**
+ * Appends a value
+ * Args:
+ *   ring: Target ring
+ *   value: Value to store
+ * Returns:
+ *   false if the ring is full
+ */
+bool mpmc_ring_push(MpmcRing *ring, const uint64_t value) {
+    size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    while (true) {
+        MpmcRingCell *cell = &ring->cells[pos & ring->mask];
+        const size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        const intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+        if (diff == 0) {
+            // Slot is free for this turn, try to claim the position
+            if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + CLAIM_NEXT,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                cell->value = value;
+                atomic_store_explicit(&cell->sequence, pos + CLAIM_NEXT, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // consumer has not freed the slot yet: full
+        } else {
+            pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * Removes the oldest value
+ * Args:
+ *   ring: Source ring
+ *   value: Receives the removed value
+ * Returns:
+ *   false if the ring is empty
+ */
+bool mpmc_ring_pop(MpmcRing *ring, uint64_t *value) {
+    size_t pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    while (true) {
+        MpmcRingCell *cell = &ring->cells[pos & ring->mask];
+        const size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        const intptr_t diff = (intptr_t) sequence - (intptr_t) (pos + CLAIM_NEXT);
+        if (diff == 0) {
+            // Slot holds a value for this turn, try to claim the position
+            if (atomic_compare_exchange_weak_explicit(&ring->dequeue_pos, &pos, pos + CLAIM_NEXT,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *value = cell->value;
+                // Hand the slot back to producers for the next lap
+                atomic_store_explicit(&cell->sequence, pos + ring->mask + CLAIM_NEXT, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // producer has not filled the slot yet: empty
+        } else {
+            pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,79 @@
+// mpmc_ring.h
+#ifndef MPMC_RING_H
+#define MPMC_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MPMC_RING_CACHE_LINE 64
+
+/**
+ * One slot of the ring
+ * Components:
+ *   sequence: Turn counter telling producers/consumers whose slot it is
+ *   value: Stored 64-bit payload (index, ticket or pointer)
+ */
+typedef struct {
+    atomic_size_t sequence;
+    uint64_t value;
+} MpmcRingCell;
+
+/**
+ * Bounded lock-free multi-producer/multi-consumer queue of 64-bit values
+ * Components:
+ *   cells: Power of two sized slot array
+ *   mask: capacity - 1, used to wrap positions
+ *   enqueue_pos: Next position producers claim
+ *   dequeue_pos: Next position consumers claim
+ * Operation:
+ *   - Each position is claimed with a CAS, slots publish through their sequence
+ *   - Never blocks, push fails when full and pop fails when empty
+ */
+typedef struct {
+    MpmcRingCell *cells;
+    size_t mask;
+    _Alignas(MPMC_RING_CACHE_LINE) atomic_size_t enqueue_pos;
+    _Alignas(MPMC_RING_CACHE_LINE) atomic_size_t dequeue_pos;
+} MpmcRing;
+
+/**
+ * Allocates the ring
+ * Args:
+ *   ring: Ring to initialize
+ *   capacity: Number of slots, rounded up to a power of two
+ * Returns:
+ *   Boolean indicating success
+ */
+bool mpmc_ring_init(MpmcRing *ring, size_t capacity);
+
+/**
+ * Frees the ring slots
+ * Args:
+ *   ring: Ring to destroy, must not be in use
+ * Returns: void
+ */
+void mpmc_ring_destroy(MpmcRing *ring);
+
+/**
+ * Appends a value
+ * Args:
+ *   ring: Target ring
+ *   value: Value to store
+ * Returns:
+ *   false if the ring is full
+ */
+bool mpmc_ring_push(MpmcRing *ring, uint64_t value);
+
+/**
+ * Removes the oldest value
+ * Args:
+ *   ring: Source ring
+ *   value: Receives the removed value
+ * Returns:
+ *   false if the ring is empty
+ */
+bool mpmc_ring_pop(MpmcRing *ring, uint64_t *value);
+
+#endif // MPMC_RING_H
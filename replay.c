@@ -0,0 +1,634 @@
+/*
+ * Feeds a replay log back into the game server
+ * Loads the recorded segment files, then plays every recorded game again as a
+ * pair of headless clients: key exchange, HEL answer and the one round trip
+ * PRV setup like Bench, then each player's recorded frames go out at their
+ * original offsets divided by the speed factor while whatever the server
+ * relays back is drained and counted
+ * Text the server wrote itself is not sent, the server produces it again
+ * Pairs are matched one at a time, so run it against a server nobody else plays on
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <openssl/crypto.h>
+#include "cryptography_game_util.h"
+#include "key_exchange.h"
+#include "message_frame.h"
+#include "replay_log.h"
+
+#define USAGE "Usage: %s [-s speed] [-c concurrent_games] <ip> <port> <segment file...>\n" \
+              "  -s 1 keeps the recorded timing, 10 plays ten times faster, 0 sends without pauses\n"
+#define MIN_ARGC 3 //positional arguments after the options, at least one segment
+#define IP_ARGV 0 //positions after the options
+#define PORT_ARGV 1
+#define FIRST_SEGMENT_ARGV 2
+#define SOCKET_ERROR -1
+#define SOCKET_INIT_ERROR 0
+#define PLAYERS_PER_GAME 2
+#define DEFAULT_SPEED 1.0
+#define DEFAULT_CONCURRENT_GAMES 16
+#define MAX_CONCURRENT_GAMES 1024
+#define AS_FAST_AS_POSSIBLE 0.0
+#define REPLAY_CAPABILITIES (FRAME_CAPABILITY_BINARY | FRAME_CAPABILITY_STREAMING | FRAME_CAPABILITY_AEAD | \
+                             FRAME_CAPABILITY_PROVISION | FRAME_CAPABILITY_SUBMIT | FRAME_CAPABILITY_CANCEL | \
+                             FRAME_CAPABILITY_DECRYPT) //accepted so no recorded frame is refused or flattened
+#define RECEIVE_TIMEOUT_SEC 30 //a player whose opponent vanished gives up after this
+#define DRAIN_IDLE_MS 100 //after the last frame, relays still arriving within this are counted
+#define NS_PER_SEC 1000000000ull
+#define NS_PER_MS 1000000ull
+#define NS_PER_US 1000.0
+#define BYTES_PER_KIB 1024.0
+#define CAPABILITY_ANSWER_SIZE 16
+#define PROVISION_REQUEST_SIZE 64
+#define REPLAY_DIRECTORY "/tmp/replay" //never created, the files are only acknowledged
+#define STATUS_OKAY_TEXT "okay"
+#define FLG_DIR_TEXT "FLG_DIR"
+#define GAME_MAX_TEXT "game limit reached\n"
+#define INITIAL_RECORD_CAPACITY 4096
+#define GROWTH_FACTOR 2
+#define POLL_NOW 0
+#define POLL_RECEIVED 1 //poll_players results
+#define POLL_IDLE 0
+#define POLL_FAILED -1
+
+/**
+ * Run parameters, set once in main
+ * Components:
+ *   speed: Divides the recorded offsets, AS_FAST_AS_POSSIBLE sends back to back
+ *   concurrent_games: Games replayed at once, one thread each
+ *   address: Server address
+ */
+typedef struct {
+    double speed;
+    unsigned int concurrent_games;
+    struct sockaddr_in address;
+} ReplayConfig;
+
+/**
+ * A record and its position in the log, the position keeps the sort stable
+ */
+typedef struct {
+    ReplayRecord record;
+    size_t order;
+} LoggedRecord;
+
+/**
+ * One recorded game, a run of the sorted record array
+ * Components:
+ *   records: First record
+ *   count: Records of the game
+ */
+typedef struct {
+    const LoggedRecord *records;
+    size_t count;
+} RecordedGame;
+
+/**
+ * One side of a replayed game
+ * Components:
+ *   session: Server connection
+ *   encoding: Framing agreed in the HEL exchange
+ *   capabilities: FRAME_CAPABILITY_* bits agreed with the server
+ *   answered_hello: The capability answer was sent, the next HEL is the AEAD acknowledgement
+ *   matched: FLG_DIR arrived, the server put the player in a game
+ *   setup_done: PRV okay was sent, the server now relays this player's frames
+ *   closed: The server closed the connection
+ */
+typedef struct {
+    CryptoSession *session;
+    FrameEncoding encoding;
+    unsigned int capabilities;
+    bool answered_hello;
+    bool matched;
+    bool setup_done;
+    bool closed;
+} Player;
+
+static ReplayConfig config = {.speed = DEFAULT_SPEED, .concurrent_games = DEFAULT_CONCURRENT_GAMES};
+static RecordedGame *games = NULL;
+static size_t game_count = 0;
+static atomic_size_t next_game = 0; //games handed to threads so far
+static pthread_mutex_t pairing_mutex = PTHREAD_MUTEX_INITIALIZER; //keeps the two players of a game together
+static atomic_ulong games_replayed = 0;
+static atomic_ulong games_failed = 0; //refused connections, setup failures and GAME_MAX
+static atomic_ulong frames_sent = 0;
+static atomic_ulong bytes_sent = 0;
+static atomic_ulong frames_received = 0; //relays and server text received after setup
+static atomic_ulong lag_total_ns = 0; //how late frames went out against their schedule
+static atomic_ulong lag_max_ns = 0;
+
+/**
+ * Reads the monotonic clock
+ * Returns:
+ *   Nanoseconds
+ */
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * NS_PER_SEC + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * qsort comparator grouping records by game, then ordering them by time and log position
+ */
+static int compare_records(const void *a, const void *b) {
+    const LoggedRecord *left = a;
+    const LoggedRecord *right = b;
+    if (left->record.game != right->record.game) {
+        return left->record.game < right->record.game ? -1 : 1;
+    }
+    if (left->record.timestamp_ns != right->record.timestamp_ns) {
+        return left->record.timestamp_ns < right->record.timestamp_ns ? -1 : 1;
+    }
+    return (left->order > right->order) - (left->order < right->order);
+}
+
+/**
+ * Maps one segment file and appends its records
+ * Args:
+ *   path: Segment file
+ *   records: Growing record array
+ *   count: Entries used
+ *   capacity: Entries allocated
+ * Operation:
+ *   The mapping stays for the whole run, every record payload points into it
+ * Returns:
+ *   Boolean indicating the file is a segment and was read
+ */
+static bool load_segment(const char *path, LoggedRecord **records, size_t *count, size_t *capacity) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size < REPLAY_FILE_HEADER_SIZE) {
+        close(fd);
+        return false;
+    }
+    const size_t size = (size_t) status.st_size;
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED || !replay_check_header(data, size)) {
+        return false;
+    }
+    size_t offset = REPLAY_FILE_HEADER_SIZE;
+    ReplayRecord record;
+    while (replay_read_record(data, size, &offset, &record)) {
+        if (*count == *capacity) {
+            const size_t grown = *capacity * GROWTH_FACTOR;
+            LoggedRecord *larger = realloc(*records, grown * sizeof(LoggedRecord));
+            if (larger == NULL) {
+                return false;
+            }
+            *records = larger;
+            *capacity = grown;
+        }
+        (*records)[*count] = (LoggedRecord) {.record = record, .order = *count};
+        (*count)++;
+    }
+    return true;
+}
+
+/**
+ * Loads every segment and splits the records into games
+ * Args:
+ *   paths: Segment files in log order
+ *   path_count: Number of files
+ * Returns:
+ *   Boolean indicating every file was read
+ */
+static bool load_games(char *const *paths, const size_t path_count) {
+    size_t capacity = INITIAL_RECORD_CAPACITY;
+    size_t count = 0;
+    LoggedRecord *records = malloc(capacity * sizeof(LoggedRecord));
+    if (records == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < path_count; i++) {
+        if (!load_segment(paths[i], &records, &count, &capacity)) {
+            printf("Cannot read replay segment %s\n", paths[i]);
+            free(records);
+            return false;
+        }
+    }
+    qsort(records, count, sizeof(LoggedRecord), compare_records);
+    games = calloc(count > 0 ? count : 1, sizeof(RecordedGame));
+    if (games == NULL) {
+        free(records);
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (i == 0 || records[i].record.game != records[i - 1].record.game) {
+            games[game_count++].records = &records[i];
+        }
+        games[game_count - 1].count++;
+    }
+    return true;
+}
+
+/**
+ * Connects and runs the key exchange
+ * Args:
+ *   player: Player to connect, receives the session
+ * Operation:
+ *   TCP_NODELAY like the client, SO_RCVTIMEO so a vanished server cannot hang the run
+ * Returns:
+ *   Boolean indicating success
+ */
+static bool player_connect(Player *player) {
+    const int socketFD = createTCPIpv4Socket();
+    if (socketFD == SOCKET_ERROR) {
+        return false;
+    }
+    const int no_delay = 1;
+    setsockopt(socketFD, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    const struct timeval timeout = {.tv_sec = RECEIVE_TIMEOUT_SEC, .tv_usec = 0};
+    setsockopt(socketFD, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(socketFD, (const struct sockaddr *) &config.address, sizeof(config.address)) != SOCKET_INIT_ERROR) {
+        close(socketFD);
+        return false;
+    }
+    size_t key_size = 0;
+    const unsigned char *key = send_recv_key(socketFD, &key_size);
+    if (key == NULL) {
+        close(socketFD);
+        return false;
+    }
+    player->session = crypto_session_create(socketFD, key, key_size, CRYPTO_ROLE_CLIENT);
+    OPENSSL_cleanse((void *) key, key_size);
+    free((void *) key);
+    if (player->session == NULL) {
+        close(socketFD);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Closes a player's connection
+ * Args:
+ *   player: Player to close, may be unconnected
+ * Returns: void
+ */
+static void player_close(Player *player) {
+    if (player->session == NULL) {
+        return;
+    }
+    const int socketFD = crypto_session_socket(player->session);
+    crypto_session_destroy(player->session);
+    close(socketFD);
+    player->session = NULL;
+}
+
+/**
+ * Answers the server's capability offer, or applies its AEAD acknowledgement
+ * Args:
+ *   player: Receiving player
+ *   hello: HEL segment
+ * Returns:
+ *   Boolean indicating success
+ */
+static bool answer_hello(Player *player, const FrameSegment *hello) {
+    if (player->answered_hello) {
+        if (player->capabilities & FRAME_CAPABILITY_AEAD) {
+            session_seal_receive(player->session);
+        }
+        return true;
+    }
+    player->answered_hello = true;
+    player->capabilities = frame_capabilities(hello) & REPLAY_CAPABILITIES;
+    char answer[CAPABILITY_ANSWER_SIZE] = {0};
+    const int answer_length = snprintf(answer, sizeof(answer), "%u", player->capabilities);
+    // The answer itself still goes out in text framing
+    const bool sent = player->capabilities & FRAME_CAPABILITY_AEAD
+                          ? send_frame_and_seal(player->session, FRAME_ENCODING_TEXT, MESSAGE_TYPE_HEL, answer,
+                                                (size_t) answer_length)
+                          : send_frame(player->session, FRAME_ENCODING_TEXT, MESSAGE_TYPE_HEL, answer,
+                                       (size_t) answer_length);
+    player->encoding = player->capabilities & FRAME_CAPABILITY_BINARY ? FRAME_ENCODING_BINARY
+                                                                       : FRAME_ENCODING_TEXT;
+    return sent;
+}
+
+/**
+ * Handles one segment received from the server
+ * Args:
+ *   player: Receiving player
+ *   segment: Segment in wire order
+ * Operation:
+ *   - Runs the HEL and PRV setup, the provisioned files are acknowledged and never written
+ *   - Counts everything after the setup, nothing a replayed player receives changes what it sends
+ * Returns:
+ *   Boolean indicating the player can go on
+ */
+static bool handle_segment(Player *player, const FrameSegment *segment) {
+    if (segment->type == MESSAGE_TYPE_HEL) {
+        return answer_hello(player, segment);
+    }
+    if (segment->type == MESSAGE_TYPE_ERR && frame_data_equals(segment, GAME_MAX_TEXT)) {
+        return false;
+    }
+    if (!player->setup_done && segment->type == MESSAGE_TYPE_FLG && frame_data_equals(segment, FLG_DIR_TEXT)) {
+        player->matched = true;
+        char request[PROVISION_REQUEST_SIZE];
+        const size_t length = write_provision(request, sizeof(request), REPLAY_DIRECTORY,
+                                              strlen(REPLAY_DIRECTORY), REPLAY_DIRECTORY,
+                                              strlen(REPLAY_DIRECTORY));
+        return player->capabilities & FRAME_CAPABILITY_PROVISION && length > 0 &&
+               send_frame(player->session, player->encoding, MESSAGE_TYPE_PRV, request, length);
+    }
+    if (!player->setup_done && segment->type == MESSAGE_TYPE_PRV) {
+        player->setup_done = send_frame(player->session, player->encoding, MESSAGE_TYPE_PRV, STATUS_OKAY_TEXT,
+                                        strlen(STATUS_OKAY_TEXT));
+        return player->setup_done;
+    }
+    if (player->setup_done) {
+        atomic_fetch_add_explicit(&frames_received, 1, memory_order_relaxed);
+    }
+    return true;
+}
+
+/**
+ * Receives and handles one message
+ * Args:
+ *   player: Receiving player
+ *   buffer: FRAME_MAX_SIZE receive buffer
+ * Returns:
+ *   Boolean indicating the player can go on, false once the server closed it
+ */
+static bool player_receive(Player *player, char *buffer) {
+    const ssize_t received = session_recv(player->session, buffer, FRAME_MAX_SIZE - 1);
+    if (received <= 0) {
+        player->closed = true;
+        return false;
+    }
+    buffer[received] = '\0';
+    FrameView view;
+    if (!parse_frame(buffer, (size_t) received, &view)) {
+        return false;
+    }
+    for (unsigned int i = 0; i < view.segment_count; i++) {
+        if (!handle_segment(player, &view.segments[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Polls both players once and handles what arrived
+ * Args:
+ *   players: Both players of the game
+ *   buffer: FRAME_MAX_SIZE receive buffer
+ *   timeout_ms: Longest wait, POLL_NOW to only take what is there
+ * Returns:
+ *   POLL_RECEIVED when something was handled, POLL_IDLE when the wait ran out, POLL_FAILED once a player failed
+ */
+static int poll_players(Player *players, char *buffer, const int timeout_ms) {
+    struct pollfd fds[PLAYERS_PER_GAME];
+    for (unsigned int i = 0; i < PLAYERS_PER_GAME; i++) {
+        fds[i] = (struct pollfd) {.fd = crypto_session_socket(players[i].session), .events = POLLIN};
+    }
+    int ready;
+    while ((ready = poll(fds, PLAYERS_PER_GAME, timeout_ms)) < 0 && errno == EINTR) {
+    }
+    if (ready <= 0) {
+        return ready == 0 ? POLL_IDLE : POLL_FAILED;
+    }
+    for (unsigned int i = 0; i < PLAYERS_PER_GAME; i++) {
+        if (fds[i].revents && !player_receive(&players[i], buffer)) {
+            return POLL_FAILED;
+        }
+    }
+    return POLL_RECEIVED;
+}
+
+/**
+ * Drains both players until neither received anything for a while
+ * Args:
+ *   players: Both players of the game
+ *   buffer: FRAME_MAX_SIZE receive buffer
+ *   idle_ms: Silence that ends the drain
+ * Returns:
+ *   Boolean indicating both players can go on
+ */
+static bool drain_until_idle(Player *players, char *buffer, const int idle_ms) {
+    int result;
+    while ((result = poll_players(players, buffer, idle_ms)) == POLL_RECEIVED) {
+    }
+    return result == POLL_IDLE;
+}
+
+/**
+ * Connects a player and waits until the server put it in a game
+ * Args:
+ *   player: Player to connect
+ *   buffer: FRAME_MAX_SIZE receive buffer
+ * Returns:
+ *   Boolean indicating the player is matched
+ */
+static bool connect_and_match(Player *player, char *buffer) {
+    if (!player_connect(player)) {
+        return false;
+    }
+    while (!player->matched) {
+        if (!player_receive(player, buffer)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Waits a frame's turn while draining both players
+ * Args:
+ *   players: Both players of the game
+ *   buffer: FRAME_MAX_SIZE receive buffer
+ *   deadline_ns: now_ns value the frame is due at
+ * Returns:
+ *   Boolean indicating both players can go on
+ */
+static bool wait_until(Player *players, char *buffer, const uint64_t deadline_ns) {
+    uint64_t now = now_ns();
+    // At least one pass, a frame already late still takes what is waiting so neither side's buffers fill up
+    do {
+        const int timeout_ms = now < deadline_ns ? (int) ((deadline_ns - now + NS_PER_MS - 1) / NS_PER_MS)
+                                                 : POLL_NOW;
+        if (poll_players(players, buffer, timeout_ms) == POLL_FAILED) {
+            return false;
+        }
+        now = now_ns();
+    } while (now < deadline_ns);
+    return true;
+}
+
+/**
+ * Records how late a frame went out
+ * Args:
+ *   lag_ns: Send time minus due time
+ * Returns: void
+ */
+static void record_lag(const uint64_t lag_ns) {
+    atomic_fetch_add_explicit(&lag_total_ns, lag_ns, memory_order_relaxed);
+    unsigned long seen = atomic_load_explicit(&lag_max_ns, memory_order_relaxed);
+    while (lag_ns > seen && !atomic_compare_exchange_weak_explicit(&lag_max_ns, &seen, lag_ns, memory_order_relaxed,
+                                                                   memory_order_relaxed)) {
+    }
+}
+
+/**
+ * Replays one recorded game
+ * Args:
+ *   game: Recorded game
+ *   buffer: FRAME_MAX_SIZE receive buffer owned by the calling thread
+ * Operation:
+ *   - Matches both players under pairing_mutex so the server pairs them with each other
+ *   - Finishes both setups, then sends every player frame at its scaled offset from the first record
+ *   - Counts the relays arriving until DRAIN_IDLE_MS of silence, then closes both players
+ * Returns:
+ *   Boolean indicating the whole game was sent
+ */
+static bool replay_game(const RecordedGame *game, char *buffer) {
+    Player players[PLAYERS_PER_GAME] = {0};
+    pthread_mutex_lock(&pairing_mutex);
+    bool ok = connect_and_match(&players[0], buffer) && connect_and_match(&players[1], buffer);
+    pthread_mutex_unlock(&pairing_mutex);
+    while (ok && !(players[0].setup_done && players[1].setup_done)) {
+        ok = poll_players(players, buffer, RECEIVE_TIMEOUT_SEC * (int) (NS_PER_SEC / NS_PER_MS)) == POLL_RECEIVED;
+    }
+    const uint64_t start = now_ns();
+    const uint64_t first = game->records[0].record.timestamp_ns;
+    for (size_t i = 0; ok && i < game->count; i++) {
+        const ReplayRecord *record = &game->records[i].record;
+        if (record->direction >= PLAYERS_PER_GAME) {
+            continue;
+        }
+        const uint64_t due = config.speed == AS_FAST_AS_POSSIBLE
+                                 ? start
+                                 : start + (uint64_t) ((double) (record->timestamp_ns - first) / config.speed);
+        ok = wait_until(players, buffer, due);
+        Player *sender = &players[record->direction];
+        ok = ok && send_frame(sender->session, sender->encoding, record->type, record->payload, record->length);
+        if (ok) {
+            record_lag(now_ns() - due);
+            atomic_fetch_add_explicit(&frames_sent, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&bytes_sent, record->length, memory_order_relaxed);
+        }
+    }
+    ok = ok && drain_until_idle(players, buffer, DRAIN_IDLE_MS);
+    player_close(&players[0]);
+    player_close(&players[1]);
+    return ok;
+}
+
+/**
+ * Replay thread body
+ * Args:
+ *   arg: Unused
+ * Operation:
+ *   Replays games until every recorded one was handed out
+ * Returns: NULL
+ */
+static void *replay_thread(void *arg) {
+    (void) arg;
+    char *buffer = malloc(FRAME_MAX_SIZE);
+    if (buffer == NULL) {
+        return NULL;
+    }
+    size_t index;
+    while ((index = atomic_fetch_add(&next_game, 1)) < game_count) {
+        atomic_fetch_add(replay_game(&games[index], buffer) ? &games_replayed : &games_failed, 1);
+    }
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * Prints the run summary
+ * Args:
+ *   elapsed_ns: Wall time of the run
+ * Returns: void
+ */
+static void report(const uint64_t elapsed_ns) {
+    const double seconds = (double) elapsed_ns / NS_PER_SEC;
+    const unsigned long sent = atomic_load(&frames_sent);
+    printf("duration               %.3fs\n", seconds);
+    printf("games                  %zu recorded, %lu replayed, %lu failed\n", game_count,
+           atomic_load(&games_replayed), atomic_load(&games_failed));
+    printf("sent                   %lu frames, %.1f frames/s, %.1f KiB/s\n", sent, sent / seconds,
+           atomic_load(&bytes_sent) / BYTES_PER_KIB / seconds);
+    printf("received               %lu frames\n", atomic_load(&frames_received));
+    printf("send lag               mean=%.1fus max=%.1fus\n",
+           sent > 0 ? atomic_load(&lag_total_ns) / NS_PER_US / sent : 0.0, atomic_load(&lag_max_ns) / NS_PER_US);
+}
+
+/**
+ * Main entry point
+ * Args:
+ *   argc: Argument count
+ *   argv: Options, then server IP, port and the segment files
+ * Operation:
+ *   - Loads the log, runs concurrent_games replay threads until every game was replayed
+ *   - Prints the report
+ * Returns:
+ *   EXIT_SUCCESS when every game was replayed in full, EXIT_FAILURE otherwise
+ */
+int main(const int argc, char *argv[]) {
+    int option;
+    while ((option = getopt(argc, argv, "s:c:")) != -1) {
+        if (option == 's' && strtod(optarg, NULL) >= AS_FAST_AS_POSSIBLE) {
+            config.speed = strtod(optarg, NULL);
+        } else if (option == 'c' && atoi(optarg) > 0 && atoi(optarg) <= MAX_CONCURRENT_GAMES) {
+            config.concurrent_games = (unsigned int) atoi(optarg);
+        } else {
+            printf(USAGE, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind < MIN_ARGC) {
+        printf("incorrect number of arguments\n");
+        printf(USAGE, argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (createIPv4Address(argv[optind + IP_ARGV], atoi(argv[optind + PORT_ARGV]), &config.address) ==
+        SOCKET_INIT_ERROR) {
+        printf("Incorrect IP or port\n");
+        return EXIT_FAILURE;
+    }
+    if (!load_games(&argv[optind + FIRST_SEGMENT_ARGV], (size_t) (argc - optind - FIRST_SEGMENT_ARGV))) {
+        return EXIT_FAILURE;
+    }
+    pthread_t *threads = calloc(config.concurrent_games, sizeof(pthread_t));
+    if (threads == NULL) {
+        return EXIT_FAILURE;
+    }
+    printf("Replaying %zu games, %u at a time, speed %.2f\n", game_count, config.concurrent_games, config.speed);
+    const uint64_t start = now_ns();
+    unsigned int started = 0;
+    while (started < config.concurrent_games &&
+           pthread_create(&threads[started], NULL, replay_thread, NULL) == 0) {
+        started++;
+    }
+    for (unsigned int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    report(now_ns() - start);
+    free(threads);
+    return atomic_load(&games_failed) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
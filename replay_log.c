@@ -0,0 +1,456 @@
+/*
+ * Append-only recording of relayed game traffic
+ * Relay threads copy each relayed segment into a pooled slot and hand its
+ * index over a lock-free ring, like the logger; one writer thread appends the
+ * records to a memory-mapped segment file and rotates to a new file when the
+ * mapping is full, so the relay path never issues a write system call
+ * The same reader is used by the Replay tool to feed a log back to a server
+ */
+
+#define _GNU_SOURCE
+#include "replay_log.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "mpmc_ring.h"
+#include "server_log.h"
+
+#define SEMAPHORE_THREAD_SHARED 0
+#define BYTE_BITS 8
+#define BYTE_MASK 0xffu
+#define NS_PER_SEC 1000000000ull
+#define REPLAY_PATH_SIZE 512
+#define REPLAY_FILE_MODE 0600
+#define FIRST_SEGMENT_SEQUENCE 0
+#define VERSION_OFFSET REPLAY_MAGIC_SIZE
+#define VERSION_SIZE 4
+#define HEADER_SIZE_OFFSET (VERSION_OFFSET + VERSION_SIZE)
+#define HEADER_SIZE_SIZE 4
+#define TIMESTAMP_OFFSET 0
+#define TIMESTAMP_SIZE 8
+#define GAME_OFFSET 8
+#define GAME_SIZE 8
+#define MARKER_OFFSET 16
+#define MARKER_SIZE 2
+#define DIRECTION_OFFSET 18
+#define TYPE_OFFSET 19
+#define LENGTH_OFFSET 20
+#define LENGTH_SIZE 4
+
+/**
+ * One queued record
+ * Components:
+ *   timestamp_ns: CLOCK_MONOTONIC of the relay
+ *   game: Game id
+ *   direction: Sender's player index or REPLAY_FROM_SERVER
+ *   type: Message type
+ *   length: Payload bytes
+ *   payload: inline_payload, or a heap copy above REPLAY_INLINE_PAYLOAD that the writer frees
+ *   inline_payload: Storage for small payloads
+ */
+typedef struct {
+    uint64_t timestamp_ns;
+    uint64_t game;
+    unsigned int direction;
+    MessageType type;
+    uint32_t length;
+    char *payload;
+    char inline_payload[REPLAY_INLINE_PAYLOAD];
+} ReplaySlot;
+
+/**
+ * Segment file being appended to, writer thread only
+ * Components:
+ *   fd: Open segment file
+ *   map: Shared writable mapping of REPLAY_SEGMENT_SIZE bytes
+ *   used: Bytes written, the file is truncated to this when the segment closes
+ *   sequence: Number of the segment in this run
+ */
+typedef struct {
+    int fd;
+    char *map;
+    size_t used;
+    unsigned int sequence;
+} ReplaySegment;
+
+/**
+ * Recorder state
+ * Components:
+ *   slots: REPLAY_QUEUE_CAPACITY records, owned by whoever holds their index
+ *   free_slots: Indexes a relay thread may fill
+ *   ready_slots: Indexes of filled records in submit order
+ *   ready_count: Counts ready_slots entries, the writer sleeps on it
+ *   writer: Thread doing the file I/O
+ *   running: Writer should keep going
+ *   started: Records are kept
+ *   segment: Current segment file
+ *   directory: Where segment files are created
+ *   run_seconds: Wall clock start of the run, part of every file name
+ *   dropped: Records dropped so far
+ */
+typedef struct {
+    ReplaySlot *slots;
+    MpmcRing free_slots;
+    MpmcRing ready_slots;
+    sem_t ready_count;
+    pthread_t writer;
+    atomic_bool running;
+    atomic_bool started;
+    ReplaySegment segment;
+    char directory[REPLAY_PATH_SIZE];
+    long long run_seconds;
+    atomic_ulong dropped;
+} ReplayRecorder;
+
+static ReplayRecorder recorder = {.segment = {.fd = -1}};
+
+/**
+ * Writes a big endian integer
+ * Args:
+ *   out: Destination
+ *   value: Value to write
+ *   bytes: Width in bytes
+ * Returns: void
+ */
+static void put_big_endian(unsigned char *out, const uint64_t value, const size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        out[i] = (unsigned char) (value >> (BYTE_BITS * (bytes - 1 - i)) & BYTE_MASK);
+    }
+}
+
+/**
+ * Reads a big endian integer
+ * Args:
+ *   in: Source
+ *   bytes: Width in bytes
+ * Returns:
+ *   Value read
+ */
+static uint64_t get_big_endian(const unsigned char *in, const size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++) {
+        value = value << BYTE_BITS | in[i];
+    }
+    return value;
+}
+
+/**
+ * Reads the monotonic clock
+ * Returns:
+ *   Nanoseconds
+ */
+static uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * NS_PER_SEC + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * Creates and maps the next segment file
+ * Args:
+ *   sequence: Number of the segment in this run
+ * Operation:
+ *   Sizes the file to REPLAY_SEGMENT_SIZE up front so appends never grow it, then writes the file header
+ * Returns:
+ *   Boolean indicating the segment is ready
+ */
+static bool open_segment(const unsigned int sequence) {
+    char path[REPLAY_PATH_SIZE];
+    if (snprintf(path, sizeof(path), "%s/replay-%010lld-%06u.log", recorder.directory, recorder.run_seconds,
+                 sequence) >= (int) sizeof(path)) {
+        return false;
+    }
+    const int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, REPLAY_FILE_MODE);
+    if (fd < 0) {
+        return false;
+    }
+    if (ftruncate(fd, REPLAY_SEGMENT_SIZE) != 0) {
+        close(fd);
+        unlink(path);
+        return false;
+    }
+    char *map = mmap(NULL, REPLAY_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        unlink(path);
+        return false;
+    }
+    memcpy(map, REPLAY_MAGIC, REPLAY_MAGIC_SIZE);
+    put_big_endian((unsigned char *) map + VERSION_OFFSET, REPLAY_VERSION, VERSION_SIZE);
+    put_big_endian((unsigned char *) map + HEADER_SIZE_OFFSET, REPLAY_RECORD_HEADER_SIZE, HEADER_SIZE_SIZE);
+    recorder.segment = (ReplaySegment) {.fd = fd, .map = map, .used = REPLAY_FILE_HEADER_SIZE, .sequence = sequence};
+    return true;
+}
+
+/**
+ * Unmaps the current segment and cuts the file down to its records
+ * Returns: void
+ */
+static void close_segment() {
+    if (recorder.segment.fd < 0) {
+        return;
+    }
+    munmap(recorder.segment.map, REPLAY_SEGMENT_SIZE);
+    if (ftruncate(recorder.segment.fd, (off_t) recorder.segment.used) != 0) {
+        // The zero filled tail still reads as the end of the segment
+        log_write(LOG_LEVEL_WARN, "Replay segment %u keeps its unused tail\n", recorder.segment.sequence);
+    }
+    close(recorder.segment.fd);
+    recorder.segment.fd = -1;
+    recorder.segment.map = NULL;
+}
+
+/**
+ * Appends one record, rotating to a new segment when it does not fit
+ * Args:
+ *   slot: Record to write
+ * Returns:
+ *   Boolean indicating the record was written
+ */
+static bool append_record(const ReplaySlot *slot) {
+    const size_t size = REPLAY_RECORD_HEADER_SIZE + slot->length;
+    if (REPLAY_FILE_HEADER_SIZE + size > REPLAY_SEGMENT_SIZE) {
+        return false;
+    }
+    if (recorder.segment.fd < 0) {
+        // A rotation failed earlier, the rest of the run is dropped
+        return false;
+    }
+    if (recorder.segment.used + size > REPLAY_SEGMENT_SIZE) {
+        const unsigned int sequence = recorder.segment.sequence + 1;
+        close_segment();
+        if (!open_segment(sequence)) {
+            log_write(LOG_LEVEL_ERROR, "Cannot open replay segment %u, recording stops\n", sequence);
+            return false;
+        }
+    }
+    unsigned char *out = (unsigned char *) recorder.segment.map + recorder.segment.used;
+    put_big_endian(out + TIMESTAMP_OFFSET, slot->timestamp_ns, TIMESTAMP_SIZE);
+    put_big_endian(out + GAME_OFFSET, slot->game, GAME_SIZE);
+    put_big_endian(out + MARKER_OFFSET, REPLAY_RECORD_MARKER, MARKER_SIZE);
+    out[DIRECTION_OFFSET] = (unsigned char) slot->direction;
+    out[TYPE_OFFSET] = (unsigned char) slot->type;
+    put_big_endian(out + LENGTH_OFFSET, slot->length, LENGTH_SIZE);
+    memcpy(out + REPLAY_RECORD_HEADER_SIZE, slot->payload, slot->length);
+    recorder.segment.used += size;
+    return true;
+}
+
+/**
+ * Writer thread body
+ * Args:
+ *   arg: Unused
+ * Operation:
+ *   - Appends every ready record and returns its slot
+ *   - Exits once stopped and drained
+ * Returns: NULL
+ */
+static void *replay_writer(void *arg) {
+    (void) arg;
+    while (true) {
+        if (sem_wait(&recorder.ready_count) != 0) {
+            continue; // interrupted, nothing was taken
+        }
+        uint64_t index;
+        while (mpmc_ring_pop(&recorder.ready_slots, &index)) {
+            ReplaySlot *slot = &recorder.slots[index];
+            if (!append_record(slot)) {
+                atomic_fetch_add_explicit(&recorder.dropped, 1, memory_order_relaxed);
+            }
+            if (slot->payload != slot->inline_payload) {
+                free(slot->payload);
+            }
+            mpmc_ring_push(&recorder.free_slots, index);
+        }
+        if (!atomic_load(&recorder.running)) {
+            // replay_log_stop posted after the last record could be pushed, the ring is drained
+            return NULL;
+        }
+    }
+}
+
+/**
+ * Starts the writer thread
+ * Args:
+ *   directory: Existing directory the segment files go to
+ * Operation:
+ *   Segments are named replay-<start seconds>-<sequence>.log, so a shell glob lists them in order
+ * Returns:
+ *   Boolean indicating the first segment is mapped and the writer runs
+ */
+bool replay_log_start(const char *directory) {
+    if (strlen(directory) >= sizeof(recorder.directory)) {
+        return false;
+    }
+    strcpy(recorder.directory, directory);
+    recorder.run_seconds = (long long) time(NULL);
+    if (!open_segment(FIRST_SEGMENT_SEQUENCE)) {
+        return false;
+    }
+    recorder.slots = calloc(REPLAY_QUEUE_CAPACITY, sizeof(ReplaySlot));
+    if (recorder.slots == NULL) {
+        close_segment();
+        return false;
+    }
+    if (!mpmc_ring_init(&recorder.free_slots, REPLAY_QUEUE_CAPACITY)) {
+        free(recorder.slots);
+        close_segment();
+        return false;
+    }
+    if (!mpmc_ring_init(&recorder.ready_slots, REPLAY_QUEUE_CAPACITY)) {
+        mpmc_ring_destroy(&recorder.free_slots);
+        free(recorder.slots);
+        close_segment();
+        return false;
+    }
+    for (uint64_t i = 0; i < REPLAY_QUEUE_CAPACITY; i++) {
+        mpmc_ring_push(&recorder.free_slots, i);
+    }
+    sem_init(&recorder.ready_count, SEMAPHORE_THREAD_SHARED, 0);
+    atomic_store(&recorder.running, true);
+    if (pthread_create(&recorder.writer, NULL, replay_writer, NULL) != 0) {
+        sem_destroy(&recorder.ready_count);
+        mpmc_ring_destroy(&recorder.ready_slots);
+        mpmc_ring_destroy(&recorder.free_slots);
+        free(recorder.slots);
+        close_segment();
+        return false;
+    }
+    atomic_store(&recorder.started, true);
+    return true;
+}
+
+/**
+ * Writes the records still queued, truncates the last segment to its records and stops the writer
+ * Returns: void
+ */
+void replay_log_stop() {
+    if (!atomic_exchange(&recorder.started, false)) {
+        return;
+    }
+    // Called after every handler exited, nothing pushes anymore
+    atomic_store(&recorder.running, false);
+    sem_post(&recorder.ready_count);
+    pthread_join(recorder.writer, NULL);
+    close_segment();
+    sem_destroy(&recorder.ready_count);
+    mpmc_ring_destroy(&recorder.ready_slots);
+    mpmc_ring_destroy(&recorder.free_slots);
+    free(recorder.slots);
+}
+
+/**
+ * Tells whether recording is on, callers skip building records otherwise
+ * Returns:
+ *   Boolean indicating replay_log_record keeps records
+ */
+bool replay_log_enabled() {
+    return atomic_load_explicit(&recorder.started, memory_order_relaxed);
+}
+
+/**
+ * Queues the segments of one relayed frame
+ * Args:
+ *   game: Game id
+ *   direction: Sender's player index or REPLAY_FROM_SERVER
+ *   segments: Frame segments
+ *   count: Number of segments
+ * Operation:
+ *   - One record per segment, stamped once for the whole frame
+ *   - Copies into a pooled slot and pushes it on a lock-free ring, the mapped file is only touched by the writer
+ *   - Drops and counts records when the pool is empty
+ * Returns: void
+ */
+void replay_log_record(const uint64_t game, const unsigned int direction, const FrameSegment *segments,
+                       const unsigned int count) {
+    if (!replay_log_enabled()) {
+        return;
+    }
+    const uint64_t timestamp = monotonic_ns();
+    for (unsigned int i = 0; i < count; i++) {
+        uint64_t index;
+        if (!mpmc_ring_pop(&recorder.free_slots, &index)) {
+            atomic_fetch_add_explicit(&recorder.dropped, count - i, memory_order_relaxed);
+            return;
+        }
+        ReplaySlot *slot = &recorder.slots[index];
+        slot->payload = segments[i].length <= REPLAY_INLINE_PAYLOAD ? slot->inline_payload
+                                                                     : malloc(segments[i].length);
+        if (slot->payload == NULL) {
+            mpmc_ring_push(&recorder.free_slots, index);
+            atomic_fetch_add_explicit(&recorder.dropped, 1, memory_order_relaxed);
+            continue;
+        }
+        slot->timestamp_ns = timestamp;
+        slot->game = game;
+        slot->direction = direction;
+        slot->type = segments[i].type;
+        slot->length = (uint32_t) segments[i].length;
+        memcpy(slot->payload, segments[i].data, segments[i].length);
+        mpmc_ring_push(&recorder.ready_slots, index);
+        sem_post(&recorder.ready_count);
+    }
+}
+
+/**
+ * Counts dropped records
+ * Returns:
+ *   Records dropped because the queue was full or a payload could not be copied
+ */
+unsigned long replay_log_dropped() {
+    return atomic_load_explicit(&recorder.dropped, memory_order_relaxed);
+}
+
+/**
+ * Checks the header of a segment file
+ * Args:
+ *   data: Start of the file
+ *   size: File size
+ * Returns:
+ *   Boolean indicating a segment of a known version
+ */
+bool replay_check_header(const char *data, const size_t size) {
+    return size >= REPLAY_FILE_HEADER_SIZE && memcmp(data, REPLAY_MAGIC, REPLAY_MAGIC_SIZE) == 0 &&
+           get_big_endian((const unsigned char *) data + VERSION_OFFSET, VERSION_SIZE) == REPLAY_VERSION &&
+           get_big_endian((const unsigned char *) data + HEADER_SIZE_OFFSET, HEADER_SIZE_SIZE) ==
+           REPLAY_RECORD_HEADER_SIZE;
+}
+
+/**
+ * Reads the next record of a segment
+ * Args:
+ *   data: Start of the file
+ *   size: File size
+ *   offset: Position of the record, advanced past it
+ *   record: Receives the record, its payload points into data
+ * Returns:
+ *   Boolean indicating a complete record was read, false at the end of the segment
+ */
+bool replay_read_record(const char *data, const size_t size, size_t *offset, ReplayRecord *record) {
+    if (*offset > size || size - *offset < REPLAY_RECORD_HEADER_SIZE) {
+        return false;
+    }
+    const unsigned char *in = (const unsigned char *) data + *offset;
+    if (get_big_endian(in + MARKER_OFFSET, MARKER_SIZE) != REPLAY_RECORD_MARKER) {
+        return false;
+    }
+    const uint32_t length = (uint32_t) get_big_endian(in + LENGTH_OFFSET, LENGTH_SIZE);
+    if (size - *offset - REPLAY_RECORD_HEADER_SIZE < length) {
+        return false;
+    }
+    record->timestamp_ns = get_big_endian(in + TIMESTAMP_OFFSET, TIMESTAMP_SIZE);
+    record->game = get_big_endian(in + GAME_OFFSET, GAME_SIZE);
+    record->direction = in[DIRECTION_OFFSET];
+    record->type = (MessageType) in[TYPE_OFFSET];
+    record->length = length;
+    record->payload = (const char *) in + REPLAY_RECORD_HEADER_SIZE;
+    *offset += REPLAY_RECORD_HEADER_SIZE + length;
+    return true;
+}
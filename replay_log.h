@@ -0,0 +1,108 @@
+// replay_log.h
+#ifndef REPLAY_LOG_H
+#define REPLAY_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "message_frame.h"
+
+#define REPLAY_MAGIC "CGREPLAY" //first bytes of every segment file
+#define REPLAY_MAGIC_SIZE 8
+#define REPLAY_VERSION 1
+#define REPLAY_FILE_HEADER_SIZE 16 //magic, version, record header size
+#define REPLAY_RECORD_HEADER_SIZE 24 //timestamp, game, marker, direction, type, length, all big endian
+#define REPLAY_RECORD_MARKER 0xc6a7 //opens every record, the zero filled tail of a crashed segment has none
+#define REPLAY_FROM_SERVER 0xff //direction of text the server itself sent to a player
+#define REPLAY_SEGMENT_SIZE (64u * 1024 * 1024) //bytes mapped per segment file before rotating
+#define REPLAY_QUEUE_CAPACITY 4096 //records waiting for the writer, power of two
+#define REPLAY_INLINE_PAYLOAD 1024 //payloads up to this size are copied into the queue slot itself
+
+/**
+ * One recorded segment
+ * Components:
+ *   timestamp_ns: CLOCK_MONOTONIC when it was relayed, only differences are meaningful
+ *   game: Game id, unique within one server run
+ *   direction: Player index of the sender, REPLAY_FROM_SERVER for the server's own text
+ *   type: Message type
+ *   length: Payload bytes
+ *   payload: Points into the mapped segment
+ */
+typedef struct {
+    uint64_t timestamp_ns;
+    uint64_t game;
+    unsigned int direction;
+    MessageType type;
+    uint32_t length;
+    const char *payload;
+} ReplayRecord;
+
+/**
+ * Starts the writer thread
+ * Args:
+ *   directory: Existing directory the segment files go to
+ * Operation:
+ *   Segments are named replay-<start seconds>-<sequence>.log, so a shell glob lists them in order
+ * Returns:
+ *   Boolean indicating the first segment is mapped and the writer runs
+ */
+bool replay_log_start(const char *directory);
+
+/**
+ * Writes the records still queued, truncates the last segment to its records and stops the writer
+ * Returns: void
+ */
+void replay_log_stop();
+
+/**
+ * Tells whether recording is on, callers skip building records otherwise
+ * Returns:
+ *   Boolean indicating replay_log_record keeps records
+ */
+bool replay_log_enabled();
+
+/**
+ * Queues the segments of one relayed frame
+ * Args:
+ *   game: Game id
+ *   direction: Sender's player index or REPLAY_FROM_SERVER
+ *   segments: Frame segments
+ *   count: Number of segments
+ * Operation:
+ *   - One record per segment, stamped once for the whole frame
+ *   - Copies into a pooled slot and pushes it on a lock-free ring, the mapped file is only touched by the writer
+ *   - Drops and counts records when the pool is empty
+ * Returns: void
+ */
+void replay_log_record(uint64_t game, unsigned int direction, const FrameSegment *segments, unsigned int count);
+
+/**
+ * Counts dropped records
+ * Returns:
+ *   Records dropped because the queue was full or a payload could not be copied
+ */
+unsigned long replay_log_dropped();
+
+/**
+ * Checks the header of a segment file
+ * Args:
+ *   data: Start of the file
+ *   size: File size
+ * Returns:
+ *   Boolean indicating a segment of a known version
+ */
+bool replay_check_header(const char *data, size_t size);
+
+/**
+ * Reads the next record of a segment
+ * Args:
+ *   data: Start of the file
+ *   size: File size
+ *   offset: Position of the record, advanced past it
+ *   record: Receives the record, its payload points into data
+ * Returns:
+ *   Boolean indicating a complete record was read, false at the end of the segment
+ */
+bool replay_read_record(const char *data, size_t size, size_t *offset, ReplayRecord *record);
+
+#endif // REPLAY_LOG_H
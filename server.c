@@ -6,60 +6,122 @@
  * using mutex locks for thread-safe operations
  */
 
+#define _GNU_SOURCE
 #include <pthread.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <limits.h>
 #include "cryptography_game_util.h"
 #include "flag_file.h"
+#include "mpmc_ring.h"
+#include "message_frame.h"
+#include "flag_provision.h"
+#include "arena.h"
+#include "server_metrics.h"
+#include "server_log.h"
+#include "cluster.h"
+#include "replay_log.h"
+#include "command_filter.h"
+#include "server_config.h"
+#include "handoff.h"
+#include <semaphore.h>
 #include <openssl/crypto.h>
+#include <openssl/sha.h>
 //defines
 #define CORRECT_ARGC 2
 #define SERVER_IP "0.0.0.0"
-#define GAME_MAX "tlength:54;type:ERR;length:19;data:game limit reached\n"
-#define INVALID_DATA "tlength:55;type:ERR;length:20;data:command not allowed\n"
-#define WAIT_CLIENT "tlength:69;type:ERR;length:34;data:Wait for second client to connect\n"
-#define SECOND_CLIENT_DISCONNECTED "tlength:66;type:ERR;length:31;data:\nSecond client disconnected ):\n"
-#define DIR_REQUEST "tlength:41;type:FLG;length:7;data:FLG_DIR"
-#define KEY_REQUEST "tlength:41;type:KEY;length:7;data:KEY_DIR"
+#define GAME_MAX "game limit reached\n"
+#define INVALID_DATA "command not allowed\n"
+#define WAIT_CLIENT "Wait for second client to connect\n"
+#define WRONG_FLAG "wrong flag\n"
+#define DECRYPT_UNSUPPORTED "the other player's client cannot decrypt in process, pick a single method\n"
+#define DIGEST_EQUAL 0
+#define SECOND_CLIENT_DISCONNECTED "\nSecond client disconnected ):\n"
+#define DIR_REQUEST "FLG_DIR"
+#define KEY_REQUEST "KEY_DIR"
 #define SOCKET_ERROR -1
 #define SOCKET_INIT_ERROR 0
-#define PORT_ARGV 1
 #define MAX_CLIENTS 2
-#define SLEEP 100000
-#define BUFFER_SIZE 4096
 #define RECEIVE_FLAG 0
 #define CHECK_RECEIVE 0
 #define NULL_CHAR 0
 #define ACCEPTED_SUCCESSFULLY 0
-#define LISTEN 1
-#define TYPE_LENGTH 3
-#define TYPE_OFFSET 5
-#define DATA_CMD_CHECK "CMD"
-#define DATA_OFFSET 5
-#define WIN_MSG "tlength:45;type:OUT;length:10;data:\nyou won!\n"
-#define LOSE_MSG "tlength:48;type:OUT;length:13;data:\nyou lost ):\n"
-#define MAX_GAMES 10
-#define MAX_CLIENTS_TOTAL 2 * MAX_GAMES
-#define GAME_NOT_FOUND -1
+#define DEFAULT_LISTEN_BACKLOG SOMAXCONN
+#define FIRST_SEGMENT 0
+#define SINGLE_SEGMENT 1
+#define CONNECTION_ARENA_SIZE (FRAME_MAX_SIZE + sizeof(FrameView) + 2 * ARENA_ALIGNMENT) //one message and its view
+#define WIN_MSG "\nyou won!\n"
+#define LOSE_MSG "\nyou lost ):\n"
+#define CAPABILITY_OFFER_SIZE 16
+#define GAME_SLAB_SIZE 64
+#define MAX_GAME_SLABS 4096
+#define WAITING_QUEUE_CAPACITY 65536
+#define TICKET_GENERATION_SHIFT 32
+#define TICKET_SLOT_MASK 0xffffffffu
 #define FIRST_CLIENT_INDEX 0
 #define SECOND_CLIENT_INDEX 1
 #define PTHREAD_CREATE_SUCCESS 0
-#define PIPE_READ 0
-#define PIPE_WRITE 1
-#define TIMEOUT_SECONDS 1
 #define TIMEOUT_USECONDS 0
-#define SELECT_ERROR_CHECK 0
-#define MAX_FD_FOR_SELECT 1
-#define PIPE_READ_BUF_SIZE 1
-#define FLAG_DATA_SIZE 32
-#define RANDOM_KEY_SIZE 8
+#define NO_STOP_EVENT -1 //reactor mode games are stopped by their reactor
+#define STOP_EVENT_VALUE 1
+#define SOCKET_POLL_INDEX 0
+#define STOP_POLL_INDEX 1
+#define SHUTDOWN_POLL_INDEX 2
+#define HANDLER_POLL_COUNT 3
+#define MULTIPLEX_SHUTDOWN_POLL_INDEX 1
+#define MULTIPLEX_STREAM_POLL_BASE 2 //stop events of the open streams' games follow the socket and shutdown
+#define MULTIPLEX_POLL_COUNT (MULTIPLEX_STREAM_POLL_BASE + FRAME_MAX_STREAMS)
+#define NO_STREAM -1
+#define LISTEN_POLL_INDEX 0
+#define ACCEPT_POLL_COUNT 3 //listen socket, shutdown_event and drain_event
+#define POLL_WAIT_FOREVER -1
+#define FLAG_DATA_SIZE PROVISION_FLAG_DATA_SIZE
+#define RANDOM_KEY_SIZE PROVISION_KEY_SIZE
 #define FLAG_COMMAND_SIZE 512
-#define FLAG_COMMAND_BUFFER_SIZE 2048
-#define KEY_COMMAND_BUFFER_SIZE 2048
 #define KEY_COMMAND_SIZE 1536
 #define MAX_FLAG_FILE_TRIES 5
-#define ENCRYPTION_METHOD_SIZE 16
-#define FIRST_ENC_INDEX 0
+#define DEFAULT_MAX_GAMES (GAME_SLAB_SIZE * MAX_GAME_SLABS) //one registry's capacity, the config can lower it
+#define DRAIN_UNTIL_GAMES_END 0 //drain_timeout that waits for the last game however long it takes
+#define DRAIN_GAMES_POLL_INDEX 0
+#define DRAIN_SHUTDOWN_POLL_INDEX 1
+#define DRAIN_POLL_COUNT 2 //games_event and shutdown_event
+#define NANOSECONDS_PER_SECOND 1000000000ull
+#define NANOSECONDS_PER_MILLISECOND 1000000ull
+#define PROVISION_PAYLOAD_SIZE (PROVISION_HEADER_SIZE + PROVISION_KEY_FILE_SIZE + PROVISION_FLAG_FILE_SIZE)
+#define THREAD_PER_CLIENT_MODE 0
+#define MAX_REACTOR_THREADS 64
+#define REACTOR_MAX_EVENTS 64
+#define REACTOR_WAIT_FOREVER -1
+#define EPOLL_ERROR -1
+#define EVENTFD_ERROR -1
+#define REACTOR_WAKEUP_VALUE 1
+#define REACTOR_IO_TIMEOUT_SECONDS 2 //bounds the blocking s_send to an unsealed client on a reactor thread
+#define REACTOR_READER_EVENTS EPOLLIN
+#define REACTOR_SOCKET_EVENTS (EPOLLIN | EPOLLRDHUP)
+#define DEFAULT_HANDSHAKE_WORKERS 4
+#define MAX_HANDSHAKE_WORKERS 64
+#define HANDSHAKE_QUEUE_CAPACITY 4096
+#define HANDSHAKE_TIMEOUT_SECONDS 5
+#define ACCEPT_BATCH_SIZE 64
+#define POLL_ERROR -1
+#define DEFAULT_LISTENERS 1
+#define LISTENERS_PER_CORE 0 //-l 0 opens one listener per online core
+#define MAX_LISTENERS 64
+#define FIRST_LISTENER 0
+#define CLUSTER_LISTENERS 1 //the listener other nodes relay their connections to
+#define LISTENER_SLOTS (MAX_LISTENERS + CLUSTER_LISTENERS)
+#define LOCAL_NODE -1 //route result that keeps the connection on this node
+#define CLUSTER_KEY_NODE_SHIFT 48 //front-end index + 1 above the local pair counter in a fallback key
+#define SOCKET_OPTION_ON 1
+#define MAX_PORT 65535
+#define USAGE "Usage: %s [-r reactor_threads] [-w handshake_workers] [-l listeners] [-b backlog] " \
+              "[-m metrics_port] [-v error|warn|info|debug] [-n ip:port,ip:port... -i node_index] " \
+              "[-R replay_directory] [-c command_rules] [-f config_file] [-H handoff_socket] <port>\n"
+#define SERVER_OPTIONS "r:w:l:b:m:v:n:i:R:c:f:H:"
 
 //data types
 struct AcceptedSocket {
@@ -67,30 +129,178 @@ struct AcceptedSocket {
     struct sockaddr_in address;
     int error;
     int acceptedSuccessfully;
-    char flag_data[FLAG_DATA_SIZE];
+    unsigned char flag_digest[SHA256_DIGEST_LENGTH]; //SHA-256 of the flag, guesses are compared against it
     char flag_dir[512];
-    unsigned char *encryption_key;
+    CryptoSession *session; //transport and encryption state, freed with the game slot
+    FrameEncoding encoding; //wire format the client asked for, text until its HEL arrives
+    unsigned int capabilities; //FRAME_CAPABILITY_* bits agreed in the HEL exchange
+    struct ClientConnection *connection; //reactor mode handler, guarded by game_mutex
 };
 
 typedef struct {
-    volatile sig_atomic_t stop_game; //stop a single game
+    atomic_uint capabilities; //FRAME_CAPABILITY_* bits from the client's HEL, select the relay encoding
+    atomic_bool flag_ready; //flag_digest is final, check_winner may compare against it
+} PlayerState;
+
+typedef struct {
+    atomic_bool stop_game; //stop a single game
     struct AcceptedSocket game_clients[MAX_CLIENTS]; //array of two client sockets
-    unsigned int acceptedSocketsCount; //num of clients in a game; max 2
-    pthread_mutex_t game_mutex; //mutex for a game
-    int stop_pipe[2]; // Pipe for stopping the game
+    atomic_uint acceptedSocketsCount; //num of clients in a game; max 2, the game's reference count
+    atomic_uint joined_clients; //published game_clients entries, their socket and session stay fixed until release
+    PlayerState players[MAX_CLIENTS]; //per client state read without game_mutex, same index as game_clients
+    pthread_mutex_t game_mutex; //covers joining, leaving and release, never the relay
+    int stop_event; //eventfd, never read so it stays readable for every handler, NO_STOP_EVENT with reactors
+    struct Reactor *reactor; //reactor mode, owns every connection of the game
+    unsigned int slot; //index of the game in the registry
+    unsigned int generation; //bumped every time the slot is released
+    uint64_t match_id; //game id in the replay log, unique within the run
+    bool in_use; //slot currently holds a live game
+    struct GameRegistry *registry; //owner, the last client to leave returns the slot to it
 } Game;
 
-struct ThreadArgs {
+typedef struct GameRegistry {
+    Game *slabs[MAX_GAME_SLABS]; //slab table, slabs never move while the server runs
+    atomic_uint slab_count; //number of published slabs
+    unsigned int *free_slots; //stack of free slot indexes
+    unsigned int free_count; //entries in free_slots
+    pthread_mutex_t registry_mutex; //guards slab growth and the free list
+    MpmcRing waiting_games; //tickets (generation << 32 | slot) of games missing a player
+} GameRegistry;
+
+struct ClientConnection {
     Game *game;
     int socketFD;
-    unsigned char *encryption_key;
+    CryptoSession *session; //shared with the game's copy in game_clients
+    FrameEncoding encoding; //wire format used for replies to this client
+    unsigned int capabilities; //FRAME_CAPABILITY_* bits agreed in the HEL exchange
+    unsigned int player; //index in game_clients and players
+    Arena arena; //receive buffer and frame view of the message being handled, reset per message
+    unsigned int flag_file_tries; //flag directory attempts
+    bool flag_request_dir; //flag command was sent
+    bool flag_okay_response; //client confirmed the flag file
+    unsigned int key_file_tries; //key directory attempts
+    bool key_request_dir; //key command was sent
+    bool key_okay_response; //client confirmed the key file
+    struct Reactor *reactor; //owning reactor, NULL in thread-per-client mode
+    struct UnsealedReader *reader; //receives under a reactor until the session is sealed, NULL otherwise
+    bool closed; //torn down, freed at the end of the epoll batch
+    bool watching_output; //EPOLLOUT armed until the session's unsent records are written
+    struct ClientConnection *prev; //reactor connection list
+    struct ClientConnection *next; //reactor connection list
+    bool multiplexed; //one stream of a multiplexed connection, its multiplexer thread reads for it
+    uint32_t stream; //stream id on a multiplexed connection
+};
+
+struct UnsealedReader {
+    pthread_t thread; //blocks in s_recv so the reactor never does
+    int event_fd; //watched by the reactor in place of the socket, readable while a message waits
+    pthread_mutex_t mutex; //guards the fields below
+    pthread_cond_t taken; //signalled when the reactor handled the message or stopped the reader
+    char *buffer; //FRAME_MAX_SIZE bytes, the waiting message is handled in place
+    ssize_t length; //s_recv result of the waiting message, CHECK_RECEIVE or below once the peer is gone
+    bool full; //a message waits for the reactor
+    bool stopping; //the reader must not call s_recv again
+};
+
+struct Multiplexer {
+    CryptoSession *session; //own reference on the connection's root session, outlives every stream
+    int socketFD; //duplicate the root session owns, the primary's descriptor goes with its game
+    unsigned int capabilities; //agreed on the primary stream, opened streams get a subset
+    unsigned int shard; //listener that accepted the connection, streams are matched from it
+    Arena arena; //receive buffer and frame view, taken over from the primary connection
+    struct ClientConnection *streams[FRAME_MAX_STREAMS]; //open streams, unordered
+    unsigned int stream_count; //entries used in streams
+};
+
+struct PendingConnection {
+    int socketFD; //accepted, not yet keyed
+    struct sockaddr_in address;
+    unsigned int shard; //listener that accepted the socket
+    uint64_t accepted_ns; //metrics_now_ns at accept, the handshake histogram includes queueing
+};
+
+typedef struct {
+    struct PendingConnection entries[HANDSHAKE_QUEUE_CAPACITY]; //ring of accepted sockets
+    unsigned int head; //oldest entry
+    unsigned int count; //queued entries
+    bool stopping; //workers exit once set
+    pthread_mutex_t queue_mutex;
+    pthread_cond_t queue_not_empty;
+    pthread_t workers[MAX_HANDSHAKE_WORKERS];
+    unsigned int worker_count;
+} HandshakeStage;
+
+struct Listener {
+    pthread_t thread; //accept loop, the first listener runs on the main thread
+    int socketFD; //non-blocking, SO_REUSEPORT when there is more than one listener
+    GameRegistry registry; //games started by clients of this listener
+    bool cluster; //accepts connections other nodes relayed, never relays them again
+};
+
+struct Reactor {
+    pthread_t thread;
+    int epoll_fd; //sealed sockets and the reader eventfds of unsealed ones, the cookie is the connection
+    int wakeup_fd; //eventfd used to wake the reactor for shutdown
+    pthread_mutex_t connections_mutex; //guards the connection list
+    struct ClientConnection *connections; //connections owned by this reactor
+    struct ClientConnection *closed_connections; //closed this batch, reactor thread only
 };
 
+/**
+ * Matchmaking backend, decides on which node and in which game a player plays
+ * Components:
+ *   name: Shown at startup
+ *   route: Picks the node of an accepted socket before its key exchange, LOCAL_NODE keeps it here
+ *   match: Finds or creates the game of a keyed client on this node, NULL rejects it
+ */
+typedef struct {
+    const char *name;
+    int (*route)(const struct PendingConnection *pending);
+    Game *(*match)(const struct AcceptedSocket *clientSocketFD, unsigned int shard);
+} MatchBackend;
+
 //globals
-Game *games[MAX_GAMES] = {NULL};
-volatile sig_atomic_t stop_all_games = 0;
+struct Listener listeners[LISTENER_SLOTS];
+unsigned int listener_count = 0;
+atomic_bool stop_all_games = false; //lock-free, so also safe to set from handle_signal
 unsigned int accepted_clients_count = 0;
 pthread_mutex_t globals_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t clients_finished = PTHREAD_COND_INITIALIZER; //signalled when accepted_clients_count drops to 0
+struct Reactor reactors[MAX_REACTOR_THREADS];
+unsigned int reactor_count = THREAD_PER_CLIENT_MODE; //0 keeps one thread per client
+unsigned int next_reactor = 0; //round robin reactor assignment, per game
+int shutdown_event = EVENTFD_ERROR; //written by handle_signal, wakes accept loops and handler threads
+atomic_ulong routed_clients = 0; //connections the ring backend routed without a ticket
+atomic_uint_fast64_t next_match_id = 0; //replay log game ids handed out so far
+atomic_uint game_limit = DEFAULT_MAX_GAMES; //max_games of the running config
+atomic_uint live_games = 0; //slots taken over every registry, held to game_limit
+atomic_uint paired_games = 0; //games both players joined, a drain waits for these
+atomic_uint flag_file_tries_limit = MAX_FLAG_FILE_TRIES; //max_flag_file_tries of the running config
+atomic_uint drain_timeout = DRAIN_UNTIL_GAMES_END; //drain_timeout of the running config, seconds
+atomic_bool draining = false; //a successor took the listeners, accept loops stop without ending games
+int drain_event = EVENTFD_ERROR; //written by begin_drain, wakes the accept loops
+int games_event = EVENTFD_ERROR; //written when paired_games drops to 0, wakes drain_games
+bool listeners_shared = false; //listen sockets came from a predecessor, another process may still use them
+int adopted_cluster_socket = SOCKET_ERROR; //cluster listener a predecessor handed over, until -n takes it
+const char *config_path = NULL; //-f file, read again on SIGHUP
+sem_t reload_requests; //posted by handle_reload_signal
+pthread_t config_reloader_thread;
+atomic_bool config_reloader_running = false;
+ServerConfig running_config = {
+    .max_games = DEFAULT_MAX_GAMES,
+    .max_flag_file_tries = MAX_FLAG_FILE_TRIES,
+    .log_level = LOG_LEVEL_INFO,
+    .ciphers = PROVISION_DEFAULT_METHODS,
+    .drain_timeout = DRAIN_UNTIL_GAMES_END,
+    .reactor_threads = THREAD_PER_CLIENT_MODE,
+    .handshake_workers = DEFAULT_HANDSHAKE_WORKERS,
+    .listeners = DEFAULT_LISTENERS,
+    .backlog = DEFAULT_LISTEN_BACKLOG
+}; //defaults, then the -f file, then the command line, only the reloader thread changes it after startup
+HandshakeStage handshake_stage = {
+    .queue_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .queue_not_empty = PTHREAD_COND_INITIALIZER
+};
 
 //prototypes
 /**
@@ -98,26 +308,83 @@ pthread_mutex_t globals_mutex = PTHREAD_MUTEX_INITIALIZER;
  * Args:
  *   signal: The signal number received (typically SIGINT)
  * Operation:
- *   Sets global stop flag and prints signal info
+ *   Sets global stop flag, wakes everything polling shutdown_event and prints signal info
  * Returns: void
  */
 void handle_signal(int signal);
 
 /**
- * Accepts new client connections on server socket
+ * Runs the key exchange for an accepted connection
  * Args:
- *   serverSocketFD: File descriptor for the server socket
+ *   pending: Accepted socket and its peer address
  * Operation:
- *   Accepts connection and populates client address info
+ *   - Bounds the exchange with SO_RCVTIMEO/SO_SNDTIMEO
+ *   - Performs recv_send_key and clears the timeouts afterwards
  * Returns:
  *   AcceptedSocket struct with client details and status
  */
-struct AcceptedSocket acceptIncomingConnection(int serverSocketFD);
+struct AcceptedSocket acceptIncomingConnection(const struct PendingConnection *pending);
+
+/**
+ * Drains the listen queue without blocking
+ * Args:
+ *   listener: Listener with a non-blocking server socket
+ * Operation:
+ *   - Calls accept4 until EAGAIN or ACCEPT_BATCH_SIZE connections
+ *   - Relays a socket the matchmaking backend routes to another node
+ *   - Hands every other socket to the handshake stage, tagged with the listener's shard
+ * Returns:
+ *   Number of accepted connections
+ */
+int accept_connection_batch(const struct Listener *listener);
+
+/**
+ * Starts the handshake worker pool
+ * Args:
+ *   count: Number of workers
+ * Operation:
+ *   Spawns workers running handshake_worker
+ * Returns:
+ *   EXIT_SUCCESS or EXIT_FAILURE
+ */
+int start_handshake_workers(unsigned int count);
+
+/**
+ * Stops the handshake worker pool
+ * Operation:
+ *   - Wakes and joins every worker, before stop_all_games they first finish the queued handshakes
+ *   - Closes sockets still waiting for a handshake
+ * Returns: void
+ */
+void stop_handshake_workers();
+
+/**
+ * Queues an accepted socket for the handshake workers
+ * Args:
+ *   pending: Accepted socket and its peer address
+ * Operation:
+ *   Thread-safe enqueue, sheds the connection when the queue is full
+ * Returns:
+ *   Boolean indicating the socket was queued
+ */
+bool enqueue_handshake(const struct PendingConnection *pending);
+
+/**
+ * Handshake worker thread function
+ * Args:
+ *   arg: Unused
+ * Operation:
+ *   - Waits for accepted sockets
+ *   - Runs the key exchange with a timeout
+ *   - Hands fully keyed sockets to matchmaking
+ * Returns: NULL on completion
+ */
+void *handshake_worker(void *arg);
 
 /**
  * Main client message handling thread function
  * Args:
- *   arg: Pointer to ThreadArgs containing socket FD and game info
+ *   arg: Pointer to ClientConnection with socket FD, session and game info
  * Operation:
  *   - Handles client messaging in a loop
  *   - Processes commands and flags
@@ -129,45 +396,312 @@ void *handle_single_client(void *arg);
 /**
  * Main server accept loop for incoming connections
  * Args:
- *   serverSocketFD: File descriptor for the server socket
+ *   listener: Listener to accept on
  * Operation:
- *   - Accepts new clients up to MAX_CLIENTS_TOTAL
+ *   - Accepts new clients
  *   - Creates handler thread for each client
- *   - Manages game instances
  * Returns: void
  */
-void startAcceptingIncomingConnections(int serverSocketFD);
+void startAcceptingIncomingConnections(struct Listener *listener);
+
+/**
+ * Accept thread function for every listener but the first
+ * Args:
+ *   arg: Pointer to the Listener
+ * Returns: NULL on completion
+ */
+void *listener_thread(void *arg);
+
+/**
+ * Opens the listen sockets and their game registries
+ * Args:
+ *   port: Port every listener binds to
+ *   count: Number of listeners
+ *   backlog: listen() backlog of each socket
+ * Operation:
+ *   - Sets SO_REUSEPORT when count > 1 so the kernel spreads connections
+ *   - Closes what was opened on failure
+ * Returns:
+ *   EXIT_SUCCESS or EXIT_FAILURE
+ */
+int open_listeners(int port, unsigned int count, int backlog);
+
+/**
+ * Runs every listener's accept loop until shutdown
+ * Operation:
+ *   - Spawns listener_thread for every listener but the first
+ *   - Runs the first one on the calling thread and joins the rest
+ * Returns: void
+ */
+void run_listeners();
+
+/**
+ * Closes every listener
+ * Operation:
+ *   Destroys the game registries, no game may be live
+ * Returns: void
+ */
+void close_listeners();
 
 /**
  * Creates and starts a new client handler thread
  * Args:
  *   clientSocketFD: Pointer to AcceptedSocket for the client
+ *   shard: Listener that accepted the client
  * Operation:
- *   - Finds/creates game instance for client
+ *   - Joins a waiting game, its own listener's first, then the others
+ *   - Creates a game in its own listener's registry otherwise
  *   - Initializes thread arguments
  *   - Spawns handler thread
  * Returns: void
  */
 void handle_single_client_on_separate_thread(
-    const struct AcceptedSocket *clientSocketFD);
+    const struct AcceptedSocket *clientSocketFD, unsigned int shard);
+
+/**
+ * Finds a game for a keyed client
+ * Args:
+ *   clientSocketFD: Pointer to AcceptedSocket for the client
+ *   shard: Listener that accepted the client
+ * Operation:
+ *   - Joins a waiting game, its own listener's first, then the others
+ *   - Creates a game in its own listener's registry otherwise
+ * Returns:
+ *   Game the client is now part of, NULL if it has to be rejected
+ */
+Game *match_client(const struct AcceptedSocket *clientSocketFD, unsigned int shard);
+
+/**
+ * Route of the single node backend
+ * Args:
+ *   pending: Accepted socket
+ * Returns:
+ *   LOCAL_NODE, every game is played here
+ */
+int route_locally(const struct PendingConnection *pending);
+
+/**
+ * Route of the cluster backend
+ * Args:
+ *   pending: Accepted socket
+ * Operation:
+ *   - Consecutive cluster tickets share a placement key, so two players meet on one owner
+ *     whichever front-ends they arrived on
+ *   - Without the matchmaker consecutive arrivals on this node pair up, under keys no ticket gives out
+ * Returns:
+ *   Owning node, LOCAL_NODE when that is this node
+ */
+int route_by_ring(const struct PendingConnection *pending);
+
+/**
+ * Cluster fallback, plays a relayed client's game here when its node is down
+ * Args:
+ *   socketFD: Client socket before its key exchange
+ * Returns:
+ *   Boolean indicating the socket was queued for the handshake workers
+ */
+bool serve_locally(int socketFD);
+
+/**
+ * Opens the listener other nodes relay their connections to
+ * Args:
+ *   port: This node's cluster port
+ *   backlog: listen() backlog
+ * Operation:
+ *   Appended after the client listeners with its own registry, so it is one more matchmaking shard
+ * Returns:
+ *   EXIT_SUCCESS or EXIT_FAILURE
+ */
+int open_cluster_listener(int port, int backlog);
+
+/**
+ * Takes over the listen sockets of the server running on a handoff socket
+ * Args:
+ *   path: -H handoff socket
+ * Operation:
+ *   - Client sockets become listeners with fresh registries, a cluster socket is kept for open_cluster_listener
+ *   - The predecessor keeps accepting on the same sockets until handoff_confirm
+ * Returns:
+ *   Connection to confirm on, HANDOFF_NONE when no server runs on path
+ */
+int adopt_listeners(const char *path);
+
+/**
+ * Offers the listen sockets to the next server started with the same -H path
+ * Args:
+ *   path: -H handoff socket
+ * Returns:
+ *   Boolean indicating the offer is up
+ */
+bool offer_listeners(const char *path);
+
+/**
+ * Handoff callback, a successor accepts on the listen sockets now
+ * Operation:
+ *   Stops the accept loops without stopping any game
+ * Returns: void
+ */
+void begin_drain();
+
+/**
+ * Lets the games of a handed off server finish
+ * Operation:
+ *   - Finishes the key exchanges already queued, their clients still get a game here
+ *   - Sleeps on games_event and shutdown_event until no game has both players, a signal or drain_timeout,
+ *     then stops everything
+ * Returns: void
+ */
+void drain_games();
+
+/**
+ * Wakes everything polling shutdown_event
+ * Operation:
+ *   Sets stop_all_games first, async-signal-safe
+ * Returns: void
+ */
+void request_shutdown();
+
+/**
+ * Checks the ranges of a config
+ * Args:
+ *   config: Parsed settings
+ * Returns:
+ *   Boolean indicating every value is one the server can run with
+ */
+bool config_in_range(const ServerConfig *config);
+
+/**
+ * Applies the reloadable settings of a config
+ * Args:
+ *   config: Settings in range
+ * Operation:
+ *   - Switches the cipher set first, a refused name changes nothing
+ *   - Game limit, flag file tries, log level and drain timeout take effect for the next check
+ * Returns:
+ *   Boolean indicating the settings are in use
+ */
+bool apply_runtime_config(const ServerConfig *config);
+
+/**
+ * Reads the -f file again
+ * Operation:
+ *   - A file that does not parse or is out of range is refused whole, the running settings stay
+ *   - Startup only settings keep their running value, a change to them is logged
+ * Returns: void
+ */
+void reload_config();
+
+/**
+ * SIGHUP handler, asks the reloader thread for a reload
+ * Args:
+ *   signal: SIGHUP
+ * Returns: void
+ */
+void handle_reload_signal(int signal);
+
+/**
+ * Reloader thread function
+ * Args:
+ *   arg: Unused
+ * Operation:
+ *   Runs reload_config for every SIGHUP, file reads and the log never run in the signal handler
+ * Returns: NULL on completion
+ */
+void *config_reloader(void *arg);
+
+/**
+ * Starts the reloader thread and installs the SIGHUP handler
+ * Returns:
+ *   Boolean indicating SIGHUP reloads the config
+ */
+bool start_config_reloader();
+
+/**
+ * Stops and joins the reloader thread
+ * Returns: void
+ */
+void stop_config_reloader();
+
+// Games always live on one node, the backends only differ in which node that is
+const MatchBackend local_backend = {"local", route_locally, match_client};
+const MatchBackend ring_backend = {"consistent hash ring", route_by_ring, match_client};
+const MatchBackend *match_backend = &local_backend;
 
 
 /**
  * Routes messages between connected clients in a game
  * Args:
- *   buffer: Message to send
+ *   segments: Message segments to send
+ *   count: Number of segments
+ *   socketFD: Sender's socket FD (excluded from receiving)
+ *   game: Pointer to Game struct for message routing
+ * Operation:
+ *   - Lock-free broadcasting to the published game clients
+ *   - Encodes once per receiver in the framing that receiver negotiated
+ *   - Relays output fragments as they arrive, flattened to OUT for receivers without streaming
+ *   - Drops types whose registry capability the receiver lacks, CAN without cancel and DEC without decrypt
+ *   - Queues and flushes, a receiver that is already being written to takes the frame along
+ * Returns: void
+ */
+void sendReceivedMessageToTheOtherClients(const FrameSegment *segments, unsigned int count, int socketFD,
+                                          Game *game);
+
+/**
+ * Sends a single text message to the other clients of a game
+ * Args:
+ *   type: Message type
+ *   text: NUL terminated payload
  *   socketFD: Sender's socket FD (excluded from receiving)
  *   game: Pointer to Game struct for message routing
+ * Returns: void
+ */
+void sendMessageToTheOtherClients(MessageType type, const char *text, int socketFD, Game *game);
+
+/**
+ * Records a relayed frame in the replay log
+ * Args:
+ *   segments: Relayed segments
+ *   count: Number of segments
+ *   socketFD: Sender's socket FD
+ *   game: Game the frame was relayed in
+ *   from_server: The server wrote the text, the sender only triggered it
+ * Operation:
+ *   The sender's index in game_clients is the recorded direction
+ * Returns: void
+ */
+void record_relay(const FrameSegment *segments, unsigned int count, int socketFD, Game *game, bool from_server);
+
+/**
+ * Applies a client's HEL answer
+ * Args:
+ *   connection: Connection that sent the answer
+ *   hello: HEL segment with the accepted capability mask
  * Operation:
- *   Thread-safe message broadcasting to other game clients
+ *   - Switches replies and relayed messages to binary frames when accepted
+ *   - Records whether streamed OFR output may be relayed to the client
+ *   - Publishes the capabilities the opponent's relay encodes for
+ *   - Moves both directions of the session to AEAD records when accepted
+ *   - Turns on stream headers when FRAME_CAPABILITY_MULTIPLEX was accepted with AEAD and binary frames
  * Returns: void
  */
-void sendReceivedMessageToTheOtherClients(const char *buffer, int socketFD, Game *game);
+void handle_client_hello(struct ClientConnection *connection, const FrameSegment *hello);
+
+/**
+ * Lists the capabilities offered in HEL
+ * Operation:
+ *   FRAME_CAPABILITY_MULTIPLEX only in thread-per-client mode, a multiplexed
+ *   connection is served by one thread that waits on all of its games
+ * Returns:
+ *   FRAME_CAPABILITY_* bits
+ */
+unsigned int offered_capabilities();
 
 /**
  * Initializes the server socket with specified configuration
  * Args:
  *   port: Port number to bind server to
+ *   backlog: listen() backlog
+ *   reuse_port: Share the port with the other listeners through SO_REUSEPORT
  * Operation:
  *   - Creates TCP/IPv4 socket
  *   - Binds to address/port
@@ -176,19 +710,20 @@ void sendReceivedMessageToTheOtherClients(const char *buffer, int socketFD, Game
  * Returns:
  *   Valid server socket FD or EXIT_FAILURE
  */
-int initServerSocket(int port);
+int initServerSocket(int port, int backlog, bool reuse_port);
 
 /**
  * Validates incoming client messages
  * Args:
- *   buffer: Message buffer to check
+ *   view: Parsed frame to check
  * Operation:
- *   - Checks message type and format
+ *   - Applies the registry rules: no setup types in the relay phase, CAN and DEC on their own,
+ *     no NUL in CMD and DEC data
  *   - Validates command data if CMD type
  * Returns:
  *   Boolean indicating message validity
  */
-int check_message_received(char buffer[4096]);
+int check_message_received(const FrameView *view);
 
 /**
  * Socket creation and address binding wrapper
@@ -208,71 +743,78 @@ int config_socket(int port, int *serverSocketFD, struct sockaddr_in *server_addr
  * Args:
  *   serverSocketFD: Server socket file descriptor
  *   server_address: Server address structure
+ *   backlog: listen() backlog
  * Operation:
  *   Binds socket and initiates listening state
  * Returns:
  *   EXIT_SUCCESS or EXIT_FAILURE
  */
-int bind_and_listen_on_socket(int serverSocketFD, struct sockaddr_in server_address);
+int bind_and_listen_on_socket(int serverSocketFD, struct sockaddr_in server_address, int backlog);
 
 /**
  * Processes and routes client messages
  * Args:
  *   clientSocketFD: Client's socket FD
- *   buffer: Message buffer
+ *   encoding: Framing negotiated with the client
+ *   capabilities: FRAME_CAPABILITY_* bits agreed with the client
+ *   view: Parsed frame, NULL if it did not parse
  *   game: Game instance pointer
  * Operation:
  *   - Handles game state messages
- *   - Checks win conditions
- *   - Routes valid messages
+ *   - Checks win conditions on SUB guesses, or on every message of clients without FRAME_CAPABILITY_SUBMIT
+ *   - Answers DEC with an error when the opponent cannot decrypt in process
+ *   - Routes valid messages, re-encoded for the receiver
  * Returns: Boolean indicating if game should end
  */
-int generate_message_for_clients(int clientSocketFD, const unsigned char *encryption_key, char buffer[4096],
-                                 Game *game);
-
-/**
- * Validates message field format
- * Args:
- *   buffer: Message to validate
- * Operation:
- *   Checks presence and format of required fields
- * Returns:
- *   Boolean indicating valid format
- */
-int check_message_fields(const char *buffer);
+int generate_message_for_clients(int clientSocketFD, CryptoSession *session, FrameEncoding encoding,
+                                 unsigned int capabilities, const FrameView *view, Game *game);
 
 /**
  * Creates encrypted flag file for client
  * Args:
- *   buffer: Directory path
+ *   directory: Directory path segment sent by the client
  *   clientSocketFD: Client's socket FD
+ *   encoding: Framing negotiated with the client
  *   game: Game instance pointer
  * Operation:
  *   - Generates random flag data
  *   - Creates and encrypts flag file
  * Returns: Status code
  */
-int generate_client_flag(const char *buffer, int clientSocketFD, const unsigned char *encryption_key, Game *game);
+int generate_client_flag(const FrameSegment *directory, int clientSocketFD, CryptoSession *session,
+                         FrameEncoding encoding, Game *game);
 
 /**
  * Checks game winning condition
  * Args:
  *   clientSocketFD: Client's socket FD
- *   buffer: Message buffer
+ *   view: Parsed frame
  *   game: Game instance pointer
  * Operation:
- *   Compares client flag data for win
+ *   - Hashes the guess once
+ *   - Compares it in constant time against the published flag digests of the other clients, without game_mutex
  * Returns:
  *   Boolean indicating win
  */
-bool check_winner(int clientSocketFD, char buffer[4096], Game *game);
+bool check_winner(int clientSocketFD, const FrameView *view, Game *game);
+
+/**
+ * Makes a client's confirmed flag visible to its opponent's check_winner
+ * Args:
+ *   connection: Connection whose flag phase just completed
+ * Operation:
+ *   Release store, flag_digest is never written again afterwards
+ * Returns: void
+ */
+void publish_client_flag(const struct ClientConnection *connection);
 
 /**
  * Processes client flag operations
  * Args:
- *   buffer: Message buffer
+ *   view: Parsed frame
  *   flag_file_tries: Pointer to attempts counter
  *   clientSocketFD: Client socket FD
+ *   encoding: Framing negotiated with the client
  *   flag_okay_response: Flag status pointer
  *   flag_request_dir: Directory request status pointer
  *   game: Game instance pointer
@@ -282,29 +824,32 @@ bool check_winner(int clientSocketFD, char buffer[4096], Game *game);
  *   - Tracks attempts
  * Returns: Operation status
  */
-int handle_client_flag(const char *buffer, unsigned int *flag_file_tries, int clientSocketFD,
-                       const unsigned char *encryption_key,bool *flag_okay_response,
+int handle_client_flag(const FrameView *view, unsigned int *flag_file_tries, int clientSocketFD,
+                       CryptoSession *session, FrameEncoding encoding, bool *flag_okay_response,
                        bool *flag_request_dir, Game *game);
 
 /**
  * Creates key file for client
  * Args:
- *   buffer: Directory path
+ *   directory: Directory path segment sent by the client
  *   clientSocketFD: Client's socket FD
+ *   encoding: Framing negotiated with the client
  *   game: Game instance pointer
  * Operation:
  *   - Generates random: key and encryption method for key file
  *   - Creates key file and encrypts flag file
  * Returns: Status code
  */
-bool generate_client_key(const char *buffer, int clientSocketFD, const unsigned char *encryption_key, Game *game);
+bool generate_client_key(const FrameSegment *directory, int clientSocketFD, CryptoSession *session,
+                         FrameEncoding encoding, Game *game);
 
 /**
  * Processes client flag operations
  * Args:
- *   buffer: Message buffer
+ *   view: Parsed frame
  *   key_file_tries: Pointer to attempts counter
  *   clientSocketFD: Client socket FD
+ *   encoding: Framing negotiated with the client
  *   key_okay_response: Flag status pointer
  *   key_request_dir: Directory request status pointer
  *   game: Game instance pointer
@@ -314,986 +859,3047 @@ bool generate_client_key(const char *buffer, int clientSocketFD, const unsigned
  *   - Tracks attempts
  * Returns: Operation status
  */
-bool handle_client_key(const char *buffer, unsigned int *key_file_tries, int clientSocketFD,
-                       const unsigned char *encryption_key,
+bool handle_client_key(const FrameView *view, unsigned int *key_file_tries, int clientSocketFD,
+                       CryptoSession *session, FrameEncoding encoding,
                        bool *key_okay_response,
                        bool *key_request_dir, Game *game);
 
 /**
- * Finds active game with space for client
+ * Generates both game files natively and sends them in one PRV message
+ * Args:
+ *   directories: Decoded PRV request with the flag and key directories
+ *   clientSocketFD: Client's socket FD
+ *   encoding: Framing negotiated with the client
+ *   game: Game instance pointer
  * Operation:
- *   Searches game array for active instance
+ *   - Takes a pregenerated flag, key, method and encrypted flag.txt from the pool
+ *   - No shell or openssl enc on the client, no PBKDF2 on this thread on a pool hit
+ *   - Records the flag for check_winner
  * Returns:
- *   Game index or -1 if none found
+ *   Boolean indicating the files were sent
  */
-int find_active_game();
+bool generate_client_provision(const Provision *directories, int clientSocketFD, CryptoSession *session,
+                               FrameEncoding encoding, Game *game);
 
 /**
- * Finds slot for new game instance
+ * Processes the one round trip flag and key setup of PRV capable clients
+ * Args:
+ *   connection: Per-connection state, both setup phases complete together
+ *   segment: First PRV segment of the frame
  * Operation:
- *   Searches for NULL entry in games array
+ *   - Answers a directory request with the provisioned files
+ *   - Completes the flag and key phases on "okay"
+ *   - Asks for new directories after an error, counting the attempts
  * Returns:
- *   Available index or -1 if full
+ *   Boolean indicating the connection may continue
  */
-int find_inactive_game();
+bool handle_client_provision(struct ClientConnection *connection, const FrameSegment *segment);
 
 /**
- * Adds a new client to an existing game instance
+ * Initializes the game registry
  * Args:
- *   clientSocketFD: Pointer to client's socket info
- *   active_game_index: Index of active game to join
+ *   registry: Registry to initialize
  * Operation:
- *   - Thread-safe update of game client count
- *   - Stores client socket info in game structure
+ *   - Prepares the slab table and free list
+ *   - Allocates the waiting-for-second-player queue
+ * Returns:
+ *   Boolean indicating success
+ */
+bool init_game_registry(GameRegistry *registry);
+
+/**
+ * Frees every slab of the registry on shutdown
+ * Args:
+ *   registry: Registry to destroy, no game may be live
  * Returns: void
  */
-void add_client_to_game(const struct AcceptedSocket *clientSocketFD, int active_game_index);
+void destroy_game_registry(GameRegistry *registry);
 
 /**
- * Initializes new game instance
+ * Maps a registry slot index to its game
  * Args:
- *   clientSocketFD: First client's socket info
- *   inactive_game_index: Array index for new game
- * Operation:
- *   - Allocates game structure
- *   - Initializes mutex and pipe
- *   - Sets initial state
+ *   registry: Registry to look in
+ *   slot: Slot index
  * Returns:
- *   Boolean indicating success
+ *   Game slot pointer
  */
-bool init_new_game(const struct AcceptedSocket *clientSocketFD, int inactive_game_index);
+Game *game_at_slot(GameRegistry *registry, unsigned int slot);
 
 /**
- * Creates thread for client handling
+ * Takes a free game slot, growing the registry by one slab when needed
  * Args:
- *   clientSocketFD: Client socket info
- *   active_game_index: Index of active game or -1
- *   inactive_game_index: Index for new game or -1
+ *   registry: Registry to allocate from
  * Operation:
- *   - Allocates thread arguments
- *   - Creates handler thread
- *   - Handles allocation failures
- * Returns: void
+ *   - Counts the game against max_games over every registry
+ *   - Pops the free list under the registry mutex
+ *   - Allocates and publishes a new slab if the free list is empty
+ * Returns:
+ *   Game slot or NULL if max_games are live or the slab table is exhausted
  */
-void create_thread_args_and_thread(const struct AcceptedSocket *clientSocketFD, int active_game_index,
-                                   int inactive_game_index);
+Game *acquire_game_slot(GameRegistry *registry);
 
 /**
- * Handles client thread termination and cleanup
+ * Returns a finished game's slot to the free list
  * Args:
- *   clientSocketFD: Client's socket file descriptor
- *   game: Pointer to associated game instance
+ *   registry: Owning registry
+ *   game: Game to release, its game_mutex must be held
  * Operation:
- *   - Notifies other clients of disconnection
- *   - Updates game client count
- *   - Signals game termination via pipe
- *   - Closes socket and updates global client count
+ *   - Closes the stop eventfd
+ *   - Closes the sockets and destroys the crypto sessions of the joined clients
+ *   - Bumps the slot generation so queued tickets become stale
+ *   - Pushes the slot on the free list
  * Returns: void
  */
-void thread_exit(int clientSocketFD, Game *game);
+void release_game_slot(GameRegistry *registry, Game *game);
 
 /**
- * Processes incoming client messages and manages game state
+ * Joins a game that is waiting for its second player
  * Args:
- *   clientSocketFD: Client's socket file descriptor
- *   game: Pointer to associated game instance
- *   flag_file_tries: Pointer to flag attempt counter
- *   flag_request_dir: Pointer to directory request status
- *   flag_okay_response: Pointer to flag response status
+ *   registry: Registry to look in
+ *   clientSocketFD: Pointer to client's socket info
  * Operation:
- *   - Receives client messages
- *   - Handles flag operations and validation
- *   - Processes game messages
+ *   - Pops tickets from the waiting queue, skipping stale ones
+ *   - Locks only the candidate game to add the client
  * Returns:
- *   Boolean indicating if client handling should terminate
+ *   Joined game or NULL if no game is waiting
  */
-bool handle_client_messages(int clientSocketFD, const unsigned char *encryption_key, Game *game,
-                            unsigned int *flag_file_tries, bool *flag_request_dir,
-                            bool *flag_okay_response, unsigned int *key_file_tries, bool *key_request_dir,
-                            bool *key_okay_response);
+Game *join_waiting_game(GameRegistry *registry, const struct AcceptedSocket *clientSocketFD);
 
 /**
- * Waits for all client threads to complete before server shutdown
+ * Initializes new game instance
+ * Args:
+ *   registry: Registry to take the slot from
+ *   clientSocketFD: First client's socket info
  * Operation:
- *   - Monitors global client count
- *   - Uses short sleep intervals to prevent busy waiting
- *   - Thread-safe access to shared counter
- * Returns: void
+ *   - Takes a slot from the registry
+ *   - Creates the stop eventfd in thread-per-client mode and sets initial state
+ *   - Publishes the game on the waiting queue
+ * Returns:
+ *   New game or NULL on failure
  */
-void wait_for_all_threads_to_finish();
+Game *init_new_game(GameRegistry *registry, const struct AcceptedSocket *clientSocketFD);
 
 /**
- * Cleans up resources for terminated games
+ * Creates the per-connection state object and hands it to a handler
+ * Args:
+ *   clientSocketFD: Client socket info
+ *   game: Game the client was matched into
  * Operation:
- *   - Checks each game slot for stopped games
- *   - Closes pipes and frees memory for finished games
- *   - Thread-safe cleanup using game mutex
+ *   - Allocates the ClientConnection and its message arena
+ *   - Creates handler thread, or registers with a reactor in event mode
+ *   - Leaves the game through thread_exit on failure
  * Returns: void
  */
-void handle_closed_games();
+void create_client_connection(const struct AcceptedSocket *clientSocketFD, Game *game);
 
 /**
- * @param serverSocketFD servers socket
+ * Allocates the per-connection state of a matched client
+ * Args:
+ *   clientSocketFD: Client socket info
+ *   game: Game the client was matched into
+ *   with_arena: Allocate the message arena, streams of a multiplexed connection share their multiplexer's
  * Operation:
- * rejects client:
- * accepets them, sends a messgae that indicates no space left and close their socket
+ *   Counts the client before any handler exists, the caller leaves the game on failure
+ * Returns:
+ *   Connection or NULL on failure
  */
-void reject_client(int serverSocketFD);
+struct ClientConnection *new_client_connection(const struct AcceptedSocket *clientSocketFD, Game *game,
+                                               bool with_arena);
 
 /**
- * @param serverSocketFD servers socket
+ * Frees a per-connection state object
+ * Args:
+ *   connection: Connection no handler or epoll event refers to anymore
  * Operation:
- * rejects client:
- * accepets them, sends a messgae that indicates no space left and close their socket
+ *   Releases the message arena with it
+ * Returns: void
  */
-void reject_client(const int serverSocketFD) {
-    // Server at capacity, reject new connection
-    pthread_mutex_unlock(&globals_mutex);
-    const int clientSocketFD = accept(serverSocketFD, NULL, NULL);
-    size_t key_len; // Only used during initialization
-    const unsigned char *encryption_key = recv_send_key(clientSocketFD, &key_len);
-    if (encryption_key == NULL) {
-        close(clientSocketFD);
-    }
-    // Send max clients error message
-    s_send(clientSocketFD, encryption_key, GAME_MAX,
-           strlen(GAME_MAX));
-    close(clientSocketFD);
-}
+void free_client_connection(struct ClientConnection *connection);
 
 /**
- * Main server accept loop for incoming connections
+ * Handles client thread termination and cleanup
  * Args:
- *   serverSocketFD: File descriptor for the server socket
- * Operation:
- *   - Accepts new clients up to MAX_CLIENTS_TOTAL
- *   - Creates handler thread for each client
- *   - Manages game instances
+ *   clientSocketFD: Client's socket file descriptor
+ *   game: Pointer to associated game instance
+ * Operation:
+ *   - Notifies other clients of disconnection
+ *   - Drops the client's reference on the game
+ *   - Signals game termination through the game's stop eventfd
+ *   - Shuts the socket down, the last client to leave closes the sockets with the game slot
+ *   - Updates global client count, waking shutdown at zero
  * Returns: void
  */
-void startAcceptingIncomingConnections(const int serverSocketFD) {
-    while (!stop_all_games) {
-        // Lock mutex before checking client count
-        pthread_mutex_lock(&globals_mutex);
-        if (accepted_clients_count < MAX_CLIENTS_TOTAL) {
-            // Unlock mutex before accepting new connection
-            pthread_mutex_unlock(&globals_mutex);
-            struct AcceptedSocket clientSocket =
-                    acceptIncomingConnection(serverSocketFD);
-            // If connection accepted successfully, add to active clients
-            if (clientSocket.acceptedSuccessfully) {
-                handle_single_client_on_separate_thread(&clientSocket);
-            }
-        } else {
-            reject_client(serverSocketFD);
-        }
-        handle_closed_games();
-        // Sleep to prevent CPU overload
-        usleep(SLEEP);
-    }
-}
+void thread_exit(int clientSocketFD, Game *game);
 
 /**
- * Creates and starts a new client handler thread
+ * Drops a client's reference on its game without touching its socket
  * Args:
- *   clientSocketFD: Pointer to AcceptedSocket for the client
+ *   clientSocketFD: Client's identity in game_clients
+ *   game: Pointer to associated game instance
  * Operation:
- *   - Finds/creates game instance for client
- *   - Initializes thread arguments
- *   - Spawns handler thread
+ *   - Notifies other clients of disconnection
+ *   - Drops the client's reference on the game, the last one releases it
+ *   - Signals game termination through the game's stop eventfd
+ *   - Updates global client count, waking shutdown at zero
  * Returns: void
  */
-void handle_single_client_on_separate_thread(
-    const struct AcceptedSocket *clientSocketFD) {
-    const int active_game_index = find_active_game();
-    int inactive_game_index = 0;
-    if (active_game_index != GAME_NOT_FOUND) {
-        add_client_to_game(clientSocketFD, active_game_index);
-    } else {
-        inactive_game_index = find_inactive_game();
-        if (inactive_game_index != GAME_NOT_FOUND) {
-            if (init_new_game(clientSocketFD, inactive_game_index)) {
-                return;
-            }
-        }
-    }
-    create_thread_args_and_thread(clientSocketFD, active_game_index, inactive_game_index);
-}
+void leave_game(int clientSocketFD, Game *game);
 
 /**
- * Finds active game with space for client
+ * Processes incoming client messages and manages game state
+ * Args:
+ *   connection: Per-connection state (socket, session, game, flag/key progress)
  * Operation:
- *   Searches game array for active instance
+ *   - Receives client messages
+ *   - Handles flag operations and validation
+ *   - Processes game messages
  * Returns:
- *   Game index or -1 if none found
+ *   Boolean indicating if client handling should terminate
  */
-int find_active_game() {
-    for (int i = 0; i < MAX_GAMES; i++) {
-        if (games[i]) {
-            pthread_mutex_lock(&games[i]->game_mutex);
-            if (!games[i]->stop_game && games[i]->acceptedSocketsCount == 1) {
-                pthread_mutex_unlock(&games[i]->game_mutex);
-                return i;
-            }
-            pthread_mutex_unlock(&games[i]->game_mutex);
-        }
-    }
-    return GAME_NOT_FOUND;
-}
+bool handle_client_messages(struct ClientConnection *connection);
 
 /**
- * Finds slot for new game instance
+ * Handles one received message of a client
+ * Args:
+ *   connection: Per-connection state (socket, session, game, flag/key progress)
+ *   buffer: Message, one byte of room after it for the terminator
+ *   length: Message length
+ *   frame: View storage for the parsed message
  * Operation:
- *   Searches for NULL entry in games array
+ *   - Handles flag operations and validation
+ *   - Processes game messages
  * Returns:
- *   Available index or -1 if full
+ *   Boolean indicating if client handling should terminate
  */
-int find_inactive_game() {
-    for (int i = 0; i < MAX_GAMES; i++) {
-        if (!games[i]) {
-            return i;
-        }
-    }
-    return GAME_NOT_FOUND;
-}
+bool handle_client_frame(struct ClientConnection *connection, char *buffer, size_t length, FrameView *frame);
 
 /**
- * Initializes new game instance
+ * Waits for all client threads to complete before server shutdown
+ * Operation:
+ *   Sleeps on clients_finished until the last thread_exit signals it
+ * Returns: void
+ */
+void wait_for_all_threads_to_finish();
+
+/**
+ * @param clientSocketFD accepted and keyed client
+ * Operation:
+ * rejects client:
+ * sends a messgae that indicates no space left and close their socket
+ */
+void reject_client(const struct AcceptedSocket *clientSocketFD);
+
+/**
+ * Starts the epoll reactor pool for event-driven mode
  * Args:
- *   clientSocketFD: First client's socket info
- *   inactive_game_index: Array index for new game
+ *   count: Number of reactor threads to start
+ * Operation:
+ *   - Creates an epoll instance and wakeup eventfd per reactor
+ *   - Spawns one thread per reactor running reactor_loop
+ * Returns:
+ *   EXIT_SUCCESS or EXIT_FAILURE
+ */
+int start_reactors(unsigned int count);
+
+/**
+ * Stops the reactor pool
+ * Operation:
+ *   - Wakes every reactor through its eventfd
+ *   - Joins reactor threads (they close their connections on the way out)
+ *   - Releases epoll and eventfd descriptors
+ * Returns: void
+ */
+void stop_reactors();
+
+/**
+ * Reactor thread function
+ * Args:
+ *   arg: Pointer to the Reactor this thread drives
+ * Operation:
+ *   - Waits on epoll for client sockets
+ *   - Drives reactor_read_connection for readable sockets
+ *   - Writes unsent records once a socket is writable again
+ *   - Closes remaining connections on server shutdown
+ * Returns: NULL on completion
+ */
+void *reactor_loop(void *arg);
+
+/**
+ * Registers a new connection with a reactor
+ * Args:
+ *   connection: Freshly created connection state
  * Operation:
- *   - Allocates game structure
- *   - Initializes mutex and pipe
- *   - Sets initial state
+ *   - Uses the game's reactor, picking one round robin for a new game
+ *   - Starts the reader that receives until the session is sealed, and bounds s_send with a socket timeout
+ *   - Sends the first flag directory request
+ *   - Adds the reader eventfd to the reactor epoll set under game_mutex
+ *   - Fails if the game already stopped, nobody would close the connection
  * Returns:
  *   Boolean indicating success
  */
-bool init_new_game(const struct AcceptedSocket *clientSocketFD, const int inactive_game_index) {
-    //create new game with malloc
-    Game *game = malloc(sizeof(Game));
-    if (game == NULL) {
-        perror("malloc");
-        return true;
-    }
-    memset(game, NULL_CHAR, sizeof(Game));
-    game->acceptedSocketsCount++;
-    game->game_clients[FIRST_CLIENT_INDEX] = *clientSocketFD;
-    pthread_mutex_init(&game->game_mutex, NULL);
-    game->stop_game = false;
-    // Initialize the stop_pipe
-    if (pipe(game->stop_pipe) != PIPE_SUCCESS) {
-        perror("Failed to create pipe for Game");
-        free(game);
-        return true;
-    }
-    games[inactive_game_index] = game;
-    return false;
-}
+bool reactor_add_connection(struct ClientConnection *connection);
 
 /**
- * Creates thread for client handling
+ * Removes a connection from its reactor's connection list
  * Args:
- *   clientSocketFD: Client socket info
- *   active_game_index: Index of active game or -1
- *   inactive_game_index: Index for new game or -1
+ *   connection: Connection to unlink
  * Operation:
- *   - Allocates thread arguments
- *   - Creates handler thread
- *   - Handles allocation failures
+ *   Thread-safe unlink under the reactor connections mutex
  * Returns: void
  */
-void create_thread_args_and_thread(const struct AcceptedSocket *clientSocketFD, const int active_game_index,
-                                   const int inactive_game_index) {
-    // Dynamically allocate memory for thread arguments
-    struct ThreadArgs *clientThreadArgs = malloc(sizeof(struct ThreadArgs));
-    if (!clientThreadArgs) {
-        if (inactive_game_index != GAME_NOT_FOUND) {
-            //if failed to allocate memory for args that have a new game then free game and set to NULL
-            free(games[inactive_game_index]);
-            games[inactive_game_index] = NULL;
-        }
-        perror("Failed to allocate memory for ThreadArgs");
-        return;
-    }
-    // Create new thread and pass socket FD as argument
-    clientThreadArgs->socketFD = clientSocketFD->acceptedSocketFD;
-    clientThreadArgs->game = active_game_index != GAME_NOT_FOUND
-                                 ? games[active_game_index]
-                                 : inactive_game_index != GAME_NOT_FOUND
-                                       ? games[inactive_game_index]
-                                       : NULL;
-    clientThreadArgs->encryption_key = clientSocketFD->encryption_key;
-    if (clientThreadArgs->game == NULL) {
-        perror("No valid game found for the client");
-        free(clientThreadArgs);
-        return;
-    }
-    pthread_t clientThread;
-    if (pthread_create(&clientThread, NULL, handle_single_client, clientThreadArgs) != PTHREAD_CREATE_SUCCESS) {
-        if (inactive_game_index != GAME_NOT_FOUND) {
-            //if failed to allocate memory for args that have a new game then free game and set to NULL
-            free(games[inactive_game_index]);
-            games[inactive_game_index] = NULL;
-        }
-        perror("Failed to create thread");
-        free(clientThreadArgs); // Free allocated memory on failure
-    }
-}
+void reactor_unlink_connection(struct ClientConnection *connection);
 
 /**
- * Adds a new client to an existing game instance
+ * Tears down a reactor owned connection
  * Args:
- *   clientSocketFD: Pointer to client's socket info
- *   active_game_index: Index of active game to join
+ *   connection: Connection to close
  * Operation:
- *   - Thread-safe update of game client count
- *   - Stores client socket info in game structure
+ *   - Removes its socket or reader eventfd from the epoll set, and stops the reader
+ *   - Stops the game and runs the regular thread_exit game cleanup
+ *   - Closes the game's other connections, they live on the same reactor
+ *   - Marks the connection closed so it is freed after the current batch
  * Returns: void
  */
-void add_client_to_game(const struct AcceptedSocket *clientSocketFD, const int active_game_index) {
-    pthread_mutex_lock(&games[active_game_index]->game_mutex);
-    games[active_game_index]->acceptedSocketsCount++;
-    games[active_game_index]->game_clients[SECOND_CLIENT_INDEX] = *clientSocketFD;
-    pthread_mutex_unlock(&games[active_game_index]->game_mutex);
-}
+void reactor_close_connection(struct ClientConnection *connection);
 
 /**
- * Main client message handling thread function
+ * Handles what a reactor owned socket has to read
  * Args:
- *   arg: Pointer to ThreadArgs containing socket FD and game info
+ *   connection: Readable connection
  * Operation:
- *   - Handles client messaging in a loop
- *   - Processes commands and flags
- *   - Routes messages between clients
+ *   - Until the session is sealed only the whole messages its reader received are handled
+ *   - A sealed socket is read once without blocking, every whole record is handled and a partial one
+ *     waits in the session, so a slow peer never holds the reactor thread
+ * Returns:
+ *   Boolean indicating the connection should be closed
+ */
+bool reactor_read_connection(struct ClientConnection *connection);
+
+/**
+ * Starts the receiving thread of a connection whose session is not sealed yet
+ * Args:
+ *   connection: Connection whose session still uses s_recv
+ * Operation:
+ *   - Creates the eventfd the reactor watches instead of the socket
+ *   - The thread receives one message at a time and waits until the reactor handled it
+ * Returns:
+ *   Boolean indicating the reader runs
+ */
+bool start_unsealed_reader(struct ClientConnection *connection);
+
+/**
+ * Unsealed reader thread function
+ * Args:
+ *   arg: Connection whose reader this is
+ * Operation:
+ *   - Receives a whole message with s_recv, however slowly the peer sends it
+ *   - Publishes it through the eventfd and waits until the reactor handled it
+ *   - Exits once the peer is gone or the reactor stopped it
  * Returns: NULL on completion
  */
-void *handle_single_client(void *arg) {
-    pthread_detach(pthread_self());
-    pthread_mutex_lock(&globals_mutex);
-    accepted_clients_count++;
-    pthread_mutex_unlock(&globals_mutex);
-    const int clientSocketFD = ((struct ThreadArgs *) arg)->socketFD;
-    Game *game = ((struct ThreadArgs *) arg)->game;
-    const unsigned char *encryption_key = ((struct ThreadArgs *) arg)->encryption_key;
-    free(arg);
-    unsigned int flag_file_tries = 0;
-    bool flag_request_dir = 0;
-    bool flag_okay_response = 0;
-    unsigned int key_file_tries = 0;
-    bool key_request_dir = 0;
-    bool key_okay_response = 0;
-    const int max_fd = clientSocketFD > game->stop_pipe[PIPE_READ] ? clientSocketFD : game->stop_pipe[PIPE_READ];
-    s_send(clientSocketFD, encryption_key,DIR_REQUEST, strlen(DIR_REQUEST));
-    while (!stop_all_games && !game->stop_game) {
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(clientSocketFD, &readfds);
-        FD_SET(game->stop_pipe[PIPE_READ], &readfds);
-        // Use select with a timeout
-        struct timeval timeout = {TIMEOUT_SECONDS, TIMEOUT_USECONDS}; // 1-second timeout
-        const int ret = select(max_fd + MAX_FD_FOR_SELECT, &readfds, NULL, NULL, &timeout);
-        if (ret < SELECT_ERROR_CHECK) {
-            perror("select");
-            break;
-        }
-        // Check if the pipe was written to
-        if (FD_ISSET(game->stop_pipe[PIPE_READ], &readfds)) {
-            char buf[PIPE_READ_BUF_SIZE];
-            read(game->stop_pipe[PIPE_READ], buf, sizeof(buf)); // Clear the pipe
-            break;
-        }
-        if (FD_ISSET(clientSocketFD, &readfds)) {
-            if (handle_client_messages(clientSocketFD, encryption_key, game, &flag_file_tries, &flag_request_dir,
-                                       &flag_okay_response, &key_file_tries, &key_request_dir, &key_okay_response))
-                break;
-        }
-    }
-    thread_exit(clientSocketFD, game);
-    return NULL;
-}
+void *unsealed_reader_thread(void *arg);
 
 /**
- * Handles client thread termination and cleanup
+ * Stops and frees the reader of a connection
  * Args:
- *   clientSocketFD: Client's socket file descriptor
- *   game: Pointer to associated game instance
+ *   connection: Connection with a reader, already out of the epoll set
  * Operation:
- *   - Notifies other clients of disconnection
- *   - Updates game client count
- *   - Signals game termination via pipe
- *   - Closes socket and updates global client count
+ *   - Wakes a reader waiting for the reactor, one inside s_recv needs the socket shut down first
+ *   - Joins the thread and closes its eventfd
  * Returns: void
  */
-void thread_exit(const int clientSocketFD, Game *game) {
-    //send disconnect message and remove accepted socket from array
-    if (!stop_all_games) {
-        sendReceivedMessageToTheOtherClients(SECOND_CLIENT_DISCONNECTED, clientSocketFD, game);
-    }
-    pthread_mutex_lock(&game->game_mutex);
-    if (game->acceptedSocketsCount > 0) {
-        game->acceptedSocketsCount--;
-    }
-    // Write to the pipe to signal that the game should stop
-    const char signal = 'N';
-    write(game->stop_pipe[PIPE_WRITE], &signal, sizeof(signal)); // Writing to stop the game
-    game->stop_game = true;
-    pthread_mutex_unlock(&game->game_mutex);
-    close(clientSocketFD);
-    printf("\033[1;31;47mThread %lu has successfully exited.\033[0m\n", pthread_self());
-    pthread_mutex_lock(&globals_mutex);
-    accepted_clients_count--;
-    pthread_mutex_unlock(&globals_mutex);
-}
+void stop_unsealed_reader(struct ClientConnection *connection);
 
 /**
- * Processes incoming client messages and manages game state
+ * Handles the message a reader published
  * Args:
- *   clientSocketFD: Client's socket file descriptor
- *   game: Pointer to associated game instance
- *   flag_file_tries: Pointer to flag attempt counter
- *   flag_request_dir: Pointer to directory request status
- *   flag_okay_response: Pointer to flag response status
+ *   connection: Connection whose reader eventfd is readable
  * Operation:
- *   - Receives client messages
- *   - Handles flag operations and validation
- *   - Processes game messages
+ *   - Runs the message through handle_client_frame on the reactor thread, like every sealed record
+ *   - The HEL answer that sealed the session stops the reader and moves the reactor to the socket,
+ *     clients that never seal keep their reader
  * Returns:
- *   Boolean indicating if client handling should terminate
+ *   Boolean indicating the connection should be closed
  */
-bool handle_client_messages(const int clientSocketFD, const unsigned char *encryption_key, Game *game,
-                            unsigned int *flag_file_tries, bool *flag_request_dir,
-                            bool *flag_okay_response, unsigned int *key_file_tries, bool *key_request_dir,
-                            bool *key_okay_response) {
-    // Initialize buffer for incoming message
-    char buffer[BUFFER_SIZE] = {NULL_CHAR};
-    // Receive data from client
-    const ssize_t amountReceived = s_recv(clientSocketFD, buffer, sizeof(buffer), encryption_key);
-    if (amountReceived > CHECK_RECEIVE) {
-        // Null terminate received message
-        buffer[amountReceived] = NULL_CHAR;
-        // Log received message
-        printf("%s\n", buffer);
-        if (!(*flag_okay_response && *flag_request_dir)) {
-            if (!handle_client_flag(buffer, flag_file_tries, clientSocketFD, encryption_key, flag_okay_response,
-                                    flag_request_dir, game)) {
-                return true;
-            }
-        } else if (!(*key_okay_response && *key_request_dir)) {
-            if (!handle_client_key(buffer, key_file_tries, clientSocketFD, encryption_key, key_okay_response,
-                                   key_request_dir, game)) {
-                return true;
-            }
-        } else {
-            //deal with client message and make an ideal response
-            game->stop_game = generate_message_for_clients(clientSocketFD, encryption_key, buffer, game);
-        }
-    }
-    // Exit if connection closed or server stopping
-    if (amountReceived <= CHECK_RECEIVE || stop_all_games || game->stop_game) {
-        return true;
-    }
-    return false;
-}
+bool reactor_read_unsealed(struct ClientConnection *connection);
 
 /**
- * Routes messages between connected clients in a game
+ * Arms or disarms EPOLLOUT for the connections of a game
  * Args:
- *   buffer: Message to send
- *   socketFD: Sender's socket FD (excluded from receiving)
- *   game: Pointer to Game struct for message routing
+ *   connection: Connection whose events were just handled
  * Operation:
- *   Thread-safe message broadcasting to other game clients
+ *   - Watches every connection of the game, handling one message may have sent to the other
+ *   - EPOLLOUT stays armed while a session holds unsent records
+ *   - Closes a connection whose session failed a send or went over CRYPTO_SESSION_BACKLOG_LIMIT
  * Returns: void
  */
-void sendReceivedMessageToTheOtherClients(const char *buffer, const int socketFD, Game *game) {
-    // Lock mutex before accessing shared client data
-    pthread_mutex_lock(&game->game_mutex);
+void reactor_watch_output(struct ClientConnection *connection);
 
-    // Iterate through all connected clients
-    for (int i = 0; i < game->acceptedSocketsCount; i++) {
-        // Skip sender's socket
-        if (game->game_clients[i].acceptedSocketFD != socketFD) {
-            // Forward message to other client
-            s_send(game->game_clients[i].acceptedSocketFD, game->game_clients[i].encryption_key, buffer,
-                   strlen(buffer));
+/**
+ * @param clientSocketFD accepted and keyed client
+ * Operation:
+ * rejects client:
+ * sends a messgae that indicates no space left and close their socket
+ */
+void reject_client(const struct AcceptedSocket *clientSocketFD) {
+    metrics_add(METRIC_REJECTED_CLIENTS, 1);
+    // Send max clients error message
+    send_frame(clientSocketFD->session, clientSocketFD->encoding, MESSAGE_TYPE_ERR, GAME_MAX, strlen(GAME_MAX));
+    close(clientSocketFD->acceptedSocketFD);
+    crypto_session_destroy(clientSocketFD->session);
+}
+
+/**
+ * Main server accept loop for incoming connections
+ * Args:
+ *   listener: Listener to accept on
+ * Operation:
+ *   - Waits for the listen socket to become readable
+ *   - Accepts pending clients in batches for the handshake workers
+ *   - Returns on shutdown or once a successor took the socket over
+ * Returns: void
+ */
+void startAcceptingIncomingConnections(struct Listener *listener) {
+    struct pollfd waits[ACCEPT_POLL_COUNT] = {
+        [LISTEN_POLL_INDEX] = {.fd = listener->socketFD, .events = POLLIN},
+        {.fd = shutdown_event, .events = POLLIN},
+        {.fd = drain_event, .events = POLLIN}
+    };
+    while (!stop_all_games && !atomic_load(&draining)) {
+        const int ready = poll(waits, ACCEPT_POLL_COUNT, POLL_WAIT_FOREVER);
+        if (ready == POLL_ERROR && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (ready > 0 && waits[LISTEN_POLL_INDEX].revents) {
+            accept_connection_batch(listener);
         }
     }
+}
 
-    // Release mutex after broadcasting
-    pthread_mutex_unlock(&game->game_mutex);
+/**
+ * Accept thread function for every listener but the first
+ * Args:
+ *   arg: Pointer to the Listener
+ * Returns: NULL on completion
+ */
+void *listener_thread(void *arg) {
+    startAcceptingIncomingConnections(arg);
+    return NULL;
 }
 
 /**
- * Accepts new client connections on server socket
+ * Opens the listen sockets and their game registries
  * Args:
- *   serverSocketFD: File descriptor for the server socket
+ *   port: Port every listener binds to
+ *   count: Number of listeners
+ *   backlog: listen() backlog of each socket
  * Operation:
- *   Accepts connection and populates client address info
+ *   - Sets SO_REUSEPORT when count > 1 so the kernel spreads connections
+ *   - Closes what was opened on failure
  * Returns:
- *   AcceptedSocket struct with client details and status
+ *   EXIT_SUCCESS or EXIT_FAILURE
  */
-struct AcceptedSocket acceptIncomingConnection(const int serverSocketFD) {
-    // Initialize socket structure
-    struct AcceptedSocket acceptedSocket = {NULL_CHAR};
-    struct sockaddr_in clientAddress;
-    int clientAddressSize = sizeof(struct sockaddr_in);
-    // Accept new connection
-    const int clientSocketFD = accept(serverSocketFD, (struct sockaddr *) &clientAddress,
-                                      (socklen_t *) &clientAddressSize);
-    // Set socket information
-    acceptedSocket.address = clientAddress;
-    acceptedSocket.acceptedSocketFD = clientSocketFD;
-    acceptedSocket.acceptedSuccessfully = clientSocketFD > ACCEPTED_SUCCESSFULLY;
-    acceptedSocket.error = clientSocketFD < ACCEPTED_SUCCESSFULLY ? clientSocketFD : ACCEPTED_SUCCESSFULLY;
-    memset(acceptedSocket.flag_data, NULL_CHAR, sizeof(acceptedSocket.flag_data));
-    memset(acceptedSocket.flag_dir, NULL_CHAR, sizeof(acceptedSocket.flag_dir));
-    if (acceptedSocket.acceptedSuccessfully) {
-        size_t key_len; // Only used during initialization
-        acceptedSocket.encryption_key = recv_send_key(acceptedSocket.acceptedSocketFD, &key_len);
-        if (acceptedSocket.encryption_key == NULL) {
-            acceptedSocket.acceptedSuccessfully = false;
-            close(acceptedSocket.acceptedSocketFD);
+int open_listeners(const int port, const unsigned int count, const int backlog) {
+    for (unsigned int i = 0; i < count; i++) {
+        struct Listener *listener = &listeners[i];
+        listener->socketFD = initServerSocket(port, backlog, count > DEFAULT_LISTENERS);
+        if (listener->socketFD == EXIT_FAILURE) {
+            close_listeners();
+            return EXIT_FAILURE;
         }
+        if (!init_game_registry(&listener->registry)) {
+            close(listener->socketFD);
+            close_listeners();
+            return EXIT_FAILURE;
+        }
+        listener_count++;
     }
-    return acceptedSocket;
+    return EXIT_SUCCESS;
 }
 
 /**
- * Validates message field format
+ * Opens the listener other nodes relay their connections to
  * Args:
- *   buffer: Message to validate
+ *   port: This node's cluster port
+ *   backlog: listen() backlog
  * Operation:
- *   Checks presence and format of required fields
+ *   Appended after the client listeners with its own registry, so it is one more matchmaking shard
  * Returns:
- *   Boolean indicating valid format
+ *   EXIT_SUCCESS or EXIT_FAILURE
  */
-int check_message_fields(const char *buffer) {
-    if (strstr(buffer, "type:") == NULL) {
-        return false;
+int open_cluster_listener(const int port, const int backlog) {
+    struct Listener *listener = &listeners[listener_count];
+    // A predecessor's socket is already bound to this node's cluster port
+    listener->socketFD = adopted_cluster_socket != SOCKET_ERROR ? adopted_cluster_socket
+                                                                : initServerSocket(port, backlog, false);
+    adopted_cluster_socket = SOCKET_ERROR;
+    if (listener->socketFD == EXIT_FAILURE) {
+        return EXIT_FAILURE;
     }
-    if (strlen(strstr(buffer, "type:") + TYPE_OFFSET) < TYPE_LENGTH) {
-        return false;
+    if (!init_game_registry(&listener->registry)) {
+        close(listener->socketFD);
+        return EXIT_FAILURE;
     }
-    if (strstr(buffer, "data:") == NULL) {
-        return false;
+    listener->cluster = true;
+    listener_count++;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Runs every listener's accept loop until shutdown
+ * Operation:
+ *   - Spawns listener_thread for every listener but the first
+ *   - Runs the first one on the calling thread and joins the rest
+ * Returns: void
+ */
+void run_listeners() {
+    bool started[LISTENER_SLOTS] = {false};
+    for (unsigned int i = FIRST_LISTENER + 1; i < listener_count; i++) {
+        started[i] = pthread_create(&listeners[i].thread, NULL, listener_thread, &listeners[i]) ==
+                     PTHREAD_CREATE_SUCCESS;
+        if (!started[i]) {
+            // Its socket stays open, the kernel keeps routing to it until shutdown
+            perror("Failed to create listener thread");
+        }
+    }
+    startAcceptingIncomingConnections(&listeners[FIRST_LISTENER]);
+    for (unsigned int i = FIRST_LISTENER + 1; i < listener_count; i++) {
+        if (started[i]) {
+            pthread_join(listeners[i].thread, NULL);
+        }
     }
-    return true;
 }
 
 /**
- * Validates incoming client messages
- * Args:
- *   buffer: Message buffer to check
+ * Closes every listener
  * Operation:
- *   - Checks message type and format
- *   - Validates command data if CMD type
- * Returns:
- *   Boolean indicating message validity
+ *   - Destroys the game registries, no game may be live
+ *   - Only closes sockets another server process also holds, shutdown would end its listen queue too
+ * Returns: void
  */
-int check_message_received(char buffer[4096]) {
-    if (!check_message_fields(buffer)) {
-        return false;
+void close_listeners() {
+    const bool shared = listeners_shared || handoff_done();
+    for (unsigned int i = 0; i < listener_count; i++) {
+        destroy_game_registry(&listeners[i].registry);
+        if (!shared) {
+            shutdown(listeners[i].socketFD, SHUT_RDWR);
+        }
+        close(listeners[i].socketFD);
     }
-    if (strncmp(strstr(buffer, "type:") + TYPE_OFFSET, DATA_CMD_CHECK, TYPE_LENGTH) ==
-        CMP_EQUAL) {
-        // Validate command data
-        return check_command_data(strstr(buffer, "data:") + DATA_OFFSET);
+    listener_count = 0;
+    if (adopted_cluster_socket != SOCKET_ERROR) {
+        close(adopted_cluster_socket);
+        adopted_cluster_socket = SOCKET_ERROR;
     }
-    return strncmp(strstr(buffer, "type:") + TYPE_OFFSET, "FLG", TYPE_LENGTH) !=
-           CMP_EQUAL;
 }
 
 /**
- * Checks game winning condition
+ * Drains the listen queue without blocking
  * Args:
- *   clientSocketFD: Client's socket FD
- *   buffer: Message buffer
- *   game: Game instance pointer
+ *   listener: Listener with a non-blocking server socket
  * Operation:
- *   Compares client flag data for win
+ *   - Calls accept4 until EAGAIN or ACCEPT_BATCH_SIZE connections
+ *   - Relays a socket the matchmaking backend routes to another node
+ *   - Hands every other socket to the handshake stage, tagged with the listener's shard
  * Returns:
- *   Boolean indicating win
+ *   Number of accepted connections
  */
-bool check_winner(const int clientSocketFD, char buffer[4096], Game *game) {
-    pthread_mutex_lock(&game->game_mutex);
-    for (int i = 0; i < game->acceptedSocketsCount; i++) {
-        if (game->game_clients[i].acceptedSocketFD != clientSocketFD) {
-            if (strcmp(strstr(buffer, "data:") + DATA_OFFSET, game->game_clients[i].flag_data) == CMP_EQUAL) {
-                pthread_mutex_unlock(&game->game_mutex);
-                return true;
+int accept_connection_batch(const struct Listener *listener) {
+    int accepted = 0;
+    while (accepted < ACCEPT_BATCH_SIZE) {
+        struct PendingConnection pending;
+        socklen_t addressSize = sizeof(pending.address);
+        pending.shard = (unsigned int) (listener - listeners);
+        pending.socketFD = accept4(listener->socketFD, (struct sockaddr *) &pending.address, &addressSize,
+                                   SOCK_CLOEXEC);
+        if (pending.socketFD < ACCEPTED_SUCCESSFULLY) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
             }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept4");
+            }
+            break;
+        }
+        accepted++;
+        metrics_add(METRIC_ACCEPTS, 1);
+        pending.accepted_ns = metrics_now_ns();
+        // A relayed connection was routed by the node that accepted it
+        const int node = listener->cluster ? LOCAL_NODE : match_backend->route(&pending);
+        if (node != LOCAL_NODE && cluster_forward(pending.socketFD, (unsigned int) node)) {
+            metrics_add(METRIC_FORWARDED, 1);
+            continue;
+        }
+        if (!enqueue_handshake(&pending)) {
+            close(pending.socketFD);
         }
     }
-    pthread_mutex_unlock(&game->game_mutex);
-    return false;
+    return accepted;
 }
 
 /**
- * Processes and routes client messages
+ * Queues an accepted socket for the handshake workers
  * Args:
- *   clientSocketFD: Client's socket FD
- *   buffer: Message buffer
- *   game: Game instance pointer
+ *   pending: Accepted socket and its peer address
  * Operation:
- *   - Handles game state messages
- *   - Checks win conditions
- *   - Routes valid messages
- * Returns: Boolean indicating if game should end
+ *   Thread-safe enqueue, sheds the connection when the queue is full
+ * Returns:
+ *   Boolean indicating the socket was queued
  */
-int generate_message_for_clients(const int clientSocketFD, const unsigned char *encryption_key, char buffer[4096],
-                                 Game *game) {
-    pthread_mutex_lock(&game->game_mutex);
-    if (game->acceptedSocketsCount < MAX_CLIENTS) {
-        pthread_mutex_unlock(&game->game_mutex);
-        //are there not 2 clients connected?
-        s_send(clientSocketFD, encryption_key,WAIT_CLIENT, strlen(WAIT_CLIENT));
-    } else {
-        pthread_mutex_unlock(&game->game_mutex);
-        if (check_winner(clientSocketFD, buffer, game)) {
-            s_send(clientSocketFD, encryption_key,WIN_MSG, strlen(WIN_MSG));
-            sendReceivedMessageToTheOtherClients(LOSE_MSG, clientSocketFD, game);
-            return true;
-        }
-        if (check_message_received(buffer)) {
-            sendReceivedMessageToTheOtherClients(buffer, clientSocketFD, game);
-        } else {
-            s_send(clientSocketFD, encryption_key,INVALID_DATA,
-                   strlen(INVALID_DATA));
-        }
+bool enqueue_handshake(const struct PendingConnection *pending) {
+    pthread_mutex_lock(&handshake_stage.queue_mutex);
+    if (handshake_stage.count == HANDSHAKE_QUEUE_CAPACITY) {
+        pthread_mutex_unlock(&handshake_stage.queue_mutex);
+        metrics_add(METRIC_REJECTED_CLIENTS, 1);
+        log_write(LOG_LEVEL_WARN, "Handshake queue is full, dropping connection\n");
+        return false;
     }
-    return false;
+    handshake_stage.entries[(handshake_stage.head + handshake_stage.count) % HANDSHAKE_QUEUE_CAPACITY] = *pending;
+    handshake_stage.count++;
+    pthread_cond_signal(&handshake_stage.queue_not_empty);
+    pthread_mutex_unlock(&handshake_stage.queue_mutex);
+    return true;
 }
 
 /**
- * Creates flag file for client
+ * Handshake worker thread function
  * Args:
- *   buffer: Directory path
- *   clientSocketFD: Client's socket FD
- *   game: Game instance pointer
+ *   arg: Unused
  * Operation:
- *   - Generates random flag data
- *   - Creates flag file
- * Returns: Status code
+ *   - Waits for accepted sockets
+ *   - Runs the key exchange with a timeout
+ *   - Hands fully keyed sockets to matchmaking
+ * Returns: NULL on completion
+ */
+void *handshake_worker(void *arg) {
+    (void) arg;
+    while (true) {
+        pthread_mutex_lock(&handshake_stage.queue_mutex);
+        while (handshake_stage.count == 0 && !handshake_stage.stopping) {
+            pthread_cond_wait(&handshake_stage.queue_not_empty, &handshake_stage.queue_mutex);
+        }
+        // A drain stops the pool with stop_all_games unset, the sockets already accepted still get a game
+        if (handshake_stage.stopping && (handshake_stage.count == 0 || stop_all_games)) {
+            pthread_mutex_unlock(&handshake_stage.queue_mutex);
+            break;
+        }
+        const struct PendingConnection pending = handshake_stage.entries[handshake_stage.head];
+        handshake_stage.head = (handshake_stage.head + 1) % HANDSHAKE_QUEUE_CAPACITY;
+        handshake_stage.count--;
+        pthread_mutex_unlock(&handshake_stage.queue_mutex);
+        struct AcceptedSocket clientSocket = acceptIncomingConnection(&pending);
+        // Only fully keyed sockets reach matchmaking
+        if (clientSocket.acceptedSuccessfully) {
+            metrics_add(METRIC_HANDSHAKES, 1);
+            metrics_observe_since(HISTOGRAM_HANDSHAKE, pending.accepted_ns);
+            handle_single_client_on_separate_thread(&clientSocket, pending.shard);
+        } else {
+            metrics_add(METRIC_HANDSHAKE_FAILURES, 1);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Starts the handshake worker pool
+ * Args:
+ *   count: Number of workers
+ * Operation:
+ *   Spawns workers running handshake_worker
+ * Returns:
+ *   EXIT_SUCCESS or EXIT_FAILURE
+ */
+int start_handshake_workers(const unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        if (pthread_create(&handshake_stage.workers[i], NULL, handshake_worker, NULL) != PTHREAD_CREATE_SUCCESS) {
+            perror("Failed to create handshake worker");
+            stop_handshake_workers();
+            return EXIT_FAILURE;
+        }
+        handshake_stage.worker_count++;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Stops the handshake worker pool
+ * Operation:
+ *   - Wakes and joins every worker, before stop_all_games they first finish the queued handshakes
+ *   - Closes sockets still waiting for a handshake
+ * Returns: void
+ */
+void stop_handshake_workers() {
+    pthread_mutex_lock(&handshake_stage.queue_mutex);
+    handshake_stage.stopping = true;
+    pthread_cond_broadcast(&handshake_stage.queue_not_empty);
+    pthread_mutex_unlock(&handshake_stage.queue_mutex);
+    for (unsigned int i = 0; i < handshake_stage.worker_count; i++) {
+        pthread_join(handshake_stage.workers[i], NULL);
+    }
+    handshake_stage.worker_count = 0;
+    while (handshake_stage.count > 0) {
+        close(handshake_stage.entries[handshake_stage.head].socketFD);
+        handshake_stage.head = (handshake_stage.head + 1) % HANDSHAKE_QUEUE_CAPACITY;
+        handshake_stage.count--;
+    }
+}
+
+/**
+ * Creates and starts a new client handler thread
+ * Args:
+ *   clientSocketFD: Pointer to AcceptedSocket for the client
+ *   shard: Listener that accepted the client
+ * Operation:
+ *   - Joins a waiting game, its own listener's first, then the others
+ *   - Creates a new one in its own listener's registry otherwise
+ *   - Initializes the connection state
+ *   - Spawns handler thread
+ * Returns: void
+ */
+void handle_single_client_on_separate_thread(
+    const struct AcceptedSocket *clientSocketFD, const unsigned int shard) {
+    Game *game = match_backend->match(clientSocketFD, shard);
+    if (game == NULL) {
+        reject_client(clientSocketFD);
+        return;
+    }
+    create_client_connection(clientSocketFD, game);
+}
+
+/**
+ * Finds a game for a keyed client
+ * Args:
+ *   clientSocketFD: Pointer to AcceptedSocket for the client
+ *   shard: Listener that accepted the client
+ * Operation:
+ *   - Joins a waiting game, its own listener's first, then the others
+ *   - Creates a game in its own listener's registry otherwise
+ * Returns:
+ *   Game the client is now part of, NULL if it has to be rejected
+ */
+Game *match_client(const struct AcceptedSocket *clientSocketFD, const unsigned int shard) {
+    Game *game = NULL;
+    // Other shards are only searched so a lone waiting player is never stranded on another listener
+    for (unsigned int i = 0; game == NULL && i < listener_count; i++) {
+        game = join_waiting_game(&listeners[(shard + i) % listener_count].registry, clientSocketFD);
+    }
+    if (game == NULL) {
+        game = init_new_game(&listeners[shard].registry, clientSocketFD);
+    }
+    return game;
+}
+
+/**
+ * Route of the single node backend
+ * Args:
+ *   pending: Accepted socket
+ * Returns:
+ *   LOCAL_NODE, every game is played here
+ */
+int route_locally(const struct PendingConnection *pending) {
+    (void) pending;
+    return LOCAL_NODE;
+}
+
+/**
+ * Route of the cluster backend
+ * Args:
+ *   pending: Accepted socket
+ * Operation:
+ *   - Consecutive cluster tickets share a placement key, so two players meet on one owner
+ *     whichever front-ends they arrived on
+ *   - Without the matchmaker consecutive arrivals on this node pair up, under keys no ticket gives out
+ * Returns:
+ *   Owning node, LOCAL_NODE when that is this node
+ */
+int route_by_ring(const struct PendingConnection *pending) {
+    (void) pending;
+    uint64_t ticket;
+    const uint64_t key = cluster_ticket(&ticket)
+                             ? ticket / MAX_CLIENTS
+                             : (uint64_t) (cluster_self() + 1) << CLUSTER_KEY_NODE_SHIFT ^
+                               atomic_fetch_add(&routed_clients, 1) / MAX_CLIENTS;
+    const unsigned int owner = cluster_owner(key);
+    return owner == cluster_self() ? LOCAL_NODE : (int) owner;
+}
+
+/**
+ * Cluster fallback, plays a relayed client's game here when its node is down
+ * Args:
+ *   socketFD: Client socket before its key exchange
+ * Returns:
+ *   Boolean indicating the socket was queued for the handshake workers
+ */
+bool serve_locally(const int socketFD) {
+    struct PendingConnection pending = {
+        .socketFD = socketFD, .shard = FIRST_LISTENER, .accepted_ns = metrics_now_ns()
+    };
+    socklen_t addressSize = sizeof(pending.address);
+    getpeername(socketFD, (struct sockaddr *) &pending.address, &addressSize);
+    return enqueue_handshake(&pending);
+}
+
+/**
+ * Initializes the game registry
+ * Args:
+ *   registry: Registry to initialize
+ * Operation:
+ *   - Prepares the slab table and free list
+ *   - Allocates the waiting-for-second-player queue
+ * Returns:
+ *   Boolean indicating success
+ */
+bool init_game_registry(GameRegistry *registry) {
+    memset(registry, NULL_CHAR, sizeof(GameRegistry));
+    atomic_init(&registry->slab_count, 0);
+    registry->free_slots = malloc(sizeof(unsigned int) * GAME_SLAB_SIZE * MAX_GAME_SLABS);
+    if (registry->free_slots == NULL) {
+        perror("malloc");
+        return false;
+    }
+    if (!mpmc_ring_init(&registry->waiting_games, WAITING_QUEUE_CAPACITY)) {
+        perror("malloc");
+        free(registry->free_slots);
+        return false;
+    }
+    pthread_mutex_init(&registry->registry_mutex, NULL);
+    return true;
+}
+
+/**
+ * Frees every slab of the registry on shutdown
+ * Args:
+ *   registry: Registry to destroy, no game may be live
+ * Returns: void
+ */
+void destroy_game_registry(GameRegistry *registry) {
+    const unsigned int slab_count = atomic_load(&registry->slab_count);
+    for (unsigned int i = 0; i < slab_count; i++) {
+        for (unsigned int j = 0; j < GAME_SLAB_SIZE; j++) {
+            pthread_mutex_destroy(&registry->slabs[i][j].game_mutex);
+        }
+        free(registry->slabs[i]);
+    }
+    free(registry->free_slots);
+    mpmc_ring_destroy(&registry->waiting_games);
+    pthread_mutex_destroy(&registry->registry_mutex);
+}
+
+/**
+ * Maps a registry slot index to its game
+ * Args:
+ *   registry: Registry to look in
+ *   slot: Slot index
+ * Returns:
+ *   Game slot pointer
+ */
+Game *game_at_slot(GameRegistry *registry, const unsigned int slot) {
+    return &registry->slabs[slot / GAME_SLAB_SIZE][slot % GAME_SLAB_SIZE];
+}
+
+/**
+ * Takes a free game slot, growing the registry by one slab when needed
+ * Args:
+ *   registry: Registry to allocate from
+ * Operation:
+ *   - Counts the game against max_games over every registry
+ *   - Pops the free list under the registry mutex
+ *   - Allocates and publishes a new slab if the free list is empty
+ * Returns:
+ *   Game slot or NULL if max_games are live or the slab table is exhausted
+ */
+Game *acquire_game_slot(GameRegistry *registry) {
+    // Counted before the check so concurrent starts cannot overshoot, a lowered limit lets live games finish
+    if (atomic_fetch_add(&live_games, 1) >= atomic_load(&game_limit)) {
+        atomic_fetch_sub(&live_games, 1);
+        return NULL;
+    }
+    pthread_mutex_lock(&registry->registry_mutex);
+    if (registry->free_count == 0) {
+        const unsigned int slab_index = atomic_load(&registry->slab_count);
+        if (slab_index == MAX_GAME_SLABS) {
+            pthread_mutex_unlock(&registry->registry_mutex);
+            atomic_fetch_sub(&live_games, 1);
+            return NULL;
+        }
+        Game *slab = calloc(GAME_SLAB_SIZE, sizeof(Game));
+        if (slab == NULL) {
+            pthread_mutex_unlock(&registry->registry_mutex);
+            atomic_fetch_sub(&live_games, 1);
+            perror("calloc");
+            return NULL;
+        }
+        // Slot mutexes live as long as the slab, slots only change ownership
+        for (unsigned int i = 0; i < GAME_SLAB_SIZE; i++) {
+            slab[i].slot = slab_index * GAME_SLAB_SIZE + i;
+            slab[i].registry = registry;
+            pthread_mutex_init(&slab[i].game_mutex, NULL);
+        }
+        // Push in reverse so the lowest slot is handed out first
+        for (unsigned int i = GAME_SLAB_SIZE; i > 0; i--) {
+            registry->free_slots[registry->free_count++] = slab[i - 1].slot;
+        }
+        registry->slabs[slab_index] = slab;
+        atomic_store(&registry->slab_count, slab_index + 1);
+    }
+    Game *game = game_at_slot(registry, registry->free_slots[--registry->free_count]);
+    pthread_mutex_unlock(&registry->registry_mutex);
+    metrics_add(METRIC_GAMES_STARTED, 1);
+    return game;
+}
+
+/**
+ * Returns a finished game's slot to the free list
+ * Args:
+ *   registry: Owning registry
+ *   game: Game to release, its game_mutex must be held
+ * Operation:
+ *   - Closes the stop eventfd
+ *   - Closes the sockets and destroys the crypto sessions of the joined clients
+ *   - Bumps the slot generation so queued tickets become stale
+ *   - Pushes the slot on the free list
+ * Returns: void
+ */
+void release_game_slot(GameRegistry *registry, Game *game) {
+    if (game->stop_event != NO_STOP_EVENT) {
+        close(game->stop_event);
+    }
+    // Every handler of the game is gone, nobody can send on these sessions or reuse these sockets anymore
+    const unsigned int joined = atomic_load(&game->joined_clients);
+    for (unsigned int i = 0; i < joined; i++) {
+        close(game->game_clients[i].acceptedSocketFD);
+        crypto_session_destroy(game->game_clients[i].session);
+        game->game_clients[i].session = NULL;
+    }
+    if (joined == MAX_CLIENTS && atomic_fetch_sub(&paired_games, 1) == 1) {
+        const uint64_t drained = STOP_EVENT_VALUE;
+        write(games_event, &drained, sizeof(drained));
+    }
+    atomic_store(&game->joined_clients, 0);
+    game->in_use = false;
+    game->generation++;
+    pthread_mutex_lock(&registry->registry_mutex);
+    registry->free_slots[registry->free_count++] = game->slot;
+    pthread_mutex_unlock(&registry->registry_mutex);
+    atomic_fetch_sub(&live_games, 1);
+    metrics_add(METRIC_GAMES_RELEASED, 1);
+}
+
+/**
+ * Joins a game that is waiting for its second player
+ * Args:
+ *   registry: Registry to look in
+ *   clientSocketFD: Pointer to client's socket info
+ * Operation:
+ *   - Pops tickets from the waiting queue, skipping stale ones
+ *   - Locks only the candidate game to add the client
+ * Returns:
+ *   Joined game or NULL if no game is waiting
+ */
+Game *join_waiting_game(GameRegistry *registry, const struct AcceptedSocket *clientSocketFD) {
+    uint64_t ticket;
+    while (mpmc_ring_pop(&registry->waiting_games, &ticket)) {
+        Game *game = game_at_slot(registry, (unsigned int) (ticket & TICKET_SLOT_MASK));
+        pthread_mutex_lock(&game->game_mutex);
+        // A ticket is stale once its game stopped or the slot was recycled
+        if (game->in_use && game->generation == (unsigned int) (ticket >> TICKET_GENERATION_SHIFT) &&
+            !atomic_load(&game->stop_game) && atomic_load(&game->acceptedSocketsCount) == 1) {
+            atomic_fetch_add(&game->acceptedSocketsCount, 1);
+            game->game_clients[SECOND_CLIENT_INDEX] = *clientSocketFD;
+            atomic_store(&game->players[SECOND_CLIENT_INDEX].capabilities, clientSocketFD->capabilities);
+            atomic_store(&game->players[SECOND_CLIENT_INDEX].flag_ready, false);
+            // Publishes the entry, the relay and check_winner read it without game_mutex from here on
+            atomic_store_explicit(&game->joined_clients, MAX_CLIENTS, memory_order_release);
+            atomic_fetch_add(&paired_games, 1);
+            pthread_mutex_unlock(&game->game_mutex);
+            return game;
+        }
+        pthread_mutex_unlock(&game->game_mutex);
+    }
+    return NULL;
+}
+
+/**
+ * Initializes new game instance
+ * Args:
+ *   registry: Registry to take the slot from
+ *   clientSocketFD: First client's socket info
+ * Operation:
+ *   - Takes a slot from the registry
+ *   - Creates the stop eventfd in thread-per-client mode and sets initial state
+ *   - Publishes the game on the waiting queue
+ * Returns:
+ *   New game or NULL on failure
+ */
+Game *init_new_game(GameRegistry *registry, const struct AcceptedSocket *clientSocketFD) {
+    Game *game = acquire_game_slot(registry);
+    if (game == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&game->game_mutex);
+    // Reactors stop a game by closing its connections themselves, only handler threads need an event
+    game->stop_event = reactor_count == THREAD_PER_CLIENT_MODE ? eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)
+                                                               : NO_STOP_EVENT;
+    if (reactor_count == THREAD_PER_CLIENT_MODE && game->stop_event == EVENTFD_ERROR) {
+        perror("Failed to create stop eventfd for Game");
+        pthread_mutex_unlock(&game->game_mutex);
+        pthread_mutex_lock(&registry->registry_mutex);
+        registry->free_slots[registry->free_count++] = game->slot;
+        pthread_mutex_unlock(&registry->registry_mutex);
+        atomic_fetch_sub(&live_games, 1);
+        return NULL;
+    }
+    memset(game->game_clients, NULL_CHAR, sizeof(game->game_clients));
+    atomic_store(&game->acceptedSocketsCount, 1);
+    game->game_clients[FIRST_CLIENT_INDEX] = *clientSocketFD;
+    atomic_store(&game->players[FIRST_CLIENT_INDEX].capabilities, clientSocketFD->capabilities);
+    atomic_store(&game->players[FIRST_CLIENT_INDEX].flag_ready, false);
+    atomic_store_explicit(&game->joined_clients, 1, memory_order_release);
+    atomic_store(&game->stop_game, false);
+    game->reactor = NULL;
+    game->match_id = atomic_fetch_add(&next_match_id, 1);
+    game->in_use = true;
+    const uint64_t ticket = (uint64_t) game->generation << TICKET_GENERATION_SHIFT | game->slot;
+    if (!mpmc_ring_push(&registry->waiting_games, ticket)) {
+        log_write(LOG_LEVEL_WARN, "Waiting queue is full\n");
+        // The caller rejects the client, closing its socket and destroying its session itself
+        atomic_store(&game->joined_clients, 0);
+        release_game_slot(registry, game);
+        pthread_mutex_unlock(&game->game_mutex);
+        return NULL;
+    }
+    pthread_mutex_unlock(&game->game_mutex);
+    return game;
+}
+
+/**
+ * Creates the per-connection state object and hands it to a handler
+ * Args:
+ *   clientSocketFD: Client socket info
+ *   game: Game the client was matched into
+ * Operation:
+ *   - Allocates the ClientConnection and its message arena
+ *   - Creates handler thread, or registers with a reactor in event mode
+ *   - Leaves the game through thread_exit on failure
+ * Returns: void
+ */
+void create_client_connection(const struct AcceptedSocket *clientSocketFD, Game *game) {
+    struct ClientConnection *connection = new_client_connection(clientSocketFD, game, true);
+    if (!connection) {
+        thread_exit(clientSocketFD->acceptedSocketFD, game);
+        return;
+    }
+    if (reactor_count != THREAD_PER_CLIENT_MODE) {
+        if (!reactor_add_connection(connection)) {
+            thread_exit(connection->socketFD, connection->game);
+            free_client_connection(connection);
+        }
+        return;
+    }
+    pthread_t clientThread;
+    if (pthread_create(&clientThread, NULL, handle_single_client, connection) != PTHREAD_CREATE_SUCCESS) {
+        perror("Failed to create thread");
+        thread_exit(connection->socketFD, connection->game);
+        free_client_connection(connection); // Free allocated memory on failure
+    }
+}
+
+/**
+ * Allocates the per-connection state of a matched client
+ * Args:
+ *   clientSocketFD: Client socket info
+ *   game: Game the client was matched into
+ *   with_arena: Allocate the message arena, streams of a multiplexed connection share their multiplexer's
+ * Operation:
+ *   Counts the client before any handler exists, the caller leaves the game on failure
+ * Returns:
+ *   Connection or NULL on failure
+ */
+struct ClientConnection *new_client_connection(const struct AcceptedSocket *clientSocketFD, Game *game,
+                                               const bool with_arena) {
+    // Counted before any handler exists so shutdown never misses a client
+    pthread_mutex_lock(&globals_mutex);
+    accepted_clients_count++;
+    pthread_mutex_unlock(&globals_mutex);
+    metrics_add(METRIC_CONNECTIONS_OPENED, 1);
+    // Dynamically allocate the connection state
+    struct ClientConnection *connection = malloc(sizeof(struct ClientConnection));
+    if (!connection) {
+        perror("Failed to allocate memory for ClientConnection");
+        return NULL;
+    }
+    memset(connection, NULL_CHAR, sizeof(struct ClientConnection));
+    // Allocated once, every message of the connection reuses it
+    if (with_arena && !arena_init(&connection->arena, CONNECTION_ARENA_SIZE)) {
+        perror("Failed to allocate connection arena");
+        free(connection);
+        return NULL;
+    }
+    connection->socketFD = clientSocketFD->acceptedSocketFD;
+    connection->game = game;
+    connection->session = clientSocketFD->session;
+    connection->encoding = clientSocketFD->encoding;
+    connection->capabilities = clientSocketFD->capabilities;
+    const unsigned int joined = atomic_load_explicit(&game->joined_clients, memory_order_acquire);
+    for (unsigned int i = 0; i < joined; i++) {
+        if (game->game_clients[i].acceptedSocketFD == connection->socketFD) {
+            connection->player = i;
+        }
+    }
+    return connection;
+}
+
+/**
+ * Frees a per-connection state object
+ * Args:
+ *   connection: Connection no handler or epoll event refers to anymore
+ * Operation:
+ *   Releases the message arena with it
+ * Returns: void
+ */
+void free_client_connection(struct ClientConnection *connection) {
+    arena_destroy(&connection->arena);
+    free(connection);
+}
+
+/**
+ * Finds an open stream of a multiplexed connection
+ * Args:
+ *   mux: Multiplexer to look in
+ *   stream: Stream id
+ * Returns:
+ *   Index in mux->streams, NO_STREAM if the stream is not open
+ */
+static int find_stream(const struct Multiplexer *mux, const uint32_t stream) {
+    for (unsigned int i = 0; i < mux->stream_count; i++) {
+        if (mux->streams[i]->stream == stream) {
+            return (int) i;
+        }
+    }
+    return NO_STREAM;
+}
+
+/**
+ * Ends one stream of a multiplexed connection
+ * Args:
+ *   mux: Owning multiplexer
+ *   index: Index of the stream in mux->streams
+ *   notify: Send the closing record, false when the client closed it or the connection is gone
+ * Operation:
+ *   - Leaves the stream's game without shutting the shared socket down
+ *   - Its identity descriptor and stream session go with the game slot
+ * Returns: void
+ */
+static void close_stream(struct Multiplexer *mux, const unsigned int index, const bool notify) {
+    struct ClientConnection *connection = mux->streams[index];
+    mux->streams[index] = mux->streams[--mux->stream_count];
+    const uint32_t stream = connection->stream;
+    const int clientSocketFD = connection->socketFD;
+    Game *game = connection->game;
+    free_client_connection(connection);
+    leave_game(clientSocketFD, game);
+    if (notify) {
+        session_close_stream(mux->session, stream);
+    }
+    log_write(LOG_LEVEL_INFO, "Stream %u of connection %d has been closed.\n", stream, mux->socketFD);
+}
+
+/**
+ * Opens a stream with the HEL a client sent on an unknown stream id
+ * Args:
+ *   mux: Owning multiplexer
+ *   stream: New stream id
+ *   buffer: Received message, one byte of room after it for the terminator
+ *   length: Message length
+ *   frame: View storage for the parsed message
+ * Operation:
+ *   - Agrees a subset of the connection's capabilities and answers with a HEL on the stream
+ *   - Gives the stream an eventfd as its identity in game_clients, it never owns the socket
+ *   - Matches it like a fresh client and asks for its flag directory
+ *   - Anything else on an unknown stream, or a full connection, is answered with a closing record
+ * Returns: void
+ */
+static void open_stream(struct Multiplexer *mux, const uint32_t stream, char *buffer, const size_t length,
+                        FrameView *frame) {
+    buffer[length] = NULL_CHAR;
+    if (mux->stream_count == FRAME_MAX_STREAMS || !parse_frame(buffer, length, frame) ||
+        frame->segment_count != SINGLE_SEGMENT || frame->segments[FIRST_SEGMENT].type != MESSAGE_TYPE_HEL) {
+        session_close_stream(mux->session, stream);
+        return;
+    }
+    struct AcceptedSocket accepted = {NULL_CHAR};
+    accepted.acceptedSuccessfully = true;
+    accepted.error = ACCEPTED_SUCCESSFULLY;
+    accepted.capabilities = frame_capabilities(&frame->segments[FIRST_SEGMENT]) & mux->capabilities;
+    accepted.encoding = accepted.capabilities & FRAME_CAPABILITY_BINARY ? FRAME_ENCODING_BINARY
+                                                                        : FRAME_ENCODING_TEXT;
+    accepted.acceptedSocketFD = eventfd(0, EFD_CLOEXEC);
+    accepted.session = accepted.acceptedSocketFD == EVENTFD_ERROR
+                           ? NULL
+                           : crypto_session_open_stream(mux->session, stream);
+    if (accepted.session == NULL) {
+        if (accepted.acceptedSocketFD != EVENTFD_ERROR) {
+            close(accepted.acceptedSocketFD);
+        }
+        session_close_stream(mux->session, stream);
+        return;
+    }
+    char answer[CAPABILITY_OFFER_SIZE];
+    const int answer_length = snprintf(answer, sizeof(answer), "%u", accepted.capabilities);
+    send_frame(accepted.session, accepted.encoding, MESSAGE_TYPE_HEL, answer, answer_length);
+    Game *game = match_backend->match(&accepted, mux->shard);
+    if (game == NULL) {
+        reject_client(&accepted);
+        session_close_stream(mux->session, stream);
+        return;
+    }
+    struct ClientConnection *connection = new_client_connection(&accepted, game, false);
+    if (connection == NULL) {
+        leave_game(accepted.acceptedSocketFD, game);
+        session_close_stream(mux->session, stream);
+        return;
+    }
+    connection->multiplexed = true;
+    connection->stream = stream;
+    mux->streams[mux->stream_count++] = connection;
+    send_frame(connection->session, connection->encoding, MESSAGE_TYPE_FLG, DIR_REQUEST, strlen(DIR_REQUEST));
+}
+
+/**
+ * Receives one record of a multiplexed connection and routes it to its stream
+ * Args:
+ *   mux: Multiplexer whose socket is readable
+ * Operation:
+ *   - An empty record closes its stream, a record for an unknown stream opens one
+ *   - Everything else is handled like a single client's message, a finished game closes the stream
+ * Returns:
+ *   Boolean indicating the connection is still usable
+ */
+static bool handle_multiplexed_record(struct Multiplexer *mux) {
+    // Shared by every stream, one record is handled at a time
+    arena_reset(&mux->arena);
+    char *buffer = arena_alloc(&mux->arena, FRAME_MAX_SIZE);
+    FrameView *frame = arena_alloc(&mux->arena, sizeof(FrameView));
+    if (buffer == NULL || frame == NULL) {
+        return false;
+    }
+    uint32_t stream;
+    const ssize_t amountReceived = session_recv_stream(mux->session, buffer, FRAME_MAX_SIZE - NULL_CHAR_LEN,
+                                                       &stream);
+    if (amountReceived < CHECK_RECEIVE) {
+        return false;
+    }
+    const int index = find_stream(mux, stream);
+    if (amountReceived == CHECK_RECEIVE) {
+        if (index != NO_STREAM) {
+            close_stream(mux, (unsigned int) index, false);
+        }
+    } else if (index == NO_STREAM) {
+        open_stream(mux, stream, buffer, (size_t) amountReceived, frame);
+    } else if (handle_client_frame(mux->streams[index], buffer, (size_t) amountReceived, frame)) {
+        close_stream(mux, (unsigned int) index, true);
+    }
+    return true;
+}
+
+/**
+ * Finds the listener a registry belongs to
+ * Args:
+ *   registry: Registry of one of the listeners
+ * Returns:
+ *   Listener index, FIRST_LISTENER if none matches
+ */
+static unsigned int registry_shard(const GameRegistry *registry) {
+    for (unsigned int i = 0; i < listener_count; i++) {
+        if (&listeners[i].registry == registry) {
+            return i;
+        }
+    }
+    return FIRST_LISTENER;
+}
+
+/**
+ * Serves every stream of a connection that agreed FRAME_CAPABILITY_MULTIPLEX
+ * Args:
+ *   primary: Connection whose HEL turned streams on, becomes stream CRYPTO_SESSION_PRIMARY_STREAM
+ * Operation:
+ *   - Polls the socket, shutdown_event and the stop event of every open stream's game
+ *   - Closes streams whose game ended and tells the client, the connection stays up for new ones
+ *   - Ends once the client disconnects or the server shuts down, leaving every game still open
+ * Returns: void
+ */
+static void run_multiplexer(struct ClientConnection *primary) {
+    struct Multiplexer mux = {0};
+    mux.session = crypto_session_retain(primary->session);
+    mux.socketFD = crypto_session_socket(mux.session);
+    mux.capabilities = primary->capabilities & ~FRAME_CAPABILITY_MULTIPLEX;
+    mux.shard = registry_shard(primary->game->registry);
+    // The primary may finish long before the connection, the buffer stays with the multiplexer
+    mux.arena = primary->arena;
+    memset(&primary->arena, NULL_CHAR, sizeof(primary->arena));
+    primary->multiplexed = true;
+    primary->stream = CRYPTO_SESSION_PRIMARY_STREAM;
+    mux.streams[mux.stream_count++] = primary;
+    struct pollfd waits[MULTIPLEX_POLL_COUNT];
+    while (!stop_all_games) {
+        waits[SOCKET_POLL_INDEX] = (struct pollfd) {.fd = mux.socketFD, .events = POLLIN};
+        waits[MULTIPLEX_SHUTDOWN_POLL_INDEX] = (struct pollfd) {.fd = shutdown_event, .events = POLLIN};
+        for (unsigned int i = 0; i < mux.stream_count; i++) {
+            waits[MULTIPLEX_STREAM_POLL_BASE + i] = (struct pollfd) {
+                .fd = mux.streams[i]->game->stop_event, .events = POLLIN
+            };
+        }
+        const unsigned int wait_count = MULTIPLEX_STREAM_POLL_BASE + mux.stream_count;
+        if (poll(waits, wait_count, POLL_WAIT_FOREVER) == POLL_ERROR) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        if (waits[MULTIPLEX_SHUTDOWN_POLL_INDEX].revents) {
+            break;
+        }
+        // Backwards, close_stream moves the last stream into the freed entry
+        for (unsigned int i = mux.stream_count; i > 0; i--) {
+            if (waits[MULTIPLEX_STREAM_POLL_BASE + i - 1].revents) {
+                close_stream(&mux, i - 1, true);
+            }
+        }
+        if (waits[SOCKET_POLL_INDEX].revents && !handle_multiplexed_record(&mux)) {
+            break;
+        }
+    }
+    while (mux.stream_count > 0) {
+        close_stream(&mux, mux.stream_count - 1, false);
+    }
+    arena_destroy(&mux.arena);
+    crypto_session_destroy(mux.session);
+}
+
+/**
+ * Main client message handling thread function
+ * Args:
+ *   arg: Pointer to ClientConnection with socket FD, session and game info
+ * Operation:
+ *   - Handles client messaging in a loop
+ *   - Processes commands and flags
+ *   - Routes messages between clients
+ * Returns: NULL on completion
+ */
+void *handle_single_client(void *arg) {
+    pthread_detach(pthread_self());
+    struct ClientConnection *connection = arg;
+    const int clientSocketFD = connection->socketFD;
+    Game *game = connection->game;
+    // Built once, poll has no FD_SETSIZE ceiling
+    struct pollfd waits[HANDLER_POLL_COUNT] = {
+        [SOCKET_POLL_INDEX] = {.fd = clientSocketFD, .events = POLLIN},
+        [STOP_POLL_INDEX] = {.fd = game->stop_event, .events = POLLIN},
+        [SHUTDOWN_POLL_INDEX] = {.fd = shutdown_event, .events = POLLIN}
+    };
+    send_frame(connection->session, connection->encoding, MESSAGE_TYPE_FLG, DIR_REQUEST, strlen(DIR_REQUEST));
+    while (!stop_all_games && !atomic_load(&game->stop_game)) {
+        const int ret = poll(waits, HANDLER_POLL_COUNT, POLL_WAIT_FOREVER);
+        if (ret == POLL_ERROR) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        // Game stopped or server shutting down
+        if (waits[STOP_POLL_INDEX].revents || waits[SHUTDOWN_POLL_INDEX].revents) {
+            break;
+        }
+        if (waits[SOCKET_POLL_INDEX].revents) {
+            if (handle_client_messages(connection))
+                break;
+            if (connection->capabilities & FRAME_CAPABILITY_MULTIPLEX) {
+                // From here on this thread reads the connection for every game on it
+                run_multiplexer(connection);
+                log_write(LOG_LEVEL_INFO, "\033[1;31;47mThread %lu has successfully exited.\033[0m\n", pthread_self());
+                return NULL;
+            }
+        }
+    }
+    free_client_connection(connection);
+    thread_exit(clientSocketFD, game);
+    log_write(LOG_LEVEL_INFO, "\033[1;31;47mThread %lu has successfully exited.\033[0m\n", pthread_self());
+    return NULL;
+}
+
+/**
+ * Handles client thread termination and cleanup
+ * Args:
+ *   clientSocketFD: Client's socket file descriptor
+ *   game: Pointer to associated game instance
+ * Operation:
+ *   - Notifies other clients of disconnection
+ *   - Drops the client's reference on the game
+ *   - Signals game termination through the game's stop eventfd
+ *   - Shuts the socket down, the last client to leave closes the sockets with the game slot
+ *   - Updates global client count, waking shutdown at zero
+ * Returns: void
+ */
+void thread_exit(const int clientSocketFD, Game *game) {
+    // The descriptor stays allocated until release, a lock-free relay still holding it must not hit a reused fd
+    shutdown(clientSocketFD, SHUT_RDWR);
+    leave_game(clientSocketFD, game);
+}
+
+/**
+ * Drops a client's reference on its game without touching its socket
+ * Args:
+ *   clientSocketFD: Client's identity in game_clients
+ *   game: Pointer to associated game instance
+ * Operation:
+ *   - Notifies other clients of disconnection
+ *   - Drops the client's reference on the game, the last one releases it
+ *   - Signals game termination through the game's stop eventfd
+ *   - Updates global client count, waking shutdown at zero
+ * Returns: void
+ */
+void leave_game(const int clientSocketFD, Game *game) {
+    //send disconnect message and remove accepted socket from array
+    if (!stop_all_games) {
+        sendMessageToTheOtherClients(MESSAGE_TYPE_ERR, SECOND_CLIENT_DISCONNECTED, clientSocketFD, game);
+    }
+    pthread_mutex_lock(&game->game_mutex);
+    // Wake the other handler threads of the game
+    if (game->stop_event != NO_STOP_EVENT) {
+        const uint64_t stop = STOP_EVENT_VALUE;
+        write(game->stop_event, &stop, sizeof(stop));
+    }
+    atomic_store(&game->stop_game, true);
+    // acceptedSocketsCount is the game's reference count, nobody else can reach a game at zero
+    const bool released = atomic_load(&game->acceptedSocketsCount) > 0 &&
+                          atomic_fetch_sub(&game->acceptedSocketsCount, 1) == 1;
+    const unsigned int slot = game->slot;
+    if (released) {
+        release_game_slot(game->registry, game);
+    }
+    pthread_mutex_unlock(&game->game_mutex);
+    if (released) {
+        log_write(LOG_LEVEL_INFO, "\033[1;30;42mGame %u resources have been released.\033[0m\n", slot);
+    }
+    metrics_add(METRIC_CONNECTIONS_CLOSED, 1);
+    pthread_mutex_lock(&globals_mutex);
+    if (--accepted_clients_count == 0) {
+        pthread_cond_broadcast(&clients_finished);
+    }
+    pthread_mutex_unlock(&globals_mutex);
+}
+
+/**
+ * Processes incoming client messages and manages game state
+ * Args:
+ *   connection: Per-connection state (socket, session, game, flag/key progress)
+ * Operation:
+ *   - Receives client messages
+ *   - Handles flag operations and validation
+ *   - Processes game messages
+ * Returns:
+ *   Boolean indicating if client handling should terminate
+ */
+bool handle_client_messages(struct ClientConnection *connection) {
+    // The previous message is done with, its buffer and view are reused for this one
+    arena_reset(&connection->arena);
+    char *buffer = arena_alloc(&connection->arena, FRAME_MAX_SIZE);
+    FrameView *frame = arena_alloc(&connection->arena, sizeof(FrameView));
+    if (buffer == NULL || frame == NULL) {
+        return true;
+    }
+    // Receive data from client, keep room for the terminator
+    const ssize_t amountReceived = session_recv(connection->session, buffer, FRAME_MAX_SIZE - NULL_CHAR_LEN);
+    // Exit if connection closed
+    if (amountReceived <= CHECK_RECEIVE) {
+        return true;
+    }
+    return handle_client_frame(connection, buffer, (size_t) amountReceived, frame);
+}
+
+/**
+ * Handles one received message of a client
+ * Args:
+ *   connection: Per-connection state (socket, session, game, flag/key progress)
+ *   buffer: Message, one byte of room after it for the terminator
+ *   length: Message length
+ *   frame: View storage for the parsed message
+ * Operation:
+ *   - Handles flag operations and validation
+ *   - Processes game messages
+ * Returns:
+ *   Boolean indicating if client handling should terminate
+ */
+bool handle_client_frame(struct ClientConnection *connection, char *buffer, const size_t length, FrameView *frame) {
+    const int clientSocketFD = connection->socketFD;
+    CryptoSession *session = connection->session;
+    Game *game = connection->game;
+    const uint64_t handling_started = metrics_now_ns();
+    metrics_add(METRIC_MESSAGES_RECEIVED, 1);
+    metrics_add(METRIC_BYTES_IN, (uint64_t) length);
+    // Null terminate received message
+    buffer[length] = NULL_CHAR;
+    // Log received message, queued for the log writer and dropped past the rate limit
+    log_write(LOG_LEVEL_DEBUG, "%s\n", buffer);
+    // Tokenize once, every handler below works on the view
+    const FrameView *view = parse_frame(buffer, length, frame) ? frame : NULL;
+    const FrameEncoding encoding = connection->encoding;
+    if (view != NULL && view->segments[FIRST_SEGMENT].type == MESSAGE_TYPE_HEL) {
+        // Capability answer until the session is sealed, never relayed, a stream's capabilities are fixed on open
+        if (view->segment_count == SINGLE_SEGMENT && !connection->multiplexed &&
+            !(connection->capabilities & FRAME_CAPABILITY_AEAD)) {
+            handle_client_hello(connection, &view->segments[FIRST_SEGMENT]);
+        }
+    } else if (view != NULL && view->segments[FIRST_SEGMENT].type == MESSAGE_TYPE_PRV &&
+               connection->capabilities & FRAME_CAPABILITY_PROVISION &&
+               !(connection->key_okay_response && connection->key_request_dir)) {
+        if (!handle_client_provision(connection, &view->segments[FIRST_SEGMENT])) {
+            return true;
+        }
+        if (connection->flag_okay_response) {
+            publish_client_flag(connection);
+        }
+    } else if (!(connection->flag_okay_response && connection->flag_request_dir)) {
+        if (!handle_client_flag(view, &connection->flag_file_tries, clientSocketFD, session, encoding,
+                                &connection->flag_okay_response, &connection->flag_request_dir, game)) {
+            return true;
+        }
+        if (connection->flag_okay_response && connection->flag_request_dir) {
+            publish_client_flag(connection);
+        }
+    } else if (!(connection->key_okay_response && connection->key_request_dir)) {
+        if (!handle_client_key(view, &connection->key_file_tries, clientSocketFD, session, encoding,
+                               &connection->key_okay_response, &connection->key_request_dir, game)) {
+            return true;
+        }
+    } else {
+        //deal with client message and make an ideal response, never clearing a stop set by the opponent
+        if (generate_message_for_clients(clientSocketFD, session, encoding, connection->capabilities, view,
+                                         game)) {
+            atomic_store(&game->stop_game, true);
+        }
+    }
+    metrics_observe_since(HISTOGRAM_MESSAGE, handling_started);
+    // Exit if server stopping or the game ended
+    return stop_all_games || atomic_load(&game->stop_game);
+}
+
+/**
+ * Routes messages between connected clients in a game
+ * Args:
+ *   segments: Message segments to send
+ *   count: Number of segments
+ *   socketFD: Sender's socket FD (excluded from receiving)
+ *   game: Pointer to Game struct for message routing
+ * Operation:
+ *   - Lock-free broadcasting to the published game clients
+ *   - Encodes once per receiver in the framing that receiver negotiated
+ *   - Relays output fragments as they arrive, flattened to OUT for receivers without streaming
+ *   - Drops types whose registry capability the receiver lacks, CAN without cancel and DEC without decrypt
+ *   - Queues and flushes, a receiver that is already being written to takes the frame along
+ * Returns: void
+ */
+void sendReceivedMessageToTheOtherClients(const FrameSegment *segments, const unsigned int count, const int socketFD,
+                                          Game *game) {
+    // Published entries keep their socket and session until release, which waits for this thread to exit
+    const unsigned int joined = atomic_load_explicit(&game->joined_clients, memory_order_acquire);
+    // CAN and DEC travel alone, so the first segment's registry entry covers the frame
+    const unsigned int required = message_type_info(segments[FIRST_SEGMENT].type)->capability;
+    for (unsigned int i = 0; i < joined; i++) {
+        const struct AcceptedSocket *peer = &game->game_clients[i];
+        // Skip sender's socket
+        if (peer->acceptedSocketFD == socketFD) {
+            continue;
+        }
+        const unsigned int capabilities = atomic_load(&game->players[i].capabilities);
+        const FrameEncoding encoding = capabilities & FRAME_CAPABILITY_BINARY ? FRAME_ENCODING_BINARY
+                                                                              : FRAME_ENCODING_TEXT;
+        // Clients that run commands synchronously have nothing to cancel, and only clients that decrypt in
+        // process know DEC, the sender falls back to openssl commands on its own
+        if ((capabilities & required) != required) {
+            continue;
+        }
+        const FrameSegment *outgoing = segments;
+        unsigned int outgoing_count = count;
+        // Clients without streaming get every output fragment as a plain OUT message
+        FrameSegment flattened[FRAME_MAX_SEGMENTS];
+        if (!(capabilities & FRAME_CAPABILITY_STREAMING)) {
+            outgoing_count = flatten_output_fragments(segments, count, flattened);
+            outgoing = flattened;
+        }
+        // Text peers cannot take frames above FRAME_TEXT_MAX_SIZE
+        const uint64_t relay_started = metrics_now_ns();
+        if (outgoing_count > 0 && queue_frame_segments(peer->session, encoding, outgoing, outgoing_count)) {
+            session_flush(peer->session);
+            metrics_add(METRIC_MESSAGES_RELAYED, 1);
+            metrics_add(METRIC_BYTES_OUT, frame_encoded_length(encoding, outgoing, outgoing_count));
+            metrics_observe_since(HISTOGRAM_RELAY, relay_started);
+        }
+    }
+}
+
+/**
+ * Sends a single text message to the other clients of a game
+ * Args:
+ *   type: Message type
+ *   text: NUL terminated payload
+ *   socketFD: Sender's socket FD (excluded from receiving)
+ *   game: Pointer to Game struct for message routing
+ * Returns: void
+ */
+void sendMessageToTheOtherClients(const MessageType type, const char *text, const int socketFD, Game *game) {
+    FrameSegment segment;
+    frame_segment_init(&segment, type, text, strlen(text));
+    record_relay(&segment, SINGLE_SEGMENT, socketFD, game, true);
+    sendReceivedMessageToTheOtherClients(&segment, SINGLE_SEGMENT, socketFD, game);
+}
+
+/**
+ * Records a relayed frame in the replay log
+ * Args:
+ *   segments: Relayed segments
+ *   count: Number of segments
+ *   socketFD: Sender's socket FD
+ *   game: Game the frame was relayed in
+ *   from_server: The server wrote the text, the sender only triggered it
+ * Operation:
+ *   The sender's index in game_clients is the recorded direction
+ * Returns: void
+ */
+void record_relay(const FrameSegment *segments, const unsigned int count, const int socketFD, Game *game,
+                  const bool from_server) {
+    if (!replay_log_enabled()) {
+        return;
+    }
+    unsigned int direction = REPLAY_FROM_SERVER;
+    const unsigned int joined = atomic_load_explicit(&game->joined_clients, memory_order_acquire);
+    for (unsigned int i = 0; !from_server && i < joined; i++) {
+        if (game->game_clients[i].acceptedSocketFD == socketFD) {
+            direction = i;
+        }
+    }
+    replay_log_record(game->match_id, direction, segments, count);
+}
+
+/**
+ * Applies a client's HEL answer
+ * Args:
+ *   connection: Connection that sent the answer
+ *   hello: HEL segment with the accepted capability mask
+ * Operation:
+ *   - Switches replies and relayed messages to binary frames when accepted
+ *   - Records whether streamed OFR output may be relayed to the client
+ *   - Updates the game's copy used by the opponent's relay
+ *   - Moves both directions of the session to AEAD records when accepted
+ *   - Turns on stream headers when FRAME_CAPABILITY_MULTIPLEX was accepted with AEAD and binary frames
+ * Returns: void
+ */
+void handle_client_hello(struct ClientConnection *connection, const FrameSegment *hello) {
+    connection->capabilities = frame_capabilities(hello) & offered_capabilities();
+    // Stream headers live inside sealed records, and streams are opened with binary HEL frames
+    if ((connection->capabilities & FRAME_MULTIPLEX_REQUIRED) != FRAME_MULTIPLEX_REQUIRED ||
+        (connection->capabilities & FRAME_CAPABILITY_MULTIPLEX &&
+         !crypto_session_enable_streams(connection->session, true))) {
+        connection->capabilities &= ~FRAME_CAPABILITY_MULTIPLEX;
+    }
+    connection->encoding = connection->capabilities & FRAME_CAPABILITY_BINARY
+                               ? FRAME_ENCODING_BINARY
+                               : FRAME_ENCODING_TEXT;
+    atomic_store(&connection->game->players[connection->player].capabilities, connection->capabilities);
+    if (connection->capabilities & FRAME_CAPABILITY_AEAD) {
+        // The client sealed its side right after the answer, confirm with a last s_send frame and seal ours
+        char answer[CAPABILITY_OFFER_SIZE];
+        const int answer_length = snprintf(answer, sizeof(answer), "%u", connection->capabilities);
+        session_seal_receive(connection->session);
+        send_frame_and_seal(connection->session, connection->encoding, MESSAGE_TYPE_HEL, answer, answer_length);
+    }
+}
+
+/**
+ * Lists the capabilities offered in HEL
+ * Operation:
+ *   FRAME_CAPABILITY_MULTIPLEX only in thread-per-client mode, a multiplexed
+ *   connection is served by one thread that waits on all of its games
+ * Returns:
+ *   FRAME_CAPABILITY_* bits
+ */
+unsigned int offered_capabilities() {
+    return reactor_count == THREAD_PER_CLIENT_MODE ? FRAME_SUPPORTED_CAPABILITIES | FRAME_CAPABILITY_MULTIPLEX
+                                                   : FRAME_SUPPORTED_CAPABILITIES;
+}
+
+/**
+ * Runs the key exchange for an accepted connection
+ * Args:
+ *   pending: Accepted socket and its peer address
+ * Operation:
+ *   - Bounds the exchange with SO_RCVTIMEO/SO_SNDTIMEO
+ *   - Performs recv_send_key and clears the timeouts afterwards
+ * Returns:
+ *   AcceptedSocket struct with client details and status
+ */
+struct AcceptedSocket acceptIncomingConnection(const struct PendingConnection *pending) {
+    // Initialize socket structure
+    struct AcceptedSocket acceptedSocket = {NULL_CHAR};
+    // Set socket information
+    acceptedSocket.address = pending->address;
+    acceptedSocket.acceptedSocketFD = pending->socketFD;
+    acceptedSocket.acceptedSuccessfully = true;
+    acceptedSocket.error = ACCEPTED_SUCCESSFULLY;
+    memset(acceptedSocket.flag_digest, 0, sizeof(acceptedSocket.flag_digest));
+    memset(acceptedSocket.flag_dir, NULL_CHAR, sizeof(acceptedSocket.flag_dir));
+    // A stalled or malicious peer can only hold this worker for the timeout
+    struct timeval timeout = {HANDSHAKE_TIMEOUT_SECONDS, TIMEOUT_USECONDS};
+    setsockopt(acceptedSocket.acceptedSocketFD, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(acceptedSocket.acceptedSocketFD, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    size_t key_len; // Only used during initialization
+    unsigned char *encryption_key = recv_send_key(acceptedSocket.acceptedSocketFD, &key_len);
+    // The session keeps its own copy and sets up the cipher contexts once
+    acceptedSocket.session = crypto_session_create(acceptedSocket.acceptedSocketFD, encryption_key, key_len,
+                                                   CRYPTO_ROLE_SERVER);
+    if (encryption_key != NULL) {
+        OPENSSL_cleanse(encryption_key, key_len);
+        free(encryption_key);
+    }
+    if (acceptedSocket.session == NULL) {
+        acceptedSocket.acceptedSuccessfully = false;
+        close(acceptedSocket.acceptedSocketFD);
+        return acceptedSocket;
+    }
+    // Offer binary framing, streaming and AEAD records, clients that do not know HEL ignore it
+    acceptedSocket.encoding = FRAME_ENCODING_TEXT;
+    char offer[CAPABILITY_OFFER_SIZE];
+    const int offer_length = snprintf(offer, sizeof(offer), "%u", offered_capabilities());
+    send_frame(acceptedSocket.session, acceptedSocket.encoding, MESSAGE_TYPE_HEL, offer, offer_length);
+    const struct timeval no_timeout = {0, 0};
+    setsockopt(acceptedSocket.acceptedSocketFD, SOL_SOCKET, SO_RCVTIMEO, &no_timeout, sizeof(no_timeout));
+    setsockopt(acceptedSocket.acceptedSocketFD, SOL_SOCKET, SO_SNDTIMEO, &no_timeout, sizeof(no_timeout));
+    return acceptedSocket;
+}
+
+/**
+ * Validates incoming client messages
+ * Args:
+ *   view: Parsed frame to check
+ * Operation:
+ *   - Applies the registry rules: no setup types in the relay phase, CAN and DEC on their own,
+ *     no NUL in CMD and DEC data
+ *   - Validates command data if CMD type
+ * Returns:
+ *   Boolean indicating message validity
+ */
+int check_message_received(const FrameView *view) {
+    for (unsigned int i = 0; i < view->segment_count; i++) {
+        const FrameSegment *segment = &view->segments[i];
+        const unsigned int rules = message_type_info(segment->type)->rules;
+        if (rules & MESSAGE_RULE_SETUP_ONLY) {
+            return false;
+        }
+        if (rules & MESSAGE_RULE_STANDALONE && view->segment_count != SINGLE_SEGMENT) {
+            return false;
+        }
+        if (rules & MESSAGE_RULE_NO_NUL && memchr(segment->data, NULL_CHAR, segment->length) != NULL) {
+            return false;
+        }
+        // Validate command data, only the last segment is NUL terminated by the receive buffer
+        if (segment->type == MESSAGE_TYPE_CMD &&
+            (i != view->segment_count - 1 || !command_filter_allows(segment->data, segment->length))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Checks game winning condition
+ * Args:
+ *   clientSocketFD: Client's socket FD
+ *   view: Parsed frame
+ *   game: Game instance pointer
+ * Operation:
+ *   - Hashes the guess once
+ *   - Compares it in constant time against the published flag digests of the other clients, without game_mutex
+ * Returns:
+ *   Boolean indicating win
+ */
+bool check_winner(const int clientSocketFD, const FrameView *view, Game *game) {
+    const FrameSegment *guess = &view->segments[FIRST_SEGMENT];
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256((const unsigned char *) guess->data, guess->length, digest);
+    bool won = false;
+    const unsigned int joined = atomic_load_explicit(&game->joined_clients, memory_order_acquire);
+    for (unsigned int i = 0; i < joined; i++) {
+        // flag_digest is final once flag_ready is set, the acquire load orders the read after it
+        if (game->game_clients[i].acceptedSocketFD != clientSocketFD &&
+            atomic_load_explicit(&game->players[i].flag_ready, memory_order_acquire) &&
+            CRYPTO_memcmp(digest, game->game_clients[i].flag_digest, sizeof(digest)) == DIGEST_EQUAL) {
+            won = true;
+        }
+    }
+    return won;
+}
+
+/**
+ * Makes a client's confirmed flag visible to its opponent's check_winner
+ * Args:
+ *   connection: Connection whose flag phase just completed
+ * Operation:
+ *   Release store, flag_digest is never written again afterwards
+ * Returns: void
+ */
+void publish_client_flag(const struct ClientConnection *connection) {
+    atomic_store_explicit(&connection->game->players[connection->player].flag_ready, true, memory_order_release);
+}
+
+/**
+ * Checks that every opponent takes DEC messages
+ * Args:
+ *   clientSocketFD: Sender's socket FD
+ *   game: Game instance pointer
+ * Returns:
+ *   Boolean indicating all joined opponents agreed FRAME_CAPABILITY_DECRYPT
+ */
+static bool opponents_decrypt(const int clientSocketFD, Game *game) {
+    const unsigned int joined = atomic_load_explicit(&game->joined_clients, memory_order_acquire);
+    for (unsigned int i = 0; i < joined; i++) {
+        if (game->game_clients[i].acceptedSocketFD != clientSocketFD &&
+            !(atomic_load(&game->players[i].capabilities) & FRAME_CAPABILITY_DECRYPT)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Processes and routes client messages
+ * Args:
+ *   clientSocketFD: Client's socket FD
+ *   encoding: Framing negotiated with the client
+ *   capabilities: FRAME_CAPABILITY_* bits agreed with the client
+ *   view: Parsed frame, NULL if it did not parse
+ *   game: Game instance pointer
+ * Operation:
+ *   - Handles game state messages
+ *   - Checks win conditions on SUB guesses, or on every message of clients without FRAME_CAPABILITY_SUBMIT
+ *   - Answers DEC with an error when the opponent cannot decrypt in process
+ *   - Routes valid messages, re-encoded for the receiver
+ * Returns: Boolean indicating if game should end
+ */
+int generate_message_for_clients(const int clientSocketFD, CryptoSession *session, const FrameEncoding encoding,
+                                 const unsigned int capabilities, const FrameView *view, Game *game) {
+    if (atomic_load(&game->acceptedSocketsCount) < MAX_CLIENTS) {
+        //are there not 2 clients connected?
+        send_frame(session, encoding, MESSAGE_TYPE_ERR, WAIT_CLIENT, strlen(WAIT_CLIENT));
+    } else {
+        const bool guess = view != NULL && view->segments[FIRST_SEGMENT].type == MESSAGE_TYPE_SUB;
+        // Commands of clients that submit flags in SUB messages are relayed without hashing them
+        if ((guess || (view != NULL && !(capabilities & FRAME_CAPABILITY_SUBMIT))) &&
+            check_winner(clientSocketFD, view, game)) {
+            metrics_add(METRIC_WINS, 1);
+            send_frame(session, encoding, MESSAGE_TYPE_OUT, WIN_MSG, strlen(WIN_MSG));
+            sendMessageToTheOtherClients(MESSAGE_TYPE_OUT, LOSE_MSG, clientSocketFD, game);
+            return true;
+        }
+        if (guess) {
+            send_frame(session, encoding, MESSAGE_TYPE_ERR, WRONG_FLAG, strlen(WRONG_FLAG));
+        } else if (view != NULL && view->segments[FIRST_SEGMENT].type == MESSAGE_TYPE_DEC &&
+                   !opponents_decrypt(clientSocketFD, game)) {
+            send_frame(session, encoding, MESSAGE_TYPE_ERR, DECRYPT_UNSUPPORTED, strlen(DECRYPT_UNSUPPORTED));
+        } else if (view != NULL && check_message_received(view)) {
+            record_relay(view->segments, view->segment_count, clientSocketFD, game, false);
+            sendReceivedMessageToTheOtherClients(view->segments, view->segment_count, clientSocketFD, game);
+        } else {
+            send_frame(session, encoding, MESSAGE_TYPE_ERR, INVALID_DATA, strlen(INVALID_DATA));
+        }
+    }
+    return false;
+}
+
+/**
+ * Creates flag file for client
+ * Args:
+ *   directory: Directory path segment sent by the client
+ *   clientSocketFD: Client's socket FD
+ *   encoding: Framing negotiated with the client
+ *   game: Game instance pointer
+ * Operation:
+ *   - Generates random flag data
+ *   - Creates flag file
+ * Returns: Status code
+ */
+int generate_client_flag(const FrameSegment *directory, const int clientSocketFD,
+                         CryptoSession *session, const FrameEncoding encoding, Game *game) {
+    char flag_command[FLAG_COMMAND_SIZE] = {NULL_CHAR};
+    char random_str[FLAG_DATA_SIZE] = {NULL_CHAR};
+    if (directory->length >= sizeof(game->game_clients[FIRST_CLIENT_INDEX].flag_dir)) {
+        return false;
+    }
+    generate_random_string(random_str, FLAG_DATA_SIZE - NULL_CHAR_LEN);
+    if (snprintf(flag_command, sizeof(flag_command),
+                 "echo '%s' > %.*s/flag.txt",
+                 random_str, (int) directory->length, directory->data) < sizeof(flag_command)) {
+        if (send_frame(session, encoding, MESSAGE_TYPE_FLG, flag_command, strlen(flag_command))) {
+            // Only this client's handler writes its entry, the opponent reads it after publish_client_flag
+            const unsigned int joined = atomic_load_explicit(&game->joined_clients, memory_order_acquire);
+            for (unsigned int i = 0; i < joined; i++) {
+                if (game->game_clients[i].acceptedSocketFD == clientSocketFD) {
+                    SHA256((const unsigned char *) random_str, strlen(random_str),
+                           game->game_clients[i].flag_digest);
+                    memcpy(game->game_clients[i].flag_dir, directory->data, directory->length);
+                    game->game_clients[i].flag_dir[directory->length] = NULL_CHAR;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Processes client flag operations
+ * Args:
+ *   view: Parsed frame
+ *   flag_file_tries: Pointer to attempts counter
+ *   clientSocketFD: Client socket FD
+ *   encoding: Framing negotiated with the client
+ *   flag_okay_response: Flag status pointer
+ *   flag_request_dir: Directory request status pointer
+ *   game: Game instance pointer
+ * Operation:
+ *   - Validates flag operations
+ *   - Handles flag file creation
+ *   - Tracks attempts
+ * Returns: Operation status
+ */
+int handle_client_flag(const FrameView *view, unsigned int *flag_file_tries, const int clientSocketFD,
+                       CryptoSession *session, const FrameEncoding encoding,
+                       bool *flag_okay_response,
+                       bool *flag_request_dir, Game *game) {
+    if (*flag_file_tries >= atomic_load(&flag_file_tries_limit)) {
+        return false;
+    }
+    if (view == NULL) {
+        return false;
+    }
+    const FrameSegment *segment = &view->segments[FIRST_SEGMENT];
+    if (segment->type != MESSAGE_TYPE_FLG) {
+        return true;
+    }
+    if (frame_data_equals(segment, "error")) {
+        *flag_okay_response = false;
+        *flag_request_dir = false;
+    } else {
+        // Single segment frames end at the NUL terminated buffer end
+        if (view->segment_count == SINGLE_SEGMENT && !command_filter_banned(segment->data, segment->length) &&
+            !*flag_request_dir) {
+            *flag_request_dir = generate_client_flag(segment, clientSocketFD, session, encoding, game);
+            return true;
+        }
+        if (*flag_request_dir) {
+            if (frame_data_equals(segment, "okay")) {
+                *flag_okay_response = true;
+                //once flag is set can ask for key
+                send_frame(session, encoding, MESSAGE_TYPE_KEY, KEY_REQUEST, strlen(KEY_REQUEST));
+                return true;
+            }
+        }
+    }
+    if (*flag_request_dir == false) {
+        send_frame(session, encoding, MESSAGE_TYPE_FLG, DIR_REQUEST, strlen(DIR_REQUEST));
+        *flag_file_tries += 1;
+    }
+    return true;
+}
+
+/**
+ * Processes client flag operations
+ * Args:
+ *   view: Parsed frame
+ *   key_file_tries: Pointer to attempts counter
+ *   clientSocketFD: Client socket FD
+ *   encoding: Framing negotiated with the client
+ *   key_okay_response: Flag status pointer
+ *   key_request_dir: Directory request status pointer
+ *   game: Game instance pointer
+ * Operation:
+ *   - Validates key operations
+ *   - Handles key file creation
+ *   - Tracks attempts
+ * Returns: Operation status
+ */
+bool handle_client_key(const FrameView *view, unsigned int *key_file_tries, const int clientSocketFD,
+                       CryptoSession *session, const FrameEncoding encoding,
+                       bool *key_okay_response,
+                       bool *key_request_dir, Game *game) {
+    if (*key_file_tries >= atomic_load(&flag_file_tries_limit)) {
+        return false;
+    }
+    if (view == NULL) {
+        return false;
+    }
+    const FrameSegment *segment = &view->segments[FIRST_SEGMENT];
+    if (segment->type != MESSAGE_TYPE_KEY) {
+        return true;
+    }
+    if (frame_data_equals(segment, "error")) {
+        *key_okay_response = false;
+        *key_request_dir = false;
+    } else {
+        // Single segment frames end at the NUL terminated buffer end
+        if (view->segment_count == SINGLE_SEGMENT && !command_filter_banned(segment->data, segment->length) &&
+            !*key_request_dir) {
+            *key_request_dir = generate_client_key(segment, clientSocketFD, session, encoding, game);
+            return true;
+        }
+        if (*key_request_dir) {
+            if (frame_data_equals(segment, "okay")) {
+                *key_okay_response = true;
+                return true;
+            }
+        }
+    }
+    if (*key_request_dir == false) {
+        send_frame(session, encoding, MESSAGE_TYPE_FLG, DIR_REQUEST, strlen(DIR_REQUEST));
+        *key_file_tries += 1;
+    }
+    return true;
+}
+
+/**
+ * Generates both game files natively and sends them in one PRV message
+ * Args:
+ *   directories: Decoded PRV request with the flag and key directories
+ *   clientSocketFD: Client's socket FD
+ *   encoding: Framing negotiated with the client
+ *   game: Game instance pointer
+ * Operation:
+ *   - Takes a pregenerated flag, key, method and encrypted flag.txt from the pool
+ *   - No shell or openssl enc on the client, no PBKDF2 on this thread on a pool hit
+ *   - Records the flag for check_winner
+ * Returns:
+ *   Boolean indicating the files were sent
+ */
+bool generate_client_provision(const Provision *directories, const int clientSocketFD, CryptoSession *session,
+                               const FrameEncoding encoding, Game *game) {
+    const FrameSegment *flag_dir = &directories->first;
+    if (flag_dir->length == 0 || directories->second.length == 0 ||
+        flag_dir->length >= sizeof(game->game_clients[FIRST_CLIENT_INDEX].flag_dir)) {
+        return false;
+    }
+    ProvisionMaterial material;
+    char payload[PROVISION_PAYLOAD_SIZE];
+    if (!provision_pool_take(&material)) {
+        return false;
+    }
+    const size_t payload_length = write_provision(payload, sizeof(payload), material.key_file,
+                                                  material.key_file_length, (const char *) material.flag_file,
+                                                  material.flag_file_length);
+    const bool sent = payload_length > 0 && send_frame(session, encoding, MESSAGE_TYPE_PRV, payload, payload_length);
+    OPENSSL_cleanse(material.key, sizeof(material.key));
+    if (!sent) {
+        OPENSSL_cleanse(material.flag_data, sizeof(material.flag_data));
+        return false;
+    }
+    // Only this client's handler writes its entry, the opponent reads it after publish_client_flag
+    const unsigned int joined = atomic_load_explicit(&game->joined_clients, memory_order_acquire);
+    for (unsigned int i = 0; i < joined; i++) {
+        if (game->game_clients[i].acceptedSocketFD == clientSocketFD) {
+            SHA256((const unsigned char *) material.flag_data, strlen(material.flag_data),
+                   game->game_clients[i].flag_digest);
+            memcpy(game->game_clients[i].flag_dir, flag_dir->data, flag_dir->length);
+            game->game_clients[i].flag_dir[flag_dir->length] = NULL_CHAR;
+        }
+    }
+    OPENSSL_cleanse(material.flag_data, sizeof(material.flag_data));
+    return true;
+}
+
+/**
+ * Processes the one round trip flag and key setup of PRV capable clients
+ * Args:
+ *   connection: Per-connection state, both setup phases complete together
+ *   segment: First PRV segment of the frame
+ * Operation:
+ *   - Answers a directory request with the provisioned files
+ *   - Completes the flag and key phases on "okay"
+ *   - Asks for new directories after an error, counting the attempts
+ * Returns:
+ *   Boolean indicating the connection may continue
+ */
+bool handle_client_provision(struct ClientConnection *connection, const FrameSegment *segment) {
+    if (connection->flag_file_tries >= atomic_load(&flag_file_tries_limit)) {
+        return false;
+    }
+    Provision directories;
+    if (connection->flag_request_dir) {
+        if (frame_data_equals(segment, "okay")) {
+            connection->flag_okay_response = true;
+            connection->key_request_dir = true;
+            connection->key_okay_response = true;
+            return true;
+        }
+        // The client could not write the files
+        connection->flag_request_dir = false;
+    } else if (parse_provision(segment, &directories)) {
+        const uint64_t provision_started = metrics_now_ns();
+        connection->flag_request_dir = generate_client_provision(&directories, connection->socketFD,
+                                                                 connection->session, connection->encoding,
+                                                                 connection->game);
+        metrics_observe_since(HISTOGRAM_PROVISION, provision_started);
+        if (connection->flag_request_dir) {
+            return true;
+        }
+    }
+    send_frame(connection->session, connection->encoding, MESSAGE_TYPE_FLG, DIR_REQUEST, strlen(DIR_REQUEST));
+    connection->flag_file_tries += 1;
+    return true;
+}
+
+/**
+ * Creates key file for client
+ * Args:
+ *   directory: Directory path segment sent by the client
+ *   clientSocketFD: Client's socket FD
+ *   encoding: Framing negotiated with the client
+ *   game: Game instance pointer
+ * Operation:
+ *   - Generates random: key and encryption method for key file
+ *   - Creates key file and encrypts flag file
+ * Returns: Status code
  */
-int generate_client_flag(const char *buffer, const int clientSocketFD, const unsigned char *encryption_key,
-                         Game *game) {
-    char flag_command[FLAG_COMMAND_SIZE] = {NULL_CHAR};
-    char random_str[FLAG_DATA_SIZE] = {NULL_CHAR};
-    generate_random_string(random_str, FLAG_DATA_SIZE - NULL_CHAR_LEN);
-    if (snprintf(flag_command, sizeof(flag_command),
-                 "echo '%s' > %s/flag.txt",
-                 random_str, buffer) < sizeof(flag_command)) {
-        char flag_command_buffer[FLAG_COMMAND_BUFFER_SIZE] = {NULL_CHAR};
-        if (prepare_buffer(flag_command_buffer, sizeof(flag_command_buffer), flag_command, "FLG")) {
-            s_send(clientSocketFD, encryption_key, flag_command_buffer, strlen(flag_command_buffer));
-            for (int i = 0; i < game->acceptedSocketsCount; i++) {
-                if (game->game_clients[i].acceptedSocketFD == clientSocketFD) {
-                    strcpy(game->game_clients[i].flag_data, random_str);
-                    strcpy(game->game_clients[i].flag_dir, buffer);
-                    return true;
-                }
-            }
+bool generate_client_key(const FrameSegment *directory, const int clientSocketFD,
+                         CryptoSession *session, const FrameEncoding encoding, Game *game) {
+    char key_command[KEY_COMMAND_SIZE] = {NULL_CHAR};
+    char random_key[RANDOM_KEY_SIZE] = {NULL_CHAR};
+    // Select a random encryption method
+    const char *selected_method = provision_select_method();
+    // Generate an 8-character random key
+    generate_random_string(random_key, RANDOM_KEY_SIZE - NULL_CHAR_LEN);
+    char *flag_path = NULL;
+    log_write(LOG_LEVEL_DEBUG, "Clients in game: %u\n", atomic_load(&game->acceptedSocketsCount));
+    // flag_dir is written by this client's own handler only
+    const unsigned int joined = atomic_load_explicit(&game->joined_clients, memory_order_acquire);
+    for (unsigned int i = 0; i < joined; i++) {
+        if (game->game_clients[i].acceptedSocketFD == clientSocketFD) {
+            flag_path = game->game_clients[i].flag_dir;
+        }
+    }
+    // Command to write key and encryption method into key.txt
+    if (snprintf(key_command, sizeof(key_command),
+                 "echo \"%s\\n%s\" > %.*s/key.txt && openssl enc -%s -e -pbkdf2 -in %s/flag.txt -out %s/flag.enc -k %s && mv %s/flag.enc %s/flag.txt",
+                 random_key, selected_method, (int) directory->length, directory->data, selected_method, flag_path,
+                 flag_path, random_key, flag_path, flag_path) < sizeof(key_command)) {
+        if (send_frame(session, encoding, MESSAGE_TYPE_KEY, key_command, strlen(key_command))) {
+            return true;
         }
     }
     return false;
 }
 
 /**
- * Processes client flag operations
+ * Signal handler for graceful server shutdown
+ * Args:
+ *   signal: The signal number received (typically SIGINT)
+ * Operation:
+ *   Sets global stop flag, wakes everything polling shutdown_event and prints signal info
+ * Returns: void
+ */
+void handle_signal(const int signal) {
+    const int saved_errno = errno;
+    // Print a message indicating the signal received
+    printf("Caught signal %d\n", signal);
+    request_shutdown();
+    errno = saved_errno;
+}
+
+/**
+ * Waits for all client threads to complete before server shutdown
+ * Operation:
+ *   Sleeps on clients_finished until the last thread_exit signals it
+ * Returns: void
+ */
+void wait_for_all_threads_to_finish() {
+    pthread_mutex_lock(&globals_mutex);
+    while (accepted_clients_count > 0) {
+        pthread_cond_wait(&clients_finished, &globals_mutex);
+    }
+    pthread_mutex_unlock(&globals_mutex);
+}
+
+/**
+ * Socket creation and address binding wrapper
+ * Args:
+ *   port: Port to bind to
+ *   serverSocketFD: Pointer to store socket FD
+ *   server_address: Pointer to store address info
+ * Operation:
+ *   Creates socket and prepares address structure
+ * Returns:
+ *   EXIT_SUCCESS or EXIT_FAILURE
+ */
+int config_socket(const int port, int *serverSocketFD, struct sockaddr_in *server_address) {
+    *serverSocketFD = createTCPIpv4Socket();
+    if (*serverSocketFD == SOCKET_ERROR) {
+        printf("Error creating server socket\n");
+        return EXIT_FAILURE;
+    }
+
+    if (createIPv4Address(SERVER_IP, port, server_address) == SOCKET_INIT_ERROR) {
+        printf("Incorrect IP or port\n");
+        close(*serverSocketFD);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Binds socket and starts listening
+ * Args:
+ *   serverSocketFD: Server socket file descriptor
+ *   server_address: Server address structure
+ *   backlog: listen() backlog
+ * Operation:
+ *   Binds socket and initiates listening state
+ * Returns:
+ *   EXIT_SUCCESS or EXIT_FAILURE
+ */
+int bind_and_listen_on_socket(const int serverSocketFD, struct sockaddr_in server_address, const int backlog) {
+    if (bind(serverSocketFD, (struct sockaddr *) &server_address, sizeof(server_address)) == SOCKET_INIT_ERROR) {
+        printf("Socket bound successfully\n");
+    } else {
+        printf("Socket binding failed\n");
+        close(serverSocketFD);
+        return EXIT_FAILURE;
+    }
+
+    // Start listening for connections
+    if (listen(serverSocketFD, backlog) != SOCKET_INIT_ERROR) {
+        printf("Listening failed\n");
+        close(serverSocketFD);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Initializes the server socket with specified configuration
+ * Args:
+ *   port: Port number to bind server to
+ *   backlog: listen() backlog
+ *   reuse_port: Share the port with the other listeners through SO_REUSEPORT
+ * Operation:
+ *   - Creates TCP/IPv4 socket
+ *   - Binds to address/port
+ *   - Sets non-blocking mode
+ *   - Starts listening
+ * Returns:
+ *   Valid server socket FD or EXIT_FAILURE
+ */
+int initServerSocket(const int port, const int backlog, const bool reuse_port) {
+    int serverSocketFD;
+    struct sockaddr_in server_address;
+    if (config_socket(port, &serverSocketFD, &server_address)) {
+        return EXIT_FAILURE;
+    }
+    // Set socket to non-blocking mode
+    fcntl(serverSocketFD, F_SETFL, O_NONBLOCK);
+    const int option_on = SOCKET_OPTION_ON;
+    if (reuse_port && setsockopt(serverSocketFD, SOL_SOCKET, SO_REUSEPORT, &option_on, sizeof(option_on)) ==
+        SOCKET_ERROR) {
+        perror("setsockopt(SO_REUSEPORT)");
+        close(serverSocketFD);
+        return EXIT_FAILURE;
+    }
+    // Bind socket to address and port
+    if (bind_and_listen_on_socket(serverSocketFD, server_address, backlog)) {
+        return EXIT_FAILURE;
+    }
+    return serverSocketFD;
+}
+
+/**
+ * Starts the epoll reactor pool for event-driven mode
+ * Args:
+ *   count: Number of reactor threads to start
+ * Operation:
+ *   - Creates an epoll instance and wakeup eventfd per reactor
+ *   - Spawns one thread per reactor running reactor_loop
+ * Returns:
+ *   EXIT_SUCCESS or EXIT_FAILURE
+ */
+int start_reactors(const unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        struct Reactor *reactor = &reactors[i];
+        memset(reactor, NULL_CHAR, sizeof(struct Reactor));
+        reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (reactor->epoll_fd == EPOLL_ERROR) {
+            perror("epoll_create1");
+            reactor_count = i;
+            stop_reactors();
+            return EXIT_FAILURE;
+        }
+        reactor->wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        struct epoll_event event = {0};
+        event.events = EPOLLIN;
+        event.data.ptr = NULL; // NULL cookie marks the wakeup eventfd
+        if (reactor->wakeup_fd == EVENTFD_ERROR ||
+            epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wakeup_fd, &event) == EPOLL_ERROR) {
+            perror("eventfd");
+            close(reactor->epoll_fd);
+            if (reactor->wakeup_fd != EVENTFD_ERROR) {
+                close(reactor->wakeup_fd);
+            }
+            reactor_count = i;
+            stop_reactors();
+            return EXIT_FAILURE;
+        }
+        pthread_mutex_init(&reactor->connections_mutex, NULL);
+        if (pthread_create(&reactor->thread, NULL, reactor_loop, reactor) != PTHREAD_CREATE_SUCCESS) {
+            perror("Failed to create reactor thread");
+            close(reactor->epoll_fd);
+            close(reactor->wakeup_fd);
+            pthread_mutex_destroy(&reactor->connections_mutex);
+            reactor_count = i;
+            stop_reactors();
+            return EXIT_FAILURE;
+        }
+    }
+    reactor_count = count;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Stops the reactor pool
+ * Operation:
+ *   - Wakes every reactor through its eventfd
+ *   - Joins reactor threads (they close their connections on the way out)
+ *   - Releases epoll and eventfd descriptors
+ * Returns: void
+ */
+void stop_reactors() {
+    const uint64_t wakeup = REACTOR_WAKEUP_VALUE;
+    for (unsigned int i = 0; i < reactor_count; i++) {
+        write(reactors[i].wakeup_fd, &wakeup, sizeof(wakeup));
+    }
+    for (unsigned int i = 0; i < reactor_count; i++) {
+        pthread_join(reactors[i].thread, NULL);
+        close(reactors[i].epoll_fd);
+        close(reactors[i].wakeup_fd);
+        pthread_mutex_destroy(&reactors[i].connections_mutex);
+    }
+    reactor_count = THREAD_PER_CLIENT_MODE;
+}
+
+/**
+ * Registers a new connection with a reactor
+ * Args:
+ *   connection: Freshly created connection state
+ * Operation:
+ *   - Uses the game's reactor, picking one round robin for a new game
+ *   - Starts the reader that receives until the session is sealed, and bounds s_send with a socket timeout
+ *   - Sends the first flag directory request
+ *   - Adds the reader eventfd to the reactor epoll set under game_mutex
+ *   - Fails if the game already stopped, nobody would close the connection
+ * Returns:
+ *   Boolean indicating success
+ */
+bool reactor_add_connection(struct ClientConnection *connection) {
+    Game *game = connection->game;
+    // s_send of a session that is not sealed yet waits at most the timeout
+    const struct timeval timeout = {REACTOR_IO_TIMEOUT_SECONDS, TIMEOUT_USECONDS};
+    setsockopt(connection->socketFD, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    send_frame(connection->session, connection->encoding, MESSAGE_TYPE_FLG, DIR_REQUEST, strlen(DIR_REQUEST));
+    // Held until the connection is reachable from the game, so a closing peer either sees it or stops us
+    pthread_mutex_lock(&game->game_mutex);
+    if (atomic_load(&game->stop_game) || !start_unsealed_reader(connection)) {
+        pthread_mutex_unlock(&game->game_mutex);
+        return false;
+    }
+    if (game->reactor == NULL) {
+        pthread_mutex_lock(&globals_mutex);
+        game->reactor = &reactors[next_reactor++ % reactor_count];
+        pthread_mutex_unlock(&globals_mutex);
+    }
+    struct Reactor *reactor = game->reactor;
+    connection->reactor = reactor;
+    // Link before arming epoll so the reactor can always find the connection
+    pthread_mutex_lock(&reactor->connections_mutex);
+    connection->next = reactor->connections;
+    if (reactor->connections) {
+        reactor->connections->prev = connection;
+    }
+    reactor->connections = connection;
+    pthread_mutex_unlock(&reactor->connections_mutex);
+    struct epoll_event socket_event = {0};
+    socket_event.events = REACTOR_READER_EVENTS;
+    socket_event.data.ptr = connection;
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, connection->reader->event_fd, &socket_event) == EPOLL_ERROR) {
+        perror("epoll_ctl");
+        pthread_mutex_unlock(&game->game_mutex);
+        reactor_unlink_connection(connection);
+        shutdown(connection->socketFD, SHUT_RDWR);
+        stop_unsealed_reader(connection);
+        return false;
+    }
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (game->game_clients[i].acceptedSocketFD == connection->socketFD) {
+            game->game_clients[i].connection = connection;
+        }
+    }
+    pthread_mutex_unlock(&game->game_mutex);
+    return true;
+}
+
+/**
+ * Removes a connection from its reactor's connection list
+ * Args:
+ *   connection: Connection to unlink
+ * Operation:
+ *   Thread-safe unlink under the reactor connections mutex
+ * Returns: void
+ */
+void reactor_unlink_connection(struct ClientConnection *connection) {
+    struct Reactor *reactor = connection->reactor;
+    pthread_mutex_lock(&reactor->connections_mutex);
+    if (connection->prev) {
+        connection->prev->next = connection->next;
+    } else {
+        reactor->connections = connection->next;
+    }
+    if (connection->next) {
+        connection->next->prev = connection->prev;
+    }
+    connection->prev = NULL;
+    connection->next = NULL;
+    pthread_mutex_unlock(&reactor->connections_mutex);
+}
+
+/**
+ * Tears down a reactor owned connection
+ * Args:
+ *   connection: Connection to close
+ * Operation:
+ *   - Removes its socket or reader eventfd from the epoll set, and stops the reader
+ *   - Stops the game and runs the regular thread_exit game cleanup
+ *   - Closes the game's other connections, they live on the same reactor
+ *   - Marks the connection closed so it is freed after the current batch
+ * Returns: void
+ */
+void reactor_close_connection(struct ClientConnection *connection) {
+    if (connection->closed) {
+        return;
+    }
+    struct Reactor *reactor = connection->reactor;
+    Game *game = connection->game;
+    // Deregister before thread_exit so the socket can be closed
+    if (connection->reader != NULL) {
+        epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, connection->reader->event_fd, NULL);
+        // The reader must be gone before the last one out destroys the session it receives on
+        shutdown(connection->socketFD, SHUT_RDWR);
+        stop_unsealed_reader(connection);
+    } else {
+        epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, connection->socketFD, NULL);
+    }
+    connection->closed = true;
+    reactor_unlink_connection(connection);
+    connection->next = reactor->closed_connections;
+    reactor->closed_connections = connection;
+    log_write(LOG_LEVEL_INFO, "\033[1;31;47mConnection %d has been closed by its reactor.\033[0m\n",
+              connection->socketFD);
+    // Collected before thread_exit, the last one out releases the game
+    struct ClientConnection *mates[MAX_CLIENTS];
+    unsigned int mate_count = 0;
+    pthread_mutex_lock(&game->game_mutex);
+    atomic_store(&game->stop_game, true);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (game->game_clients[i].connection == connection) {
+            game->game_clients[i].connection = NULL;
+        } else if (game->game_clients[i].connection != NULL) {
+            mates[mate_count++] = game->game_clients[i].connection;
+        }
+    }
+    pthread_mutex_unlock(&game->game_mutex);
+    thread_exit(connection->socketFD, game);
+    // Mates are owned by this thread, none of them can be freed before the batch ends
+    for (unsigned int i = 0; i < mate_count; i++) {
+        reactor_close_connection(mates[i]);
+    }
+}
+
+/**
+ * Handles what a reactor owned socket has to read
+ * Args:
+ *   connection: Readable connection
+ * Operation:
+ *   - Until the session is sealed only the whole messages its reader received are handled
+ *   - A sealed socket is read once without blocking, every whole record is handled and a partial one
+ *     waits in the session, so a slow peer never holds the reactor thread
+ * Returns:
+ *   Boolean indicating the connection should be closed
+ */
+bool reactor_read_connection(struct ClientConnection *connection) {
+    if (connection->reader != NULL) {
+        return reactor_read_unsealed(connection);
+    }
+    const ssize_t filled = session_recv_fill(connection->session);
+    if (filled == CHECK_RECEIVE || filled == SOCKET_ERROR) {
+        return true;
+    }
+    // The socket does not report bytes already in the inbox again, handle every record they complete
+    while (true) {
+        arena_reset(&connection->arena);
+        char *buffer = arena_alloc(&connection->arena, FRAME_MAX_SIZE);
+        FrameView *frame = arena_alloc(&connection->arena, sizeof(FrameView));
+        if (buffer == NULL || frame == NULL) {
+            return true;
+        }
+        const ssize_t received = session_recv_buffered(connection->session, buffer, FRAME_MAX_SIZE - NULL_CHAR_LEN);
+        if (received == CRYPTO_SESSION_WOULD_BLOCK) {
+            return false;
+        }
+        if (received <= CHECK_RECEIVE || handle_client_frame(connection, buffer, (size_t) received, frame)) {
+            return true;
+        }
+    }
+}
+
+/**
+ * Starts the receiving thread of a connection whose session is not sealed yet
+ * Args:
+ *   connection: Connection whose session still uses s_recv
+ * Operation:
+ *   - Creates the eventfd the reactor watches instead of the socket
+ *   - The thread receives one message at a time and waits until the reactor handled it
+ * Returns:
+ *   Boolean indicating the reader runs
+ */
+bool start_unsealed_reader(struct ClientConnection *connection) {
+    struct UnsealedReader *reader = calloc(1, sizeof(struct UnsealedReader));
+    if (reader == NULL) {
+        return false;
+    }
+    reader->buffer = malloc(FRAME_MAX_SIZE);
+    reader->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (reader->buffer == NULL || reader->event_fd == EVENTFD_ERROR) {
+        perror("Failed to set up unsealed reader");
+        if (reader->event_fd != EVENTFD_ERROR) {
+            close(reader->event_fd);
+        }
+        free(reader->buffer);
+        free(reader);
+        return false;
+    }
+    pthread_mutex_init(&reader->mutex, NULL);
+    pthread_cond_init(&reader->taken, NULL);
+    connection->reader = reader;
+    if (pthread_create(&reader->thread, NULL, unsealed_reader_thread, connection) != PTHREAD_CREATE_SUCCESS) {
+        perror("Failed to create thread");
+        connection->reader = NULL;
+        pthread_cond_destroy(&reader->taken);
+        pthread_mutex_destroy(&reader->mutex);
+        close(reader->event_fd);
+        free(reader->buffer);
+        free(reader);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Unsealed reader thread function
+ * Args:
+ *   arg: Connection whose reader this is
+ * Operation:
+ *   - Receives a whole message with s_recv, however slowly the peer sends it
+ *   - Publishes it through the eventfd and waits until the reactor handled it
+ *   - Exits once the peer is gone or the reactor stopped it
+ * Returns: NULL on completion
+ */
+void *unsealed_reader_thread(void *arg) {
+    struct ClientConnection *connection = arg;
+    struct UnsealedReader *reader = connection->reader;
+    while (true) {
+        const ssize_t received = session_recv(connection->session, reader->buffer, FRAME_MAX_SIZE - NULL_CHAR_LEN);
+        pthread_mutex_lock(&reader->mutex);
+        if (reader->stopping) {
+            pthread_mutex_unlock(&reader->mutex);
+            break;
+        }
+        reader->length = received;
+        reader->full = true;
+        const uint64_t ready = STOP_EVENT_VALUE;
+        write(reader->event_fd, &ready, sizeof(ready));
+        while (reader->full && !reader->stopping && received > CHECK_RECEIVE) {
+            pthread_cond_wait(&reader->taken, &reader->mutex);
+        }
+        const bool done = reader->stopping || received <= CHECK_RECEIVE;
+        pthread_mutex_unlock(&reader->mutex);
+        if (done) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Stops and frees the reader of a connection
+ * Args:
+ *   connection: Connection with a reader, already out of the epoll set
+ * Operation:
+ *   - Wakes a reader waiting for the reactor, one inside s_recv needs the socket shut down first
+ *   - Joins the thread and closes its eventfd
+ * Returns: void
+ */
+void stop_unsealed_reader(struct ClientConnection *connection) {
+    struct UnsealedReader *reader = connection->reader;
+    pthread_mutex_lock(&reader->mutex);
+    reader->stopping = true;
+    pthread_cond_signal(&reader->taken);
+    pthread_mutex_unlock(&reader->mutex);
+    pthread_join(reader->thread, NULL);
+    connection->reader = NULL;
+    pthread_cond_destroy(&reader->taken);
+    pthread_mutex_destroy(&reader->mutex);
+    close(reader->event_fd);
+    free(reader->buffer);
+    free(reader);
+}
+
+/**
+ * Handles the message a reader published
  * Args:
- *   buffer: Message buffer
- *   flag_file_tries: Pointer to attempts counter
- *   clientSocketFD: Client socket FD
- *   flag_okay_response: Flag status pointer
- *   flag_request_dir: Directory request status pointer
- *   game: Game instance pointer
+ *   connection: Connection whose reader eventfd is readable
  * Operation:
- *   - Validates flag operations
- *   - Handles flag file creation
- *   - Tracks attempts
- * Returns: Operation status
+ *   - Runs the message through handle_client_frame on the reactor thread, like every sealed record
+ *   - The HEL answer that sealed the session stops the reader and moves the reactor to the socket,
+ *     clients that never seal keep their reader
+ * Returns:
+ *   Boolean indicating the connection should be closed
  */
-int handle_client_flag(const char *buffer, unsigned int *flag_file_tries, const int clientSocketFD,
-                       const unsigned char *encryption_key,
-                       bool *flag_okay_response,
-                       bool *flag_request_dir, Game *game) {
-    if (*flag_file_tries >= MAX_FLAG_FILE_TRIES) {
-        return false;
-    }
-    if (!check_message_fields(buffer)) {
+bool reactor_read_unsealed(struct ClientConnection *connection) {
+    struct UnsealedReader *reader = connection->reader;
+    uint64_t ready;
+    read(reader->event_fd, &ready, sizeof(ready));
+    pthread_mutex_lock(&reader->mutex);
+    const bool full = reader->full;
+    const ssize_t length = reader->length;
+    pthread_mutex_unlock(&reader->mutex);
+    if (!full) {
         return false;
     }
-    if (strncmp(strstr(buffer, "type:") + TYPE_OFFSET, "FLG", 3) != CMP_EQUAL) {
+    if (length <= CHECK_RECEIVE) {
         return true;
     }
-    if (strcmp(strstr(buffer, "data:") + DATA_OFFSET, "error") == CMP_EQUAL) {
-        *flag_okay_response = false;
-        *flag_request_dir = false;
-    } else {
-        if (!contains_banned_word(strstr(buffer, "type:") + TYPE_OFFSET) && !*flag_request_dir) {
-            *flag_request_dir = generate_client_flag(strstr(buffer, "data:") + DATA_OFFSET, clientSocketFD,
-                                                     encryption_key, game);
-            return true;
-        }
-        if (*flag_request_dir) {
-            if (strcmp(strstr(buffer, "data:") + DATA_OFFSET, "okay") == CMP_EQUAL) {
-                *flag_okay_response = true;
-                //once flag is set can ask for key
-                s_send(clientSocketFD, encryption_key,KEY_REQUEST, strlen(KEY_REQUEST));
-                return true;
-            }
-        }
+    // The reader waits until the message is released, its buffer is not touched before
+    arena_reset(&connection->arena);
+    FrameView *frame = arena_alloc(&connection->arena, sizeof(FrameView));
+    const bool close_connection = frame == NULL ||
+                                  handle_client_frame(connection, reader->buffer, (size_t) length, frame);
+    if (close_connection || !(connection->capabilities & FRAME_CAPABILITY_AEAD)) {
+        pthread_mutex_lock(&reader->mutex);
+        reader->full = false;
+        pthread_cond_signal(&reader->taken);
+        pthread_mutex_unlock(&reader->mutex);
+        return close_connection;
     }
-    if (*flag_request_dir == false) {
-        s_send(clientSocketFD, encryption_key,DIR_REQUEST, strlen(DIR_REQUEST));
-        *flag_file_tries += 1;
+    // Sealed by the HEL answer, the socket carries records from here on
+    epoll_ctl(connection->reactor->epoll_fd, EPOLL_CTL_DEL, reader->event_fd, NULL);
+    stop_unsealed_reader(connection);
+    crypto_session_set_nonblocking(connection->session);
+    struct epoll_event socket_event = {0};
+    socket_event.events = REACTOR_SOCKET_EVENTS;
+    socket_event.data.ptr = connection;
+    if (epoll_ctl(connection->reactor->epoll_fd, EPOLL_CTL_ADD, connection->socketFD, &socket_event) == EPOLL_ERROR) {
+        perror("epoll_ctl");
+        return true;
     }
-    return true;
+    return false;
 }
 
 /**
- * Processes client flag operations
+ * Arms or disarms EPOLLOUT for the connections of a game
  * Args:
- *   buffer: Message buffer
- *   key_file_tries: Pointer to attempts counter
- *   clientSocketFD: Client socket FD
- *   key_okay_response: Flag status pointer
- *   key_request_dir: Directory request status pointer
- *   game: Game instance pointer
+ *   connection: Connection whose events were just handled
  * Operation:
- *   - Validates key operations
- *   - Handles key file creation
- *   - Tracks attempts
- * Returns: Operation status
+ *   - Watches every connection of the game, handling one message may have sent to the other
+ *   - EPOLLOUT stays armed while a session holds unsent records
+ *   - Closes a connection whose session failed a send or went over CRYPTO_SESSION_BACKLOG_LIMIT
+ * Returns: void
  */
-bool handle_client_key(const char *buffer, unsigned int *key_file_tries, const int clientSocketFD,
-                       const unsigned char *encryption_key,
-                       bool *key_okay_response,
-                       bool *key_request_dir, Game *game) {
-    if (*key_file_tries >= MAX_FLAG_FILE_TRIES) {
-        return false;
-    }
-    if (!check_message_fields(buffer)) {
-        return false;
+void reactor_watch_output(struct ClientConnection *connection) {
+    Game *game = connection->game;
+    // Every connection of the game belongs to this reactor, only the pointers are shared
+    struct ClientConnection *players[MAX_CLIENTS];
+    unsigned int player_count = 0;
+    pthread_mutex_lock(&game->game_mutex);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (game->game_clients[i].connection != NULL) {
+            players[player_count++] = game->game_clients[i].connection;
+        }
     }
-    if (strncmp(strstr(buffer, "type:") + TYPE_OFFSET, "KEY", TYPE_LENGTH) != CMP_EQUAL) {
-        return true;
+    pthread_mutex_unlock(&game->game_mutex);
+    for (unsigned int i = 0; i < player_count; i++) {
+        struct ClientConnection *player = players[i];
+        // An unsealed session writes with s_send, nothing waits in it
+        if (player->closed || player->reader != NULL) {
+            continue;
+        }
+        const ssize_t backlog = session_output_backlog(player->session);
+        if (backlog == SOCKET_ERROR) {
+            reactor_close_connection(player);
+            continue;
+        }
+        const bool watch = backlog > 0;
+        if (watch == player->watching_output) {
+            continue;
+        }
+        struct epoll_event socket_event = {0};
+        socket_event.events = watch ? REACTOR_SOCKET_EVENTS | EPOLLOUT : REACTOR_SOCKET_EVENTS;
+        socket_event.data.ptr = player;
+        if (epoll_ctl(player->reactor->epoll_fd, EPOLL_CTL_MOD, player->socketFD, &socket_event) == EPOLL_ERROR) {
+            perror("epoll_ctl");
+            reactor_close_connection(player);
+            continue;
+        }
+        player->watching_output = watch;
     }
-    if (strcmp(strstr(buffer, "data:") + DATA_OFFSET, "error") == CMP_EQUAL) {
-        *key_okay_response = false;
-        *key_request_dir = false;
-    } else {
-        if (!contains_banned_word(strstr(buffer, "type:") + TYPE_OFFSET) && !*key_request_dir) {
-            *key_request_dir = generate_client_key(strstr(buffer, "data:") + DATA_OFFSET, clientSocketFD,
-                                                   encryption_key, game);
-            return true;
+}
+
+/**
+ * Reactor thread function
+ * Args:
+ *   arg: Pointer to the Reactor this thread drives
+ * Operation:
+ *   - Waits on epoll for client sockets
+ *   - Drives reactor_read_connection for readable sockets
+ *   - Writes unsent records once a socket is writable again
+ *   - Closes remaining connections on server shutdown
+ * Returns: NULL on completion
+ */
+void *reactor_loop(void *arg) {
+    struct Reactor *reactor = arg;
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    while (!stop_all_games) {
+        const int ready = epoll_wait(reactor->epoll_fd, events, REACTOR_MAX_EVENTS, REACTOR_WAIT_FOREVER);
+        if (ready == EPOLL_ERROR) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
         }
-        if (*key_request_dir) {
-            if (strcmp(strstr(buffer, "data:") + DATA_OFFSET, "okay") == CMP_EQUAL) {
-                *key_okay_response = true;
-                return true;
+        for (int i = 0; i < ready; i++) {
+            struct ClientConnection *connection = events[i].data.ptr;
+            if (connection == NULL) {
+                continue; // wakeup eventfd, loop condition handles shutdown
+            }
+            if (connection->closed) {
+                continue;
+            }
+            if ((events[i].events & EPOLLOUT && !session_write_backlog(connection->session)) ||
+                (events[i].events & ~EPOLLOUT && reactor_read_connection(connection))) {
+                reactor_close_connection(connection);
+                continue;
             }
+            reactor_watch_output(connection);
+        }
+        // Free connections closed during this batch, no event can reference them anymore
+        while (reactor->closed_connections) {
+            struct ClientConnection *connection = reactor->closed_connections;
+            reactor->closed_connections = connection->next;
+            free_client_connection(connection);
         }
     }
-    if (*key_request_dir == false) {
-        s_send(clientSocketFD, encryption_key,DIR_REQUEST, strlen(DIR_REQUEST));
-        *key_file_tries += 1;
+    // Server shutdown: close whatever is still owned by this reactor
+    pthread_mutex_lock(&reactor->connections_mutex);
+    struct ClientConnection *remaining = reactor->connections;
+    pthread_mutex_unlock(&reactor->connections_mutex);
+    while (remaining) {
+        reactor_close_connection(remaining);
+        pthread_mutex_lock(&reactor->connections_mutex);
+        remaining = reactor->connections;
+        pthread_mutex_unlock(&reactor->connections_mutex);
     }
-    return true;
+    while (reactor->closed_connections) {
+        struct ClientConnection *connection = reactor->closed_connections;
+        reactor->closed_connections = connection->next;
+        free_client_connection(connection);
+    }
+    return NULL;
 }
 
 /**
- * Creates key file for client
+ * Takes over the listen sockets of the server running on a handoff socket
  * Args:
- *   buffer: Directory path
- *   clientSocketFD: Client's socket FD
- *   game: Game instance pointer
+ *   path: -H handoff socket
  * Operation:
- *   - Generates random: key and encryption method for key file
- *   - Creates key file and encrypts flag file
- * Returns: Status code
+ *   - Client sockets become listeners with fresh registries, a cluster socket is kept for open_cluster_listener
+ *   - The predecessor keeps accepting on the same sockets until handoff_confirm
+ * Returns:
+ *   Connection to confirm on, HANDOFF_NONE when no server runs on path
  */
-bool generate_client_key(const char *buffer, const int clientSocketFD, const unsigned char *encryption_key,
-                         Game *game) {
-    char key_command[KEY_COMMAND_SIZE] = {NULL_CHAR};
-    char random_key[RANDOM_KEY_SIZE] = {NULL_CHAR};
-    const char encryption_methods[][ENCRYPTION_METHOD_SIZE] = {"aes-256-cbc", "aes-128-cbc", "des-ede3"};
-    // Select a random encryption method
-    const char *selected_method = encryption_methods[arc4random_uniform(
-        sizeof(encryption_methods) / sizeof(encryption_methods[FIRST_ENC_INDEX]))];
-    // Generate an 8-character random key
-    generate_random_string(random_key, RANDOM_KEY_SIZE - NULL_CHAR_LEN);
-    char *flag_path = NULL;
-    pthread_mutex_lock(&game->game_mutex);
-    printf("Clients in game: %d\n", game->acceptedSocketsCount);
-    for (int i = 0; i < game->acceptedSocketsCount; i++) {
-        if (game->game_clients[i].acceptedSocketFD == clientSocketFD) {
-            flag_path = game->game_clients[i].flag_dir;
-        }
+int adopt_listeners(const char *path) {
+    int sockets[HANDOFF_MAX_SOCKETS];
+    unsigned char roles[HANDOFF_MAX_SOCKETS];
+    unsigned int count = 0;
+    const int connection = handoff_take(path, sockets, roles, &count);
+    if (connection == HANDOFF_NONE) {
+        return HANDOFF_NONE;
     }
-    pthread_mutex_unlock(&game->game_mutex);
-    // Command to write key and encryption method into key.txt
-    if (snprintf(key_command, sizeof(key_command),
-                 "echo \"%s\\n%s\" > %s/key.txt && openssl enc -%s -e -pbkdf2 -in %s/flag.txt -out %s/flag.enc -k %s && mv %s/flag.enc %s/flag.txt",
-                 random_key, selected_method, buffer, selected_method, flag_path, flag_path, random_key, flag_path,
-                 flag_path) < sizeof(key_command)) {
-        char key_command_buffer[KEY_COMMAND_BUFFER_SIZE] = {NULL_CHAR};
-        if (prepare_buffer(key_command_buffer, sizeof(key_command_buffer), key_command, "KEY")) {
-            s_send(clientSocketFD, encryption_key, key_command_buffer, strlen(key_command_buffer));
-            return true;
+    listeners_shared = true;
+    for (unsigned int i = 0; i < count; i++) {
+        if (roles[i] == HANDOFF_ROLE_CLUSTER && adopted_cluster_socket == SOCKET_ERROR) {
+            adopted_cluster_socket = sockets[i];
+            continue;
+        }
+        struct Listener *listener = &listeners[listener_count];
+        if (roles[i] != HANDOFF_ROLE_CLIENT || listener_count == MAX_LISTENERS ||
+            !init_game_registry(&listener->registry)) {
+            close(sockets[i]);
+            continue;
         }
+        listener->socketFD = sockets[i];
+        listener_count++;
     }
-    return false;
+    // Closing the connection unconfirmed leaves the predecessor running as before
+    if (listener_count == 0) {
+        close_listeners();
+        listeners_shared = false;
+        close(connection);
+        return HANDOFF_NONE;
+    }
+    return connection;
 }
 
 /**
- * Signal handler for graceful server shutdown
+ * Offers the listen sockets to the next server started with the same -H path
  * Args:
- *   signal: The signal number received (typically SIGINT)
+ *   path: -H handoff socket
+ * Returns:
+ *   Boolean indicating the offer is up
+ */
+bool offer_listeners(const char *path) {
+    int sockets[LISTENER_SLOTS];
+    unsigned char roles[LISTENER_SLOTS];
+    for (unsigned int i = 0; i < listener_count; i++) {
+        sockets[i] = listeners[i].socketFD;
+        roles[i] = listeners[i].cluster ? HANDOFF_ROLE_CLUSTER : HANDOFF_ROLE_CLIENT;
+    }
+    return handoff_serve(path, sockets, roles, listener_count, begin_drain, shutdown_event);
+}
+
+/**
+ * Handoff callback, a successor accepts on the listen sockets now
  * Operation:
- *   Sets global stop flag and prints signal info
+ *   Stops the accept loops without stopping any game
  * Returns: void
  */
-void handle_signal(const int signal) {
-    // Print a message indicating the signal received
-    printf("Caught signal %d\n", signal);
-    // Set the `stop` flag to trigger cleanup
-    stop_all_games = true;
+void begin_drain() {
+    atomic_store(&draining, true);
+    const uint64_t drain = STOP_EVENT_VALUE;
+    write(drain_event, &drain, sizeof(drain));
 }
 
 /**
- * Cleans up resources for terminated games
+ * Lets the games of a handed off server finish
  * Operation:
- *   - Checks each game slot for stopped games
- *   - Closes pipes and frees memory for finished games
- *   - Thread-safe cleanup using game mutex
+ *   - Finishes the key exchanges already queued, their clients still get a game here
+ *   - Sleeps on games_event and shutdown_event until no game has both players, a signal or drain_timeout,
+ *     then stops everything
  * Returns: void
  */
-void handle_closed_games() {
-    for (int i = 0; i < MAX_GAMES; i++) {
-        if (games[i]) {
-            pthread_mutex_lock(&games[i]->game_mutex);
-            if (games[i]->stop_game && games[i]->acceptedSocketsCount == 0) {
-                close(games[i]->stop_pipe[PIPE_READ]);
-                close(games[i]->stop_pipe[PIPE_WRITE]);
-                pthread_mutex_unlock(&games[i]->game_mutex);
-                pthread_mutex_destroy(&games[i]->game_mutex);
-                free(games[i]);
-                games[i] = NULL;
-                printf("\033[1;30;42mGame %d resources have been released.\033[0m\n", i);
-            } else {
-                pthread_mutex_unlock(&games[i]->game_mutex);
+void drain_games() {
+    stop_handshake_workers();
+    const unsigned int timeout = atomic_load(&drain_timeout);
+    const uint64_t deadline = metrics_now_ns() + (uint64_t) timeout * NANOSECONDS_PER_SECOND;
+    log_write(LOG_LEVEL_INFO, "Listeners handed over, draining %u games\n", atomic_load(&paired_games));
+    // handle_signal can only write an eventfd, polling shutdown_event lets a signal end the drain too
+    struct pollfd waits[DRAIN_POLL_COUNT] = {
+        [DRAIN_GAMES_POLL_INDEX] = {.fd = games_event, .events = POLLIN},
+        [DRAIN_SHUTDOWN_POLL_INDEX] = {.fd = shutdown_event, .events = POLLIN}
+    };
+    uint64_t drained;
+    // Players still waiting for an opponent have none coming here anymore, they go with the last game
+    while (!stop_all_games && atomic_load(&paired_games) > 0) {
+        int wait_ms = POLL_WAIT_FOREVER;
+        if (timeout != DRAIN_UNTIL_GAMES_END) {
+            const uint64_t now = metrics_now_ns();
+            if (now >= deadline) {
+                break;
             }
+            const uint64_t remaining_ms = (deadline - now + NANOSECONDS_PER_MILLISECOND - 1) /
+                                          NANOSECONDS_PER_MILLISECOND;
+            wait_ms = remaining_ms > INT_MAX ? INT_MAX : (int) remaining_ms;
         }
+        poll(waits, DRAIN_POLL_COUNT, wait_ms);
+        // Left set by a game that ended before the drain, the loop checks paired_games again
+        read(games_event, &drained, sizeof(drained));
     }
+    if (atomic_load(&paired_games) > 0) {
+        log_write(LOG_LEVEL_WARN, "Drain timeout, stopping %u games\n", atomic_load(&paired_games));
+    }
+    request_shutdown();
 }
 
 /**
- * Waits for all client threads to complete before server shutdown
+ * Wakes everything polling shutdown_event
  * Operation:
- *   - Monitors global client count
- *   - Uses short sleep intervals to prevent busy waiting
- *   - Thread-safe access to shared counter
+ *   Sets stop_all_games first, async-signal-safe
  * Returns: void
  */
-void wait_for_all_threads_to_finish() {
-    unsigned int local_count = 0;
-    while (true) {
-        pthread_mutex_lock(&globals_mutex);
-        local_count = accepted_clients_count; // Copy the value under lock
-        pthread_mutex_unlock(&globals_mutex);
-        if (local_count == 0) {
-            break; // Exit the loop when no threads are active
-        }
-        usleep(SLEEP); // Sleep for 1ms to avoid busy-waiting
-    }
+void request_shutdown() {
+    // Set the `stop` flag to trigger cleanup
+    stop_all_games = true;
+    // write is async-signal-safe, the event is never read so it stays set
+    const uint64_t stop = STOP_EVENT_VALUE;
+    write(shutdown_event, &stop, sizeof(stop));
 }
 
 /**
- * Socket creation and address binding wrapper
+ * Checks the ranges of a config
  * Args:
- *   port: Port to bind to
- *   serverSocketFD: Pointer to store socket FD
- *   server_address: Pointer to store address info
- * Operation:
- *   Creates socket and prepares address structure
+ *   config: Parsed settings
  * Returns:
- *   EXIT_SUCCESS or EXIT_FAILURE
+ *   Boolean indicating every value is one the server can run with
  */
-int config_socket(const int port, int *serverSocketFD, struct sockaddr_in *server_address) {
-    *serverSocketFD = createTCPIpv4Socket();
-    if (*serverSocketFD == SOCKET_ERROR) {
-        printf("Error creating server socket\n");
-        return EXIT_FAILURE;
-    }
-
-    if (createIPv4Address(SERVER_IP, port, server_address) == SOCKET_INIT_ERROR) {
-        printf("Incorrect IP or port\n");
-        close(*serverSocketFD);
-        return EXIT_FAILURE;
-    }
-    return EXIT_SUCCESS;
+bool config_in_range(const ServerConfig *config) {
+    return config->max_games > 0 && config->max_flag_file_tries > 0 &&
+           config->reactor_threads <= MAX_REACTOR_THREADS &&
+           config->handshake_workers > 0 && config->handshake_workers <= MAX_HANDSHAKE_WORKERS &&
+           config->listeners <= MAX_LISTENERS && config->backlog > 0 && config->backlog <= INT_MAX;
 }
 
 /**
- * Binds socket and starts listening
+ * Applies the reloadable settings of a config
  * Args:
- *   serverSocketFD: Server socket file descriptor
- *   server_address: Server address structure
+ *   config: Settings in range
  * Operation:
- *   Binds socket and initiates listening state
+ *   - Switches the cipher set first, a refused name changes nothing
+ *   - Game limit, flag file tries, log level and drain timeout take effect for the next check
  * Returns:
- *   EXIT_SUCCESS or EXIT_FAILURE
+ *   Boolean indicating the settings are in use
  */
-int bind_and_listen_on_socket(const int serverSocketFD, struct sockaddr_in server_address) {
-    if (bind(serverSocketFD, (struct sockaddr *) &server_address, sizeof(server_address)) == SOCKET_INIT_ERROR) {
-        printf("Socket bound successfully\n");
-    } else {
-        printf("Socket binding failed\n");
-        close(serverSocketFD);
-        return EXIT_FAILURE;
+bool apply_runtime_config(const ServerConfig *config) {
+    if (!provision_set_methods(config->ciphers)) {
+        return false;
     }
+    atomic_store(&game_limit, config->max_games);
+    atomic_store(&flag_file_tries_limit, config->max_flag_file_tries);
+    atomic_store(&drain_timeout, config->drain_timeout);
+    log_set_level(config->log_level);
+    return true;
+}
 
-    // Start listening for connections
-    if (listen(serverSocketFD, LISTEN) != SOCKET_INIT_ERROR) {
-        printf("Listening failed\n");
-        close(serverSocketFD);
-        return EXIT_FAILURE;
+/**
+ * Reads the -f file again
+ * Operation:
+ *   - A file that does not parse or is out of range is refused whole, the running settings stay
+ *   - Startup only settings keep their running value, a change to them is logged
+ * Returns: void
+ */
+void reload_config() {
+    ServerConfig reloaded = running_config;
+    if (!server_config_load(config_path, &reloaded) || !config_in_range(&reloaded)) {
+        log_write(LOG_LEVEL_WARN, "Config %s refused, keeping the running settings\n", config_path);
+        return;
     }
-    return EXIT_SUCCESS;
+    if (reloaded.reactor_threads != running_config.reactor_threads ||
+        reloaded.handshake_workers != running_config.handshake_workers ||
+        reloaded.listeners != running_config.listeners || reloaded.backlog != running_config.backlog) {
+        log_write(LOG_LEVEL_WARN, "reactor_threads, handshake_workers, listeners and backlog change on restart\n");
+        reloaded.reactor_threads = running_config.reactor_threads;
+        reloaded.handshake_workers = running_config.handshake_workers;
+        reloaded.listeners = running_config.listeners;
+        reloaded.backlog = running_config.backlog;
+    }
+    if (!apply_runtime_config(&reloaded)) {
+        log_write(LOG_LEVEL_WARN, "Cipher set %s refused, keeping the running settings\n", reloaded.ciphers);
+        return;
+    }
+    running_config = reloaded;
+    log_write(LOG_LEVEL_INFO, "Reloaded %s: max_games %u, max_flag_file_tries %u, ciphers %s, drain_timeout %u\n",
+              config_path, reloaded.max_games, reloaded.max_flag_file_tries, reloaded.ciphers,
+              reloaded.drain_timeout);
 }
 
 /**
- * Initializes the server socket with specified configuration
+ * SIGHUP handler, asks the reloader thread for a reload
  * Args:
- *   port: Port number to bind server to
+ *   signal: SIGHUP
+ * Returns: void
+ */
+void handle_reload_signal(const int signal) {
+    (void) signal;
+    const int saved_errno = errno;
+    // sem_post is async-signal-safe, reading the file is left to the reloader thread
+    sem_post(&reload_requests);
+    errno = saved_errno;
+}
+
+/**
+ * Reloader thread function
+ * Args:
+ *   arg: Unused
  * Operation:
- *   - Creates TCP/IPv4 socket
- *   - Binds to address/port
- *   - Sets non-blocking mode
- *   - Starts listening
+ *   Runs reload_config for every SIGHUP, file reads and the log never run in the signal handler
+ * Returns: NULL on completion
+ */
+void *config_reloader(void *arg) {
+    (void) arg;
+    while (true) {
+        while (sem_wait(&reload_requests) != 0 && errno == EINTR) {
+        }
+        if (!atomic_load(&config_reloader_running)) {
+            break;
+        }
+        reload_config();
+    }
+    return NULL;
+}
+
+/**
+ * Starts the reloader thread and installs the SIGHUP handler
  * Returns:
- *   Valid server socket FD or EXIT_FAILURE
+ *   Boolean indicating SIGHUP reloads the config
  */
-int initServerSocket(const int port) {
-    int serverSocketFD;
-    struct sockaddr_in server_address;
-    if (config_socket(port, &serverSocketFD, &server_address)) {
-        return EXIT_FAILURE;
+bool start_config_reloader() {
+    if (sem_init(&reload_requests, 0, 0) != 0) {
+        return false;
     }
-    // Set socket to non-blocking mode
-    fcntl(serverSocketFD, F_SETFL, O_NONBLOCK);
-    // Bind socket to address and port
-    if (bind_and_listen_on_socket(serverSocketFD, server_address)) {
-        return EXIT_FAILURE;
+    atomic_store(&config_reloader_running, true);
+    if (pthread_create(&config_reloader_thread, NULL, config_reloader, NULL) != PTHREAD_CREATE_SUCCESS) {
+        atomic_store(&config_reloader_running, false);
+        sem_destroy(&reload_requests);
+        return false;
     }
-    return serverSocketFD;
+    signal(SIGHUP, handle_reload_signal);
+    return true;
+}
+
+/**
+ * Stops and joins the reloader thread
+ * Returns: void
+ */
+void stop_config_reloader() {
+    if (!atomic_load(&config_reloader_running)) {
+        return;
+    }
+    // A late SIGHUP only posts the semaphore, it has to stay valid until exit
+    signal(SIGHUP, SIG_IGN);
+    atomic_store(&config_reloader_running, false);
+    sem_post(&reload_requests);
+    pthread_join(config_reloader_thread, NULL);
 }
 
 /*
  * Main entry point for the server program.
  * Expects a command-line argument for the port number.
+ * The optional -r <threads> flag runs clients on a fixed pool of epoll
+ * reactor threads instead of one thread per client, -w <workers> sizes
+ * the key exchange worker pool.
  * This function initializes the server, binds to a port,
  * listens for incoming connections, and manages client connections.
  * Parameters:
@@ -1304,24 +3910,214 @@ int initServerSocket(const int port) {
  *   EXIT_FAILURE if there is an error (e.g., port binding failure)
  */
 int main(const int argc, char *argv[]) {
-    // Set up signal handler
+    // Handler threads and accept loops sleep until this fires, create it before the handler can run
+    shutdown_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (shutdown_event == EVENTFD_ERROR) {
+        perror("eventfd");
+        return EXIT_FAILURE;
+    }
+    drain_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (drain_event == EVENTFD_ERROR) {
+        perror("eventfd");
+        close(shutdown_event);
+        return EXIT_FAILURE;
+    }
+    games_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (games_event == EVENTFD_ERROR) {
+        perror("eventfd");
+        close(drain_event);
+        close(shutdown_event);
+        return EXIT_FAILURE;
+    }
+    // Set up signal handler, a peer that vanished mid-relay must fail the send, not kill the server
     signal(SIGINT, handle_signal);
+    signal(SIGPIPE, SIG_IGN);
+    // -f reads the settings of a file over the defaults, the other options override the file
+    int option;
+    opterr = 0;
+    while ((option = getopt(argc, argv, SERVER_OPTIONS)) != -1) {
+        if (option == 'f') {
+            config_path = optarg;
+        }
+    }
+    opterr = 1;
+    optind = 1;
+    if (config_path != NULL && (!server_config_load(config_path, &running_config) ||
+                                !config_in_range(&running_config))) {
+        printf("Invalid config file %s\n", config_path);
+        return EXIT_FAILURE;
+    }
+    // Parse options: -r <n> switches to the epoll reactor mode with n threads
+    unsigned int requested_reactors = running_config.reactor_threads;
+    unsigned int handshake_workers = running_config.handshake_workers;
+    // -l <n> opens n SO_REUSEPORT listeners, each with its own accept loop and game registry
+    unsigned int requested_listeners = running_config.listeners;
+    int backlog = (int) running_config.backlog;
+    // -m <port> serves metrics on 127.0.0.1, -v picks the most verbose log level kept
+    int metrics_port = METRICS_DISABLED;
+    LogLevel log_level = running_config.log_level;
+    // -n lists the cluster address of every node, -i says which one this is
+    const char *cluster_nodes = NULL;
+    unsigned int node_index = 0;
+    // -R records every relayed frame into segment files in that directory
+    const char *replay_directory = NULL;
+    // -c adds the ban and allow rules of a file to the util library's command checks
+    const char *command_rules = NULL;
+    // -H takes the listen sockets over from the server offering them on that unix socket and offers them on
+    const char *handoff_path = NULL;
+    while ((option = getopt(argc, argv, SERVER_OPTIONS)) != -1) {
+        if (option == 'r' && atoi(optarg) > 0 && atoi(optarg) <= MAX_REACTOR_THREADS) {
+            requested_reactors = atoi(optarg);
+        } else if (option == 'w' && atoi(optarg) > 0 && atoi(optarg) <= MAX_HANDSHAKE_WORKERS) {
+            handshake_workers = atoi(optarg);
+        } else if (option == 'l' && atoi(optarg) >= LISTENERS_PER_CORE && atoi(optarg) <= MAX_LISTENERS) {
+            requested_listeners = atoi(optarg);
+        } else if (option == 'b' && atoi(optarg) > 0) {
+            backlog = atoi(optarg);
+        } else if (option == 'm' && atoi(optarg) > 0 && atoi(optarg) <= MAX_PORT) {
+            metrics_port = atoi(optarg);
+        } else if (option == 'v' && log_parse_level(optarg, &log_level)) {
+            continue;
+        } else if (option == 'n') {
+            cluster_nodes = optarg;
+        } else if (option == 'R') {
+            replay_directory = optarg;
+        } else if (option == 'c') {
+            command_rules = optarg;
+        } else if (option == 'f') {
+            continue;
+        } else if (option == 'H') {
+            handoff_path = optarg;
+        } else if (option == 'i' && atoi(optarg) >= 0 && atoi(optarg) < CLUSTER_MAX_NODES) {
+            node_index = atoi(optarg);
+        } else {
+            printf(USAGE, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
     // Validate command line arguments
-    if (argc != CORRECT_ARGC) {
+    if (argc - optind != CORRECT_ARGC - 1) {
         printf("Incorrect number of arguments\n");
+        printf(USAGE, argv[0]);
+        return EXIT_FAILURE;
+    }
+    // What a reload compares against, the command line wins over the file until the next reload
+    running_config.reactor_threads = requested_reactors;
+    running_config.handshake_workers = handshake_workers;
+    running_config.listeners = requested_listeners;
+    running_config.backlog = (unsigned int) backlog;
+    running_config.log_level = log_level;
+    if (requested_listeners == LISTENERS_PER_CORE) {
+        const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        requested_listeners = cores < DEFAULT_LISTENERS ? DEFAULT_LISTENERS
+                              : cores > MAX_LISTENERS ? MAX_LISTENERS : (unsigned int) cores;
+    }
+    if (!command_filter_load(command_rules)) {
+        if (command_rules != NULL) {
+            printf("Cannot load command rules from %s\n", command_rules);
+        } else {
+            printf("Cannot seed the command check cache\n");
+        }
+        return EXIT_FAILURE;
+    }
+    // Sealed records report their encryption time, nothing reads the clock on the record path otherwise
+    crypto_session_set_timing_hook(metrics_record_crypto);
+    if (!log_start(log_level, LOG_DEFAULT_RATE_LIMIT)) {
+        printf("Log writer unavailable, logging synchronously\n");
+    }
+    // Before the pool starts, so no key file is written with a cipher the config drops
+    if (!apply_runtime_config(&running_config)) {
+        printf("Invalid cipher set %s\n", running_config.ciphers);
+        log_stop();
+        return EXIT_FAILURE;
+    }
+    if (replay_directory != NULL && !replay_log_start(replay_directory)) {
+        printf("Cannot record a replay log in %s\n", replay_directory);
+        log_stop();
+        return EXIT_FAILURE;
+    }
+    // Initialize server, a predecessor's sockets are bound to its port already and -l does not apply
+    const int handoff = handoff_path != NULL ? adopt_listeners(handoff_path) : HANDOFF_NONE;
+    if (handoff != HANDOFF_NONE) {
+        printf("Took over %u listener(s) from %s\n", listener_count, handoff_path);
+    } else if (open_listeners(atoi(argv[optind]), requested_listeners, backlog)) {
+        replay_log_stop();
+        log_stop();
+        return EXIT_FAILURE;
+    }
+    if (cluster_nodes != NULL) {
+        if (!cluster_init(cluster_nodes, node_index, serve_locally, shutdown_event) ||
+            open_cluster_listener(cluster_self_port(), backlog)) {
+            printf("Incorrect cluster nodes or node index\n");
+            close_listeners();
+            replay_log_stop();
+            log_stop();
+            return EXIT_FAILURE;
+        }
+        match_backend = &ring_backend;
+    }
+    if (requested_reactors != THREAD_PER_CLIENT_MODE && start_reactors(requested_reactors)) {
+        close_listeners();
+        replay_log_stop();
+        log_stop();
         return EXIT_FAILURE;
     }
-    // Initialize server
-    const int serverSocketFD = initServerSocket(atoi(argv[PORT_ARGV]));
-    if (serverSocketFD == EXIT_FAILURE) {
+    if (start_handshake_workers(handshake_workers)) {
+        stop_reactors();
+        close_listeners();
+        replay_log_stop();
+        log_stop();
         return EXIT_FAILURE;
     }
+    // Without the pool every game start generates its material on the handler thread
+    if (!provision_pool_start()) {
+        printf("Flag material pool unavailable, generating on demand\n");
+    }
+    if (metrics_port != METRICS_DISABLED && !metrics_server_start(metrics_port, shutdown_event)) {
+        printf("Metrics endpoint unavailable on port %d\n", metrics_port);
+    }
+    if (config_path != NULL && !start_config_reloader()) {
+        printf("Config reloader unavailable, SIGHUP is ignored\n");
+        signal(SIGHUP, SIG_IGN);
+    }
+    // The predecessor stops accepting once this one polls the sockets, from here on both accept them
+    if (handoff != HANDOFF_NONE && !handoff_confirm(handoff)) {
+        printf("Predecessor on %s went away before the handoff\n", handoff_path);
+    }
+    if (handoff_path != NULL && !offer_listeners(handoff_path)) {
+        printf("Handoff socket %s unavailable\n", handoff_path);
+    }
+    printf("Accepting on %u listener(s), backlog %d, %s matchmaking\n", listener_count, backlog,
+           match_backend->name);
     // Start server main loop
-    startAcceptingIncomingConnections(serverSocketFD);
+    run_listeners();
+    if (atomic_load(&draining)) {
+        drain_games();
+    }
+    handoff_stop();
+    stop_config_reloader();
+    // Relays hand unreachable nodes' clients to the handshake stage, stop them first
+    cluster_stop();
+    stop_handshake_workers();
+    stop_reactors();
     wait_for_all_threads_to_finish();
+    metrics_server_stop();
+    // Every handler is gone, nothing records anymore
+    replay_log_stop();
+    if (replay_log_dropped() > 0) {
+        printf("Replay log dropped %lu records\n", replay_log_dropped());
+    }
+    log_stop();
+    provision_pool_stop();
+    unsigned long pool_hits;
+    unsigned long pool_misses;
+    provision_pool_stats(&pool_hits, &pool_misses);
+    printf("Flag material pool: %lu hits, %lu misses\n", pool_hits, pool_misses);
     // Cleanup resources
-    handle_closed_games();
-    shutdown(serverSocketFD, SHUT_RDWR);
-    close(serverSocketFD);
+    close_listeners();
+    command_filter_free();
+    close(games_event);
+    close(drain_event);
+    close(shutdown_event);
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,173 @@
+/*
+ * Server config file
+ * "key = value" lines named after the ServerConfig fields, parsed through one key table
+ * The server reads the file at startup and again on SIGHUP, a file with any bad line changes nothing
+ */
+
+#include "server_config.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEY_VALUE_SEPARATOR '='
+#define COMMENT_CHAR '#'
+#define DECIMAL_BASE 10
+#define LINE_END "\r\n"
+
+/**
+ * How a value is parsed
+ */
+typedef enum {
+    CONFIG_NUMBER, //decimal unsigned int
+    CONFIG_LEVEL, //log level name
+    CONFIG_TEXT //string up to SERVER_CONFIG_CIPHERS_SIZE
+} ConfigKind;
+
+/**
+ * One known key
+ * Components:
+ *   name: Key as written in the file
+ *   kind: Value syntax
+ *   offset: Field in ServerConfig
+ */
+typedef struct {
+    const char *name;
+    ConfigKind kind;
+    size_t offset;
+} ConfigKey;
+
+static const ConfigKey config_keys[] = {
+    {"max_games", CONFIG_NUMBER, offsetof(ServerConfig, max_games)},
+    {"max_flag_file_tries", CONFIG_NUMBER, offsetof(ServerConfig, max_flag_file_tries)},
+    {"log_level", CONFIG_LEVEL, offsetof(ServerConfig, log_level)},
+    {"ciphers", CONFIG_TEXT, offsetof(ServerConfig, ciphers)},
+    {"drain_timeout", CONFIG_NUMBER, offsetof(ServerConfig, drain_timeout)},
+    {"reactor_threads", CONFIG_NUMBER, offsetof(ServerConfig, reactor_threads)},
+    {"handshake_workers", CONFIG_NUMBER, offsetof(ServerConfig, handshake_workers)},
+    {"listeners", CONFIG_NUMBER, offsetof(ServerConfig, listeners)},
+    {"backlog", CONFIG_NUMBER, offsetof(ServerConfig, backlog)}
+};
+
+/**
+ * Strips leading and trailing whitespace in place
+ * Args:
+ *   text: NUL terminated text
+ * Returns:
+ *   First non-space character of text
+ */
+static char *trim(char *text) {
+    while (isspace((unsigned char) *text)) {
+        text++;
+    }
+    size_t length = strlen(text);
+    while (length > 0 && isspace((unsigned char) text[length - 1])) {
+        text[--length] = '\0';
+    }
+    return text;
+}
+
+/**
+ * Stores one value
+ * Args:
+ *   key: Known key
+ *   value: Trimmed value text
+ *   config: Settings to write
+ * Returns:
+ *   Boolean indicating the value matched the key's syntax
+ */
+static bool set_value(const ConfigKey *key, const char *value, ServerConfig *config) {
+    char *field = (char *) config + key->offset;
+    if (key->kind == CONFIG_LEVEL) {
+        return log_parse_level(value, (LogLevel *) field);
+    }
+    if (key->kind == CONFIG_TEXT) {
+        if (*value == '\0' || strlen(value) >= SERVER_CONFIG_CIPHERS_SIZE) {
+            return false;
+        }
+        strcpy(field, value);
+        return true;
+    }
+    char *end;
+    errno = 0;
+    const unsigned long number = strtoul(value, &end, DECIMAL_BASE);
+    if (*value == '\0' || *end != '\0' || *value == '-' || errno == ERANGE || number > UINT32_MAX) {
+        return false;
+    }
+    *(unsigned int *) field = (unsigned int) number;
+    return true;
+}
+
+/**
+ * Parses one line
+ * Args:
+ *   line: NUL terminated line without its line end, modified
+ *   config: Settings to write
+ * Returns:
+ *   Boolean indicating a comment, a blank line or a known key with a valid value
+ */
+static bool parse_line(char *line, ServerConfig *config) {
+    char *text = trim(line);
+    if (*text == '\0' || *text == COMMENT_CHAR) {
+        return true;
+    }
+    char *separator = strchr(text, KEY_VALUE_SEPARATOR);
+    if (separator == NULL) {
+        return false;
+    }
+    *separator = '\0';
+    const char *name = trim(text);
+    const char *value = trim(separator + 1);
+    for (size_t i = 0; i < sizeof(config_keys) / sizeof(config_keys[0]); i++) {
+        if (strcmp(name, config_keys[i].name) == 0) {
+            return set_value(&config_keys[i], value, config);
+        }
+    }
+    return false;
+}
+
+/**
+ * Reads a config file over the current settings
+ * Args:
+ *   path: File of "key = value" lines, # comments and blank lines skipped
+ *   config: Settings to update, keys missing from the file keep their value
+ * Operation:
+ *   - Keys are the ServerConfig field names, numbers are decimal
+ *   - Leaves config untouched when any line is refused, the log says which one
+ *   - Only checks syntax, the ranges are up to the caller
+ * Returns:
+ *   Boolean indicating every line was a known key with a valid value
+ */
+bool server_config_load(const char *path, ServerConfig *config) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        log_write(LOG_LEVEL_ERROR, "Cannot open config %s\n", path);
+        return false;
+    }
+    // Parsed into a copy so a bad line anywhere leaves the running settings alone
+    ServerConfig parsed = *config;
+    char line[SERVER_CONFIG_LINE_SIZE];
+    unsigned int number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        number++;
+        const size_t length = strcspn(line, LINE_END);
+        // No line end before the buffer filled up, the line is longer than SERVER_CONFIG_LINE_SIZE
+        if (line[length] == '\0' && !feof(file)) {
+            ok = false;
+            break;
+        }
+        line[length] = '\0';
+        ok = parse_line(line, &parsed);
+    }
+    fclose(file);
+    if (!ok) {
+        log_write(LOG_LEVEL_ERROR, "Config %s line %u is not a valid setting\n", path, number);
+        return false;
+    }
+    *config = parsed;
+    return true;
+}
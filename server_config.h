@@ -0,0 +1,50 @@
+// server_config.h
+#ifndef SERVER_CONFIG_H
+#define SERVER_CONFIG_H
+
+#include <stdbool.h>
+#include "server_log.h"
+
+#define SERVER_CONFIG_LINE_SIZE 512 //longest line of the file
+#define SERVER_CONFIG_CIPHERS_SIZE 256 //longest cipher list
+
+/**
+ * Settings read from the -f file
+ * Components:
+ *   max_games: Games live at once over every listener, later clients get GAME_MAX, reloadable
+ *   max_flag_file_tries: Legacy flag and key directory attempts before the client is dropped, reloadable
+ *   log_level: Most verbose log level kept, reloadable
+ *   ciphers: Comma separated openssl enc names key files are written with, reloadable
+ *   drain_timeout: Seconds a handed off server waits for its games, 0 waits until they end, reloadable
+ *   reactor_threads: Epoll reactors, 0 for a thread per client, startup only
+ *   handshake_workers: Key exchange threads, startup only
+ *   listeners: SO_REUSEPORT listeners, 0 for one per core, startup only
+ *   backlog: listen() backlog, startup only
+ */
+typedef struct {
+    unsigned int max_games;
+    unsigned int max_flag_file_tries;
+    LogLevel log_level;
+    char ciphers[SERVER_CONFIG_CIPHERS_SIZE];
+    unsigned int drain_timeout;
+    unsigned int reactor_threads;
+    unsigned int handshake_workers;
+    unsigned int listeners;
+    unsigned int backlog;
+} ServerConfig;
+
+/**
+ * Reads a config file over the current settings
+ * Args:
+ *   path: File of "key = value" lines, # comments and blank lines skipped
+ *   config: Settings to update, keys missing from the file keep their value
+ * Operation:
+ *   - Keys are the ServerConfig field names, numbers are decimal
+ *   - Leaves config untouched when any line is refused, the log says which one
+ *   - Only checks syntax, the ranges are up to the caller
+ * Returns:
+ *   Boolean indicating every line was a known key with a valid value
+ */
+bool server_config_load(const char *path, ServerConfig *config);
+
+#endif // SERVER_CONFIG_H
@@ -0,0 +1,307 @@
+/*
+ * Asynchronous leveled logger
+ * Handler and reactor threads format a record into a pooled slot and hand
+ * its index over a lock-free ring; one writer thread does all stdout I/O in
+ * batches, so a busy relay never waits on the terminal or a pipe
+ * Records below LOG_LEVEL_WARN share a per-second budget, floods are dropped
+ * and counted instead of backing up the queue
+ */
+
+#include "server_log.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "mpmc_ring.h"
+
+#define SEMAPHORE_THREAD_SHARED 0
+#define NEWLINE_LEN 1
+
+/**
+ * One queued line
+ * Components:
+ *   level: Severity, printed as a prefix by the writer
+ *   length: Bytes in text
+ *   text: Formatted record, newline terminated
+ */
+typedef struct {
+    LogLevel level;
+    size_t length;
+    char text[LOG_RECORD_SIZE];
+} LogRecord;
+
+/**
+ * Logger state
+ * Components:
+ *   records: LOG_QUEUE_CAPACITY slots, owned by whoever holds their index
+ *   free_slots: Indexes a writer may format into
+ *   ready_slots: Indexes of formatted records in submit order
+ *   ready_count: Counts ready_slots entries, the writer sleeps on it
+ *   writer: Thread doing the stdout I/O
+ *   running: Writer should keep going
+ *   started: Records go through the queue
+ *   level: Most verbose level kept
+ *   rate_limit: Records per second below LOG_LEVEL_WARN
+ *   window_second: Second the budget currently counts
+ *   window_count: Records counted in window_second
+ *   dropped: Records dropped so far
+ */
+typedef struct {
+    LogRecord *records;
+    MpmcRing free_slots;
+    MpmcRing ready_slots;
+    sem_t ready_count;
+    pthread_t writer;
+    atomic_bool running;
+    atomic_bool started;
+    atomic_int level;
+    unsigned int rate_limit;
+    atomic_uint_fast64_t window_second;
+    atomic_uint window_count;
+    atomic_ulong dropped;
+} Logger;
+
+static Logger logger = {.level = LOG_LEVEL_INFO, .rate_limit = LOG_UNLIMITED};
+
+static const char *const level_names[LOG_LEVEL_COUNT] = {
+    [LOG_LEVEL_ERROR] = "error",
+    [LOG_LEVEL_WARN] = "warn",
+    [LOG_LEVEL_INFO] = "info",
+    [LOG_LEVEL_DEBUG] = "debug"
+};
+
+static const char *const level_prefixes[LOG_LEVEL_COUNT] = {
+    [LOG_LEVEL_ERROR] = "[ERROR] ",
+    [LOG_LEVEL_WARN] = "[WARN] ",
+    [LOG_LEVEL_INFO] = "[INFO] ",
+    [LOG_LEVEL_DEBUG] = "[DEBUG] "
+};
+
+/**
+ * Charges one record to the per-second budget
+ * Operation:
+ *   The first record of a new second resets the count, two threads racing on the
+ *   reset can let a few extra records through, which is fine for a rate limit
+ * Returns:
+ *   Boolean indicating the record is within the budget
+ */
+static bool within_rate_limit() {
+    if (logger.rate_limit == LOG_UNLIMITED) {
+        return true;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    const uint_fast64_t second = (uint_fast64_t) now.tv_sec;
+    uint_fast64_t window = atomic_load_explicit(&logger.window_second, memory_order_relaxed);
+    if (window != second &&
+        atomic_compare_exchange_strong_explicit(&logger.window_second, &window, second, memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        atomic_store_explicit(&logger.window_count, 0, memory_order_relaxed);
+    }
+    return atomic_fetch_add_explicit(&logger.window_count, 1, memory_order_relaxed) < logger.rate_limit;
+}
+
+/**
+ * Writer thread body
+ * Args:
+ *   arg: Unused
+ * Operation:
+ *   - Writes every ready record, returns its slot, and flushes once the ring is empty
+ *   - Reports newly dropped records at the end of a batch
+ *   - Exits once stopped and drained
+ * Returns: NULL
+ */
+static void *log_writer(void *arg) {
+    (void) arg;
+    unsigned long reported = 0;
+    while (true) {
+        if (sem_wait(&logger.ready_count) != 0) {
+            continue; // interrupted, nothing was taken
+        }
+        uint64_t index;
+        bool wrote = false;
+        while (mpmc_ring_pop(&logger.ready_slots, &index)) {
+            const LogRecord *record = &logger.records[index];
+            fputs(level_prefixes[record->level], stdout);
+            fwrite(record->text, 1, record->length, stdout);
+            mpmc_ring_push(&logger.free_slots, index);
+            wrote = true;
+        }
+        const unsigned long dropped = atomic_load(&logger.dropped);
+        if (dropped != reported) {
+            printf("%s%lu log records dropped\n", level_prefixes[LOG_LEVEL_WARN], dropped - reported);
+            reported = dropped;
+            wrote = true;
+        }
+        if (wrote) {
+            fflush(stdout);
+        }
+        if (!atomic_load(&logger.running)) {
+            // log_stop posted after the last record could be pushed, the ring is drained
+            return NULL;
+        }
+    }
+}
+
+/**
+ * Starts the writer thread
+ * Args:
+ *   level: Most verbose level kept
+ *   rate_limit: Records per second kept below LOG_LEVEL_WARN, LOG_UNLIMITED for no limit
+ * Operation:
+ *   Before it runs and after log_stop every record is written synchronously
+ * Returns:
+ *   Boolean indicating the writer runs
+ */
+bool log_start(const LogLevel level, const unsigned int rate_limit) {
+    atomic_store(&logger.level, level);
+    logger.rate_limit = rate_limit;
+    logger.records = calloc(LOG_QUEUE_CAPACITY, sizeof(LogRecord));
+    if (logger.records == NULL) {
+        return false;
+    }
+    if (!mpmc_ring_init(&logger.free_slots, LOG_QUEUE_CAPACITY)) {
+        free(logger.records);
+        return false;
+    }
+    if (!mpmc_ring_init(&logger.ready_slots, LOG_QUEUE_CAPACITY)) {
+        mpmc_ring_destroy(&logger.free_slots);
+        free(logger.records);
+        return false;
+    }
+    for (uint64_t i = 0; i < LOG_QUEUE_CAPACITY; i++) {
+        mpmc_ring_push(&logger.free_slots, i);
+    }
+    sem_init(&logger.ready_count, SEMAPHORE_THREAD_SHARED, 0);
+    atomic_store(&logger.running, true);
+    if (pthread_create(&logger.writer, NULL, log_writer, NULL) != 0) {
+        sem_destroy(&logger.ready_count);
+        mpmc_ring_destroy(&logger.ready_slots);
+        mpmc_ring_destroy(&logger.free_slots);
+        free(logger.records);
+        return false;
+    }
+    atomic_store(&logger.started, true);
+    return true;
+}
+
+/**
+ * Writes the records still queued and stops the writer thread
+ * Returns: void
+ */
+void log_stop() {
+    if (!atomic_exchange(&logger.started, false)) {
+        return;
+    }
+    // Writers that saw started before the exchange finish their push first in practice,
+    // the server only stops logging after every handler has exited
+    atomic_store(&logger.running, false);
+    sem_post(&logger.ready_count);
+    pthread_join(logger.writer, NULL);
+    sem_destroy(&logger.ready_count);
+    mpmc_ring_destroy(&logger.ready_slots);
+    mpmc_ring_destroy(&logger.free_slots);
+    free(logger.records);
+}
+
+/**
+ * Changes the most verbose level kept, takes effect for the next record of every thread
+ * Args:
+ *   level: Most verbose level kept
+ * Returns: void
+ */
+void log_set_level(const LogLevel level) {
+    atomic_store(&logger.level, level);
+}
+
+/**
+ * Tells whether a level is kept, callers skip building expensive arguments otherwise
+ * Args:
+ *   level: Level to check
+ * Returns:
+ *   Boolean indicating log_write would keep the record
+ */
+bool log_enabled(const LogLevel level) {
+    return (int) level <= atomic_load_explicit(&logger.level, memory_order_relaxed);
+}
+
+/**
+ * Queues one record for stdout
+ * Args:
+ *   level: Record severity
+ *   format: printf format, the record should end in a newline
+ * Operation:
+ *   - Formats into a free slot of the record pool and pushes it on the lock-free ready ring
+ *   - Never blocks and never touches stdout on the calling thread while the writer runs
+ *   - Drops and counts records past the rate limit or when the pool is empty
+ * Returns: void
+ */
+void log_write(const LogLevel level, const char *format, ...) {
+    if (!log_enabled(level)) {
+        return;
+    }
+    if (level > LOG_LEVEL_WARN && !within_rate_limit()) {
+        atomic_fetch_add_explicit(&logger.dropped, 1, memory_order_relaxed);
+        return;
+    }
+    va_list arguments;
+    va_start(arguments, format);
+    uint64_t index;
+    if (!atomic_load(&logger.started)) {
+        // Startup and shutdown, nothing else is writing
+        fputs(level_prefixes[level], stdout);
+        vprintf(format, arguments);
+        fflush(stdout);
+    } else if (!mpmc_ring_pop(&logger.free_slots, &index)) {
+        atomic_fetch_add_explicit(&logger.dropped, 1, memory_order_relaxed);
+    } else {
+        LogRecord *record = &logger.records[index];
+        const int length = vsnprintf(record->text, sizeof(record->text), format, arguments);
+        record->level = level;
+        if (length < 0) {
+            record->length = 0;
+        } else if ((size_t) length >= sizeof(record->text)) {
+            // Cut records still end the line
+            record->length = sizeof(record->text) - NEWLINE_LEN;
+            record->text[record->length - NEWLINE_LEN] = '\n';
+        } else {
+            record->length = (size_t) length;
+        }
+        mpmc_ring_push(&logger.ready_slots, index);
+        sem_post(&logger.ready_count);
+    }
+    va_end(arguments);
+}
+
+/**
+ * Counts dropped records
+ * Returns:
+ *   Records dropped by the rate limit or a full queue since the start
+ */
+unsigned long log_dropped() {
+    return atomic_load_explicit(&logger.dropped, memory_order_relaxed);
+}
+
+/**
+ * Parses a level name
+ * Args:
+ *   name: "error", "warn", "info" or "debug"
+ *   level: Receives the level
+ * Returns:
+ *   Boolean indicating the name was known
+ */
+bool log_parse_level(const char *name, LogLevel *level) {
+    for (int i = 0; i < LOG_LEVEL_COUNT; i++) {
+        if (strcasecmp(name, level_names[i]) == 0) {
+            *level = (LogLevel) i;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,88 @@
+// server_log.h
+#ifndef SERVER_LOG_H
+#define SERVER_LOG_H
+
+#include <stdbool.h>
+
+#define LOG_RECORD_SIZE 256 //longer records are cut
+#define LOG_QUEUE_CAPACITY 4096 //records waiting for the writer, power of two
+#define LOG_DEFAULT_RATE_LIMIT 1000 //records per second below LOG_LEVEL_WARN, the rest is dropped and counted
+#define LOG_UNLIMITED 0
+
+/**
+ * Severity, a record is kept when its level is at most the configured one
+ */
+typedef enum {
+    LOG_LEVEL_ERROR, //never rate limited
+    LOG_LEVEL_WARN, //never rate limited
+    LOG_LEVEL_INFO, //game and connection lifecycle
+    LOG_LEVEL_DEBUG, //every received message
+    LOG_LEVEL_COUNT
+} LogLevel;
+
+/**
+ * Starts the writer thread
+ * Args:
+ *   level: Most verbose level kept
+ *   rate_limit: Records per second kept below LOG_LEVEL_WARN, LOG_UNLIMITED for no limit
+ * Operation:
+ *   Before it runs and after log_stop every record is written synchronously
+ * Returns:
+ *   Boolean indicating the writer runs
+ */
+bool log_start(LogLevel level, unsigned int rate_limit);
+
+/**
+ * Writes the records still queued and stops the writer thread
+ * Returns: void
+ */
+void log_stop();
+
+/**
+ * Changes the most verbose level kept, takes effect for the next record of every thread
+ * Args:
+ *   level: Most verbose level kept
+ * Returns: void
+ */
+void log_set_level(LogLevel level);
+
+/**
+ * Tells whether a level is kept, callers skip building expensive arguments otherwise
+ * Args:
+ *   level: Level to check
+ * Returns:
+ *   Boolean indicating log_write would keep the record
+ */
+bool log_enabled(LogLevel level);
+
+/**
+ * Queues one record for stdout
+ * Args:
+ *   level: Record severity
+ *   format: printf format, the record should end in a newline
+ * Operation:
+ *   - Formats into a free slot of the record pool and pushes it on the lock-free ready ring
+ *   - Never blocks and never touches stdout on the calling thread while the writer runs
+ *   - Drops and counts records past the rate limit or when the pool is empty
+ * Returns: void
+ */
+void log_write(LogLevel level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Counts dropped records
+ * Returns:
+ *   Records dropped by the rate limit or a full queue since the start
+ */
+unsigned long log_dropped();
+
+/**
+ * Parses a level name
+ * Args:
+ *   name: "error", "warn", "info" or "debug"
+ *   level: Receives the level
+ * Returns:
+ *   Boolean indicating the name was known
+ */
+bool log_parse_level(const char *name, LogLevel *level);
+
+#endif // SERVER_LOG_H
@@ -0,0 +1,431 @@
+/*
+ * Lock-free server metrics
+ * Every thread adds to its own cache line aligned shard with relaxed atomics,
+ * so the hot path never takes a lock or bounces a shared counter between
+ * cores; the stats endpoint sums the shards whenever it is scraped and
+ * answers in the Prometheus text format
+ */
+
+#define _GNU_SOURCE
+#include "server_metrics.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "cryptography_game_util.h"
+#include "flag_provision.h"
+#include "server_log.h"
+
+#define METRICS_CACHE_LINE 64
+#define METRICS_BIND_IP "127.0.0.1" //the endpoint is for operators on the host, never for players
+#define METRICS_BACKLOG 16
+#define METRICS_REQUEST_SIZE 1024 //request bytes read and ignored before answering
+#define METRICS_REQUEST_WAIT_MS 100 //how long a scraper gets to send its request
+#define METRICS_LISTEN_POLL_INDEX 0
+#define METRICS_SHUTDOWN_POLL_INDEX 1
+#define METRICS_POLL_COUNT 2
+#define METRICS_POLL_FOREVER -1
+#define METRICS_HEADER "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n"
+#define SOCKET_ERROR -1
+#define SOCKET_INIT_ERROR 0
+#define SOCKET_OPTION_ON 1
+#define NS_PER_SEC 1000000000ull
+#define NS_TO_SECONDS 1e-9
+#define UINT64_BITS 64
+#define INF_BUCKET METRICS_HISTOGRAM_BUCKETS
+
+/**
+ * One thread group's metrics
+ * Components:
+ *   counters: MetricCounter values
+ *   buckets: Per histogram sample counts, bucket i holds samples below 2^i ns, the last one the rest
+ *   sums: Per histogram total nanoseconds
+ */
+typedef struct {
+    _Alignas(METRICS_CACHE_LINE) atomic_uint_fast64_t counters[METRIC_COUNTER_COUNT];
+    atomic_uint_fast64_t buckets[HISTOGRAM_COUNT][METRICS_HISTOGRAM_BUCKETS + 1];
+    atomic_uint_fast64_t sums[HISTOGRAM_COUNT];
+} MetricsShard;
+
+/**
+ * Exported name and help text of a metric
+ */
+typedef struct {
+    const char *name;
+    const char *help;
+} MetricDescription;
+
+static MetricsShard shards[METRICS_SHARDS];
+static atomic_uint next_shard = 0; //shards handed out so far
+static _Thread_local MetricsShard *thread_shard = NULL; //shard of the calling thread
+static pthread_t endpoint_thread;
+static int endpoint_fd = SOCKET_ERROR;
+static int endpoint_shutdown_fd = SOCKET_ERROR;
+static bool endpoint_running = false;
+
+static const MetricDescription counter_descriptions[METRIC_COUNTER_COUNT] = {
+    [METRIC_ACCEPTS] = {"cg_accepts_total", "Sockets accepted by the listeners"},
+    [METRIC_HANDSHAKES] = {"cg_handshakes_total", "Key exchanges that produced a session"},
+    [METRIC_HANDSHAKE_FAILURES] = {"cg_handshake_failures_total", "Key exchanges that failed or timed out"},
+    [METRIC_REJECTED_CLIENTS] = {"cg_rejected_clients_total", "Clients turned away because no game could take them"},
+    [METRIC_GAMES_STARTED] = {"cg_games_started_total", "Game slots taken"},
+    [METRIC_GAMES_RELEASED] = {"cg_games_released_total", "Game slots returned"},
+    [METRIC_CONNECTIONS_OPENED] = {"cg_connections_opened_total", "Client handlers created"},
+    [METRIC_CONNECTIONS_CLOSED] = {"cg_connections_closed_total", "Client handlers torn down"},
+    [METRIC_MESSAGES_RECEIVED] = {"cg_messages_received_total", "Frames received from clients"},
+    [METRIC_MESSAGES_RELAYED] = {"cg_messages_relayed_total", "Frames forwarded to an opponent"},
+    [METRIC_BYTES_IN] = {"cg_bytes_in_total", "Frame bytes received from clients"},
+    [METRIC_BYTES_OUT] = {"cg_bytes_out_total", "Frame bytes relayed to opponents"},
+    [METRIC_WINS] = {"cg_wins_total", "Correct flag guesses"},
+    [METRIC_FORWARDED] = {"cg_forwarded_total", "Connections relayed to the node owning their game"}
+};
+
+static const MetricDescription histogram_descriptions[HISTOGRAM_COUNT] = {
+    [HISTOGRAM_HANDSHAKE] = {"cg_handshake_seconds", "Accept to session ready, handshake queueing included"},
+    [HISTOGRAM_MESSAGE] = {"cg_message_handling_seconds", "Handling of one received frame, receive excluded"},
+    [HISTOGRAM_RELAY] = {"cg_relay_seconds", "Encoding and sending one frame to the opponent"},
+    [HISTOGRAM_PROVISION] = {"cg_provision_seconds", "Building and sending one PRV reply"},
+    [HISTOGRAM_ENCRYPT] = {"cg_encrypt_seconds", "Sealing one AES-GCM record"},
+    [HISTOGRAM_DECRYPT] = {"cg_decrypt_seconds", "Opening one AES-GCM record"}
+};
+
+/**
+ * Reads the clock the histograms use
+ * Returns:
+ *   CLOCK_MONOTONIC in nanoseconds
+ */
+uint64_t metrics_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * NS_PER_SEC + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * Finds the calling thread's shard
+ * Operation:
+ *   Assigned round robin on first use and cached thread locally
+ * Returns:
+ *   Shard pointer
+ */
+static MetricsShard *current_shard() {
+    if (thread_shard == NULL) {
+        thread_shard = &shards[atomic_fetch_add_explicit(&next_shard, 1, memory_order_relaxed) % METRICS_SHARDS];
+    }
+    return thread_shard;
+}
+
+/**
+ * Adds to a counter
+ * Args:
+ *   counter: Counter to bump
+ *   amount: Value to add
+ * Operation:
+ *   Relaxed add on the calling thread's shard, no lock and no shared cache line
+ * Returns: void
+ */
+void metrics_add(const MetricCounter counter, const uint64_t amount) {
+    atomic_fetch_add_explicit(&current_shard()->counters[counter], amount, memory_order_relaxed);
+}
+
+/**
+ * Records one latency sample
+ * Args:
+ *   histogram: Histogram to update
+ *   ns: Duration in nanoseconds
+ * Operation:
+ *   Relaxed adds to the bucket, the count and the sum on the calling thread's shard
+ * Returns: void
+ */
+void metrics_observe(const MetricHistogram histogram, const uint64_t ns) {
+    // Bit length of ns, the first power of two above the sample
+    unsigned int bucket = ns == 0 ? 0 : UINT64_BITS - (unsigned int) __builtin_clzll(ns);
+    bucket = bucket < METRICS_HISTOGRAM_BUCKETS ? bucket : INF_BUCKET;
+    MetricsShard *shard = current_shard();
+    atomic_fetch_add_explicit(&shard->buckets[histogram][bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&shard->sums[histogram], ns, memory_order_relaxed);
+}
+
+/**
+ * Records the time since a metrics_now_ns reading
+ * Args:
+ *   histogram: Histogram to update
+ *   start_ns: Earlier metrics_now_ns value
+ * Returns: void
+ */
+void metrics_observe_since(const MetricHistogram histogram, const uint64_t start_ns) {
+    metrics_observe(histogram, metrics_now_ns() - start_ns);
+}
+
+/**
+ * CryptoTimingHook feeding HISTOGRAM_ENCRYPT and HISTOGRAM_DECRYPT
+ * Args:
+ *   timing: Sealed or opened record
+ *   ns: Time the AES-GCM work took
+ * Returns: void
+ */
+void metrics_record_crypto(const CryptoTiming timing, const uint64_t ns) {
+    metrics_observe(timing == CRYPTO_TIMING_SEAL ? HISTOGRAM_ENCRYPT : HISTOGRAM_DECRYPT, ns);
+}
+
+/**
+ * Sums one counter over every shard
+ * Args:
+ *   counter: Counter to read
+ * Returns:
+ *   Snapshot value
+ */
+static uint64_t counter_total(const MetricCounter counter) {
+    uint64_t total = 0;
+    for (unsigned int i = 0; i < METRICS_SHARDS; i++) {
+        total += atomic_load_explicit(&shards[i].counters[counter], memory_order_relaxed);
+    }
+    return total;
+}
+
+/**
+ * Appends one formatted line
+ * Args:
+ *   out: Destination buffer
+ *   size: Size of out
+ *   length: Bytes used, advanced on success
+ *   format: printf format
+ * Returns:
+ *   Boolean indicating the line fit, a line that does not fit is dropped whole
+ */
+static bool append_line(char *out, const size_t size, size_t *length, const char *format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    const int written = vsnprintf(out + *length, size - *length, format, arguments);
+    va_end(arguments);
+    if (written < 0 || (size_t) written >= size - *length) {
+        out[*length] = '\0';
+        return false;
+    }
+    *length += (size_t) written;
+    return true;
+}
+
+/**
+ * Writes a counter or gauge with its HELP and TYPE lines
+ * Args:
+ *   out, size, length: Output buffer as in append_line
+ *   name: Metric name
+ *   help: Help text
+ *   type: "counter" or "gauge"
+ *   value: Value
+ * Returns:
+ *   Boolean indicating it fit
+ */
+static bool append_value(char *out, const size_t size, size_t *length, const char *name, const char *help,
+                         const char *type, const uint64_t value) {
+    return append_line(out, size, length, "# HELP %s %s\n", name, help) &&
+           append_line(out, size, length, "# TYPE %s %s\n", name, type) &&
+           append_line(out, size, length, "%s %llu\n", name, (unsigned long long) value);
+}
+
+/**
+ * Writes one histogram, cumulative buckets in seconds
+ * Args:
+ *   out, size, length: Output buffer as in append_line
+ *   histogram: Histogram to write
+ * Returns:
+ *   Boolean indicating it fit
+ */
+static bool append_histogram(char *out, const size_t size, size_t *length, const MetricHistogram histogram) {
+    const MetricDescription *description = &histogram_descriptions[histogram];
+    bool ok = append_line(out, size, length, "# HELP %s %s\n", description->name, description->help) &&
+              append_line(out, size, length, "# TYPE %s histogram\n", description->name);
+    uint64_t cumulative = 0;
+    uint64_t sum = 0;
+    for (unsigned int i = 0; i < METRICS_SHARDS; i++) {
+        sum += atomic_load_explicit(&shards[i].sums[histogram], memory_order_relaxed);
+    }
+    for (unsigned int bucket = 0; ok && bucket <= INF_BUCKET; bucket++) {
+        for (unsigned int i = 0; i < METRICS_SHARDS; i++) {
+            cumulative += atomic_load_explicit(&shards[i].buckets[histogram][bucket], memory_order_relaxed);
+        }
+        if (bucket == INF_BUCKET) {
+            ok = append_line(out, size, length, "%s_bucket{le=\"+Inf\"} %llu\n", description->name,
+                             (unsigned long long) cumulative);
+        } else {
+            ok = append_line(out, size, length, "%s_bucket{le=\"%.9g\"} %llu\n", description->name,
+                             (double) (1ull << bucket) * NS_TO_SECONDS, (unsigned long long) cumulative);
+        }
+    }
+    return ok && append_line(out, size, length, "%s_sum %.9f\n", description->name, (double) sum * NS_TO_SECONDS) &&
+           append_line(out, size, length, "%s_count %llu\n", description->name, (unsigned long long) cumulative);
+}
+
+/**
+ * Writes every metric in the Prometheus text exposition format
+ * Args:
+ *   out: Destination buffer
+ *   size: Size of out
+ * Operation:
+ *   Sums the shards without stopping the writers, each value is a relaxed snapshot
+ * Returns:
+ *   Length of the text, truncated at a line boundary if it does not fit
+ */
+size_t metrics_format(char *out, const size_t size) {
+    size_t length = 0;
+    if (size == 0) {
+        return 0;
+    }
+    out[0] = '\0';
+    bool ok = true;
+    for (unsigned int counter = 0; ok && counter < METRIC_COUNTER_COUNT; counter++) {
+        ok = append_value(out, size, &length, counter_descriptions[counter].name,
+                          counter_descriptions[counter].help, "counter", counter_total(counter));
+    }
+    // Released is read first so a game starting during the scrape never shows up as a negative count
+    const uint64_t games_released = counter_total(METRIC_GAMES_RELEASED);
+    const uint64_t connections_closed = counter_total(METRIC_CONNECTIONS_CLOSED);
+    ok = ok && append_value(out, size, &length, "cg_games_active", "Games holding a slot", "gauge",
+                            counter_total(METRIC_GAMES_STARTED) - games_released);
+    ok = ok && append_value(out, size, &length, "cg_connections_active", "Client handlers alive", "gauge",
+                            counter_total(METRIC_CONNECTIONS_OPENED) - connections_closed);
+    unsigned long pool_hits = 0;
+    unsigned long pool_misses = 0;
+    provision_pool_stats(&pool_hits, &pool_misses);
+    ok = ok && append_value(out, size, &length, "cg_provision_pool_hits_total",
+                            "Game starts served from the flag material pool", "counter", pool_hits);
+    ok = ok && append_value(out, size, &length, "cg_provision_pool_misses_total",
+                            "Game starts that generated their flag material on the handler", "counter", pool_misses);
+    ok = ok && append_value(out, size, &length, "cg_log_dropped_total",
+                            "Log records dropped by the rate limit or a full log queue", "counter", log_dropped());
+    for (unsigned int histogram = 0; ok && histogram < HISTOGRAM_COUNT; histogram++) {
+        ok = append_histogram(out, size, &length, histogram);
+    }
+    return length;
+}
+
+/**
+ * Answers one scrape
+ * Args:
+ *   clientFD: Accepted endpoint connection
+ *   response: METRICS_RESPONSE_SIZE scratch buffer
+ * Operation:
+ *   Reads whatever request arrives within METRICS_REQUEST_WAIT_MS, so closing
+ *   does not reset the connection under the scraper, then writes the header and the metrics
+ * Returns: void
+ */
+static void answer_scrape(const int clientFD, char *response) {
+    struct pollfd request = {.fd = clientFD, .events = POLLIN};
+    if (poll(&request, 1, METRICS_REQUEST_WAIT_MS) > 0) {
+        char ignored[METRICS_REQUEST_SIZE];
+        recv(clientFD, ignored, sizeof(ignored), MSG_DONTWAIT);
+    }
+    const size_t header_length = strlen(METRICS_HEADER);
+    memcpy(response, METRICS_HEADER, header_length);
+    const size_t length = header_length + metrics_format(response + header_length,
+                                                         METRICS_RESPONSE_SIZE - header_length);
+    size_t sent = 0;
+    while (sent < length) {
+        const ssize_t amount = send(clientFD, response + sent, length - sent, MSG_NOSIGNAL);
+        if (amount <= 0) {
+            break;
+        }
+        sent += (size_t) amount;
+    }
+    shutdown(clientFD, SHUT_WR);
+}
+
+/**
+ * Endpoint thread body
+ * Args:
+ *   arg: Unused
+ * Operation:
+ *   Serves scrapes one at a time until endpoint_shutdown_fd becomes readable
+ * Returns: NULL
+ */
+static void *metrics_endpoint(void *arg) {
+    (void) arg;
+    char *response = malloc(METRICS_RESPONSE_SIZE);
+    if (response == NULL) {
+        return NULL;
+    }
+    struct pollfd fds[METRICS_POLL_COUNT] = {
+        [METRICS_LISTEN_POLL_INDEX] = {.fd = endpoint_fd, .events = POLLIN},
+        [METRICS_SHUTDOWN_POLL_INDEX] = {.fd = endpoint_shutdown_fd, .events = POLLIN}
+    };
+    while (true) {
+        if (poll(fds, METRICS_POLL_COUNT, METRICS_POLL_FOREVER) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[METRICS_SHUTDOWN_POLL_INDEX].revents & POLLIN) {
+            break;
+        }
+        if (fds[METRICS_LISTEN_POLL_INDEX].revents & POLLIN) {
+            const int clientFD = accept4(endpoint_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (clientFD != SOCKET_ERROR) {
+                answer_scrape(clientFD, response);
+                close(clientFD);
+            }
+        }
+    }
+    free(response);
+    return NULL;
+}
+
+/**
+ * Starts the stats endpoint
+ * Args:
+ *   port: TCP port on 127.0.0.1
+ *   shutdown_fd: Readable once the server stops, ends the endpoint thread
+ * Operation:
+ *   Every connection gets one HTTP/1.0 response with metrics_format output,
+ *   so curl, a Prometheus scraper and nc all work
+ * Returns:
+ *   Boolean indicating the endpoint is listening
+ */
+bool metrics_server_start(const int port, const int shutdown_fd) {
+    struct sockaddr_in address;
+    if (createIPv4Address(METRICS_BIND_IP, port, &address) == SOCKET_INIT_ERROR) {
+        return false;
+    }
+    endpoint_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (endpoint_fd == SOCKET_ERROR) {
+        return false;
+    }
+    const int reuse = SOCKET_OPTION_ON;
+    setsockopt(endpoint_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(endpoint_fd, (struct sockaddr *) &address, sizeof(address)) != SOCKET_INIT_ERROR ||
+        listen(endpoint_fd, METRICS_BACKLOG) != SOCKET_INIT_ERROR) {
+        close(endpoint_fd);
+        endpoint_fd = SOCKET_ERROR;
+        return false;
+    }
+    endpoint_shutdown_fd = shutdown_fd;
+    if (pthread_create(&endpoint_thread, NULL, metrics_endpoint, NULL) != 0) {
+        close(endpoint_fd);
+        endpoint_fd = SOCKET_ERROR;
+        return false;
+    }
+    endpoint_running = true;
+    return true;
+}
+
+/**
+ * Waits for the endpoint thread to exit after shutdown_fd fired
+ * Returns: void
+ */
+void metrics_server_stop() {
+    if (!endpoint_running) {
+        return;
+    }
+    pthread_join(endpoint_thread, NULL);
+    close(endpoint_fd);
+    endpoint_fd = SOCKET_ERROR;
+    endpoint_running = false;
+}
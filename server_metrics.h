@@ -0,0 +1,127 @@
+// server_metrics.h
+#ifndef SERVER_METRICS_H
+#define SERVER_METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "crypto_session.h"
+
+#define METRICS_SHARDS 64 //threads map onto shards round robin, more threads share a shard
+#define METRICS_HISTOGRAM_BUCKETS 36 //power of two nanosecond buckets, 1ns up to about 34s, then +Inf
+#define METRICS_RESPONSE_SIZE 65536 //largest text exposition the endpoint sends
+#define METRICS_DISABLED 0 //no -m option, no endpoint
+
+/**
+ * Monotonic counters, gauges are exported as the difference of two of them
+ */
+typedef enum {
+    METRIC_ACCEPTS, //sockets accepted by the listeners
+    METRIC_HANDSHAKES, //key exchanges that produced a session
+    METRIC_HANDSHAKE_FAILURES, //key exchanges that failed or timed out
+    METRIC_REJECTED_CLIENTS, //clients turned away with GAME_MAX or a full queue
+    METRIC_GAMES_STARTED, //game slots taken
+    METRIC_GAMES_RELEASED, //game slots returned
+    METRIC_CONNECTIONS_OPENED, //client handlers created
+    METRIC_CONNECTIONS_CLOSED, //client handlers torn down
+    METRIC_MESSAGES_RECEIVED, //frames received from clients
+    METRIC_MESSAGES_RELAYED, //frames forwarded to an opponent
+    METRIC_BYTES_IN, //frame bytes received from clients
+    METRIC_BYTES_OUT, //frame bytes relayed to opponents
+    METRIC_WINS, //correct flag guesses
+    METRIC_FORWARDED, //connections relayed to the node owning their game
+    METRIC_COUNTER_COUNT
+} MetricCounter;
+
+/**
+ * Latency histograms, all in nanoseconds
+ */
+typedef enum {
+    HISTOGRAM_HANDSHAKE, //accept to session ready, queueing included
+    HISTOGRAM_MESSAGE, //handling of one received frame, receive excluded
+    HISTOGRAM_RELAY, //encoding and sending one frame to the opponent
+    HISTOGRAM_PROVISION, //building and sending the PRV reply
+    HISTOGRAM_ENCRYPT, //sealing one AES-GCM record
+    HISTOGRAM_DECRYPT, //opening one AES-GCM record
+    HISTOGRAM_COUNT
+} MetricHistogram;
+
+/**
+ * Reads the clock the histograms use
+ * Returns:
+ *   CLOCK_MONOTONIC in nanoseconds
+ */
+uint64_t metrics_now_ns();
+
+/**
+ * Adds to a counter
+ * Args:
+ *   counter: Counter to bump
+ *   amount: Value to add
+ * Operation:
+ *   Relaxed add on the calling thread's shard, no lock and no shared cache line
+ * Returns: void
+ */
+void metrics_add(MetricCounter counter, uint64_t amount);
+
+/**
+ * Records one latency sample
+ * Args:
+ *   histogram: Histogram to update
+ *   ns: Duration in nanoseconds
+ * Operation:
+ *   Relaxed adds to the bucket, the count and the sum on the calling thread's shard
+ * Returns: void
+ */
+void metrics_observe(MetricHistogram histogram, uint64_t ns);
+
+/**
+ * Records the time since a metrics_now_ns reading
+ * Args:
+ *   histogram: Histogram to update
+ *   start_ns: Earlier metrics_now_ns value
+ * Returns: void
+ */
+void metrics_observe_since(MetricHistogram histogram, uint64_t start_ns);
+
+/**
+ * CryptoTimingHook feeding HISTOGRAM_ENCRYPT and HISTOGRAM_DECRYPT
+ * Args:
+ *   timing: Sealed or opened record
+ *   ns: Time the AES-GCM work took
+ * Returns: void
+ */
+void metrics_record_crypto(CryptoTiming timing, uint64_t ns);
+
+/**
+ * Writes every metric in the Prometheus text exposition format
+ * Args:
+ *   out: Destination buffer
+ *   size: Size of out
+ * Operation:
+ *   Sums the shards without stopping the writers, each value is a relaxed snapshot
+ * Returns:
+ *   Length of the text, truncated at a line boundary if it does not fit
+ */
+size_t metrics_format(char *out, size_t size);
+
+/**
+ * Starts the stats endpoint
+ * Args:
+ *   port: TCP port on 127.0.0.1
+ *   shutdown_fd: Readable once the server stops, ends the endpoint thread
+ * Operation:
+ *   Every connection gets one HTTP/1.0 response with metrics_format output,
+ *   so curl, a Prometheus scraper and nc all work
+ * Returns:
+ *   Boolean indicating the endpoint is listening
+ */
+bool metrics_server_start(int port, int shutdown_fd);
+
+/**
+ * Waits for the endpoint thread to exit after shutdown_fd fired
+ * Returns: void
+ */
+void metrics_server_stop();
+
+#endif // SERVER_METRICS_H
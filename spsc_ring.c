@@ -0,0 +1,104 @@
+/*
+ * Bounded lock-free single-producer/single-consumer byte ring
+ * The producer only advances write_pos and the consumer only advances
+ * read_pos, each reads the other's position with an acquire load, so a
+ * burst is copied in at most two memcpy calls per side
+ */
+
+#include "spsc_ring.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_RING_CAPACITY 2
+
+/**
+ * Allocates the ring
+ * Args:
+ *   ring: Ring to initialize
+ *   capacity: Number of bytes, rounded up to a power of two
+ * Returns:
+ *   Boolean indicating success
+ */
+bool spsc_ring_init(SpscRing *ring, const size_t capacity) {
+    size_t size = MIN_RING_CAPACITY;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    ring->data = malloc(size);
+    if (ring->data == NULL) {
+        return false;
+    }
+    ring->mask = size - 1;
+    atomic_init(&ring->read_pos, 0);
+    atomic_init(&ring->write_pos, 0);
+    return true;
+}
+
+/**
+ * Frees the ring buffer
+ * Args:
+ *   ring: Ring to destroy, must not be in use
+ * Returns: void
+ */
+void spsc_ring_destroy(SpscRing *ring) {
+    free(ring->data);
+    ring->data = NULL;
+}
+
+/**
+ * Appends as many bytes as fit, producer only
+ * Args:
+ *   ring: Target ring
+ *   data: Bytes to store
+ *   length: Number of bytes
+ * Returns:
+ *   Bytes stored, less than length when the ring is full
+ */
+size_t spsc_ring_write(SpscRing *ring, const char *data, const size_t length) {
+    const size_t write = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    const size_t read = atomic_load_explicit(&ring->read_pos, memory_order_acquire);
+    const size_t free_space = ring->mask + 1 - (write - read);
+    const size_t amount = length < free_space ? length : free_space;
+    const size_t offset = write & ring->mask;
+    // The copy may wrap around the end of the buffer once
+    const size_t first = amount < ring->mask + 1 - offset ? amount : ring->mask + 1 - offset;
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, data + first, amount - first);
+    atomic_store_explicit(&ring->write_pos, write + amount, memory_order_release);
+    return amount;
+}
+
+/**
+ * Removes up to size of the oldest bytes, consumer only
+ * Args:
+ *   ring: Source ring
+ *   buffer: Destination
+ *   size: Size of buffer
+ * Returns:
+ *   Bytes removed, 0 when the ring is empty
+ */
+size_t spsc_ring_read(SpscRing *ring, char *buffer, const size_t size) {
+    const size_t read = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+    const size_t write = atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+    const size_t available = write - read;
+    const size_t amount = size < available ? size : available;
+    const size_t offset = read & ring->mask;
+    const size_t first = amount < ring->mask + 1 - offset ? amount : ring->mask + 1 - offset;
+    memcpy(buffer, ring->data + offset, first);
+    memcpy(buffer + first, ring->data, amount - first);
+    atomic_store_explicit(&ring->read_pos, read + amount, memory_order_release);
+    return amount;
+}
+
+/**
+ * Checks for free space, producer only
+ * Args:
+ *   ring: Ring to check
+ * Returns:
+ *   true if no byte can be written
+ */
+bool spsc_ring_full(SpscRing *ring) {
+    const size_t write = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    const size_t read = atomic_load_explicit(&ring->read_pos, memory_order_acquire);
+    return write - read > ring->mask;
+}
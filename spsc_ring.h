@@ -0,0 +1,79 @@
+// spsc_ring.h
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SPSC_RING_CACHE_LINE 64
+
+/**
+ * Bounded lock-free single-producer/single-consumer byte queue
+ * Components:
+ *   data: Power of two sized byte buffer
+ *   mask: capacity - 1, used to wrap positions
+ *   read_pos: Bytes consumed so far, only the consumer stores it
+ *   write_pos: Bytes produced so far, only the producer stores it
+ * Operation:
+ *   - Positions grow without wrapping, their difference is the fill level
+ *   - Each side publishes its position with a release store after touching
+ *     the bytes, so neither side ever takes a lock
+ */
+typedef struct {
+    char *data;
+    size_t mask;
+    _Alignas(SPSC_RING_CACHE_LINE) atomic_size_t read_pos;
+    _Alignas(SPSC_RING_CACHE_LINE) atomic_size_t write_pos;
+} SpscRing;
+
+/**
+ * Allocates the ring
+ * Args:
+ *   ring: Ring to initialize
+ *   capacity: Number of bytes, rounded up to a power of two
+ * Returns:
+ *   Boolean indicating success
+ */
+bool spsc_ring_init(SpscRing *ring, size_t capacity);
+
+/**
+ * Frees the ring buffer
+ * Args:
+ *   ring: Ring to destroy, must not be in use
+ * Returns: void
+ */
+void spsc_ring_destroy(SpscRing *ring);
+
+/**
+ * Appends as many bytes as fit, producer only
+ * Args:
+ *   ring: Target ring
+ *   data: Bytes to store
+ *   length: Number of bytes
+ * Returns:
+ *   Bytes stored, less than length when the ring is full
+ */
+size_t spsc_ring_write(SpscRing *ring, const char *data, size_t length);
+
+/**
+ * Removes up to size of the oldest bytes, consumer only
+ * Args:
+ *   ring: Source ring
+ *   buffer: Destination
+ *   size: Size of buffer
+ * Returns:
+ *   Bytes removed, 0 when the ring is empty
+ */
+size_t spsc_ring_read(SpscRing *ring, char *buffer, size_t size);
+
+/**
+ * Checks for free space, producer only
+ * Args:
+ *   ring: Ring to check
+ * Returns:
+ *   true if no byte can be written
+ */
+bool spsc_ring_full(SpscRing *ring);
+
+#endif // SPSC_RING_H
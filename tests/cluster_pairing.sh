@@ -0,0 +1,65 @@
+#!/bin/sh
+# cluster_pairing.sh <Server> <ClientCli>
+# Runs two cluster nodes. The first two players arrive one on each front-end and must play each other, then three
+# arrive on the first and one on the second. A player's command only comes back with output from an opponent's
+# shell, so every player sends one to show it shares a game with someone, wherever the two of them arrived.
+SERVER=$1
+CLIENT=$2
+BASE=$((20000 + $$ % 20000))
+NODES=127.0.0.1:$((BASE + 2)),127.0.0.1:$((BASE + 3))
+DIR=$(mktemp -d)
+HOLDERS=""
+PLAYERS=""
+
+"$SERVER" -n $NODES -i 0 $BASE > "$DIR/node0.log" 2>&1 &
+NODE0=$!
+"$SERVER" -n $NODES -i 1 $((BASE + 1)) > "$DIR/node1.log" 2>&1 &
+NODE1=$!
+sleep 1
+
+# start_player <name> <port>, the sleep keeps the fifo open so the client never sees end of input
+start_player() {
+    mkfifo "$DIR/$1.in"
+    sleep 60 > "$DIR/$1.in" &
+    HOLDERS="$HOLDERS $!"
+    "$CLIENT" 127.0.0.1 $2 < "$DIR/$1.in" > "$DIR/$1.out" 2>&1 &
+    PLAYERS="$PLAYERS $!"
+    sleep 0.5
+}
+
+# check_paired <name>..., every named player sends a command that only comes back from an opponent's shell
+check_paired() {
+    for name in "$@"; do
+        echo "echo paired_$name" > "$DIR/$name.in"
+    done
+    sleep 2
+    for name in "$@"; do
+        if ! grep -q "^paired_$name" "$DIR/$name.out"; then
+            echo "player $name was not paired"
+            cat "$DIR/$name.out"
+            STATUS=1
+        fi
+    done
+}
+
+STATUS=0
+# Alone on their front-ends, these two can only play each other
+start_player a $BASE
+start_player b $((BASE + 1))
+sleep 1
+check_paired a b
+start_player c $BASE
+start_player d $BASE
+start_player e $BASE
+start_player f $((BASE + 1))
+sleep 1
+check_paired c d e f
+kill $PLAYERS $HOLDERS 2>/dev/null
+wait $PLAYERS 2>/dev/null
+kill -INT $NODE0 $NODE1
+wait $NODE0 $NODE1
+if [ $STATUS -ne 0 ]; then
+    cat "$DIR/node0.log" "$DIR/node1.log"
+fi
+rm -rf "$DIR"
+exit $STATUS
@@ -0,0 +1,35 @@
+#!/bin/sh
+# relay_stress.sh <Server> <Bench> [server options...]
+# Runs two Bench loads side by side against one server so games join, relay and release on many threads at once,
+# then stops the server with SIGINT. Fails when a bot failed, the server did not exit cleanly, or a sanitizer
+# (-DSANITIZE_THREAD=ON) reported anything.
+SERVER=$1
+BENCH=$2
+shift 2
+PORT=$((20000 + $$ % 20000))
+LOG=relay_stress.$$.log
+export TSAN_OPTIONS="halt_on_error=1 exitcode=66 ${TSAN_OPTIONS}"
+
+"$SERVER" "$@" $PORT > "$LOG" 2>&1 &
+SERVER_PID=$!
+sleep 1
+"$BENCH" -g 60 -c 16 -m 40 127.0.0.1 $PORT > "$LOG.bench1" 2>&1 &
+FIRST_PID=$!
+"$BENCH" -g 60 -c 16 -m 40 -w 4 -s 256 127.0.0.1 $PORT > "$LOG.bench2" 2>&1
+SECOND_STATUS=$?
+wait $FIRST_PID
+FIRST_STATUS=$?
+kill -INT $SERVER_PID
+wait $SERVER_PID
+SERVER_STATUS=$?
+
+cat "$LOG.bench1" "$LOG.bench2"
+if [ $FIRST_STATUS -ne 0 ] || [ $SECOND_STATUS -ne 0 ] || [ $SERVER_STATUS -ne 0 ] ||
+   grep -q "WARNING: ThreadSanitizer" "$LOG" "$LOG.bench1" "$LOG.bench2"; then
+    echo "bench exit $FIRST_STATUS and $SECOND_STATUS, server exit $SERVER_STATUS"
+    cat "$LOG"
+    rm -f "$LOG" "$LOG.bench1" "$LOG.bench2"
+    exit 1
+fi
+rm -f "$LOG" "$LOG.bench1" "$LOG.bench2"
+exit 0